@@ -70,6 +70,7 @@ static void do_help(char **args);
 static void do_icheck(char **args);
 static void do_lcd(char **args);
 static void do_locate(char **args);
+static void do_locality(char **args);
 static void do_logdump(char **args);
 static void do_ls(char **args);
 static void do_net_stats(char **args);
@@ -224,9 +225,14 @@ static struct command commands[] = {
 		"locate <block#> ...",
 		"List all pathnames of the inode(s)/lockname(s)",
 	},
+	{ "locality",
+		do_locality,
+		"locality [-n count]",
+		"Show how far apart related inodes and extents are",
+	},
 	{ "logdump",
 		do_logdump,
-		"logdump [-T] <slot#>",
+		"logdump [-T] [-S] <slot#>|all",
 		"Show journal file for the node slot",
 	},
 	{ "ls",
@@ -1188,37 +1194,86 @@ static void do_cat(char **args)
 	return ;
 }
 
+static void do_locality(char **args)
+{
+	FILE *out;
+	int top = 10;
+	char *ptr;
+	int c, argc;
+
+	if (check_device_open())
+		return;
+
+	for (argc = 0; (args[argc]); ++argc);
+	optind = 0;
+
+	while ((c = getopt(argc, args, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			top = strtoul(optarg, &ptr, 0);
+			if (*ptr) {
+				fprintf(stderr, "usage: locality [-n count]\n");
+				return;
+			}
+			break;
+		default:
+			fprintf(stderr, "usage: locality [-n count]\n");
+			return;
+		}
+	}
+
+	out = open_pager(gbls.interactive);
+	show_locality(gbls.fs, top, out);
+	close_pager(out);
+}
+
 static void do_logdump(char **args)
 {
 	errcode_t ret;
 	uint16_t slotnum;
+	uint16_t slots[OCFS2_MAX_SLOTS];
+	int nr_slots = 0;
+	int summary = 0;
 	uint64_t blkno;
 	FILE *out;
 	int index = 1;
-	const char *logdump_usage = "usage: logdump [-T] <slot#>";
+	const char *logdump_usage = "usage: logdump [-T] [-S] <slot#>|all";
 
 	if (check_device_open())
 		return ;
 
+	for (; args[index] && args[index][0] == '-'; index++) {
+		if (!strcmp(args[index], "-S"))
+			summary = 1;
+		else if (strcmp(args[index], "-T"))
+			break;
+	}
+
 	if (!args[index]) {
 		fprintf(stderr, "%s\n", logdump_usage);
 		return ;
 	}
 
-	if (!strncmp(args[index], "-T", 2)) {
-		index++;
-	}
-
-	if (get_slotnum(args[index], &slotnum)) {
+	if (summary && !strcmp(args[index], "all")) {
+		for (slotnum = 0;
+		     slotnum < OCFS2_RAW_SB(gbls.fs->fs_super)->s_max_slots;
+		     slotnum++)
+			if (gbls.jrnl_blkno[slotnum])
+				slots[nr_slots++] = slotnum;
+	} else if (get_slotnum(args[index], &slotnum)) {
 		fprintf(stderr, "%s: Invalid node slot number\n", args[0]);
 		fprintf(stderr, "%s\n", logdump_usage);
 		return ;
-	}
-
-	blkno = gbls.jrnl_blkno[slotnum];
+	} else
+		slots[nr_slots++] = slotnum;
 
 	out = open_pager(gbls.interactive);
-	ret = read_journal(gbls.fs, blkno, out);
+	if (summary)
+		ret = summarize_journals(gbls.fs, slots, nr_slots, out);
+	else {
+		blkno = gbls.jrnl_blkno[slotnum];
+		ret = read_journal(gbls.fs, blkno, out);
+	}
 	close_pager(out);
 	if (ret)
 		com_err(gbls.cmd, ret, "while reading journal");
@@ -62,6 +62,12 @@ void dump_super_block(FILE *out, struct ocfs2_super_block *sb)
 
 	get_tunefs_flag(sb, buf, sizeof(buf));
 	fprintf(out, "\tTunefs Incomplete: %u %s\n", sb->s_tunefs_flag, buf);
+	if (sb->s_tunefs_flag & OCFS2_TUNEFS_INPROG_INODE_PASS)
+		fprintf(out, "\tTunefs Cursor: %"PRIu64"\n",
+			(uint64_t)sb->s_tunefs_cursor);
+	if (sb->s_tunefs_flag & OCFS2_TUNEFS_INPROG_CLUSTER_SIZE)
+		fprintf(out, "\tTunefs Record: %"PRIu64"\n",
+			(uint64_t)sb->s_tunefs_csize_record);
 
 	get_rocompat_flag(sb, buf, sizeof(buf));
 	fprintf(out, "\tFeature RO compat: %u %s\n", sb->s_feature_ro_compat,
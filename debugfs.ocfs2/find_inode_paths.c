@@ -20,155 +20,95 @@
  * License along with this program; if not, write to the
  * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
  * Boston, MA  02110-1301 USA.
- *
- *  This code is a port of e2fsprogs/lib/ext2fs/dir_iterate.c
- *  Copyright (C) 1993, 1994, 1994, 1995, 1996, 1997 Theodore Ts'o.
  */
 
 #include "main.h"
 
 struct walk_path {
-	char *argv0;
 	FILE *out;
-	ocfs2_filesys *fs;
-	char *path;
 	uint32_t found;
 	uint32_t count;
 	int findall;
 	uint64_t *inode;
+	char path[PATH_MAX + 1];
 };
 
-static int walk_tree_func(struct ocfs2_dir_entry *dentry,
-			  uint64_t blocknr, int offset,
-			  int blocksize, char *buf, void *priv_data)
+static int want_inode(uint64_t ino, void *priv_data)
 {
-	errcode_t ret;
-	int len;
-	int reti = 0;
-	int i = 0;
-	int print = 0;
-	char *old_path, *path;
 	struct walk_path *wp = priv_data;
-
-	if (!strncmp(dentry->name, ".", dentry->name_len) ||
-	    !strncmp(dentry->name, "..", dentry->name_len))
-		return 0;
-
-	len = strlen(wp->path);
-
-	if (len + dentry->name_len > 4095) {
-		com_err(wp->argv0, OCFS2_ET_NO_SPACE,
-			"name is too long in %s\n", wp->path);
-		return OCFS2_DIRENT_ABORT;
-	}
-
-	ret = ocfs2_malloc0(4096, &path);
-	if (ret) {
-		com_err(wp->argv0, ret,
-			"while allocating path memory in %s\n", wp->path);
-		return OCFS2_DIRENT_ABORT;
-	}
-	
-	memcpy(path, wp->path, len);
-	memcpy(path + len, dentry->name, dentry->name_len);
-	if (dentry->file_type == OCFS2_FT_DIR)
-		path[len + dentry->name_len] = '/';
+	int i;
 
 	for (i = 0; i < wp->count; ++i) {
-		if (dentry->inode == wp->inode[i]) {
-			if (!print)
-				dump_inode_path(wp->out, dentry->inode, path);
-			++wp->found;
-			++print;
-		}
+		if (ino == wp->inode[i])
+			return 1;
 	}
 
-	if (!wp->findall) {
-		if (wp->found >= wp->count) {
-			ocfs2_free(&path);	
-			return OCFS2_DIRENT_ABORT;
-		}
-	}
+	return 0;
+}
 
-	if (dentry->file_type == OCFS2_FT_DIR) {
-		old_path = wp->path;
-		wp->path = path;
-		ret = ocfs2_dir_iterate(wp->fs, dentry->inode, 0, NULL,
-					walk_tree_func, wp);
-		if (ret) {
-			com_err(wp->argv0, ret, "while walking %s", wp->path);
-			reti = OCFS2_DIRENT_ABORT;
-		}
-		wp->path = old_path;
-	}
+static int print_path_func(uint64_t ino, const char *path, int file_type,
+			   void *priv_data)
+{
+	struct walk_path *wp = priv_data;
+	int len = strlen(path);
 
-	ocfs2_free(&path);
+	/* Directories are shown with a trailing slash */
+	snprintf(wp->path, sizeof(wp->path), "%s%s", path,
+		 (file_type == OCFS2_FT_DIR && path[len - 1] != '/') ?
+		 "/" : "");
+	dump_inode_path(wp->out, ino, wp->path);
+	++wp->found;
 
-	return reti;
+	return !wp->findall;
 }
 
+/*
+ * Rather than walking the namespace looking for the inodes, read all
+ * the directory blocks in disk order and put the paths together in
+ * memory.
+ */
 errcode_t find_inode_paths(ocfs2_filesys *fs, char **args, int findall,
 			   uint32_t count, uint64_t *blknos, FILE *out)
 {
 	errcode_t ret = 0;
-	struct walk_path wp;
+	struct walk_path *wp = NULL;
+	ocfs2_dir_revmap *map = NULL;
 	int i;
-	int printroot = 0;
-	int printsysd = 0;
-
-	wp.argv0 = args[0];
-	wp.out = out;
-	wp.count = count;
-	wp.inode = blknos;
-	wp.findall = findall;
-	wp.found = 0;
-	wp.fs = fs;
 
-	/* Compare with root and sysdir */
-	for (i = 0; i < count; ++i) {
-		if (blknos[i] == fs->fs_root_blkno) {
-			if (!printroot)
-				dump_inode_path(out, blknos[i], "/");
-			++wp.found;
-			++printroot;
-		}
-		if (blknos[i] == fs->fs_sysdir_blkno) {
-			if (!printsysd)
-				dump_inode_path(out, blknos[i], "//");
-			++wp.found;
-			++printsysd;
-		}
-	}
-
-	if (!findall) {
-		if (wp.found >= wp.count)
-			goto bail;
+	ret = ocfs2_malloc0(sizeof(struct walk_path), &wp);
+	if (ret) {
+		com_err(args[0], ret, "while allocating path memory");
+		goto bail;
 	}
 
+	wp->out = out;
+	wp->count = count;
+	wp->inode = blknos;
+	wp->findall = findall;
 
-	/* Walk system dir */
-	wp.path = "//";
-	ret = ocfs2_dir_iterate(fs,
-				OCFS2_RAW_SB(fs->fs_super)->s_system_dir_blkno,
-				0, NULL, walk_tree_func, &wp);
+	ret = ocfs2_dir_revmap_build(fs, want_inode, wp, &map);
 	if (ret) {
-		com_err(args[0], ret, "while walking system dir");
+		com_err(args[0], ret, "while reading the directories");
 		goto bail;
 	}
 
-	/* Walk root dir */
-	wp.path = "/";
-	ret = ocfs2_dir_iterate(fs,
-				OCFS2_RAW_SB(fs->fs_super)->s_root_blkno,
-				0, NULL, walk_tree_func, &wp);
-	if (ret) {
-		com_err(args[0], ret, "while walking root dir");
-		goto bail;
+	for (i = 0; i < count; ++i) {
+		ret = ocfs2_dir_revmap_iterate(map, blknos[i],
+					       print_path_func, wp);
+		if (ret) {
+			com_err(args[0], ret, "while finding the paths of "
+				"inode %"PRIu64, blknos[i]);
+			goto bail;
+		}
 	}
 
-	if (!wp.found)
+	if (!wp->found)
 		com_err(args[0], OCFS2_ET_FILE_NOT_FOUND, " ");
 
 bail:
+	if (map)
+		ocfs2_dir_revmap_free(map);
+	if (wp)
+		ocfs2_free(&wp);
 	return ret;
 }
@@ -27,5 +27,7 @@
 #define _JOURNAL_H_
 
 errcode_t read_journal(ocfs2_filesys *fs, uint64_t blkno, FILE *out);
+errcode_t summarize_journals(ocfs2_filesys *fs, uint16_t *slots, int nr_slots,
+			     FILE *out);
 
 #endif		/* _JOURNAL_H_ */
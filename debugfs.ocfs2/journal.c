@@ -26,51 +26,100 @@
  */
 
 #include "main.h"
+#include "ocfs2/byteorder.h"
 
 extern struct dbgfs_gbls gbls;
 
-static void scan_journal(FILE *out, journal_superblock_t *jsb, char *buf,
-			 int len, uint64_t *blocknum, uint64_t *last_unknown)
-{
-	char *block;
-	char *p;
-	enum ocfs2_block_type type;
-	journal_header_t *header;
+typedef void (*journal_block_func)(journal_superblock_t *jsb, char *block,
+				  uint64_t blocknum, void *priv_data);
 
-	p = buf;
+struct journal_dump {
+	FILE *jd_out;
+	uint64_t jd_last_unknown;
+	uint64_t jd_end;
+};
 
-	while (len) {
-		block = p;
-		header = (journal_header_t *)block;
-		if (header->h_magic == ntohl(JBD2_MAGIC_NUMBER)) {
-			if (*last_unknown) {
-				dump_jbd_unknown(out, *last_unknown, *blocknum);
-				*last_unknown = 0;
-			}
-			dump_jbd_block(out, jsb, header, *blocknum);
-		} else {
-			type = ocfs2_detect_block(block);
-			if (type == OCFS2_BLOCK_UNKNOWN) {
-				if (*last_unknown == 0)
-					*last_unknown = *blocknum;
-			} else {
-				if (*last_unknown) {
-					dump_jbd_unknown(out, *last_unknown,
-							 *blocknum);
-					*last_unknown = 0;
-				}
-				dump_jbd_metadata(out, type, block, *blocknum);
-			}
-		}
-		(*blocknum)++;
-		p += gbls.fs->fs_blocksize;
-		len -= gbls.fs->fs_blocksize;
-	}
+/* How many hot blocks and owners the summary lists */
+#define JOURNAL_SUMMARY_TOP		10
+/* Transaction sizes are bucketed by powers of two */
+#define JOURNAL_TXN_BUCKETS		17
 
-	return;
-}
+/* One logged copy of a filesystem block */
+struct journal_record {
+	uint64_t jr_blkno;
+	uint64_t jr_owner;
+	uint32_t jr_seq;
+	uint16_t jr_slot;
+	uint16_t jr_type;
+};
 
-errcode_t read_journal(ocfs2_filesys *fs, uint64_t blkno, FILE *out)
+/* A logged filesystem block, aggregated over all of its copies */
+struct journal_hot {
+	uint64_t jh_blkno;
+	uint64_t jh_owner;
+	uint64_t jh_logged;
+	uint64_t jh_txns;
+	uint16_t jh_slots;
+	uint16_t jh_type;
+};
+
+struct journal_summary {
+	FILE *js_out;
+	uint16_t js_slot;
+
+	/* Tags of the last descriptor that are still to be matched */
+	uint64_t *js_tags;
+	int js_nr_tags;
+	int js_next_tag;
+
+	/* The transaction being walked */
+	uint32_t js_seq;
+	int js_in_txn;
+	uint64_t js_txn_blocks;
+
+	/* Per slot counts, reset for each journal */
+	uint32_t js_maxlen;
+	uint32_t js_start;
+	uint32_t js_sequence;
+	uint64_t js_descs;
+	uint64_t js_commits;
+	uint64_t js_revokes;
+	uint64_t js_revoked;
+	uint64_t js_logged;
+
+	/* Totals over all journals walked */
+	uint64_t js_txns;
+	uint64_t js_txn_hist[JOURNAL_TXN_BUCKETS];
+	uint64_t js_types[OCFS2_BLOCK_DXLEAF + 1];
+
+	struct journal_record *js_recs;
+	uint64_t js_nr_recs;
+	uint64_t js_max_recs;
+
+	/* Extent allocator of each slot, looked up on first use */
+	uint64_t js_eb_alloc[OCFS2_MAX_SLOTS];
+};
+
+static const char *journal_block_names[] = {
+	[OCFS2_BLOCK_UNKNOWN]		= "Unknown",
+	[OCFS2_BLOCK_INODE]		= "Inode",
+	[OCFS2_BLOCK_SUPERBLOCK]	= "Superblock",
+	[OCFS2_BLOCK_EXTENT_BLOCK]	= "Extent",
+	[OCFS2_BLOCK_GROUP_DESCRIPTOR]	= "Group",
+	[OCFS2_BLOCK_DIR_BLOCK]		= "Dirblock",
+	[OCFS2_BLOCK_XATTR]		= "Xattr",
+	[OCFS2_BLOCK_REFCOUNT]		= "Refcount",
+	[OCFS2_BLOCK_DXROOT]		= "DxRoot",
+	[OCFS2_BLOCK_DXLEAF]		= "DxLeaf",
+};
+
+/*
+ * Reads the journal inode at blkno in 1MB chunks and hands every block
+ * to func in journal order.  Block 0 is passed as it is on disk; the
+ * later blocks get the swapped journal superblock.
+ */
+static errcode_t walk_journal(ocfs2_filesys *fs, uint64_t blkno,
+			      journal_block_func func, void *priv_data)
 {
 	char *buf = NULL;
 	char *jsb_buf = NULL;
@@ -79,7 +128,6 @@ errcode_t read_journal(ocfs2_filesys *fs, uint64_t blkno, FILE *out)
 	uint64_t len;
 	uint64_t offset;
 	uint32_t got;
-	uint64_t last_unknown = 0;
 	uint32_t buflen = 1024 * 1024;
 	int buflenbits;
 	ocfs2_cached_inode *ci = NULL;
@@ -125,25 +173,25 @@ errcode_t read_journal(ocfs2_filesys *fs, uint64_t blkno, FILE *out)
 
 		if (offset == 0) {
 			memcpy(jsb_buf, buf, fs->fs_blocksize);
-			dump_jbd_superblock(out, jsb);
+			func(jsb, jsb_buf, blocknum, priv_data);
 			ocfs2_swap_journal_superblock(jsb);
 			blocknum++;
 			p += fs->fs_blocksize;
 			len -= fs->fs_blocksize;
 		}
 
-		scan_journal(out, jsb, p, len, &blocknum, &last_unknown);
+		while (len) {
+			func(jsb, p, blocknum, priv_data);
+			blocknum++;
+			p += fs->fs_blocksize;
+			len -= fs->fs_blocksize;
+		}
 
 		if (got < buflen)
 			break;
 		offset += got;
 	}
 
-	if (last_unknown) {
-		dump_jbd_unknown(out, last_unknown, blocknum);
-		last_unknown = 0;
-	}
-
 bail:
 	if (jsb_buf)
 		ocfs2_free(&jsb_buf);
@@ -155,3 +203,482 @@ bail:
 	return ret;
 }
 
+static void dump_journal_block(journal_superblock_t *jsb, char *block,
+			       uint64_t blocknum, void *priv_data)
+{
+	struct journal_dump *jd = priv_data;
+	enum ocfs2_block_type type;
+	journal_header_t *header = (journal_header_t *)block;
+
+	jd->jd_end = blocknum + 1;
+
+	if (!blocknum) {
+		dump_jbd_superblock(jd->jd_out, (journal_superblock_t *)block);
+		return;
+	}
+
+	if (header->h_magic == ntohl(JBD2_MAGIC_NUMBER)) {
+		if (jd->jd_last_unknown) {
+			dump_jbd_unknown(jd->jd_out, jd->jd_last_unknown,
+					 blocknum);
+			jd->jd_last_unknown = 0;
+		}
+		dump_jbd_block(jd->jd_out, jsb, header, blocknum);
+	} else {
+		type = ocfs2_detect_block(block);
+		if (type == OCFS2_BLOCK_UNKNOWN) {
+			if (jd->jd_last_unknown == 0)
+				jd->jd_last_unknown = blocknum;
+		} else {
+			if (jd->jd_last_unknown) {
+				dump_jbd_unknown(jd->jd_out,
+						 jd->jd_last_unknown, blocknum);
+				jd->jd_last_unknown = 0;
+			}
+			dump_jbd_metadata(jd->jd_out, type, block, blocknum);
+		}
+	}
+}
+
+errcode_t read_journal(ocfs2_filesys *fs, uint64_t blkno, FILE *out)
+{
+	errcode_t ret;
+	struct journal_dump jd = {
+		.jd_out = out,
+	};
+
+	ret = walk_journal(fs, blkno, dump_journal_block, &jd);
+
+	if (jd.jd_last_unknown)
+		dump_jbd_unknown(out, jd.jd_last_unknown, jd.jd_end);
+
+	return ret;
+}
+
+static uint64_t journal_slot_extent_alloc(struct journal_summary *js,
+					  uint16_t slot)
+{
+	uint64_t blkno;
+
+	if (slot >= OCFS2_RAW_SB(gbls.fs->fs_super)->s_max_slots)
+		return 0;
+
+	if (!js->js_eb_alloc[slot] &&
+	    !ocfs2_lookup_system_inode(gbls.fs, EXTENT_ALLOC_SYSTEM_INODE,
+				       slot, &blkno))
+		js->js_eb_alloc[slot] = blkno;
+
+	return js->js_eb_alloc[slot];
+}
+
+/*
+ * The inode or allocator a logged block belongs to.  Inodes own
+ * themselves, directory blocks and groups name their parent, and
+ * suballocated metadata is charged to its slot's extent allocator.
+ */
+static uint64_t journal_block_owner(struct journal_summary *js,
+				    enum ocfs2_block_type type, char *block)
+{
+	struct ocfs2_dir_block_trailer *trailer;
+
+	switch (type) {
+	case OCFS2_BLOCK_INODE:
+	case OCFS2_BLOCK_SUPERBLOCK:
+		return le64_to_cpu(((struct ocfs2_dinode *)block)->i_blkno);
+	case OCFS2_BLOCK_GROUP_DESCRIPTOR:
+		return le64_to_cpu(((struct ocfs2_group_desc *)block)->bg_parent_dinode);
+	case OCFS2_BLOCK_DIR_BLOCK:
+		trailer = ocfs2_dir_trailer_from_block(gbls.fs, block);
+		return le64_to_cpu(trailer->db_parent_dinode);
+	case OCFS2_BLOCK_DXROOT:
+		return le64_to_cpu(((struct ocfs2_dx_root_block *)block)->dr_dir_blkno);
+	case OCFS2_BLOCK_EXTENT_BLOCK:
+		return journal_slot_extent_alloc(js,
+			le16_to_cpu(((struct ocfs2_extent_block *)block)->h_suballoc_slot));
+	case OCFS2_BLOCK_XATTR:
+		return journal_slot_extent_alloc(js,
+			le16_to_cpu(((struct ocfs2_xattr_block *)block)->xb_suballoc_slot));
+	case OCFS2_BLOCK_REFCOUNT:
+		return journal_slot_extent_alloc(js,
+			le16_to_cpu(((struct ocfs2_refcount_block *)block)->rf_suballoc_slot));
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static void journal_start_txn(struct journal_summary *js, uint32_t seq)
+{
+	if (js->js_in_txn && js->js_seq == seq)
+		return;
+
+	js->js_in_txn = 1;
+	js->js_seq = seq;
+	js->js_txn_blocks = 0;
+}
+
+static void journal_commit_txn(struct journal_summary *js, uint32_t seq)
+{
+	uint64_t blocks = 0;
+	int bucket = 0;
+
+	if (js->js_in_txn && js->js_seq == seq)
+		blocks = js->js_txn_blocks;
+
+	while (blocks && bucket < JOURNAL_TXN_BUCKETS - 1) {
+		blocks >>= 1;
+		bucket++;
+	}
+
+	js->js_txn_hist[bucket]++;
+	js->js_txns++;
+	js->js_in_txn = 0;
+}
+
+static void journal_read_tags(struct journal_summary *js,
+			      journal_superblock_t *jsb, char *block)
+{
+	int i;
+	int tag_bytes = ocfs2_journal_tag_bytes(jsb);
+	journal_block_tag_t *tag;
+
+	js->js_nr_tags = 0;
+	js->js_next_tag = 0;
+
+	for (i = sizeof(journal_header_t);
+	     i + tag_bytes <= gbls.fs->fs_blocksize; i += tag_bytes) {
+		tag = (journal_block_tag_t *)&block[i];
+		js->js_tags[js->js_nr_tags++] =
+			ocfs2_journal_tag_block(tag, tag_bytes);
+
+		if (tag->t_flags & htonl(JBD2_FLAG_LAST_TAG))
+			break;
+
+		/* skip the uuid. */
+		if (!(tag->t_flags & htonl(JBD2_FLAG_SAME_UUID)))
+			i += 16;
+	}
+}
+
+static errcode_t journal_add_record(struct journal_summary *js,
+				    uint64_t blkno, char *block)
+{
+	errcode_t ret;
+	struct journal_record *jr;
+	enum ocfs2_block_type type;
+
+	if (js->js_nr_recs == js->js_max_recs) {
+		js->js_max_recs = js->js_max_recs ? js->js_max_recs * 2 : 1024;
+		ret = ocfs2_realloc(js->js_max_recs * sizeof(*jr),
+				    &js->js_recs);
+		if (ret)
+			return ret;
+	}
+
+	type = ocfs2_detect_block(block);
+	jr = &js->js_recs[js->js_nr_recs++];
+	jr->jr_blkno = blkno;
+	jr->jr_owner = journal_block_owner(js, type, block);
+	jr->jr_seq = js->js_seq;
+	jr->jr_slot = js->js_slot;
+	jr->jr_type = type;
+	js->js_types[type]++;
+
+	return 0;
+}
+
+/*
+ * Classifies each journal block.  Blocks carrying the JBD2 magic are
+ * log records; the blocks following a descriptor are the logged copies
+ * of the filesystem blocks it tags.  Anything else is unused.
+ * Stale records left from earlier passes through the log are counted
+ * too, as they still describe the workload.
+ */
+static void summarize_journal_block(journal_superblock_t *jsb, char *block,
+				    uint64_t blocknum, void *priv_data)
+{
+	struct journal_summary *js = priv_data;
+	journal_header_t *header = (journal_header_t *)block;
+	journal_revoke_header_t *revoke;
+	uint32_t seq;
+
+	if (!blocknum) {
+		jsb = (journal_superblock_t *)block;
+		js->js_maxlen = ntohl(jsb->s_maxlen);
+		js->js_start = ntohl(jsb->s_start);
+		js->js_sequence = ntohl(jsb->s_sequence);
+		return;
+	}
+
+	if (header->h_magic == htonl(JBD2_MAGIC_NUMBER)) {
+		js->js_nr_tags = 0;
+		seq = ntohl(header->h_sequence);
+
+		switch (ntohl(header->h_blocktype)) {
+		case JBD2_DESCRIPTOR_BLOCK:
+			js->js_descs++;
+			journal_start_txn(js, seq);
+			journal_read_tags(js, jsb, block);
+			return;
+		case JBD2_COMMIT_BLOCK:
+			js->js_commits++;
+			journal_commit_txn(js, seq);
+			return;
+		case JBD2_REVOKE_BLOCK:
+			js->js_revokes++;
+			journal_start_txn(js, seq);
+			revoke = (journal_revoke_header_t *)block;
+			js->js_revoked += (ntohl(revoke->r_count) -
+					   sizeof(journal_revoke_header_t)) /
+					  sizeof(uint32_t);
+			return;
+		default:
+			break;
+		}
+	} else if (js->js_next_tag < js->js_nr_tags) {
+		js->js_logged++;
+		js->js_txn_blocks++;
+		if (journal_add_record(js, js->js_tags[js->js_next_tag++],
+				       block))
+			js->js_nr_tags = 0;
+	}
+}
+
+static int journal_record_blkno_cmp(const void *a, const void *b)
+{
+	const struct journal_record *ra = a, *rb = b;
+
+	if (ra->jr_blkno != rb->jr_blkno)
+		return ra->jr_blkno < rb->jr_blkno ? -1 : 1;
+	if (ra->jr_slot != rb->jr_slot)
+		return ra->jr_slot < rb->jr_slot ? -1 : 1;
+	if (ra->jr_seq != rb->jr_seq)
+		return ra->jr_seq < rb->jr_seq ? -1 : 1;
+	return 0;
+}
+
+static int journal_record_owner_cmp(const void *a, const void *b)
+{
+	const struct journal_record *ra = a, *rb = b;
+
+	if (ra->jr_owner != rb->jr_owner)
+		return ra->jr_owner < rb->jr_owner ? -1 : 1;
+	if (ra->jr_blkno != rb->jr_blkno)
+		return ra->jr_blkno < rb->jr_blkno ? -1 : 1;
+	return 0;
+}
+
+static int journal_hot_cmp(const void *a, const void *b)
+{
+	const struct journal_hot *ha = a, *hb = b;
+
+	if (ha->jh_logged != hb->jh_logged)
+		return ha->jh_logged > hb->jh_logged ? -1 : 1;
+	if (ha->jh_txns != hb->jh_txns)
+		return ha->jh_txns > hb->jh_txns ? -1 : 1;
+	if (ha->jh_blkno != hb->jh_blkno)
+		return ha->jh_blkno < hb->jh_blkno ? -1 : 1;
+	return 0;
+}
+
+static void print_journal_totals(FILE *out, struct journal_summary *js)
+{
+	int i;
+	uint64_t logged = js->js_nr_recs;
+
+	fprintf(out, "\n\tTransactions: %"PRIu64"  Logged blocks: %"PRIu64,
+		js->js_txns, logged);
+	if (js->js_txns)
+		fprintf(out, "  Average: %.1f blocks/transaction",
+			(double)logged / js->js_txns);
+	fprintf(out, "\n");
+
+	if (js->js_txns) {
+		fprintf(out, "\n\t%-17s %s\n", "Blocks/Trans", "Count");
+		for (i = 0; i < JOURNAL_TXN_BUCKETS; i++) {
+			if (!js->js_txn_hist[i])
+				continue;
+			if (!i)
+				fprintf(out, "\t%8u%-9s ", 0, "");
+			else if (i == JOURNAL_TXN_BUCKETS - 1)
+				fprintf(out, "\t%8u%-9s ", 1 << (i - 1), "+");
+			else
+				fprintf(out, "\t%8u - %-6u ", 1 << (i - 1),
+					(1 << i) - 1);
+			fprintf(out, "%"PRIu64"\n", js->js_txn_hist[i]);
+		}
+	}
+
+	if (!logged)
+		return;
+
+	fprintf(out, "\n\t%-12s %-12s %s\n", "Type", "Logged", "Percent");
+	for (i = 0; i <= OCFS2_BLOCK_DXLEAF; i++) {
+		if (!js->js_types[i])
+			continue;
+		fprintf(out, "\t%-12s %-12"PRIu64" %.1f%%\n",
+			journal_block_names[i], js->js_types[i],
+			js->js_types[i] * 100.0 / logged);
+	}
+}
+
+static errcode_t print_journal_hot(FILE *out, struct journal_summary *js)
+{
+	errcode_t ret;
+	uint64_t i, nr_hot = 0, repeated = 0;
+	struct journal_record *jr, *prev = NULL;
+	struct journal_hot *hot = NULL, *jh = NULL;
+
+	ret = ocfs2_malloc0(js->js_nr_recs * sizeof(*hot), &hot);
+	if (ret)
+		return ret;
+
+	/* Sorted by block, slot and sequence, a block's copies are a run */
+	qsort(js->js_recs, js->js_nr_recs, sizeof(*jr),
+	      journal_record_blkno_cmp);
+	for (i = 0; i < js->js_nr_recs; i++) {
+		jr = &js->js_recs[i];
+		if (!prev || prev->jr_blkno != jr->jr_blkno) {
+			jh = &hot[nr_hot++];
+			jh->jh_blkno = jr->jr_blkno;
+			jh->jh_owner = jr->jr_owner;
+			jh->jh_type = jr->jr_type;
+			jh->jh_slots = 1;
+			jh->jh_txns = 1;
+		} else if (prev->jr_slot != jr->jr_slot) {
+			jh->jh_slots++;
+			jh->jh_txns++;
+		} else if (prev->jr_seq != jr->jr_seq)
+			jh->jh_txns++;
+		jh->jh_logged++;
+		prev = jr;
+	}
+
+	for (i = 0; i < nr_hot; i++)
+		if (hot[i].jh_txns > 1)
+			repeated++;
+
+	fprintf(out, "\n\tDistinct blocks: %"PRIu64"  Logged in more than "
+		"one transaction: %"PRIu64"\n", nr_hot, repeated);
+
+	qsort(hot, nr_hot, sizeof(*hot), journal_hot_cmp);
+	fprintf(out, "\n\t%-15s %-12s %-15s %-8s %-8s %s\n", "Block", "Type",
+		"Owner", "Logged", "Trans", "Slots");
+	for (i = 0; i < nr_hot && i < JOURNAL_SUMMARY_TOP; i++) {
+		jh = &hot[i];
+		fprintf(out, "\t%-15"PRIu64" %-12s ", jh->jh_blkno,
+			journal_block_names[jh->jh_type]);
+		if (jh->jh_owner)
+			fprintf(out, "%-15"PRIu64" ", jh->jh_owner);
+		else
+			fprintf(out, "%-15s ", "-");
+		fprintf(out, "%-8"PRIu64" %-8"PRIu64" %u\n", jh->jh_logged,
+			jh->jh_txns, jh->jh_slots);
+	}
+
+	/* Now one entry per owner; jh_txns counts its distinct blocks */
+	memset(hot, 0, nr_hot * sizeof(*hot));
+	nr_hot = 0;
+	prev = NULL;
+	qsort(js->js_recs, js->js_nr_recs, sizeof(*jr),
+	      journal_record_owner_cmp);
+	for (i = 0; i < js->js_nr_recs; i++) {
+		jr = &js->js_recs[i];
+		if (!jr->jr_owner)
+			continue;
+		if (!prev || prev->jr_owner != jr->jr_owner) {
+			jh = &hot[nr_hot++];
+			jh->jh_blkno = jr->jr_owner;
+			jh->jh_txns = 1;
+		} else if (prev->jr_blkno != jr->jr_blkno)
+			jh->jh_txns++;
+		jh->jh_logged++;
+		prev = jr;
+	}
+
+	qsort(hot, nr_hot, sizeof(*hot), journal_hot_cmp);
+	fprintf(out, "\n\t%-15s %-8s %s\n", "Owner", "Logged", "Blocks");
+	for (i = 0; i < nr_hot && i < JOURNAL_SUMMARY_TOP; i++)
+		fprintf(out, "\t%-15"PRIu64" %-8"PRIu64" %"PRIu64"\n",
+			hot[i].jh_blkno, hot[i].jh_logged, hot[i].jh_txns);
+
+	ocfs2_free(&hot);
+	return 0;
+}
+
+static int journal_slot_cmp(const void *a, const void *b)
+{
+	uint64_t ja = gbls.jrnl_blkno[*(const uint16_t *)a];
+	uint64_t jb = gbls.jrnl_blkno[*(const uint16_t *)b];
+
+	if (ja != jb)
+		return ja < jb ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Summarizes the journals of the given slots: per slot usage, then the
+ * transaction sizes, block types, hot blocks and owners over all of
+ * them.  The journals are walked in disk order.
+ */
+errcode_t summarize_journals(ocfs2_filesys *fs, uint16_t *slots, int nr_slots,
+			     FILE *out)
+{
+	errcode_t ret = 0;
+	int i;
+	uint64_t records;
+	struct journal_summary *js = NULL;
+
+	ret = ocfs2_malloc0(sizeof(*js), &js);
+	if (ret)
+		goto bail;
+
+	ret = ocfs2_malloc0(fs->fs_blocksize, &js->js_tags);
+	if (ret)
+		goto bail;
+
+	js->js_out = out;
+	qsort(slots, nr_slots, sizeof(*slots), journal_slot_cmp);
+
+	fprintf(out, "\tJournal usage:\n");
+	for (i = 0; i < nr_slots; i++) {
+		js->js_slot = slots[i];
+		js->js_in_txn = 0;
+		js->js_nr_tags = 0;
+		js->js_descs = js->js_commits = js->js_revokes = 0;
+		js->js_revoked = js->js_logged = 0;
+		js->js_maxlen = js->js_start = js->js_sequence = 0;
+
+		ret = walk_journal(fs, gbls.jrnl_blkno[slots[i]],
+				   summarize_journal_block, js);
+		if (ret)
+			goto bail;
+
+		records = js->js_descs + js->js_logged + js->js_revokes +
+			js->js_commits;
+		fprintf(out, "\tSlot %u: start %u, sequence %u, %"PRIu64" of %u "
+			"blocks in use (%.1f%%)\n", slots[i], js->js_start,
+			js->js_sequence, records, js->js_maxlen,
+			js->js_maxlen ? records * 100.0 / js->js_maxlen : 0);
+		fprintf(out, "\t\tDescriptor: %"PRIu64"  Logged: %"PRIu64
+			"  Revoke: %"PRIu64" (%"PRIu64" records)  Commit: %"
+			PRIu64"\n", js->js_descs, js->js_logged,
+			js->js_revokes, js->js_revoked, js->js_commits);
+	}
+
+	print_journal_totals(out, js);
+	if (js->js_nr_recs)
+		ret = print_journal_hot(out, js);
+
+bail:
+	if (js) {
+		if (js->js_recs)
+			ocfs2_free(&js->js_recs);
+		if (js->js_tags)
+			ocfs2_free(&js->js_tags);
+		ocfs2_free(&js);
+	}
+
+	return ret;
+}
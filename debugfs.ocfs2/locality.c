@@ -0,0 +1,707 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * locality.c
+ *
+ * Measures how far apart related metadata sits on disk
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA  02110-1301 USA.
+ *
+ */
+
+/*
+ * Things that are used together should sit together.  We measure three
+ * distances, in blocks:
+ *
+ *   dir->child   a directory inode to each inode it names
+ *   inode->data  an inode to its first data extent
+ *   inode->eb    an inode to each of its extent blocks
+ *
+ * A single inode scan collects every inode and walks its extents.  The
+ * directories found are then iterated, and their children are looked
+ * up in the sorted scan results to see which slot allocated them.  The
+ * distances are kept as power-of-two histograms, for the volume and
+ * per slot.  The worst directories and inodes are named at the end.
+ */
+
+#include "main.h"
+#include "ocfs2/byteorder.h"
+
+extern struct dbgfs_gbls gbls;
+
+/* Bucket 0 is distance 0, bucket n holds [2^(n-1), 2^n) */
+#define LOCALITY_BUCKETS	65
+
+enum locality_metric {
+	LOC_DIR_CHILD = 0,
+	LOC_INODE_DATA,
+	LOC_INODE_EB,
+	LOC_NUM_METRICS,
+};
+
+static const char *locality_metric_names[LOC_NUM_METRICS] = {
+	"Dir->child", "Inode->data", "Inode->eb",
+};
+
+struct locality_hist {
+	uint64_t lh_count[LOCALITY_BUCKETS];
+	uint64_t lh_total;
+};
+
+struct locality_slot {
+	uint64_t ls_inodes;
+	uint64_t ls_dirs;
+	uint64_t ls_children;
+	uint64_t ls_cross_slot;		/* Children from another slot */
+	struct locality_hist ls_hist[LOC_NUM_METRICS];
+};
+
+struct locality_inode {
+	uint64_t li_blkno;
+	uint64_t li_data;		/* UINT64_MAX if no data extents */
+	uint64_t li_eb;			/* Farthest extent block */
+	uint16_t li_slot;		/* Index into lo_slots */
+	uint16_t li_dir;
+};
+
+struct locality_dir {
+	uint64_t ld_blkno;
+	uint64_t ld_children;
+	uint64_t ld_total;		/* Sum of child distances */
+	uint64_t ld_max;
+	uint64_t ld_cross_slot;
+};
+
+struct locality {
+	ocfs2_filesys *lo_fs;
+	FILE *lo_out;
+	int lo_top;
+
+	/* s_max_slots entries, then one for the global allocator */
+	int lo_nr_slots;
+	struct locality_slot *lo_slots;
+	struct locality_hist lo_hist[LOC_NUM_METRICS];
+
+	struct locality_inode *lo_inodes;
+	uint64_t lo_num_inodes;
+	uint64_t lo_max_inodes;
+
+	struct locality_dir *lo_dirs;
+	uint64_t lo_num_dirs;
+
+	/* State for the extent and dirent callbacks */
+	struct locality_inode *lo_cur_inode;
+	struct locality_dir *lo_cur_dir;
+	uint16_t lo_cur_slot;
+
+	/* Inodes we want paths for, sorted */
+	uint64_t *lo_wanted;
+	int lo_num_wanted;
+};
+
+static inline uint64_t locality_distance(uint64_t a, uint64_t b)
+{
+	return (a > b) ? a - b : b - a;
+}
+
+static inline int locality_bucket(uint64_t dist)
+{
+	int b = 0;
+
+	while (dist) {
+		b++;
+		dist >>= 1;
+	}
+	return b;
+}
+
+static void locality_record(struct locality *lo, uint16_t slot,
+			    enum locality_metric m, uint64_t dist)
+{
+	int b = locality_bucket(dist);
+
+	lo->lo_hist[m].lh_count[b]++;
+	lo->lo_hist[m].lh_total++;
+	lo->lo_slots[slot].ls_hist[m].lh_count[b]++;
+	lo->lo_slots[slot].ls_hist[m].lh_total++;
+}
+
+/* Upper bound of the bucket holding the pct'th percentile */
+static uint64_t locality_percentile(struct locality_hist *lh, int pct)
+{
+	uint64_t want, seen = 0;
+	int b;
+
+	if (!lh->lh_total)
+		return 0;
+
+	want = (lh->lh_total * pct + 99) / 100;
+	for (b = 0; b < LOCALITY_BUCKETS - 1; b++) {
+		seen += lh->lh_count[b];
+		if (seen >= want)
+			break;
+	}
+
+	return b ? (1ULL << b) : 0;
+}
+
+/* Prints a distance in blocks as a size, eg 1M */
+static char *locality_size_str(struct locality *lo, uint64_t blocks,
+			       char *buf, size_t len)
+{
+	const char *units = "KMGTPE";
+	uint64_t kb;
+	int u = 0;
+
+	kb = blocks * (lo->lo_fs->fs_blocksize >> 10);
+	while ((kb >= 1024) && units[u + 1]) {
+		kb >>= 10;
+		u++;
+	}
+	if (!blocks)
+		snprintf(buf, len, "0");
+	else
+		snprintf(buf, len, "%"PRIu64"%c", kb, units[u]);
+
+	return buf;
+}
+
+static uint16_t locality_slot_index(struct locality *lo,
+				    struct ocfs2_dinode *di)
+{
+	uint16_t slot = di->i_suballoc_slot;
+
+	if (slot == (uint16_t)OCFS2_INVALID_SLOT ||
+	    slot >= lo->lo_nr_slots - 1)
+		return lo->lo_nr_slots - 1;
+	return slot;
+}
+
+static int locality_extent_func(ocfs2_filesys *fs,
+				struct ocfs2_extent_rec *rec, int tree_depth,
+				uint32_t ccount, uint64_t ref_blkno,
+				int ref_recno, void *priv_data)
+{
+	struct locality *lo = priv_data;
+	struct locality_inode *li = lo->lo_cur_inode;
+	uint64_t dist;
+
+	if (!rec->e_blkno)
+		return 0;
+
+	dist = locality_distance(li->li_blkno, rec->e_blkno);
+	if (tree_depth) {
+		locality_record(lo, li->li_slot, LOC_INODE_EB, dist);
+		if (dist > li->li_eb)
+			li->li_eb = dist;
+	} else if (li->li_data == UINT64_MAX) {
+		/* Records come in cpos order, so this is the first */
+		locality_record(lo, li->li_slot, LOC_INODE_DATA, dist);
+		li->li_data = dist;
+	}
+
+	return 0;
+}
+
+static errcode_t locality_add_inode(struct locality *lo,
+				    struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	struct locality_inode *li;
+	uint64_t new_max;
+
+	if (lo->lo_num_inodes == lo->lo_max_inodes) {
+		new_max = lo->lo_max_inodes ? lo->lo_max_inodes * 2 : 1024;
+		ret = ocfs2_realloc(new_max * sizeof(struct locality_inode),
+				    &lo->lo_inodes);
+		if (ret)
+			return ret;
+		lo->lo_max_inodes = new_max;
+	}
+
+	li = &lo->lo_inodes[lo->lo_num_inodes++];
+	li->li_blkno = di->i_blkno;
+	li->li_data = UINT64_MAX;
+	li->li_eb = 0;
+	li->li_slot = locality_slot_index(lo, di);
+	li->li_dir = !!S_ISDIR(di->i_mode);
+
+	lo->lo_slots[li->li_slot].ls_inodes++;
+	if (li->li_dir) {
+		lo->lo_slots[li->li_slot].ls_dirs++;
+		lo->lo_num_dirs++;
+	}
+
+	if (!di->i_clusters || (di->i_dyn_features & OCFS2_INLINE_DATA_FL))
+		return 0;
+
+	lo->lo_cur_inode = li;
+	return ocfs2_extent_iterate_inode(lo->lo_fs, di, 0, NULL,
+					  locality_extent_func, lo);
+}
+
+static errcode_t locality_scan_inodes(struct locality *lo)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = lo->lo_fs;
+	ocfs2_inode_scan *scan = NULL;
+	struct ocfs2_dinode *di;
+	uint64_t blkno;
+	char *buf = NULL;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto out;
+	di = (struct ocfs2_dinode *)buf;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (ret)
+		goto out;
+
+	for (;;) {
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret || !blkno)
+			break;
+
+		if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
+			   strlen(OCFS2_INODE_SIGNATURE)))
+			continue;
+
+		ocfs2_swap_inode_to_cpu(fs, di);
+
+		if (di->i_fs_generation != fs->fs_super->i_fs_generation)
+			continue;
+
+		if (!(di->i_flags & OCFS2_VALID_FL) ||
+		    (di->i_flags & OCFS2_SYSTEM_FL))
+			continue;
+
+		ret = locality_add_inode(lo, di);
+		if (ret)
+			break;
+	}
+
+out:
+	if (scan)
+		ocfs2_close_inode_scan(scan);
+	if (buf)
+		ocfs2_free(&buf);
+	return ret;
+}
+
+static int locality_inode_cmp(const void *a, const void *b)
+{
+	const struct locality_inode *l = a, *r = b;
+
+	if (l->li_blkno < r->li_blkno)
+		return -1;
+	return l->li_blkno > r->li_blkno;
+}
+
+static struct locality_inode *locality_lookup(struct locality *lo,
+					      uint64_t blkno)
+{
+	struct locality_inode key = { .li_blkno = blkno, };
+
+	return bsearch(&key, lo->lo_inodes, lo->lo_num_inodes,
+		       sizeof(struct locality_inode), locality_inode_cmp);
+}
+
+static int locality_dirent_func(struct ocfs2_dir_entry *dirent,
+				uint64_t blocknr, int offset, int blocksize,
+				char *buf, void *priv_data)
+{
+	struct locality *lo = priv_data;
+	struct locality_dir *ld = lo->lo_cur_dir;
+	struct locality_inode *child;
+	uint64_t dist;
+
+	dist = locality_distance(ld->ld_blkno, dirent->inode);
+	locality_record(lo, lo->lo_cur_slot, LOC_DIR_CHILD, dist);
+
+	ld->ld_children++;
+	ld->ld_total += dist;
+	if (dist > ld->ld_max)
+		ld->ld_max = dist;
+
+	lo->lo_slots[lo->lo_cur_slot].ls_children++;
+	child = locality_lookup(lo, dirent->inode);
+	if (child && (child->li_slot != lo->lo_cur_slot)) {
+		ld->ld_cross_slot++;
+		lo->lo_slots[lo->lo_cur_slot].ls_cross_slot++;
+	}
+
+	return 0;
+}
+
+static errcode_t locality_scan_dirs(struct locality *lo)
+{
+	errcode_t ret = 0;
+	struct locality_inode *li;
+	struct locality_dir *ld;
+	uint64_t i;
+
+	if (!lo->lo_num_dirs)
+		return 0;
+
+	ret = ocfs2_malloc0(lo->lo_num_dirs * sizeof(struct locality_dir),
+			    &lo->lo_dirs);
+	if (ret)
+		return ret;
+
+	/* lo_inodes is sorted, so directories are visited in disk order */
+	ld = lo->lo_dirs;
+	for (i = 0; i < lo->lo_num_inodes; i++) {
+		li = &lo->lo_inodes[i];
+		if (!li->li_dir)
+			continue;
+
+		ld->ld_blkno = li->li_blkno;
+		lo->lo_cur_dir = ld;
+		lo->lo_cur_slot = li->li_slot;
+		ret = ocfs2_dir_iterate(lo->lo_fs, li->li_blkno,
+					OCFS2_DIRENT_FLAG_EXCLUDE_DOTS, NULL,
+					locality_dirent_func, lo);
+		if (ret) {
+			com_err(gbls.cmd, ret, "while iterating directory "
+				"%"PRIu64, li->li_blkno);
+			ret = 0;
+		}
+		ld++;
+	}
+
+	return ret;
+}
+
+static int locality_wanted_cmp(const void *a, const void *b)
+{
+	const uint64_t *l = a, *r = b;
+
+	if (*l < *r)
+		return -1;
+	return *l > *r;
+}
+
+static int locality_want_inode(uint64_t ino, void *priv_data)
+{
+	struct locality *lo = priv_data;
+
+	return !!bsearch(&ino, lo->lo_wanted, lo->lo_num_wanted,
+			 sizeof(uint64_t), locality_wanted_cmp);
+}
+
+static int locality_path_func(uint64_t ino, const char *path, int file_type,
+			      void *priv_data)
+{
+	char *buf = priv_data;
+
+	snprintf(buf, PATH_MAX, "%s", path);
+	return 1;
+}
+
+static void locality_print_path(struct locality *lo, ocfs2_dir_revmap *map,
+				uint64_t blkno, char *path)
+{
+	*path = '\0';
+	if (map)
+		ocfs2_dir_revmap_iterate(map, blkno, locality_path_func,
+					 path);
+	fprintf(lo->lo_out, "  %s\n", *path ? path : "-");
+}
+
+static double locality_dir_mean(struct locality_dir *ld)
+{
+	return ld->ld_children ?
+		(double)ld->ld_total / ld->ld_children : 0;
+}
+
+static int locality_dir_cmp(const void *a, const void *b)
+{
+	const struct locality_dir *l = a, *r = b;
+	double lm = locality_dir_mean((struct locality_dir *)l);
+	double rm = locality_dir_mean((struct locality_dir *)r);
+
+	if (lm != rm)
+		return (lm < rm) ? 1 : -1;
+	if (l->ld_max != r->ld_max)
+		return (l->ld_max < r->ld_max) ? 1 : -1;
+	return 0;
+}
+
+static uint64_t locality_inode_worst(const struct locality_inode *li)
+{
+	uint64_t data = (li->li_data == UINT64_MAX) ? 0 : li->li_data;
+
+	return max(data, li->li_eb);
+}
+
+static int locality_inode_worst_cmp(const void *a, const void *b)
+{
+	uint64_t l = locality_inode_worst(a), r = locality_inode_worst(b);
+
+	if (l != r)
+		return (l < r) ? 1 : -1;
+	return 0;
+}
+
+static void locality_print_hists(struct locality *lo)
+{
+	int b, m, lo_b = LOCALITY_BUCKETS, hi_b = -1;
+	char size[16];
+
+	for (m = 0; m < LOC_NUM_METRICS; m++) {
+		for (b = 0; b < LOCALITY_BUCKETS; b++) {
+			if (!lo->lo_hist[m].lh_count[b])
+				continue;
+			lo_b = min(lo_b, b);
+			hi_b = max(hi_b, b);
+		}
+	}
+	if (hi_b < 0)
+		return;
+
+	fprintf(lo->lo_out, "\n%-10s", "Distance");
+	for (m = 0; m < LOC_NUM_METRICS; m++)
+		fprintf(lo->lo_out, "  %12s", locality_metric_names[m]);
+	fprintf(lo->lo_out, "\n");
+
+	for (b = lo_b; b <= hi_b; b++) {
+		fprintf(lo->lo_out, "%s%-9s",
+			b ? "<" : " ",
+			b ? locality_size_str(lo, 1ULL << b, size,
+					      sizeof(size)) : "0");
+		for (m = 0; m < LOC_NUM_METRICS; m++)
+			fprintf(lo->lo_out, "  %12"PRIu64,
+				lo->lo_hist[m].lh_count[b]);
+		fprintf(lo->lo_out, "\n");
+	}
+}
+
+static char *locality_percentile_str(struct locality *lo,
+				     struct locality_hist *lh, int pct,
+				     char *buf, size_t len)
+{
+	uint64_t bound = locality_percentile(lh, pct);
+	char size[16];
+
+	if (!bound)
+		snprintf(buf, len, "0");
+	else
+		snprintf(buf, len, "<%s",
+			 locality_size_str(lo, bound, size, sizeof(size)));
+	return buf;
+}
+
+static void locality_print_slots(struct locality *lo)
+{
+	struct locality_slot *ls;
+	char p50[16], p90[16], d50[16], d90[16];
+	char slotname[16];
+	int i;
+
+	fprintf(lo->lo_out, "\n%-6s  %10s  %8s  %8s  %8s  %8s  %8s  %10s\n",
+		"Slot", "Inodes", "Dirs", "Child50", "Child90",
+		"Data50", "Data90", "CrossSlot");
+
+	for (i = 0; i < lo->lo_nr_slots; i++) {
+		ls = &lo->lo_slots[i];
+		if (!ls->ls_inodes)
+			continue;
+
+		if (i == lo->lo_nr_slots - 1)
+			snprintf(slotname, sizeof(slotname), "global");
+		else
+			snprintf(slotname, sizeof(slotname), "%d", i);
+
+		locality_percentile_str(lo, &ls->ls_hist[LOC_DIR_CHILD], 50,
+					p50, sizeof(p50));
+		locality_percentile_str(lo, &ls->ls_hist[LOC_DIR_CHILD], 90,
+					p90, sizeof(p90));
+		locality_percentile_str(lo, &ls->ls_hist[LOC_INODE_DATA], 50,
+					d50, sizeof(d50));
+		locality_percentile_str(lo, &ls->ls_hist[LOC_INODE_DATA], 90,
+					d90, sizeof(d90));
+		fprintf(lo->lo_out,
+			"%-6s  %10"PRIu64"  %8"PRIu64"  %8s  %8s  %8s  %8s"
+			"  %10"PRIu64"\n",
+			slotname, ls->ls_inodes, ls->ls_dirs,
+			p50, p90, d50, d90, ls->ls_cross_slot);
+	}
+}
+
+/* Names the worst directories and inodes */
+static errcode_t locality_print_worst(struct locality *lo)
+{
+	errcode_t ret;
+	ocfs2_dir_revmap *map = NULL;
+	int i, ndirs, ninodes;
+	char mean[16], maxd[16], data[16], eb[16], slotname[16];
+	char *path = NULL;
+	struct locality_dir *ld;
+	struct locality_inode *li;
+
+	qsort(lo->lo_dirs, lo->lo_num_dirs, sizeof(struct locality_dir),
+	      locality_dir_cmp);
+	qsort(lo->lo_inodes, lo->lo_num_inodes,
+	      sizeof(struct locality_inode), locality_inode_worst_cmp);
+
+	ndirs = min((uint64_t)lo->lo_top, lo->lo_num_dirs);
+	ninodes = min((uint64_t)lo->lo_top, lo->lo_num_inodes);
+	while (ninodes && !locality_inode_worst(&lo->lo_inodes[ninodes - 1]))
+		ninodes--;
+
+	ret = ocfs2_malloc0(PATH_MAX, &path);
+	if (ret)
+		goto out;
+	ret = ocfs2_malloc0((ndirs + ninodes + 1) * sizeof(uint64_t),
+			    &lo->lo_wanted);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < ndirs; i++)
+		lo->lo_wanted[lo->lo_num_wanted++] = lo->lo_dirs[i].ld_blkno;
+	for (i = 0; i < ninodes; i++)
+		lo->lo_wanted[lo->lo_num_wanted++] =
+			lo->lo_inodes[i].li_blkno;
+	qsort(lo->lo_wanted, lo->lo_num_wanted, sizeof(uint64_t),
+	      locality_wanted_cmp);
+
+	/* Paths are nice to have; carry on without them */
+	if (lo->lo_num_wanted &&
+	    ocfs2_dir_revmap_build(lo->lo_fs, locality_want_inode, lo, &map))
+		map = NULL;
+
+	if (ndirs) {
+		fprintf(lo->lo_out, "\nWorst directories by mean child "
+			"distance:\n%-12s  %8s  %8s  %8s  %9s  %s\n",
+			"Inode", "Children", "Mean", "Max", "CrossSlot",
+			"Path");
+		for (i = 0; i < ndirs; i++) {
+			ld = &lo->lo_dirs[i];
+			fprintf(lo->lo_out,
+				"%-12"PRIu64"  %8"PRIu64"  %8s  %8s  %9"PRIu64,
+				ld->ld_blkno, ld->ld_children,
+				locality_size_str(lo,
+					(uint64_t)locality_dir_mean(ld),
+					mean, sizeof(mean)),
+				locality_size_str(lo, ld->ld_max, maxd,
+						  sizeof(maxd)),
+				ld->ld_cross_slot);
+			locality_print_path(lo, map, ld->ld_blkno, path);
+		}
+	}
+
+	if (ninodes) {
+		fprintf(lo->lo_out, "\nWorst inodes by data or extent block "
+			"distance:\n%-12s  %6s  %8s  %8s  %s\n",
+			"Inode", "Slot", "Data", "ExtBlk", "Path");
+		for (i = 0; i < ninodes; i++) {
+			li = &lo->lo_inodes[i];
+			if (li->li_slot == lo->lo_nr_slots - 1)
+				snprintf(slotname, sizeof(slotname), "global");
+			else
+				snprintf(slotname, sizeof(slotname), "%u",
+					 li->li_slot);
+			fprintf(lo->lo_out, "%-12"PRIu64"  %6s  %8s  %8s",
+				li->li_blkno, slotname,
+				(li->li_data == UINT64_MAX) ? "-" :
+				locality_size_str(lo, li->li_data, data,
+						  sizeof(data)),
+				locality_size_str(lo, li->li_eb, eb,
+						  sizeof(eb)));
+			locality_print_path(lo, map, li->li_blkno, path);
+		}
+	}
+
+out:
+	if (map)
+		ocfs2_dir_revmap_free(map);
+	if (path)
+		ocfs2_free(&path);
+	return ret;
+}
+
+errcode_t show_locality(ocfs2_filesys *fs, int top, FILE *out)
+{
+	errcode_t ret;
+	struct locality *lo = NULL;
+	struct locality_slot *ls;
+	uint64_t children = 0, cross = 0;
+	int i;
+
+	ret = ocfs2_malloc0(sizeof(struct locality), &lo);
+	if (ret)
+		goto out;
+
+	lo->lo_fs = fs;
+	lo->lo_out = out;
+	lo->lo_top = top;
+	lo->lo_nr_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots + 1;
+	ret = ocfs2_malloc0(lo->lo_nr_slots * sizeof(struct locality_slot),
+			    &lo->lo_slots);
+	if (ret)
+		goto out;
+
+	ret = locality_scan_inodes(lo);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while scanning inodes");
+		goto out;
+	}
+
+	qsort(lo->lo_inodes, lo->lo_num_inodes,
+	      sizeof(struct locality_inode), locality_inode_cmp);
+
+	ret = locality_scan_dirs(lo);
+	if (ret) {
+		com_err(gbls.cmd, ret, "while scanning directories");
+		goto out;
+	}
+
+	for (i = 0; i < lo->lo_nr_slots; i++) {
+		ls = &lo->lo_slots[i];
+		children += ls->ls_children;
+		cross += ls->ls_cross_slot;
+	}
+
+	fprintf(out, "Inodes: %"PRIu64"  Directories: %"PRIu64
+		"  Entries: %"PRIu64"  Cross-slot entries: %"PRIu64
+		" (%.1f%%)\n",
+		lo->lo_num_inodes, lo->lo_num_dirs, children, cross,
+		children ? (double)cross * 100 / children : 0);
+
+	locality_print_hists(lo);
+	locality_print_slots(lo);
+
+	ret = locality_print_worst(lo);
+	if (ret)
+		com_err(gbls.cmd, ret, "while finding the worst offenders");
+
+out:
+	if (lo) {
+		if (lo->lo_wanted)
+			ocfs2_free(&lo->lo_wanted);
+		if (lo->lo_dirs)
+			ocfs2_free(&lo->lo_dirs);
+		if (lo->lo_inodes)
+			ocfs2_free(&lo->lo_inodes);
+		if (lo->lo_slots)
+			ocfs2_free(&lo->lo_slots);
+		ocfs2_free(&lo);
+	}
+	return ret;
+}
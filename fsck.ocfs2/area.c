@@ -0,0 +1,116 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * area.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * Tracks which bytes of an object are already claimed, so that fsck
+ * can ask "does [off, off + len) overlap anything?" in one bitmap scan.
+ * One bit per byte of the object.
+ */
+#include <string.h>
+
+#include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
+
+#include "area.h"
+
+void o2fsck_area_init(struct o2fsck_area_map *am, unsigned int size)
+{
+	/* Nothing we check is bigger than a block */
+	if (size > O2FSCK_AREA_MAX_SIZE)
+		size = O2FSCK_AREA_MAX_SIZE;
+
+	am->am_size = size;
+	memset(am->am_bits, 0, (size + 7) / 8);
+}
+
+/* Returns 0 if [off, off + len) is inside the object and unclaimed */
+int o2fsck_area_fits(struct o2fsck_area_map *am, unsigned int off,
+		     unsigned int len)
+{
+	if (off > am->am_size || len > (am->am_size - off))
+		return -1;
+
+	if (!len)
+		return 0;
+
+	if (ocfs2_find_next_bit_set(am->am_bits, off + len, off) <
+	    (off + len))
+		return -1;
+
+	return 0;
+}
+
+static void area_fill(struct o2fsck_area_map *am, unsigned int off,
+		      unsigned int len, int set)
+{
+	unsigned int end;
+
+	if (off >= am->am_size)
+		return;
+	if (len > (am->am_size - off))
+		len = am->am_size - off;
+	end = off + len;
+
+	/* Partial leading byte, whole bytes, then the partial tail */
+	for (; (off < end) && (off & 7); off++) {
+		if (set)
+			ocfs2_set_bit(off, am->am_bits);
+		else
+			ocfs2_clear_bit(off, am->am_bits);
+	}
+
+	if ((end - off) >= 8) {
+		memset(am->am_bits + (off >> 3), set ? 0xff : 0,
+		       (end - off) >> 3);
+		off += (end - off) & ~7;
+	}
+
+	for (; off < end; off++) {
+		if (set)
+			ocfs2_set_bit(off, am->am_bits);
+		else
+			ocfs2_clear_bit(off, am->am_bits);
+	}
+}
+
+void o2fsck_area_set(struct o2fsck_area_map *am, unsigned int off,
+		     unsigned int len)
+{
+	area_fill(am, off, len, 1);
+}
+
+void o2fsck_area_clear(struct o2fsck_area_map *am, unsigned int off,
+		       unsigned int len)
+{
+	area_fill(am, off, len, 0);
+}
+
+/* How many unclaimed bytes start at off */
+unsigned int o2fsck_area_free_len(struct o2fsck_area_map *am,
+				  unsigned int off)
+{
+	unsigned int next;
+
+	if (off >= am->am_size)
+		return 0;
+
+	next = ocfs2_find_next_bit_set(am->am_bits, am->am_size, off);
+	if (next > am->am_size)
+		next = am->am_size;
+
+	return next - off;
+}
@@ -20,7 +20,7 @@
  *
  * --
  *
- * An rbtree to record a directory's parent information.  _dirent records
+ * A table to record a directory's parent information.  _dirent records
  * the inode who had a directory entry that points to the directory in
  * question.  _dot_dot records the inode that the directory's ".." points to;
  * who it thinks its parent is.
@@ -36,25 +36,158 @@
 #include "dirparents.h"
 #include "util.h"
 
+/*
+ * Pass 1 finds directories in nearly ascending inode order, so most
+ * adds append to the last chunk.  An add into the middle of a full
+ * chunk splits it in two.
+ */
+#define O2FSCK_DIR_PARENT_CHUNK	1024
+
+struct o2fsck_dir_parent_chunk {
+	unsigned int		dpc_used;
+	o2fsck_dir_parent	dpc_recs[O2FSCK_DIR_PARENT_CHUNK];
+};
+
+/* The chunk that would hold ino: the last one starting at or below it */
+static unsigned int dp_find_chunk(struct o2fsck_dir_parents *dps,
+				  uint64_t ino)
+{
+	unsigned int lo = 0, hi = dps->dps_nr_chunks, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (dps->dps_first[mid] <= ino)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* The first slot in the chunk whose inode is not below ino */
+static unsigned int dp_find_rec(struct o2fsck_dir_parent_chunk *dpc,
+				uint64_t ino)
+{
+	unsigned int lo = 0, hi = dpc->dpc_used, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (dpc->dpc_recs[mid].dp_ino < ino)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Make room for a new, empty chunk at index c */
+static errcode_t dp_insert_chunk(struct o2fsck_dir_parents *dps,
+				 unsigned int c)
+{
+	unsigned int max;
+	struct o2fsck_dir_parent_chunk *dpc, **chunks;
+	uint64_t *first;
+
+	if (dps->dps_nr_chunks == dps->dps_max_chunks) {
+		max = dps->dps_max_chunks ? dps->dps_max_chunks * 2 : 16;
+		chunks = realloc(dps->dps_chunks, max * sizeof(*chunks));
+		if (chunks == NULL)
+			return OCFS2_ET_NO_MEMORY;
+		dps->dps_chunks = chunks;
+
+		first = realloc(dps->dps_first, max * sizeof(*first));
+		if (first == NULL)
+			return OCFS2_ET_NO_MEMORY;
+		dps->dps_first = first;
+
+		dps->dps_max_chunks = max;
+	}
+
+	dpc = malloc(sizeof(*dpc));
+	if (dpc == NULL)
+		return OCFS2_ET_NO_MEMORY;
+	dpc->dpc_used = 0;
+
+	memmove(&dps->dps_chunks[c + 1], &dps->dps_chunks[c],
+		(dps->dps_nr_chunks - c) * sizeof(*dps->dps_chunks));
+	memmove(&dps->dps_first[c + 1], &dps->dps_first[c],
+		(dps->dps_nr_chunks - c) * sizeof(*dps->dps_first));
+	dps->dps_chunks[c] = dpc;
+	dps->dps_nr_chunks++;
+
+	return 0;
+}
+
+static void dp_remove_chunk(struct o2fsck_dir_parents *dps, unsigned int c)
+{
+	free(dps->dps_chunks[c]);
+
+	dps->dps_nr_chunks--;
+	memmove(&dps->dps_chunks[c], &dps->dps_chunks[c + 1],
+		(dps->dps_nr_chunks - c) * sizeof(*dps->dps_chunks));
+	memmove(&dps->dps_first[c], &dps->dps_first[c + 1],
+		(dps->dps_nr_chunks - c) * sizeof(*dps->dps_first));
+}
+
 /* XXX callers are supposed to make sure they don't call with dup inodes.
  * we'll see. */
-errcode_t o2fsck_add_dir_parent(struct rb_root *root,
+errcode_t o2fsck_add_dir_parent(struct o2fsck_dir_parents *dps,
 				uint64_t ino,
 				uint64_t dot_dot,
 				uint64_t dirent,
 				unsigned in_orphan_dir)
 {
-	struct rb_node ** p = &root->rb_node;
-	struct rb_node * parent = NULL;
-	o2fsck_dir_parent *dp, *tmp_dp;
-	errcode_t ret = 0;
-
-	dp = calloc(1, sizeof(*dp));
-	if (dp == NULL) {
-		ret = OCFS2_ET_NO_MEMORY;
-		goto out;
+	struct o2fsck_dir_parent_chunk *dpc, *next;
+	o2fsck_dir_parent *dp;
+	unsigned int c = 0, pos = 0, half;
+	errcode_t ret;
+
+	if (!dps->dps_nr_chunks) {
+		ret = dp_insert_chunk(dps, 0);
+		if (ret)
+			return ret;
 	}
 
+	c = dp_find_chunk(dps, ino);
+	dpc = dps->dps_chunks[c];
+	pos = dp_find_rec(dpc, ino);
+
+	if ((pos < dpc->dpc_used) && (dpc->dpc_recs[pos].dp_ino == ino))
+		return OCFS2_ET_INTERNAL_FAILURE;
+
+	if (dpc->dpc_used == O2FSCK_DIR_PARENT_CHUNK) {
+		ret = dp_insert_chunk(dps, c + 1);
+		if (ret)
+			return ret;
+		next = dps->dps_chunks[c + 1];
+
+		/* Appending starts a fresh chunk; anything else splits */
+		half = O2FSCK_DIR_PARENT_CHUNK;
+		if (pos < O2FSCK_DIR_PARENT_CHUNK)
+			half = O2FSCK_DIR_PARENT_CHUNK / 2;
+
+		next->dpc_used = O2FSCK_DIR_PARENT_CHUNK - half;
+		memcpy(next->dpc_recs, &dpc->dpc_recs[half],
+		       next->dpc_used * sizeof(o2fsck_dir_parent));
+		dpc->dpc_used = half;
+		if (next->dpc_used)
+			dps->dps_first[c + 1] = next->dpc_recs[0].dp_ino;
+
+		if (pos >= half) {
+			pos -= half;
+			dpc = next;
+			c++;
+		}
+	}
+
+	memmove(&dpc->dpc_recs[pos + 1], &dpc->dpc_recs[pos],
+		(dpc->dpc_used - pos) * sizeof(o2fsck_dir_parent));
+	dpc->dpc_used++;
+
+	dp = &dpc->dpc_recs[pos];
+	memset(dp, 0, sizeof(*dp));
 	dp->dp_ino = ino;
 	dp->dp_dot_dot = dot_dot;
 	dp->dp_dirent = dirent;
@@ -62,92 +195,76 @@ errcode_t o2fsck_add_dir_parent(struct rb_root *root,
 	dp->dp_loop_no = 0;
 	dp->dp_in_orphan_dir = in_orphan_dir ? 1 : 0;
 
-	while (*p)
-	{
-		parent = *p;
-		tmp_dp = rb_entry(parent, o2fsck_dir_parent, dp_node);
-
-		if (dp->dp_ino < tmp_dp->dp_ino)
-			p = &(*p)->rb_left;
-		else if (dp->dp_ino > tmp_dp->dp_ino)
-			p = &(*p)->rb_right;
-		else {
-			ret = OCFS2_ET_INTERNAL_FAILURE;
-			goto out;
-		}
-	}
-
-	rb_link_node(&dp->dp_node, parent, p);
-	rb_insert_color(&dp->dp_node, root);
-out:
-	if (ret && dp)
-		free(dp);
+	if (!pos)
+		dps->dps_first[c] = ino;
 
-	return ret;
+	return 0;
 }
 
-o2fsck_dir_parent *o2fsck_dir_parent_lookup(struct rb_root *root, uint64_t ino)
+o2fsck_dir_parent *o2fsck_dir_parent_lookup(struct o2fsck_dir_parents *dps,
+					    uint64_t ino)
 {
-	struct rb_node *node = root->rb_node;
-	o2fsck_dir_parent *dp;
+	struct o2fsck_dir_parent_chunk *dpc;
+	unsigned int pos;
 
-	while (node) {
-		dp = rb_entry(node, o2fsck_dir_parent, dp_node);
+	if (!dps->dps_nr_chunks)
+		return NULL;
+
+	dpc = dps->dps_chunks[dp_find_chunk(dps, ino)];
+	pos = dp_find_rec(dpc, ino);
+	if ((pos < dpc->dpc_used) && (dpc->dpc_recs[pos].dp_ino == ino))
+		return &dpc->dpc_recs[pos];
 
-		if (ino < dp->dp_ino)
-			node = node->rb_left;
-		else if (ino > dp->dp_ino)
-			node = node->rb_right;
-		else
-			return dp;
-	}
 	return NULL;
 }
 
-o2fsck_dir_parent *o2fsck_dir_parent_first(struct rb_root *root)
+o2fsck_dir_parent *o2fsck_dir_parent_first(struct o2fsck_dir_parents *dps)
 {
-	struct rb_node *node = rb_first(root);
-	o2fsck_dir_parent *dp = NULL;
+	if (!dps->dps_nr_chunks)
+		return NULL;
 
-	if (node)
-		dp = rb_entry(node, o2fsck_dir_parent, dp_node);
-
-	return dp;
+	return &dps->dps_chunks[0]->dpc_recs[0];
 }
 
-o2fsck_dir_parent *o2fsck_dir_parent_next(o2fsck_dir_parent *from)
+o2fsck_dir_parent *o2fsck_dir_parent_next(struct o2fsck_dir_parents *dps,
+					  o2fsck_dir_parent *from)
 {
-	struct rb_node *node = rb_next(&from->dp_node);
-	o2fsck_dir_parent *dp = NULL;
+	unsigned int c = dp_find_chunk(dps, from->dp_ino);
+	struct o2fsck_dir_parent_chunk *dpc = dps->dps_chunks[c];
+	unsigned int pos = from - dpc->dpc_recs;
 
-	if (node)
-		dp = rb_entry(node, o2fsck_dir_parent, dp_node);
+	if (pos + 1 < dpc->dpc_used)
+		return &dpc->dpc_recs[pos + 1];
+	if (c + 1 < dps->dps_nr_chunks)
+		return &dps->dps_chunks[c + 1]->dpc_recs[0];
 
-	return dp;
+	return NULL;
 }
 
-void ocfsck_remove_dir_parent(struct rb_root *root, uint64_t ino)
+void ocfsck_remove_dir_parent(struct o2fsck_dir_parents *dps, uint64_t ino)
 {
-	o2fsck_dir_parent *dp = NULL;
-	struct rb_node *p = root->rb_node;
+	struct o2fsck_dir_parent_chunk *dpc;
+	unsigned int c, pos;
 
-	while (p)
-	{
-		dp = rb_entry(p, o2fsck_dir_parent, dp_node);
+	if (!dps->dps_nr_chunks)
+		goto out;
 
-		if (dp->dp_ino > ino)
-			p = p->rb_left;
-		else if (dp->dp_ino < ino)
-			p = p->rb_right;
-		else
-			break;
-	}
+	c = dp_find_chunk(dps, ino);
+	dpc = dps->dps_chunks[c];
+	pos = dp_find_rec(dpc, ino);
+	if ((pos == dpc->dpc_used) || (dpc->dpc_recs[pos].dp_ino != ino))
+		goto out;
 
-	if(!p)
+	dpc->dpc_used--;
+	if (!dpc->dpc_used) {
+		dp_remove_chunk(dps, c);
 		goto out;
+	}
 
-	rb_erase(&dp->dp_node, root);
-	free(dp);
+	memmove(&dpc->dpc_recs[pos], &dpc->dpc_recs[pos + 1],
+		(dpc->dpc_used - pos) * sizeof(o2fsck_dir_parent));
+	if (!pos)
+		dps->dps_first[c] = dpc->dpc_recs[0].dp_ino;
 out:
 	return;
 }
@@ -71,6 +71,7 @@
 #include "problem.h"
 #include "util.h"
 #include "slot_recovery.h"
+#include "triage.h"
 
 int verbose = 0;
 
@@ -135,8 +136,11 @@ static void print_usage(void)
 		" -b superblock	Treat given block as the super block\n"
 		" -B blocksize	Force the given block size\n"
 		" -G		Ask to fix mismatched inode generations\n"
+		" -H backing	Back the I/O cache with hugetlb, thp, interleave, local\n"
 		" -P		Show progress\n"
 		" -t		Show I/O statistics\n"
+		" -T samples	Sample the volume read-only and report whether\n"
+		"		a forced check is needed\n"
 		" -tt		Show I/O statistics per pass\n"
 		" -u		Access the device with buffering\n"
 		" -V		Output fsck.ocfs2's version\n"
@@ -280,6 +284,11 @@ static errcode_t write_out_superblock(o2fsck_state *ost)
 		sb->s_feature_incompat &=
 				 ~OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG;
 		sb->s_tunefs_flag = 0;
+		sb->s_tunefs_cursor = 0;
+		sb->s_tunefs_cursor_inodes = 0;
+		memset(sb->s_tunefs_cursor_passes, 0,
+		       sizeof(sb->s_tunefs_cursor_passes));
+		sb->s_tunefs_csize_record = 0;
 	}
 
 	if (ost->ost_num_clusters)
@@ -773,6 +782,8 @@ int main(int argc, char **argv)
 	int sb_num = 0;
 	int fsck_mask = FSCK_OK;
 	int slot_recover_err = 0;
+	uint64_t triage_samples = 0;
+	int full_check;
 	errcode_t ret;
 	int mount_flags;
 	int proceed = 1;
@@ -780,7 +791,6 @@ int main(int argc, char **argv)
 	memset(ost, 0, sizeof(o2fsck_state));
 	ost->ost_ask = 1;
 	ost->ost_dirblocks.db_root = RB_ROOT;
-	ost->ost_dir_parents = RB_ROOT;
 	ost->ost_refcount_trees = RB_ROOT;
 
 	/* These mean "autodetect" */
@@ -795,7 +805,7 @@ int main(int argc, char **argv)
 
 	tools_progress_disable();
 
-	while ((c = getopt(argc, argv, "b:B:DfFGnupavVytPr:")) != EOF) {
+	while ((c = getopt(argc, argv, "b:B:DfFGH:nupavVytT:Pr:")) != EOF) {
 		switch (c) {
 			case 'b':
 				blkno = read_number(optarg);
@@ -824,6 +834,19 @@ int main(int argc, char **argv)
 				ost->ost_compress_dirs = 1;
 				break;
 
+			case 'H':
+				ret = io_parse_cache_backing(optarg,
+						&ost->ost_cache_backing);
+				if (ret) {
+					fprintf(stderr,
+						"Invalid cache backing: %s\n",
+						optarg);
+					fsck_mask |= FSCK_USAGE;
+					print_usage();
+					goto out;
+				}
+				break;
+
 			case 'F':
 				ost->ost_skip_o2cb = 1;
 				break;
@@ -888,6 +911,18 @@ int main(int argc, char **argv)
 				ost->ost_show_stats = 1;
 				break;
 
+			case 'T':
+				triage_samples = read_number(optarg);
+				if (!triage_samples) {
+					fprintf(stderr,
+						"Invalid sample count: %s\n",
+						optarg);
+					fsck_mask |= FSCK_USAGE;
+					print_usage();
+					goto out;
+				}
+				break;
+
 			default:
 				fsck_mask |= FSCK_USAGE;
 				print_usage();
@@ -896,6 +931,22 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (triage_samples) {
+		if (ost->ost_compress_dirs || sb_num) {
+			fprintf(stderr, "Triage (-T) is read-only and can't be "
+				"combined with -D or -r\n");
+			fsck_mask |= FSCK_USAGE;
+			print_usage();
+			goto out;
+		}
+
+		/* Same as -n */
+		open_flags &= ~OCFS2_FLAG_RW;
+		open_flags |= OCFS2_FLAG_RO;
+		ost->ost_ask = 0;
+		ost->ost_answer = 0;
+	}
+
 	if (!(open_flags & OCFS2_FLAG_RW) && ost->ost_compress_dirs) {
 		fprintf(stderr, "Compress directories (-D) incompatible with read-only mode\n");
 		fsck_mask |= FSCK_USAGE;
@@ -988,6 +1039,22 @@ int main(int argc, char **argv)
 		goto out;
 	}
 
+	/*
+	 * A volume caught between two cluster sizes is neither.  Only
+	 * tunefs.ocfs2 knows how far it got.
+	 */
+	if ((OCFS2_RAW_SB(ost->ost_fs->fs_super)->s_feature_incompat &
+	     OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG) &&
+	    (OCFS2_RAW_SB(ost->ost_fs->fs_super)->s_tunefs_flag &
+	     OCFS2_TUNEFS_INPROG_CLUSTER_SIZE)) {
+		printf("tunefs.ocfs2 was interrupted while changing the "
+		       "cluster size of \"%s\".  Run \"tunefs.ocfs2 "
+		       "--cluster-size\" with the same size to finish it, "
+		       "then check the volume.\n", filename);
+		fsck_mask |= FSCK_ERROR;
+		goto close;
+	}
+
 	if (open_flags & OCFS2_FLAG_RW && !ost->ost_skip_o2cb &&
 	    !ocfs2_mount_local(ost->ost_fs)) {
 		ret = fsck_lock_fs(ost);
@@ -1049,6 +1116,16 @@ int main(int argc, char **argv)
 		ost->ost_force = 1;
 	}
 
+	if (triage_samples) {
+		mark_magical_clusters(ost);
+		ret = o2fsck_triage(ost, triage_samples, &full_check);
+		if (ret)
+			fsck_mask |= FSCK_ERROR;
+		else
+			fsck_mask = full_check ? FSCK_UNCORRECTED : FSCK_OK;
+		goto unlock;
+	}
+
 	if (fs_is_clean(ost, filename)) {
 		fsck_mask = FSCK_OK;
 		goto clear_dirty_flag;
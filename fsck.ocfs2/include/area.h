@@ -0,0 +1,45 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * area.h
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __O2FSCK_AREA_H__
+#define __O2FSCK_AREA_H__
+
+#include "ocfs2/ocfs2.h"
+
+#define O2FSCK_AREA_MAX_SIZE	OCFS2_MAX_BLOCKSIZE
+
+/*
+ * A byte map of the claimed regions of a block-sized object, such as
+ * an xattr bucket or a directory block.  It is small enough to live
+ * on the stack, so checking n structures costs no allocations.
+ */
+struct o2fsck_area_map {
+	unsigned int	am_size;
+	unsigned char	am_bits[O2FSCK_AREA_MAX_SIZE / 8];
+};
+
+void o2fsck_area_init(struct o2fsck_area_map *am, unsigned int size);
+int o2fsck_area_fits(struct o2fsck_area_map *am, unsigned int off,
+		     unsigned int len);
+void o2fsck_area_set(struct o2fsck_area_map *am, unsigned int off,
+		     unsigned int len);
+void o2fsck_area_clear(struct o2fsck_area_map *am, unsigned int off,
+		       unsigned int len);
+unsigned int o2fsck_area_free_len(struct o2fsck_area_map *am,
+				  unsigned int off);
+
+#endif /* __O2FSCK_AREA_H__ */
@@ -24,10 +24,7 @@
 #ifndef __O2FSCK_DIRPARENTS_H__
 #define __O2FSCK_DIRPARENTS_H__
 
-#include "ocfs2/kernel-rbtree.h"
-
 typedef struct _o2fsck_dir_parent {
-	struct rb_node	dp_node;
 	uint64_t 	dp_ino; /* The dir inode in question. */
 
 	uint64_t 	dp_dot_dot; /* The parent according to the dir's own 
@@ -43,17 +40,32 @@ typedef struct _o2fsck_dir_parent {
 			dp_in_orphan_dir:1;
 } o2fsck_dir_parent;
 
-errcode_t o2fsck_add_dir_parent(struct rb_root *root,
+struct o2fsck_dir_parent_chunk;
+
+/*
+ * The dir_parent records are kept sorted by inode in fixed size
+ * chunks.  dps_first[i] is the first inode in dps_chunks[i], so a
+ * lookup only touches the one chunk it lands in.  A record pointer is
+ * good until the next add or remove.
+ */
+struct o2fsck_dir_parents {
+	struct o2fsck_dir_parent_chunk	**dps_chunks;
+	uint64_t			*dps_first;
+	unsigned int			dps_nr_chunks;
+	unsigned int			dps_max_chunks;
+};
+
+errcode_t o2fsck_add_dir_parent(struct o2fsck_dir_parents *dps,
 				uint64_t ino,
 				uint64_t dot_dot,
 				uint64_t dirent,
 				unsigned in_orphan_dir);
 
-o2fsck_dir_parent *o2fsck_dir_parent_lookup(struct rb_root *root, 
-						uint64_t ino);
-o2fsck_dir_parent *o2fsck_dir_parent_first(struct rb_root *root);
-o2fsck_dir_parent *o2fsck_dir_parent_next(o2fsck_dir_parent *from);
+o2fsck_dir_parent *o2fsck_dir_parent_lookup(struct o2fsck_dir_parents *dps,
+					    uint64_t ino);
+o2fsck_dir_parent *o2fsck_dir_parent_first(struct o2fsck_dir_parents *dps);
+o2fsck_dir_parent *o2fsck_dir_parent_next(struct o2fsck_dir_parents *dps,
+					  o2fsck_dir_parent *from);
 
-void ocfsck_remove_dir_parent(struct rb_root *root, uint64_t ino);
+void ocfsck_remove_dir_parent(struct o2fsck_dir_parents *dps, uint64_t ino);
 #endif /* __O2FSCK_DIRPARENTS_H__ */
-
@@ -28,6 +28,7 @@
 
 #include "icount.h"
 #include "dirblocks.h"
+#include "dirparents.h"
 #include "tools-internal/progress.h"
 
 struct refcount_file;
@@ -70,7 +71,7 @@ typedef struct _o2fsck_state {
 
 	uint32_t	ost_num_clusters;
 
-	struct rb_root	ost_dir_parents;
+	struct o2fsck_dir_parents ost_dir_parents;
 
 	struct rb_root	ost_refcount_trees;
 	struct refcount_file *ost_latest_file;
@@ -95,6 +96,8 @@ typedef struct _o2fsck_state {
 			ost_show_stats:1,
 			ost_show_extended_stats:1;
 	errcode_t ost_err;
+	int		ost_cache_backing;	/* -H: IO_CACHE_* wanted */
+	uint32_t	ost_problem_count;	/* prompts asked so far */
 
 	struct o2fsck_resource_track	ost_rt;
 	struct tools_progress		*ost_prog;
@@ -27,6 +27,8 @@
 #include "fsck.h"
 
 errcode_t o2fsck_pass1(o2fsck_state *ost);
+errcode_t o2fsck_pass1_check_inode(o2fsck_state *ost, uint64_t blkno,
+				   struct ocfs2_dinode *di);
 void o2fsck_free_inode_allocs(o2fsck_state *ost);
 
 #endif /* __O2FSCK_PASS1_H__ */
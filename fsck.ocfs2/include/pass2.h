@@ -28,6 +28,7 @@
 
 errcode_t o2fsck_pass2(o2fsck_state *ost);
 int o2fsck_test_inode_allocated(o2fsck_state *ost, uint64_t blkno);
+int o2fsck_corrupt_dirent_lengths(struct ocfs2_dir_entry *dirent, int left);
 
 #endif /* __O2FSCK_PASS2_H__ */
 
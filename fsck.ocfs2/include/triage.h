@@ -0,0 +1,26 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * triage.h
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#ifndef __O2FSCK_TRIAGE_H__
+#define __O2FSCK_TRIAGE_H__
+
+#include "fsck.h"
+
+errcode_t o2fsck_triage(o2fsck_state *ost, uint64_t samples,
+			int *full_check);
+
+#endif /* __O2FSCK_TRIAGE_H__ */
@@ -954,7 +954,7 @@ static errcode_t o2fsck_check_blocks(ocfs2_filesys *fs, o2fsck_state *ost,
 		di->i_flags &= ~OCFS2_VALID_FL;
 		o2fsck_write_inode(ost, di->i_blkno, di);
 		/* for a directory, we also need to clear it 
-		 * from the dir_parent rb-tree. */
+		 * from the dir_parent table. */
 		if (S_ISDIR(di->i_mode))
 			ocfsck_remove_dir_parent(&ost->ost_dir_parents,
 						 di->i_blkno);
@@ -1091,6 +1091,29 @@ out:
 	return ret;
 }
 
+/*
+ * The checks pass 1 makes of a single inode that has already been
+ * swapped to cpu order.  Triage runs them on the inodes it samples.
+ */
+errcode_t o2fsck_pass1_check_inode(o2fsck_state *ost, uint64_t blkno,
+				   struct ocfs2_dinode *di)
+{
+	errcode_t ret = 0;
+
+	if (di->i_flags & OCFS2_VALID_FL)
+		o2fsck_verify_inode_fields(ost->ost_fs, ost, blkno, di);
+	if (!(di->i_flags & OCFS2_VALID_FL))
+		goto out;
+
+	ret = o2fsck_check_refcount_tree(ost, di);
+	if (!ret)
+		ret = o2fsck_check_blocks(ost->ost_fs, ost, blkno, di);
+	if (!ret)
+		ret = o2fsck_check_xattr(ost, di);
+out:
+	return ret;
+}
+
 /* 
  * we just make sure that the bits that are clear in the local
  * alloc are still reserved in the global bitmap.  We leave
@@ -1515,22 +1538,9 @@ errcode_t o2fsck_pass1(o2fsck_state *ost)
 			if ((ost->ost_fix_fs_gen ||
 			    (di->i_fs_generation == ost->ost_fs_generation))) {
 
-				if (di->i_flags & OCFS2_VALID_FL)
-					o2fsck_verify_inode_fields(fs, ost,
-								   blkno, di);
-				if (di->i_flags & OCFS2_VALID_FL) {
-					ret = o2fsck_check_refcount_tree(ost,
-									 di);
-					if (ret)
-						goto out;
-					ret = o2fsck_check_blocks(fs, ost,
-								  blkno, di);
-					if (ret)
-						goto out;
-					ret = o2fsck_check_xattr(ost, di);
-					if (ret)
-						goto out;
-				}
+				ret = o2fsck_pass1_check_inode(ost, blkno, di);
+				if (ret)
+					goto out;
 
 				valid = di->i_flags & OCFS2_VALID_FL;
 			}
@@ -111,6 +111,17 @@ struct dup_inode {
 
 	/* the refcount tree it has. */
 	uint64_t	di_refcount_loc;
+
+	/*
+	 * Clusters we've agreed to refcount but haven't written yet.
+	 * Runs that are contiguous both logically and physically are
+	 * collected here so that each run costs one extent flag change
+	 * and one refcount change.  See o2fsck_flush_refcount().
+	 */
+	struct list_head	di_pending_list;
+	uint32_t		di_pending_cpos;
+	uint32_t		di_pending_cluster;
+	uint32_t		di_pending_len;
 };
 
 /*
@@ -153,6 +164,9 @@ struct dup_context {
 	struct rb_root	dup_inodes;
 	/* How many there are */
 	uint64_t	dup_inode_count;
+
+	/* Inodes with a pending refcount run */
+	struct list_head	dup_pending;
 };
 
 /* See if the cluster rbtree has the given cluster.  */
@@ -275,6 +289,7 @@ static errcode_t dup_insert(struct dup_context *dct, uint32_t cluster,
 			"structures");
 		goto out;
 	}
+	INIT_LIST_HEAD(&new_di->di_pending_list);
 	new_di->di_ino = dinode->i_blkno;
 	new_di->di_flags = dinode->i_flags;
 	new_di->di_refcount_loc = dinode->i_refcount_loc;
@@ -821,28 +836,10 @@ out:
  * Pass 1C
  */
 
-struct dir_to_scan {
-	struct list_head ts_list;
-	uint64_t ts_ino;
-	char *ts_path;
-};
-
-struct dir_scan_context {
-	o2fsck_state *ds_ost;
-	struct dup_context *ds_dct;
-
-	/* Inodes we still have to find */
-	int64_t ds_inodes_left;
-
-	/* Subdirs that are pending */
-	struct list_head ds_paths;
-
-	/* The cwd's path and ino */
-	uint64_t ds_ino;
-	char *ds_cwd;
-	int ds_cwdlen;
-};
-
+/*
+ * The names are found by reading every directory block in disk order
+ * and putting the paths together in memory.  See libocfs2/dir_revmap.c.
+ */
 static void pass1c_warn(errcode_t ret)
 {
 	static int warned = 0;
@@ -857,163 +854,58 @@ static void pass1c_warn(errcode_t ret)
 		"inode number instead of name.");
 }
 
-static char *de_to_path(struct dir_scan_context *scan,
-			struct ocfs2_dir_entry *de)
-{
-	/* The 2 is for the path separator and the null */
-	int copied, pathlen = scan->ds_cwdlen + de->name_len + 2;
-	char *path = NULL;
-	/* We start with an empty cwd as we add '/' or '//' */
-	const char *cwdstr = scan->ds_cwdlen ? scan->ds_cwd : "";
-	const char *sep = "/";
-
-	/* Don't repeat '/' */
-	if (scan->ds_cwdlen &&
-	    (scan->ds_cwd[scan->ds_cwdlen - 1] == '/'))
-		sep = "";
-	if (de->name_len && (de->name[0] == '/'))
-		sep = "";
-
-	if (!ocfs2_malloc0(sizeof(char) * pathlen, &path)) {
-		copied = snprintf(path, pathlen, "%s%s%.*s",
-				  cwdstr, sep, de->name_len, de->name);
-		assert(copied < pathlen);
-	}
-
-	return path;
-}
-
-static void push_dir(struct dir_scan_context *scan,
-		     struct ocfs2_dir_entry *de)
-{
-	errcode_t ret;
-	struct dir_to_scan *ts = NULL;
-
-	ret = ocfs2_malloc0(sizeof(struct dir_to_scan), &ts);
-	if (ret)
-		goto warn;
-
-	ts->ts_ino = de->inode;
-	ts->ts_path = de_to_path(scan, de);
-	if (!ts->ts_path) {
-		ret = OCFS2_ET_NO_MEMORY;
-		goto warn;
-	}
-
-	list_add(&ts->ts_list, &scan->ds_paths);
-	return;
-
-warn:
-	if (ts)
-		ocfs2_free(&ts);
-	pass1c_warn(ret);
-}
-
-static void set_next_cwd(struct dir_scan_context *scan)
+static int pass1c_want(uint64_t ino, void *priv_data)
 {
-	struct dir_to_scan *ts;
-
-	if (scan->ds_cwd)
-		ocfs2_free(&scan->ds_cwd);
-
-	ts = list_entry(scan->ds_paths.next, struct dir_to_scan, ts_list);
-	list_del(&ts->ts_list);
+	struct dup_context *dct = priv_data;
 
-	/* Steal the string from ts */
-	scan->ds_cwd = ts->ts_path;
-	scan->ds_cwdlen = strlen(scan->ds_cwd);
-	scan->ds_ino = ts->ts_ino;
-
-	ocfs2_free(&ts);
+	return dup_inode_lookup(dct, ino) != NULL;
 }
 
-static void name_inode(struct dir_scan_context *scan,
-		       struct ocfs2_dir_entry *de)
+static int name_inode(uint64_t ino, const char *path, int file_type,
+		      void *priv_data)
 {
-	struct dup_inode *di = dup_inode_lookup(scan->ds_dct, de->inode);
-
-	if (!di || di->di_path)
-		return;
-
-	scan->ds_inodes_left--;
+	struct dup_inode *di = priv_data;
 
-	di->di_path = de_to_path(scan, de);
-	if (!di->di_path)
+	if (ocfs2_malloc0(strlen(path) + 1, &di->di_path)) {
 		pass1c_warn(OCFS2_ET_NO_MEMORY);
-}
-
-static int walk_iterate(struct ocfs2_dir_entry *de, uint64_t blocknr,
-			int offset, int blocksize, char *buf, void *priv_data)
-{
-	struct dir_scan_context *scan = priv_data;
+		return 1;
+	}
 
-	/* Directories are checked when they're traversed */
-	if (de->file_type == OCFS2_FT_DIR)
-		push_dir(scan, de);
-	else
-		name_inode(scan, de);
+	strcpy(di->di_path, path);
 
-	return scan->ds_inodes_left ? 0 : OCFS2_DIRENT_ABORT;
+	/* One name is enough */
+	return 1;
 }
 
-static void walk_cwd(struct dir_scan_context *scan)
+static void o2fsck_pass1c(o2fsck_state *ost, struct dup_context *dct)
 {
 	errcode_t ret;
-	struct ocfs2_dir_entry *de;
-	int len = sizeof(struct ocfs2_dir_entry);
+	struct rb_node *node;
+	struct dup_inode *di;
+	ocfs2_dir_revmap *map = NULL;
 
-	if (scan->ds_cwdlen > OCFS2_MAX_FILENAME_LEN)
-		len = sizeof(struct ocfs2_dir_entry) + scan->ds_cwdlen
-			- OCFS2_MAX_FILENAME_LEN;
+	whoami = "pass1c";
+	printf("Pass 1c: Determining the names of inodes owning "
+	       "multiply-claimed clusters\n");
 
-	ret = ocfs2_malloc(len, &de);
+	ret = ocfs2_dir_revmap_build(ost->ost_fs, pass1c_want, dct, &map);
 	if (ret) {
 		pass1c_warn(ret);
 		return;
 	}
 
-	memcpy(de->name, scan->ds_cwd, scan->ds_cwdlen);
-	de->name_len = scan->ds_cwdlen;
-	name_inode(scan, de);
-	free(de);
- 
-	ret = ocfs2_dir_iterate(scan->ds_ost->ost_fs, scan->ds_ino,
-				OCFS2_DIRENT_FLAG_EXCLUDE_DOTS, NULL,
-				walk_iterate, scan);
-	if (ret)
-		pass1c_warn(ret);
-}
-
-static void o2fsck_pass1c(o2fsck_state *ost, struct dup_context *dct)
-{
-	struct dir_scan_context scan = {
-		.ds_ost = ost,
-		.ds_dct = dct,
-		.ds_inodes_left = dct->dup_inode_count,
-	};
-
-	whoami = "pass1c";
-	printf("Pass 1c: Determining the names of inodes owning "
-	       "multiply-claimed clusters\n");
+	for (node = rb_first(&dct->dup_inodes); node; node = rb_next(node)) {
+		di = rb_entry(node, struct dup_inode, di_node);
+		if (di->di_path)
+			continue;
 
-	INIT_LIST_HEAD(&scan.ds_paths);
-	push_dir(&scan, &(struct ocfs2_dir_entry){
-		 .name = "/",
-		 .name_len = 1,
-		 .file_type = OCFS2_FT_DIR,
-		 .inode = ost->ost_fs->fs_root_blkno,
-		 });
-	push_dir(&scan, &(struct ocfs2_dir_entry){
-		 .name = "//",
-		 .name_len = 2,
-		 .file_type = OCFS2_FT_DIR,
-		 .inode = ost->ost_fs->fs_sysdir_blkno,
-		 });
-
-	while (scan.ds_inodes_left && !list_empty(&scan.ds_paths)) {
-		set_next_cwd(&scan);
-		walk_cwd(&scan);
+		ret = ocfs2_dir_revmap_iterate(map, di->di_ino, name_inode,
+					       di);
+		if (ret)
+			pass1c_warn(ret);
 	}
+
+	ocfs2_dir_revmap_free(map);
 }
 
 
@@ -1137,8 +1029,15 @@ static errcode_t new_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 	uint64_t clone_blkno = 0;
 	uint64_t bytes = orig_ci->ci_inode->i_size;
 	uint32_t clusters = ocfs2_clusters_in_bytes(fs, bytes);
-
-	ret = ocfs2_new_inode(fs, &clone_blkno, orig_ci->ci_inode->i_mode);
+	int slot;
+
+	/* The clone replaces the original, so keep it beside it */
+	slot = orig_ci->ci_inode->i_suballoc_slot;
+	if (slot >= OCFS2_RAW_SB(fs->fs_super)->s_max_slots)
+		slot = 0;
+	ret = ocfs2_new_inode_in_slot(fs, &clone_blkno,
+				      orig_ci->ci_inode->i_mode, slot,
+				      orig_ci->ci_blkno);
 	if (ret) {
 		com_err(whoami, ret, "while allocating a clone inode");
 		return ret;
@@ -1185,8 +1084,9 @@ out:
 	return ret;
 }
 
-static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
-			    ocfs2_cached_inode *clone_ci)
+static errcode_t copy_clone_buffered(ocfs2_filesys *fs,
+				     ocfs2_cached_inode *orig_ci,
+				     ocfs2_cached_inode *clone_ci)
 {
 	char *buf;
 	errcode_t ret;
@@ -1194,6 +1094,7 @@ static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 	uint64_t filesize = orig_ci->ci_inode->i_size;
 	unsigned int iosize = 1024 * 1024;  /* Let's read in 1MB hunks */
 	unsigned int got, wrote, write_len;
+	ocfs2_write_session *ws;
 
 	ret = ocfs2_malloc_blocks(fs->fs_io, iosize / fs->fs_blocksize,
 				  &buf);
@@ -1202,6 +1103,13 @@ static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 		return ret;
 	}
 
+	ret = ocfs2_write_session_begin(clone_ci, &ws);
+	if (ret) {
+		com_err(whoami, ret, "while starting to write clone data");
+		ocfs2_free(&buf);
+		return ret;
+	}
+
 	while (offset < filesize) {
 		ret = ocfs2_file_read(orig_ci, buf, iosize, offset, &got);
 		if (ret) {
@@ -1210,8 +1118,8 @@ static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 		}
 
 		write_len = ocfs2_align_bytes_to_blocks(fs, got);
-		ret = ocfs2_file_write(clone_ci, buf, write_len,
-				       offset, &wrote);
+		ret = ocfs2_write_session_write(ws, buf, write_len,
+						offset, &wrote);
 		if (ret) {
 			com_err(whoami, ret, "while writing clone data");
 			break;
@@ -1220,10 +1128,266 @@ static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 		offset += wrote;
 	}
 
+	if (!ret) {
+		ret = ocfs2_write_session_flush(ws);
+		if (ret)
+			com_err(whoami, ret, "while writing clone data");
+	}
+
+	ocfs2_write_session_free(ws);
 	ocfs2_free(&buf);
 	return ret;
 }
 
+/*
+ * new_clone() has already allocated every cluster of the clone, so we
+ * don't need ocfs2_file_write() to map and allocate block by block.
+ * Instead we walk the clone's extents and fill each one from the
+ * original in large hunks, bypassing the I/O cache.  Hunks that are
+ * entirely holes in the original are left unwritten.  The unwritten
+ * extents we did fill are remembered and marked written at the end,
+ * so the clone's extent tree is only modified once the data is down.
+ */
+#define CLONE_IO_BYTES	(8 * 1024 * 1024)
+
+struct clone_written {
+	uint32_t cw_cpos;
+	uint32_t cw_clusters;
+	uint64_t cw_blkno;
+};
+
+struct clone_copy {
+	ocfs2_filesys *cc_fs;
+	ocfs2_cached_inode *cc_orig;
+	ocfs2_cached_inode *cc_clone;
+	char *cc_buf;
+	uint64_t cc_buf_blocks;
+	uint64_t cc_size_blocks;	/* Blocks covered by i_size */
+	struct clone_written *cc_written;
+	int cc_nr_written;
+	int cc_max_written;
+};
+
+/*
+ * Fill cc_buf with the original's data for count blocks at v_blkno.
+ * Holes, unwritten extents, and blocks past i_size read as zeros.
+ * *has_data is set if anything came off the disk.
+ */
+static errcode_t clone_gather(struct clone_copy *cc, uint64_t v_blkno,
+			      uint64_t count, int *has_data)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = cc->cc_fs;
+	char *ptr = cc->cc_buf;
+	uint64_t p_blkno, contig;
+	uint16_t extent_flags;
+
+	*has_data = 0;
+	while (count) {
+		if (v_blkno >= cc->cc_size_blocks) {
+			memset(ptr, 0, count * fs->fs_blocksize);
+			break;
+		}
+
+		ret = ocfs2_extent_map_get_blocks(cc->cc_orig, v_blkno, 1,
+						  &p_blkno, &contig,
+						  &extent_flags);
+		if (ret) {
+			com_err(whoami, ret,
+				"while mapping block %"PRIu64" of inode "
+				"%"PRIu64, v_blkno, cc->cc_orig->ci_blkno);
+			break;
+		}
+
+		if (!contig || contig > count)
+			contig = count;
+		if (contig > cc->cc_size_blocks - v_blkno)
+			contig = cc->cc_size_blocks - v_blkno;
+
+		if (!p_blkno || (extent_flags & OCFS2_EXT_UNWRITTEN))
+			memset(ptr, 0, contig * fs->fs_blocksize);
+		else {
+			ret = io_read_block_nocache(fs->fs_io, p_blkno,
+						    contig, ptr);
+			if (ret) {
+				com_err(whoami, ret,
+					"while reading inode to clone");
+				break;
+			}
+			*has_data = 1;
+		}
+
+		ptr += contig * fs->fs_blocksize;
+		v_blkno += contig;
+		count -= contig;
+	}
+
+	return ret;
+}
+
+/* Remember a filled range of an unwritten clone extent */
+static errcode_t clone_note_written(struct clone_copy *cc, uint64_t v_blkno,
+				    uint64_t p_blkno, uint64_t blocks,
+				    int same_extent)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = cc->cc_fs;
+	uint32_t cpos = ocfs2_blocks_to_clusters(fs, v_blkno);
+	uint32_t clusters = ocfs2_clusters_in_blocks(fs, blocks);
+	struct clone_written *cw;
+
+	if (same_extent && cc->cc_nr_written) {
+		cw = &cc->cc_written[cc->cc_nr_written - 1];
+		if ((cw->cw_cpos + cw->cw_clusters) == cpos) {
+			cw->cw_clusters += clusters;
+			return 0;
+		}
+	}
+
+	if (cc->cc_nr_written == cc->cc_max_written) {
+		ret = ocfs2_realloc(sizeof(struct clone_written) *
+				    (cc->cc_max_written + 64),
+				    &cc->cc_written);
+		if (ret) {
+			com_err(whoami, ret,
+				"while allocating the clone extent list");
+			return ret;
+		}
+		cc->cc_max_written += 64;
+	}
+
+	cw = &cc->cc_written[cc->cc_nr_written++];
+	cw->cw_cpos = cpos;
+	cw->cw_clusters = clusters;
+	cw->cw_blkno = p_blkno;
+
+	return 0;
+}
+
+static errcode_t clone_fill_extents(struct clone_copy *cc)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = cc->cc_fs;
+	uint64_t v_blkno = 0, end, p_blkno, len, todo;
+	uint16_t extent_flags;
+	int unwritten, same_extent, has_data;
+
+	end = ocfs2_clusters_to_blocks(fs,
+			ocfs2_clusters_in_bytes(fs,
+					cc->cc_orig->ci_inode->i_size));
+
+	while (v_blkno < end) {
+		ret = ocfs2_extent_map_get_blocks(cc->cc_clone, v_blkno, 1,
+						  &p_blkno, &len,
+						  &extent_flags);
+		if (!ret && !p_blkno)
+			ret = OCFS2_ET_INTERNAL_FAILURE;
+		if (ret) {
+			com_err(whoami, ret,
+				"while mapping block %"PRIu64" of clone "
+				"inode %"PRIu64, v_blkno,
+				cc->cc_clone->ci_blkno);
+			break;
+		}
+
+		if (!len || len > end - v_blkno)
+			len = end - v_blkno;
+		unwritten = !!(extent_flags & OCFS2_EXT_UNWRITTEN);
+		same_extent = 0;
+
+		while (len) {
+			todo = len;
+			if (todo > cc->cc_buf_blocks)
+				todo = cc->cc_buf_blocks;
+
+			ret = clone_gather(cc, v_blkno, todo, &has_data);
+			if (ret)
+				goto out;
+
+			if (has_data || !unwritten) {
+				ret = io_write_block_nocache(fs->fs_io,
+							     p_blkno, todo,
+							     cc->cc_buf);
+				if (ret) {
+					com_err(whoami, ret,
+						"while writing clone data");
+					goto out;
+				}
+				if (unwritten) {
+					ret = clone_note_written(cc, v_blkno,
+								 p_blkno,
+								 todo,
+								 same_extent);
+					if (ret)
+						goto out;
+					same_extent = 1;
+				}
+			} else
+				same_extent = 0;
+
+			v_blkno += todo;
+			p_blkno += todo;
+			len -= todo;
+		}
+	}
+
+out:
+	return ret;
+}
+
+static errcode_t copy_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
+			    ocfs2_cached_inode *clone_ci)
+{
+	int i;
+	errcode_t ret;
+	struct clone_written *cw;
+	struct clone_copy cc = {
+		.cc_fs = fs,
+		.cc_orig = orig_ci,
+		.cc_clone = clone_ci,
+	};
+
+	if (orig_ci->ci_inode->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return copy_clone_buffered(fs, orig_ci, clone_ci);
+
+	/* Keep hunks cluster aligned so they map to whole clusters */
+	cc.cc_buf_blocks = ocfs2_clusters_to_blocks(fs,
+			ocfs2_clusters_in_bytes(fs, CLONE_IO_BYTES));
+	cc.cc_size_blocks = ocfs2_blocks_in_bytes(fs,
+						  orig_ci->ci_inode->i_size);
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, cc.cc_buf_blocks, &cc.cc_buf);
+	if (ret) {
+		com_err(whoami, ret, "while allocating clone buffer");
+		return ret;
+	}
+
+	ret = clone_fill_extents(&cc);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < cc.cc_nr_written; i++) {
+		cw = &cc.cc_written[i];
+		ret = ocfs2_mark_extent_written(fs, clone_ci->ci_inode,
+						cw->cw_cpos, cw->cw_clusters,
+						cw->cw_blkno);
+		if (!ret)
+			ret = ocfs2_refresh_cached_inode(fs, clone_ci);
+		if (ret) {
+			com_err(whoami, ret,
+				"while marking clone inode %"PRIu64" written",
+				clone_ci->ci_blkno);
+			break;
+		}
+	}
+
+out:
+	if (cc.cc_written)
+		ocfs2_free(&cc.cc_written);
+	ocfs2_free(&cc.cc_buf);
+	return ret;
+}
+
 static errcode_t swap_clone(ocfs2_filesys *fs, ocfs2_cached_inode *orig_ci,
 			    ocfs2_cached_inode *clone_ci)
 {
@@ -1350,9 +1514,17 @@ static errcode_t pass1d_free_clusters(ocfs2_filesys *fs, uint32_t len,
 
 static int delete_one_inode(struct fix_dup_context *fd, uint64_t ino)
 {
-	errcode_t ret;
+	errcode_t ret, tmp;
 	o2fsck_state *ost = fd->fd_ost;
 
+	/*
+	 * pass1d_free_clusters() frees one cluster at a time.  Write
+	 * the allocators once when we're done rather than per cluster.
+	 * We're over-freeing anyway, so a crash before the write is no
+	 * worse than a crash in the middle.
+	 */
+	ocfs2_defer_allocator_writes(ost->ost_fs);
+
 	verbosef("Truncating inode %"PRIu64"\n", ino);
 	ret = ocfs2_truncate_full(ost->ost_fs, ino, 0,
 				  pass1d_free_clusters, fd);
@@ -1371,6 +1543,14 @@ static int delete_one_inode(struct fix_dup_context *fd, uint64_t ino)
 		o2fsck_icount_set(ost->ost_icount_in_inodes, ino, 0);
 
 out:
+	tmp = ocfs2_write_deferred_allocators(ost->ost_fs);
+	if (tmp) {
+		com_err(whoami, tmp,
+			"while writing the allocators after removing inode "
+			"%"PRIu64, ino);
+		if (!ret)
+			ret = tmp;
+	}
 	return ret ? 1 : 0;
 }
 
@@ -1460,8 +1640,89 @@ static int fix_dups_func(struct dup_cluster *dc, struct dup_inode *di,
 	return ret;
 }
 
+/*
+ * Write out the pending run of di.  ocfs2_change_refcount_flag() works
+ * within a single extent record, so the run is split wherever the
+ * extent tree splits it.  Clusters that aren't found in the data
+ * extent tree (xattr values) are handled one at a time.
+ */
+static errcode_t o2fsck_flush_refcount_run(o2fsck_state *ost,
+					   struct dup_inode *di)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = ost->ost_fs;
+	ocfs2_cached_inode *ci = NULL;
+	uint32_t done, len, p_cluster, num_clusters;
+	uint16_t ext_flags;
+
+	list_del(&di->di_pending_list);
+
+	for (done = 0; done < di->di_pending_len; done += len) {
+		ret = ocfs2_read_cached_inode(fs, di->di_ino, &ci);
+		if (ret)
+			goto out;
+
+		ret = ocfs2_get_clusters(ci, di->di_pending_cpos + done,
+					 &p_cluster, &num_clusters,
+					 &ext_flags);
+		ocfs2_free_cached_inode(fs, ci);
+		if (ret)
+			goto out;
+
+		len = 1;
+		if (p_cluster == (di->di_pending_cluster + done)) {
+			len = di->di_pending_len - done;
+			if (len > num_clusters)
+				len = num_clusters;
+		}
+
+		ret = ocfs2_change_refcount_flag(fs, di->di_ino,
+						 di->di_pending_cpos + done,
+						 len,
+						 di->di_pending_cluster + done,
+						 OCFS2_EXT_REFCOUNTED, 0);
+		if (ret) {
+			com_err(whoami, ret,
+				"while mark extent refcounted at %u in file "
+				"%"PRIu64, di->di_pending_cpos + done,
+				di->di_ino);
+			goto out;
+		}
+	}
+
+	ret = ocfs2_increase_refcount(fs, di->di_ino, di->di_pending_cluster,
+				      di->di_pending_len);
+	if (ret)
+		com_err(whoami, ret,
+			"while increasing refcount at %u for file %"PRIu64,
+			di->di_pending_cluster, di->di_ino);
+
+out:
+	di->di_pending_len = 0;
+	return ret;
+}
+
+/* Write out every pending run. */
+static errcode_t o2fsck_flush_refcount(o2fsck_state *ost,
+				       struct dup_context *dct)
+{
+	errcode_t ret = 0, tmpret;
+	struct dup_inode *di;
+
+	while (!list_empty(&dct->dup_pending)) {
+		di = list_entry(dct->dup_pending.next, struct dup_inode,
+				di_pending_list);
+		tmpret = o2fsck_flush_refcount_run(ost, di);
+		if (!ret)
+			ret = tmpret;
+	}
+
+	return ret;
+}
+
 struct create_refcount {
 	o2fsck_state *cr_ost;
+	struct dup_context *cr_dct;
 	uint64_t cr_refcount_loc;
 	errcode_t cr_err;
 };
@@ -1469,7 +1730,7 @@ struct create_refcount {
 static int create_refcount_func(struct dup_cluster *dc, struct dup_inode *di,
 				struct dup_cluster_owner *dco, void *priv_data)
 {
-	errcode_t ret;
+	errcode_t ret = 0;
 	struct create_refcount *cr = priv_data;
 	ocfs2_filesys *fs = cr->cr_ost->ost_fs;
 
@@ -1486,26 +1747,30 @@ static int create_refcount_func(struct dup_cluster *dc, struct dup_inode *di,
 		di->di_refcount_loc = cr->cr_refcount_loc;
 	}
 
-	ret = ocfs2_change_refcount_flag(fs, di->di_ino,
-					 dco->dco_cpos, 1, dc->dc_cluster,
-					 OCFS2_EXT_REFCOUNTED, 0);
-	if (ret) {
-		com_err(whoami, ret,
-			"while mark extent refcounted at %u in file %"PRIu64,
-			dco->dco_cpos, di->di_ino);
+	/* Extend the pending run if this cluster follows on from it */
+	if (di->di_pending_len &&
+	    (dco->dco_cpos == di->di_pending_cpos + di->di_pending_len) &&
+	    (dc->dc_cluster == di->di_pending_cluster + di->di_pending_len)) {
+		di->di_pending_len++;
 		goto out;
 	}
 
-	ret = ocfs2_increase_refcount(fs, di->di_ino, dc->dc_cluster, 1);
-	if (ret)
-		com_err(whoami, ret,
-			"while increasing refcount at %u for file %"PRIu64,
-			dc->dc_cluster, di->di_ino);
+	if (di->di_pending_len) {
+		ret = o2fsck_flush_refcount_run(cr->cr_ost, di);
+		if (ret)
+			goto out;
+	}
+
+	di->di_pending_cpos = dco->dco_cpos;
+	di->di_pending_cluster = dc->dc_cluster;
+	di->di_pending_len = 1;
+	list_add_tail(&di->di_pending_list, &cr->cr_dct->dup_pending);
 
 out:
 	cr->cr_err = ret;
 	return ret;
 }
+
 /*
  * Create refcount record for all the files sharing the same clusters.
  * Create a new refcount tree if all the files don't have it(refcount_loc = 0).
@@ -1519,6 +1784,7 @@ static errcode_t o2fsck_create_refcount(o2fsck_state *ost,
 	errcode_t ret = 0;
 	struct create_refcount cr = {
 		.cr_ost = ost,
+		.cr_dct = dct,
 		.cr_refcount_loc = refcount_loc,
 	};
 
@@ -1542,7 +1808,7 @@ out:
 
 static errcode_t o2fsck_pass1d(o2fsck_state *ost, struct dup_context *dct)
 {
-	errcode_t ret = 0;
+	errcode_t ret = 0, tmpret;
 	struct dup_cluster *dc;
 	struct rb_node *node = rb_first(&dct->dup_clusters);
 	uint64_t dups, refcount_loc;
@@ -1582,6 +1848,11 @@ static errcode_t o2fsck_pass1d(o2fsck_state *ost, struct dup_context *dct)
 			}
 		}
 
+		/* Cloning and deleting must see the refcounts so far. */
+		ret = o2fsck_flush_refcount(ost, dct);
+		if (ret)
+			break;
+
 		for_each_owner(dct, dc, fix_dups_func, &fd);
 		if (fd.fd_err) {
 			ret = fd.fd_err;
@@ -1589,6 +1860,10 @@ static errcode_t o2fsck_pass1d(o2fsck_state *ost, struct dup_context *dct)
 		}
 	}
 
+	tmpret = o2fsck_flush_refcount(ost, dct);
+	if (!ret)
+		ret = tmpret;
+
 	return ret;
 }
 
@@ -1604,6 +1879,8 @@ errcode_t ocfs2_pass1_dups(o2fsck_state *ost)
 		.dup_inodes = RB_ROOT,
 	};
 
+	INIT_LIST_HEAD(&dct.dup_pending);
+
 	ret = o2fsck_pass1b(ost, &dct);
 	if (!ret) {
 		o2fsck_pass1c(ost, &dct);
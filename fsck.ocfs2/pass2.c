@@ -38,6 +38,7 @@
 #include "ocfs2/ocfs2.h"
 #include "ocfs2/kernel-rbtree.h"
 
+#include "area.h"
 #include "dirparents.h"
 #include "icount.h"
 #include "fsck.h"
@@ -692,7 +693,7 @@ out:
 	return ret;
 }
 
-static int corrupt_dirent_lengths(struct ocfs2_dir_entry *dirent, int left)
+int o2fsck_corrupt_dirent_lengths(struct ocfs2_dir_entry *dirent, int left)
 {
 	if ((dirent->rec_len >= OCFS2_DIR_REC_LEN(1)) &&
 	    ((dirent->rec_len & OCFS2_DIR_ROUND) == 0) &&
@@ -714,8 +715,9 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 	struct dirblock_data *dd = priv_data;
 	struct ocfs2_dir_entry *dirent, *prev = NULL;
 	unsigned int offset = 0, ret_flags = 0, end = dd->fs->fs_blocksize;
-	unsigned int write_off, saved_reclen;
+	unsigned int write_off, saved_reclen, xattr_size;
 	struct ocfs2_dinode *di = (struct ocfs2_dinode *)dd->inoblock_buf; 
+	struct o2fsck_area_map amap;
 	errcode_t ret = 0;
 
 	if (!o2fsck_test_inode_allocated(dd->ost, dbe->e_ino)) {
@@ -763,6 +765,12 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 	verbosef("dir block %"PRIu64" block offs %"PRIu64" in ino\n",
 		 dbe->e_blkno, dbe->e_blkcount);
 
+	/*
+	 * The parts of the block that aren't dirent space are claimed
+	 * up front, so no dirent can run into them.
+	 */
+	o2fsck_area_init(&amap, dd->fs->fs_blocksize);
+
 	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL) {
 		if (dbe->e_ino != dbe->e_blkno)
 			goto out;
@@ -770,6 +778,12 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 		memcpy(dd->dirblock_buf, dd->inoblock_buf,
 		       dd->fs->fs_blocksize);
 		offset = offsetof(struct ocfs2_dinode, id2.i_data.id_data);
+		o2fsck_area_set(&amap, 0, offset);
+
+		xattr_size = di->i_xattr_inline_size;
+		if ((di->i_dyn_features & OCFS2_INLINE_XATTR_FL) &&
+		    xattr_size < (end - offset))
+			o2fsck_area_set(&amap, end - xattr_size, xattr_size);
 	} else {
 		if (dbe->e_blkcount >= ocfs2_blocks_in_bytes(dd->fs,
 							     di->i_size))
@@ -784,9 +798,11 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 		}
 
 		if (ocfs2_dir_has_trailer(dd->fs, di))
-			end = ocfs2_dir_trailer_blk_off(dd->fs);
+			o2fsck_area_set(&amap, ocfs2_dir_trailer_blk_off(dd->fs),
+					sizeof(struct ocfs2_dir_block_trailer));
 	}
 
+	end = offset + o2fsck_area_free_len(&amap, offset);
 	write_off = offset;
 
 	while (offset < end) {
@@ -802,7 +818,7 @@ static unsigned pass2_dir_block_iterate(o2fsck_dirblock_entry *dbe,
 
 		/* if we can't trust this dirent then fix it up or skip
 		 * the whole block */
-		if (corrupt_dirent_lengths(dirent,
+		if (o2fsck_corrupt_dirent_lengths(dirent,
 					   end - offset)) {
 			if (!prompt(dd->ost, PY, PR_DIRENT_LENGTH,
 				    "Directory inode %"PRIu64" "
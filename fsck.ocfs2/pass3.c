@@ -134,7 +134,8 @@ static void check_lostfound(o2fsck_state *ost)
 		    "that we can possibly fill it with orphaned inodes?"))
 		return;
 
-	ret = ocfs2_new_inode(ost->ost_fs, &blkno, 0755 | S_IFDIR);
+	ret = ocfs2_new_inode_in_slot(ost->ost_fs, &blkno, 0755 | S_IFDIR,
+				      0, ost->ost_fs->fs_root_blkno);
 	if (ret) {
 		com_err(whoami, ret, "while trying to allocate a new inode "
 			"for /lost+found");
@@ -432,7 +433,7 @@ errcode_t o2fsck_pass3(o2fsck_state *ost)
 	dp->dp_connected = 1;
 
 	for(dp = o2fsck_dir_parent_first(&ost->ost_dir_parents) ;
-	    dp; dp = o2fsck_dir_parent_next(dp)) {
+	    dp; dp = o2fsck_dir_parent_next(&ost->ost_dir_parents, dp)) {
 		/* XXX hmm, make sure dir->ino is in the dir map? */
 		ret = connect_directory(ost, dp);
 		if (ret)
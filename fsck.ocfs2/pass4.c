@@ -28,6 +28,7 @@
  */
 #include <inttypes.h>
 #include <limits.h>
+#include <stdlib.h>
 
 #include "ocfs2/ocfs2.h"
 
@@ -38,9 +39,26 @@
 #include "problem.h"
 #include "util.h"
 
+/*
+ * Orphans are replayed in three steps.  We first collect every orphan
+ * entry from all the orphan dirs.  Then we truncate and delete the
+ * inodes in block order, with allocator writes deferred so that each
+ * allocator is written once.  Only when the allocators are on disk do we
+ * clear the orphan dir entries.
+ */
+struct orphan_entry {
+	uint64_t	oe_ino;
+	uint64_t	oe_orphan_dir;
+	unsigned int	oe_dio:1,	/* dio orphan, don't delete */
+			oe_done:1;	/* dirent can be cleared */
+};
+
 struct orphan_dir_ctxt {
 	o2fsck_state *ost;
 	uint64_t orphan_dir;
+	struct orphan_entry *entries;
+	size_t nr_entries;
+	size_t max_entries;
 };
 
 static const char *whoami = "pass4";
@@ -103,15 +121,133 @@ out:
 #define OCFS2_DIO_ORPHAN_PREFIX "dio-"
 #define OCFS2_DIO_ORPHAN_PREFIX_LEN 4
 
-static int replay_orphan_iterate(struct ocfs2_dir_entry *dirent,
-				 uint64_t blocknr,
-				 int	offset,
-				 int	blocksize,
-				 char	*buf,
-				 void	*priv_data)
+#define ORPHAN_RA_BLOCKS	1024
+#define ORPHAN_RA_GAP		8
+
+static int orphan_entry_cmp(const void *a, const void *b)
+{
+	const struct orphan_entry *l = a, *r = b;
+
+	if (l->oe_ino < r->oe_ino)
+		return -1;
+	if (l->oe_ino > r->oe_ino)
+		return 1;
+	return 0;
+}
+
+static int blkno_cmp(const void *a, const void *b)
+{
+	const uint64_t *l = a, *r = b;
+
+	if (*l < *r)
+		return -1;
+	if (*l > *r)
+		return 1;
+	return 0;
+}
+
+/*
+ * Pull a sorted list of blocks into the I/O cache.  Nearby blocks are
+ * read as one extent; blocks already cached are not read again.
+ */
+static void orphan_readahead(ocfs2_filesys *fs, uint64_t *blknos,
+			     size_t count)
+{
+	char *buf = NULL;
+	size_t i, n;
+	uint64_t start, len;
+
+	if (!count)
+		return;
+
+	if (ORPHAN_RA_BLOCKS * fs->fs_blocksize > io_get_cache_size(fs->fs_io))
+		return;
+
+	if (ocfs2_malloc_blocks(fs->fs_io, ORPHAN_RA_BLOCKS, &buf))
+		return;
+
+	for (i = 0; i < count; i += n) {
+		start = blknos[i];
+		for (n = 1; i + n < count; n++) {
+			if ((blknos[i + n] - blknos[i + n - 1]) >
+			    ORPHAN_RA_GAP)
+				break;
+			if ((blknos[i + n] - start) >= ORPHAN_RA_BLOCKS)
+				break;
+		}
+		len = blknos[i + n - 1] - start + 1;
+		/* Errors will be seen when the blocks are really read */
+		io_read_block(fs->fs_io, start, len, buf);
+	}
+
+	ocfs2_free(&buf);
+}
+
+/*
+ * Read the orphan inodes and the top of their extent trees in block
+ * order, so that the truncates that follow hit the cache.
+ */
+static void orphan_readahead_inodes(o2fsck_state *ost,
+				    struct orphan_dir_ctxt *ctxt, char *buf)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)buf;
+	struct ocfs2_extent_list *el;
+	uint64_t *blknos = NULL;
+	size_t i, count = 0, max = ctxt->nr_entries;
+	int j;
+
+	if (ocfs2_malloc(sizeof(uint64_t) * max, &blknos))
+		return;
+
+	for (i = 0; i < ctxt->nr_entries; i++) {
+		if (!i || (ctxt->entries[i].oe_ino != blknos[count - 1]))
+			blknos[count++] = ctxt->entries[i].oe_ino;
+	}
+	orphan_readahead(fs, blknos, count);
+
+	/* Now the extent blocks hanging off those inodes */
+	count = 0;
+	for (i = 0; i < ctxt->nr_entries; i++) {
+		if (i && (ctxt->entries[i].oe_ino ==
+			  ctxt->entries[i - 1].oe_ino))
+			continue;
+		if (ocfs2_read_inode(fs, ctxt->entries[i].oe_ino, buf))
+			continue;
+		if ((di->i_dyn_features & OCFS2_INLINE_DATA_FL) ||
+		    (S_ISLNK(di->i_mode) && !di->i_clusters))
+			continue;
+
+		el = &di->id2.i_list;
+		if (!el->l_tree_depth)
+			continue;
+		for (j = 0; j < el->l_next_free_rec; j++) {
+			if (count == max) {
+				max *= 2;
+				if (ocfs2_realloc(sizeof(uint64_t) * max,
+						  &blknos))
+					goto out;
+			}
+			blknos[count++] = el->l_recs[j].e_blkno;
+		}
+	}
+	qsort(blknos, count, sizeof(uint64_t), blkno_cmp);
+	orphan_readahead(fs, blknos, count);
+
+out:
+	ocfs2_free(&blknos);
+}
+
+static int collect_orphan_iterate(struct ocfs2_dir_entry *dirent,
+				  uint64_t blocknr,
+				  int	offset,
+				  int	blocksize,
+				  char	*buf,
+				  void	*priv_data)
 {
 	struct orphan_dir_ctxt *ctxt = priv_data;
 	o2fsck_state *ost = ctxt->ost;
+	struct orphan_entry *oe;
 	int ret_flags = 0;
 	errcode_t ret = 0;
 
@@ -133,30 +269,97 @@ static int replay_orphan_iterate(struct ocfs2_dir_entry *dirent,
 			goto out;
 	}
 
-	ret = ocfs2_truncate(ost->ost_fs, dirent->inode, 0);
+	if (ctxt->nr_entries == ctxt->max_entries) {
+		ctxt->max_entries = ctxt->max_entries ?
+					ctxt->max_entries * 2 : 64;
+		ret = ocfs2_realloc(sizeof(struct orphan_entry) *
+				    ctxt->max_entries, &ctxt->entries);
+		if (ret) {
+			com_err(whoami, ret, "while recording orphan inode "
+				"%"PRIu64, (uint64_t)dirent->inode);
+			ret_flags |= OCFS2_DIRENT_ABORT;
+			goto out;
+		}
+	}
+
+	oe = &ctxt->entries[ctxt->nr_entries++];
+	memset(oe, 0, sizeof(struct orphan_entry));
+	oe->oe_ino = dirent->inode;
+	oe->oe_orphan_dir = ctxt->orphan_dir;
+	/* do not delete inode in case of dio orphan entry */
+	if (!strncmp(dirent->name, OCFS2_DIO_ORPHAN_PREFIX,
+		     OCFS2_DIO_ORPHAN_PREFIX_LEN))
+		oe->oe_dio = 1;
+
+out:
+	ost->ost_err = ret;
+	return ret_flags;
+}
+
+static errcode_t replay_orphan_entry(o2fsck_state *ost,
+				     struct orphan_entry *oe, char *buf)
+{
+	errcode_t ret;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)buf;
+
+	/* An interrupted replay may have deleted it already */
+	ret = ocfs2_read_inode(ost->ost_fs, oe->oe_ino, buf);
+	if (!ret && !(di->i_flags & OCFS2_VALID_FL) && !oe->oe_dio)
+		goto done;
+
+	ret = ocfs2_truncate(ost->ost_fs, oe->oe_ino, 0);
 	if (ret) {
 		com_err(whoami, ret, "while truncating orphan inode %"PRIu64,
-			(uint64_t)dirent->inode);
-		ret_flags |= OCFS2_DIRENT_ABORT;
+			oe->oe_ino);
 		goto out;
 	}
 
-	/* do not delete inode in case of dio orphan entry */
-	if (!strncmp(dirent->name, OCFS2_DIO_ORPHAN_PREFIX,
-			OCFS2_DIO_ORPHAN_PREFIX_LEN))
-		goto out_check;
+	if (oe->oe_dio)
+		goto done;
 
-	ret = ocfs2_delete_inode(ost->ost_fs, dirent->inode);
+	ret = ocfs2_delete_inode(ost->ost_fs, oe->oe_ino);
 	if (ret) {
 		com_err(whoami, ret, "while deleting orphan inode %"PRIu64
-			"after truncating it", (uint64_t)dirent->inode);
-		ret_flags |= OCFS2_DIRENT_ABORT;
+			"after truncating it", oe->oe_ino);
 		goto out;
 	}
 
 	ost->ost_orphan_deleted_count++;
 
-out_check:
+done:
+	oe->oe_done = 1;
+out:
+	return ret;
+}
+
+static int clear_orphan_iterate(struct ocfs2_dir_entry *dirent,
+				uint64_t blocknr,
+				int	offset,
+				int	blocksize,
+				char	*buf,
+				void	*priv_data)
+{
+	struct orphan_dir_ctxt *ctxt = priv_data;
+	o2fsck_state *ost = ctxt->ost;
+	struct orphan_entry key, *oe;
+
+	key.oe_ino = dirent->inode;
+	oe = bsearch(&key, ctxt->entries, ctxt->nr_entries,
+		     sizeof(struct orphan_entry), orphan_entry_cmp);
+	if (!oe)
+		return 0;
+
+	/* The same inode could be in more than one orphan dir */
+	while ((oe > ctxt->entries) && ((oe - 1)->oe_ino == key.oe_ino))
+		oe--;
+	while ((oe < ctxt->entries + ctxt->nr_entries) &&
+	       (oe->oe_ino == key.oe_ino) &&
+	       (oe->oe_orphan_dir != ctxt->orphan_dir))
+		oe++;
+	if ((oe == ctxt->entries + ctxt->nr_entries) ||
+	    (oe->oe_ino != key.oe_ino) || !oe->oe_done)
+		return 0;
+
 	/* Only calculate icount in force check. */
 	if (ost->ost_force) {
 		/*
@@ -181,12 +384,10 @@ out_check:
 					    dirent->inode, -1);
 	}
 
+	/* Don't match this entry again */
+	oe->oe_done = 0;
 	dirent->inode = 0;
-	ret_flags |= OCFS2_DIRENT_CHANGED;
-
-out:
-	ost->ost_err = ret;
-	return ret_flags;
+	return OCFS2_DIRENT_CHANGED;
 }
 
 static errcode_t create_orphan_dir(o2fsck_state *ost, char *fname)
@@ -229,15 +430,26 @@ bail:
  */
 errcode_t replay_orphan_dir(o2fsck_state *ost, int slot_recovery)
 {
-	errcode_t ret = OCFS2_ET_CORRUPT_SUPERBLOCK;
+	errcode_t tmp, ret = OCFS2_ET_CORRUPT_SUPERBLOCK;
 	char name[PATH_MAX];
-	uint64_t ino;
+	char *buf = NULL;
+	uint64_t ino, *orphan_dirs = NULL;
 	int bytes;
 	int i;
-	int num_slots = OCFS2_RAW_SB(ost->ost_fs->fs_super)->s_max_slots;
+	size_t n;
+	ocfs2_filesys *fs = ost->ost_fs;
+	int num_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
 	struct orphan_dir_ctxt ctxt;
 
+	memset(&ctxt, 0, sizeof(ctxt));
 	ctxt.ost = ost;
+
+	tmp = ocfs2_malloc0(sizeof(uint64_t) * num_slots, &orphan_dirs);
+	if (tmp) {
+		ret = tmp;
+		goto out;
+	}
+
 	for (i = 0; i < num_slots; ++i) {
 		bytes = ocfs2_sprintf_system_inode_name(name, PATH_MAX,
 				ORPHAN_DIR_SYSTEM_INODE, i);
@@ -246,7 +458,7 @@ errcode_t replay_orphan_dir(o2fsck_state *ost, int slot_recovery)
 			goto out;
 		}
 
-		ret = ocfs2_lookup(ost->ost_fs, ost->ost_fs->fs_sysdir_blkno,
+		ret = ocfs2_lookup(fs, fs->fs_sysdir_blkno,
 				   name, bytes, NULL, &ino);
 		if (ret) {
 			if (slot_recovery)
@@ -263,26 +475,93 @@ errcode_t replay_orphan_dir(o2fsck_state *ost, int slot_recovery)
 				   "%s is missing in system directory. "
 				   "Create it?", name)) {
 				ret = create_orphan_dir(ost, name);
-				if (ret) {
+				if (ret)
 					com_err(whoami, ret, "while creating"
 						"orphan directory %s", name);
-					continue;
-				}
 			}
+			/* A new orphan dir is empty */
+			ret = 0;
+			continue;
 		}
 
+		orphan_dirs[i] = ino;
 		ctxt.orphan_dir = ino;
 		ost->ost_err = 0;
-		ret = ocfs2_dir_iterate(ost->ost_fs, ino,
+		ret = ocfs2_dir_iterate(fs, ino,
 					OCFS2_DIRENT_FLAG_EXCLUDE_DOTS, NULL,
-					replay_orphan_iterate, &ctxt);
+					collect_orphan_iterate, &ctxt);
 		if (!ret)
 			ret = ost->ost_err;
 		if (ret && slot_recovery)
 			break;
 	}
 
+	if (!ctxt.nr_entries)
+		goto out;
+
+	qsort(ctxt.entries, ctxt.nr_entries, sizeof(struct orphan_entry),
+	      orphan_entry_cmp);
+
+	tmp = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (tmp) {
+		com_err(whoami, tmp, "while allocating space to read inodes");
+		if (!ret)
+			ret = tmp;
+		goto out;
+	}
+
+	orphan_readahead_inodes(ost, &ctxt, buf);
+
+	ocfs2_defer_allocator_writes(fs);
+	for (n = 0; n < ctxt.nr_entries; n++) {
+		if (n && (ctxt.entries[n].oe_ino ==
+			  ctxt.entries[n - 1].oe_ino)) {
+			ctxt.entries[n].oe_done = ctxt.entries[n - 1].oe_done;
+			continue;
+		}
+
+		tmp = replay_orphan_entry(ost, &ctxt.entries[n], buf);
+		if (tmp) {
+			if (!ret)
+				ret = tmp;
+			break;
+		}
+	}
+
+	/* The entries stay until what they point to is freed on disk */
+	tmp = ocfs2_write_deferred_allocators(fs);
+	if (tmp) {
+		com_err(whoami, tmp, "while writing out the allocators freed "
+			"by orphan inodes");
+		if (!ret)
+			ret = tmp;
+		goto out;
+	}
+
+	for (i = 0; i < num_slots; ++i) {
+		if (!orphan_dirs[i])
+			continue;
+
+		ctxt.orphan_dir = orphan_dirs[i];
+		tmp = ocfs2_dir_iterate(fs, orphan_dirs[i],
+					OCFS2_DIRENT_FLAG_EXCLUDE_DOTS, NULL,
+					clear_orphan_iterate, &ctxt);
+		if (tmp) {
+			com_err(whoami, tmp, "while clearing entries in "
+				"orphan directory %"PRIu64, orphan_dirs[i]);
+			if (!ret)
+				ret = tmp;
+		}
+	}
+
 out:
+	if (buf)
+		ocfs2_free(&buf);
+	if (ctxt.entries)
+		ocfs2_free(&ctxt.entries);
+	if (orphan_dirs)
+		ocfs2_free(&orphan_dirs);
+
 	return ret;
 }
 
@@ -102,6 +102,8 @@ int prompt_input(o2fsck_state *ost, unsigned flags, struct prompt_code code,
 	if((flags & PY) && (flags & PN))
 		flags &= ~PY;
 
+	ost->ost_problem_count++;
+
 	printf("[%s] ", code.str);
 
 	va_start(ap, fmt);
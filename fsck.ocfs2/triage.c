@@ -0,0 +1,708 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * triage.c
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * --
+ *
+ * Triage answers "does this volume need a full check?" in bounded time.
+ *
+ * The structures everything else hangs off of are checked in full: the
+ * super block when the volume is opened, then pass 0 for the allocator
+ * chains and their summaries, then the system directory.  Files are
+ * too many to walk, so we pick inodes uniformly at random from the
+ * in-use bits of every inode allocator group and run the pass 1 checks
+ * on each, which covers their extent trees, refcount trees and xattrs.
+ * The directory blocks of the sampled directories are then sampled in
+ * turn.  The rates we saw are reported with 95% Wilson score bounds.
+ *
+ * Everything runs with the answer to every prompt forced to 'no' on a
+ * read-only device; a prompt is how we learn that a sample is bad.
+ * Checks that need the whole volume (link counts, cluster bitmap
+ * agreement, directory connectivity) are left to a full run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
+
+#include "fsck.h"
+#include "pass0.h"
+#include "pass1.h"
+#include "pass2.h"
+#include "triage.h"
+#include "util.h"
+
+static const char *whoami = "triage";
+
+/* 95% two-sided */
+#define TRIAGE_Z	1.96
+
+struct triage_group {
+	uint64_t	tg_blkno;
+	uint64_t	tg_first;	/* sample index of first in-use inode */
+	uint32_t	tg_used;
+	int16_t		tg_slot;
+};
+
+struct triage_state {
+	o2fsck_state		*ts_ost;
+	struct triage_group	*ts_groups;
+	uint32_t		ts_num_groups;
+	uint32_t		ts_max_groups;
+	uint64_t		ts_inodes_used;
+
+	uint64_t		ts_inodes_checked;
+	uint64_t		ts_inodes_bad;
+
+	uint64_t		ts_dir_stride;
+	uint64_t		ts_dir_seen;	/* outside the system dir */
+	uint64_t		ts_dir_last_ino;
+	int			ts_dir_last_bad;
+	uint64_t		ts_dirblocks_checked;
+	uint64_t		ts_dirblocks_bad;
+
+	char			*ts_gd_buf;
+	char			*ts_inode_buf;
+	char			*ts_dir_inode_buf;
+	char			*ts_dir_buf;
+};
+
+/* fsck doesn't link libm, and a bound doesn't need more than Newton */
+static double triage_sqrt(double x)
+{
+	double r = x > 1 ? x : 1;
+	int i;
+
+	if (x <= 0)
+		return 0;
+
+	for (i = 0; i < 64; i++)
+		r = (r + x / r) / 2;
+
+	return r;
+}
+
+static void triage_bounds(uint64_t bad, uint64_t n, double *lo, double *hi)
+{
+	double z2 = TRIAGE_Z * TRIAGE_Z;
+	double p, denom, centre, spread;
+
+	if (!n) {
+		*lo = 0;
+		*hi = 1;
+		return;
+	}
+
+	p = (double)bad / n;
+	denom = 1 + z2 / n;
+	centre = p + z2 / (2.0 * n);
+	spread = TRIAGE_Z * triage_sqrt(p * (1 - p) / n +
+					z2 / (4.0 * n * n));
+
+	*lo = (centre - spread) / denom;
+	*hi = (centre + spread) / denom;
+	if (*lo < 0)
+		*lo = 0;
+	if (*hi > 1)
+		*hi = 1;
+}
+
+static void triage_report(const char *what, uint64_t bad, uint64_t n,
+			  uint64_t total, int exact)
+{
+	double lo, hi;
+
+	printf("  %-18s %"PRIu64" of %"PRIu64" checked, %"PRIu64" bad",
+	       what, n, total, bad);
+	if (!n) {
+		printf("\n");
+		return;
+	}
+
+	if (exact) {
+		printf(" (%.3f%%, exact)\n", 100.0 * bad / n);
+		return;
+	}
+
+	triage_bounds(bad, n, &lo, &hi);
+	printf(" (%.3f%%, 95%% bounds %.3f%%..%.3f%%)\n",
+	       100.0 * bad / n, 100.0 * lo, 100.0 * hi);
+}
+
+static uint64_t triage_dup_clusters(o2fsck_state *ost)
+{
+	if (!ost->ost_duplicate_clusters)
+		return 0;
+	return ocfs2_bitmap_get_set_bits(ost->ost_duplicate_clusters);
+}
+
+static errcode_t triage_add_group(struct triage_state *ts, int16_t slot,
+				  struct ocfs2_group_desc *gd)
+{
+	errcode_t ret;
+	struct triage_group *tg;
+	uint32_t max;
+
+	if (ts->ts_num_groups == ts->ts_max_groups) {
+		max = ts->ts_max_groups ? ts->ts_max_groups * 2 : 64;
+		ret = ocfs2_realloc(max * sizeof(struct triage_group),
+				    &ts->ts_groups);
+		if (ret)
+			return ret;
+		ts->ts_max_groups = max;
+	}
+
+	tg = &ts->ts_groups[ts->ts_num_groups++];
+	tg->tg_blkno = gd->bg_blkno;
+	tg->tg_slot = slot;
+	tg->tg_first = ts->ts_inodes_used;
+	/* Bit 0 is the group descriptor itself */
+	if (gd->bg_free_bits_count < gd->bg_bits)
+		tg->tg_used = gd->bg_bits - gd->bg_free_bits_count - 1;
+	else
+		tg->tg_used = 0;
+	ts->ts_inodes_used += tg->tg_used;
+
+	return 0;
+}
+
+/* Pass 0 has loaded and checked the allocators, so the chains are sane */
+static errcode_t triage_find_groups(struct triage_state *ts)
+{
+	o2fsck_state *ost = ts->ts_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	uint16_t max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+	struct ocfs2_group_desc *gd;
+	struct ocfs2_chain_list *cl;
+	ocfs2_cached_inode *ci;
+	uint64_t blkno, limit;
+	int16_t slot;
+	int i;
+	errcode_t ret = 0;
+
+	gd = (struct ocfs2_group_desc *)ts->ts_gd_buf;
+
+	for (slot = OCFS2_INVALID_SLOT; slot != max_slots; slot++) {
+		if (slot == OCFS2_INVALID_SLOT)
+			ci = ost->ost_global_inode_alloc;
+		else
+			ci = ost->ost_inode_allocs[slot];
+		if (!ci)
+			continue;
+
+		cl = &ci->ci_inode->id2.i_chain;
+		for (i = 0; i < cl->cl_next_free_rec; i++) {
+			/* A looping chain must not hang us */
+			limit = fs->fs_clusters / ocfs2_max(cl->cl_cpg,
+							     (uint16_t)1);
+			limit++;
+			blkno = cl->cl_recs[i].c_blkno;
+			while (blkno && limit--) {
+				ret = ocfs2_read_group_desc(fs, blkno,
+							    ts->ts_gd_buf);
+				if (ret) {
+					com_err(whoami, ret, "while reading "
+						"inode group %"PRIu64, blkno);
+					return ret;
+				}
+
+				ret = triage_add_group(ts, slot, gd);
+				if (ret)
+					return ret;
+
+				blkno = gd->bg_next_group;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/* Returns non-zero if the sample is bad */
+static int triage_check_inode(struct triage_state *ts,
+			      struct triage_group *tg, int bit)
+{
+	o2fsck_state *ost = ts->ts_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ts->ts_inode_buf;
+	uint64_t blkno = tg->tg_blkno + bit;
+	uint32_t problems = ost->ost_problem_count;
+	uint64_t dups = triage_dup_clusters(ost);
+	errcode_t ret;
+	int bad = 0;
+
+	verbosef("sampling inode %"PRIu64"\n", blkno);
+
+	ret = ocfs2_read_inode(fs, blkno, ts->ts_inode_buf);
+	if (ret) {
+		printf("Inode %"PRIu64" is marked in use but can't be read: "
+		       "%s\n", blkno, error_message(ret));
+		return 1;
+	}
+
+	if (!(di->i_flags & OCFS2_VALID_FL) ||
+	    di->i_fs_generation != ost->ost_fs_generation) {
+		printf("Inode %"PRIu64" is marked in use but isn't a valid "
+		       "inode\n", blkno);
+		return 1;
+	}
+
+	if ((int16_t)di->i_suballoc_slot != tg->tg_slot ||
+	    di->i_suballoc_bit != bit) {
+		printf("Inode %"PRIu64" claims slot %"PRId16" bit %u but is "
+		       "allocated from slot %"PRId16" bit %d\n", blkno,
+		       (int16_t)di->i_suballoc_slot, di->i_suballoc_bit,
+		       tg->tg_slot, bit);
+		bad = 1;
+	}
+
+	ret = o2fsck_pass1_check_inode(ost, blkno, di);
+	if (ret) {
+		com_err(whoami, ret, "while checking inode %"PRIu64, blkno);
+		bad = 1;
+	}
+
+	if (ost->ost_problem_count != problems ||
+	    triage_dup_clusters(ost) != dups)
+		bad = 1;
+
+	return bad;
+}
+
+static int triage_compare_index(const void *a, const void *b)
+{
+	const uint64_t *l = a, *r = b;
+
+	if (*l < *r)
+		return -1;
+	return *l > *r;
+}
+
+static uint64_t triage_random(uint64_t range)
+{
+	uint64_t r;
+
+	r = ((uint64_t)lrand48() << 31) | (uint64_t)lrand48();
+	return r % range;
+}
+
+/*
+ * Picks the inodes to check as indices into the in-use inodes of all
+ * groups, sorted so that we walk the disk in one direction.  When the
+ * volume has no more inodes than we were asked to sample we check them
+ * all.
+ */
+static errcode_t triage_pick_inodes(struct triage_state *ts,
+				    uint64_t samples, uint64_t **indices,
+				    uint64_t *count)
+{
+	uint64_t *idx, i, j;
+	errcode_t ret;
+
+	if (samples > ts->ts_inodes_used)
+		samples = ts->ts_inodes_used;
+
+	*count = 0;
+	if (!samples)
+		return 0;
+
+	ret = ocfs2_malloc(samples * sizeof(uint64_t), &idx);
+	if (ret)
+		return ret;
+
+	if (samples == ts->ts_inodes_used) {
+		for (i = 0; i < samples; i++)
+			idx[i] = i;
+		j = samples;
+	} else {
+		/*
+		 * Checking an inode twice would see its clusters twice,
+		 * so draw again until the duplicates are replaced.
+		 */
+		for (j = 0; j < samples; ) {
+			for (i = j; i < samples; i++)
+				idx[i] = triage_random(ts->ts_inodes_used);
+			qsort(idx, samples, sizeof(uint64_t),
+			      triage_compare_index);
+
+			for (i = 1, j = 1; i < samples; i++) {
+				if (idx[i] != idx[j - 1])
+					idx[j++] = idx[i];
+			}
+		}
+	}
+
+	*indices = idx;
+	*count = j;
+	return 0;
+}
+
+static errcode_t triage_sample_inodes(struct triage_state *ts,
+				      uint64_t samples)
+{
+	o2fsck_state *ost = ts->ts_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_group_desc *gd;
+	struct triage_group *tg = NULL;
+	uint64_t *idx = NULL, count, i, want, rank = 0;
+	uint32_t g = 0;
+	int bit = 0;
+	errcode_t ret;
+
+	gd = (struct ocfs2_group_desc *)ts->ts_gd_buf;
+
+	ret = triage_pick_inodes(ts, samples, &idx, &count);
+	if (ret || !count)
+		goto out;
+
+	if (tools_progress_enabled()) {
+		ost->ost_prog = tools_progress_start("Sampling inodes",
+						     "inodes", count);
+		if (ost->ost_prog)
+			setbuf(stdout, NULL);
+	}
+
+	for (i = 0; i < count; i++) {
+		while (idx[i] >= ts->ts_groups[g].tg_first +
+				 ts->ts_groups[g].tg_used)
+			g++;
+
+		if (tg != &ts->ts_groups[g]) {
+			tg = &ts->ts_groups[g];
+			ret = ocfs2_read_group_desc(fs, tg->tg_blkno,
+						    ts->ts_gd_buf);
+			if (ret) {
+				com_err(whoami, ret, "while reading inode "
+					"group %"PRIu64, tg->tg_blkno);
+				goto out;
+			}
+			rank = 0;
+			bit = 0;
+		}
+
+		/* The want'th in-use inode of this group, counting from 0 */
+		want = idx[i] - tg->tg_first;
+		while (rank <= want) {
+			bit = ocfs2_find_next_bit_set(gd->bg_bitmap,
+						      gd->bg_bits, bit + 1);
+			if (bit >= gd->bg_bits)
+				break;
+			rank++;
+		}
+
+		/* A miscounted group; pass 0 has complained about it */
+		if (rank <= want)
+			continue;
+
+		/* Already checked with the rest of the system directory */
+		if (tg->tg_blkno + bit == fs->fs_sysdir_blkno)
+			continue;
+
+		ts->ts_inodes_checked++;
+		if (triage_check_inode(ts, tg, bit))
+			ts->ts_inodes_bad++;
+
+		if (ost->ost_prog)
+			tools_progress_step(ost->ost_prog, 1);
+	}
+
+out:
+	if (ost->ost_prog) {
+		tools_progress_stop(ost->ost_prog);
+		ost->ost_prog = NULL;
+		setlinebuf(stdout);
+	}
+	if (idx)
+		ocfs2_free(&idx);
+	return ret;
+}
+
+/*
+ * Returns 1 if the directory block is bad, 0 if it is good and -1 if it
+ * lies past i_size, where pass 2 would ignore it.
+ */
+static int triage_check_dirblock(struct triage_state *ts,
+				 o2fsck_dirblock_entry *dbe)
+{
+	ocfs2_filesys *fs = ts->ts_ost->ost_fs;
+	struct ocfs2_dinode *di;
+	struct ocfs2_dir_entry *dirent;
+	unsigned int offset, end;
+	errcode_t ret;
+
+	di = (struct ocfs2_dinode *)ts->ts_dir_inode_buf;
+
+	if (dbe->e_ino != ts->ts_dir_last_ino) {
+		ts->ts_dir_last_ino = dbe->e_ino;
+		ret = ocfs2_read_inode(fs, dbe->e_ino, ts->ts_dir_inode_buf);
+		ts->ts_dir_last_bad = !!ret;
+		if (ret)
+			printf("Directory inode %"PRIu64" can't be read: "
+			       "%s\n", dbe->e_ino, error_message(ret));
+	}
+	if (ts->ts_dir_last_bad)
+		return 1;
+
+	if (!(di->i_dyn_features & OCFS2_INLINE_DATA_FL) &&
+	    dbe->e_blkcount >= ocfs2_blocks_in_bytes(fs, di->i_size))
+		return -1;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL) {
+		memcpy(ts->ts_dir_buf, ts->ts_dir_inode_buf,
+		       fs->fs_blocksize);
+		offset = offsetof(struct ocfs2_dinode, id2.i_data.id_data);
+		end = offset + di->id2.i_data.id_count;
+		if (end > fs->fs_blocksize)
+			end = fs->fs_blocksize;
+	} else {
+		ret = ocfs2_read_dir_block(fs, di, dbe->e_blkno,
+					   ts->ts_dir_buf);
+		if (ret) {
+			printf("Directory block %"PRIu64" of inode %"PRIu64" "
+			       "is corrupt: %s\n", dbe->e_blkno, dbe->e_ino,
+			       error_message(ret));
+			return 1;
+		}
+		offset = 0;
+		if (ocfs2_dir_has_trailer(fs, di))
+			end = ocfs2_dir_trailer_blk_off(fs);
+		else
+			end = fs->fs_blocksize;
+	}
+
+	while (offset < end) {
+		dirent = (struct ocfs2_dir_entry *)(ts->ts_dir_buf + offset);
+
+		if (o2fsck_corrupt_dirent_lengths(dirent, end - offset)) {
+			printf("Directory block %"PRIu64" of inode %"PRIu64" "
+			       "has a corrupt entry at offset %u\n",
+			       dbe->e_blkno, dbe->e_ino, offset);
+			return 1;
+		}
+
+		if (dirent->inode &&
+		    (dirent->inode >= fs->fs_blocks ||
+		     !o2fsck_test_inode_allocated(ts->ts_ost,
+						  dirent->inode))) {
+			printf("Directory block %"PRIu64" of inode %"PRIu64" "
+			       "refers to unallocated inode %"PRIu64"\n",
+			       dbe->e_blkno, dbe->e_ino,
+			       (uint64_t)dirent->inode);
+			return 1;
+		}
+
+		offset += dirent->rec_len;
+	}
+
+	return 0;
+}
+
+static unsigned triage_dirblock_iterate(o2fsck_dirblock_entry *dbe,
+					void *priv_data)
+{
+	struct triage_state *ts = priv_data;
+	ocfs2_filesys *fs = ts->ts_ost->ost_fs;
+	int bad;
+
+	/* The system directory is checked in full */
+	if (dbe->e_ino != fs->fs_sysdir_blkno &&
+	    (ts->ts_dir_seen++ % ts->ts_dir_stride))
+		return 0;
+
+	bad = triage_check_dirblock(ts, dbe);
+	if (bad < 0)
+		return 0;
+
+	ts->ts_dirblocks_checked++;
+	if (bad)
+		ts->ts_dirblocks_bad++;
+
+	return 0;
+}
+
+/* The system directory inode and its blocks are checked in full */
+static errcode_t triage_check_sysdir(struct triage_state *ts)
+{
+	o2fsck_state *ost = ts->ts_ost;
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ts->ts_inode_buf;
+	errcode_t ret;
+
+	ret = ocfs2_read_inode(fs, fs->fs_sysdir_blkno, ts->ts_inode_buf);
+	if (ret) {
+		com_err(whoami, ret, "while reading the system directory "
+			"inode %"PRIu64, fs->fs_sysdir_blkno);
+		return ret;
+	}
+
+	ret = o2fsck_pass1_check_inode(ost, fs->fs_sysdir_blkno, di);
+	if (ret)
+		com_err(whoami, ret, "while checking the system directory");
+
+	return ret;
+}
+
+static errcode_t triage_state_init(o2fsck_state *ost,
+				   struct triage_state *ts)
+{
+	errcode_t ret;
+
+	memset(ts, 0, sizeof(struct triage_state));
+	ts->ts_ost = ost;
+	ts->ts_dir_stride = 1;
+
+	ret = ocfs2_malloc_block(ost->ost_fs->fs_io, &ts->ts_gd_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(ost->ost_fs->fs_io,
+					 &ts->ts_inode_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(ost->ost_fs->fs_io,
+					 &ts->ts_dir_inode_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(ost->ost_fs->fs_io, &ts->ts_dir_buf);
+	if (ret)
+		com_err(whoami, ret, "while allocating triage buffers");
+
+	return ret;
+}
+
+static void triage_state_release(struct triage_state *ts)
+{
+	if (ts->ts_groups)
+		ocfs2_free(&ts->ts_groups);
+	if (ts->ts_gd_buf)
+		ocfs2_free(&ts->ts_gd_buf);
+	if (ts->ts_inode_buf)
+		ocfs2_free(&ts->ts_inode_buf);
+	if (ts->ts_dir_inode_buf)
+		ocfs2_free(&ts->ts_dir_inode_buf);
+	if (ts->ts_dir_buf)
+		ocfs2_free(&ts->ts_dir_buf);
+}
+
+/*
+ * Sets *full_check if anything we looked at was bad or the volume
+ * otherwise says it wants a full check.  Returns an error only when
+ * triage itself couldn't run.
+ */
+errcode_t o2fsck_triage(o2fsck_state *ost, uint64_t samples, int *full_check)
+{
+	ocfs2_filesys *fs = ost->ost_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	struct triage_state ts;
+	struct o2fsck_resource_track rt;
+	uint32_t structural;
+	int exact;
+	errcode_t ret;
+
+	*full_check = 0;
+
+	ret = triage_state_init(ost, &ts);
+	if (ret)
+		goto out;
+
+	srand48(time(NULL) ^ getpid());
+
+	ret = o2fsck_pass0(ost);
+	if (ret) {
+		com_err(whoami, ret, "while performing pass 0");
+		/* Allocators we can't walk are themselves the answer */
+		*full_check = 1;
+		ret = 0;
+		goto out;
+	}
+
+	printf("Triage: Sampling inodes and directory blocks\n");
+
+	o2fsck_init_resource_track(&rt, fs->fs_io);
+
+	ret = triage_check_sysdir(&ts);
+	if (ret)
+		goto out_track;
+
+	ret = triage_find_groups(&ts);
+	if (ret)
+		goto out_track;
+
+	structural = ost->ost_problem_count;
+
+	ret = triage_sample_inodes(&ts, samples);
+	if (ret)
+		goto out_track;
+
+	if (ost->ost_dirblocks.db_numblocks > samples)
+		ts.ts_dir_stride = ost->ost_dirblocks.db_numblocks / samples;
+	o2fsck_dir_block_iterate(ost, triage_dirblock_iterate, &ts);
+
+out_track:
+	o2fsck_compute_resource_track(&rt, fs->fs_io);
+	o2fsck_print_resource_track("Triage", ost, &rt, fs->fs_io);
+	o2fsck_add_resource_track(&ost->ost_rt, &rt);
+
+	if (ret) {
+		com_err(whoami, ret, "while sampling");
+		*full_check = 1;
+		ret = 0;
+		goto out;
+	}
+
+	printf("\nTriage summary:\n");
+	printf("  %-18s %"PRIu32" problems\n", "Structure:", structural);
+	exact = samples >= ts.ts_inodes_used;
+	triage_report("Inodes:", ts.ts_inodes_bad, ts.ts_inodes_checked,
+		      ts.ts_inodes_used, exact);
+	triage_report("Directory blocks:", ts.ts_dirblocks_bad,
+		      ts.ts_dirblocks_checked,
+		      ost->ost_dirblocks.db_numblocks, ts.ts_dir_stride == 1);
+	if (ts.ts_inodes_checked && !exact) {
+		double lo, hi;
+
+		triage_bounds(ts.ts_inodes_bad, ts.ts_inodes_checked,
+			      &lo, &hi);
+		printf("  %-18s %.0f..%.0f\n", "Bad inodes (est.):",
+		       lo * ts.ts_inodes_used, hi * ts.ts_inodes_used);
+	}
+	if (ost->ost_has_journal_dirty)
+		printf("  The journals need replaying; some of the above may "
+		       "be fixed by replay.\n");
+
+	if (structural || ts.ts_inodes_bad || ts.ts_dirblocks_bad) {
+		*full_check = 1;
+		printf("  Problems were found.\n");
+	} else if (sb->s_state & OCFS2_ERROR_FS) {
+		*full_check = 1;
+		printf("  The file system is marked with errors.\n");
+	} else if (sb->s_feature_incompat &
+		   (OCFS2_FEATURE_INCOMPAT_RESIZE_INPROG |
+		    OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG)) {
+		*full_check = 1;
+		printf("  An interrupted resize or tunefs operation was "
+		       "found.\n");
+	}
+
+out:
+	if (!ret)
+		printf("A full check (-f) is %s.\n\n",
+		       *full_check ? "recommended" : "not needed");
+	triage_state_release(&ts);
+	if (ost->ost_inode_allocs)
+		o2fsck_free_inode_allocs(ost);
+	return ret;
+}
@@ -289,6 +289,8 @@ void o2fsck_print_resource_track(char *pass, o2fsck_state *ost,
 				 io_channel *channel)
 {
 	struct ocfs2_io_stats *rtio = &rt->rt_io_stats;
+	struct ocfs2_io_stats ios;
+	char backing[64];
 	uint64_t total_io, cache_read;
 	float rtime_s, utime_s, stime_s, walltime;
 	uint32_t rtime_m, utime_m, stime_m;
@@ -320,9 +322,13 @@ void o2fsck_print_resource_track(char *pass, o2fsck_state *ost,
 	cache_read = (uint64_t)rtio->is_cache_hits * io_get_blksize(channel);
 	total_io = rtio->is_bytes_read + rtio->is_bytes_written;
 
-	if (!pass)
-		printf("  Cache size: %luMB\n",
-		       mbytes(io_get_cache_size(channel)));
+	if (!pass) {
+		io_get_stats(channel, &ios);
+		io_snprint_cache_backing(backing, sizeof(backing),
+					 ios.is_cache_backing);
+		printf("  Cache size: %luMB, backing: %s\n",
+		       mbytes(io_get_cache_size(channel)), backing);
+	}
 
 	printf("  I/O read disk/cache: %"PRIu64"MB / %"PRIu64"MB, "
 	       "write: %"PRIu64"MB, rate: %.2fMB/s\n",
@@ -395,6 +401,7 @@ void o2fsck_init_cache(o2fsck_state *ost, enum o2fsck_cache_hint hint)
 	if (pages_wanted > avpages)
 		av_blocks = avpages * getpagesize() / fs->fs_blocksize;
 
+	io_set_cache_backing(fs->fs_io, ost->ost_cache_backing);
 	while (blocks_wanted > 0) {
 		io_destroy_cache(fs->fs_io);
 
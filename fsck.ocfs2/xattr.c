@@ -19,7 +19,9 @@
 
 #include "ocfs2/byteorder.h"
 #include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
 
+#include "area.h"
 #include "xattr.h"
 #include "extent.h"
 #include "fsck.h"
@@ -53,23 +55,6 @@ struct xattr_info {
 	uint64_t blkno;
 };
 
-/*
- * This use to describe the used area of xattr in inode, block and bucket.
- * The used area include all xattr structs, such as header, entry, name+value.
- */
-struct used_area {
-	struct list_head ua_list;	/* list of used area */
-	uint16_t ua_offset;		/* the offset of the area */
-	uint16_t ua_length;		/* the length of the area */
-	struct ocfs2_xattr_entry ua_xe;	/* store the valid xattr entry */
-	uint16_t ua_xe_valid;		/* whether it is a valid xattr entry */
-};
-
-struct used_map {
-	uint16_t um_size;		/* the size of the map */
-	struct list_head um_areas;	/* list of used area */
-};
-
 static int check_xattr_count(o2fsck_state *ost,
 			     struct ocfs2_dinode *di,
 			     struct ocfs2_xattr_header *xh,
@@ -117,136 +102,31 @@ static int check_xattr_count(o2fsck_state *ost,
 	return 0;
 }
 
-static struct used_area *new_used_area(uint16_t off, uint16_t len,
-				       struct ocfs2_xattr_entry *xe)
-{
-	struct used_area *ua = NULL;
-
-	ua = malloc(sizeof(struct used_area));
-	if (!ua)
-		return NULL;
-
-	memset(ua, 0 , sizeof(struct used_area));
-	ua->ua_offset = off;
-	ua->ua_length = len;
-
-	if (xe) {
-		memcpy(&ua->ua_xe, xe, ENTRY_SIZE);
-		ua->ua_xe_valid = 1;
-	}
-
-	return ua;
-}
-
-static errcode_t set_used_area(struct used_map *um,
-			       uint16_t off, uint16_t len,
-			       struct ocfs2_xattr_entry *xe)
-{
-	struct used_area *new_area = NULL;
-
-	if (!um)
-		return OCFS2_ET_INVALID_ARGUMENT;
-
-	new_area = new_used_area(off, len, xe);
-	if (!new_area) {
-		com_err(whoami, OCFS2_ET_NO_MEMORY, "Unable to allocate"
-			" buffer for extended attribute ");
-		return OCFS2_ET_NO_MEMORY;
-	}
-
-	INIT_LIST_HEAD(&new_area->ua_list);
-	list_add_tail(&new_area->ua_list, &um->um_areas);
-
-	return 0;
-}
-
-static void clear_used_area(struct used_map *um, uint16_t off, uint16_t len)
-{
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
-	if (list_empty(&um->um_areas))
-		return;
-
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		if (off == area->ua_offset && len == area->ua_length) {
-			list_del(ua);
-			free(area);
-			return;
-		}
-	}
-	return;
-}
-
-static int check_area_fits(struct used_map *um, uint16_t off, uint16_t len)
-{
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
-	if (!um || (off + len) > um->um_size)
-		return -1;
-
-	if (list_empty(&um->um_areas))
-		return 0;
-
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		if ((off + len) <= area->ua_offset)
-			continue;
-		if ((area->ua_offset + area->ua_length) <= off)
-			continue;
-		return -1;
-	}
-
-	return 0;
-}
-
-static void free_used_map(struct used_map *um)
-{
-	struct used_area *area = NULL;
-	struct list_head *ua, *ua2;
-
-	if (list_empty(&um->um_areas))
-		return;
-
-	list_for_each_safe(ua, ua2, &um->um_areas) {
-		area = list_entry(ua, struct used_area, ua_list);
-		list_del(ua);
-		free(area);
-	}
-	return;
-}
-
 static errcode_t check_xattr_entry(o2fsck_state *ost,
 				   struct ocfs2_dinode *di,
 				   struct ocfs2_xattr_header *xh,
 				   int *changed,
 				   struct xattr_info *xi)
 {
-	int i, ret = 0;
+	int i, j, ret = 0;
 	uint16_t count;
-	struct used_map *umap;
+	struct o2fsck_area_map amap;
+	/* Entries that passed, by index.  An entry must fit in amap. */
+	unsigned char good[O2FSCK_AREA_MAX_SIZE / ENTRY_SIZE / 8];
 
 	count = xh->xh_count;
-	umap = malloc(sizeof(struct used_map));
-	if (!umap) {
-		com_err(whoami, OCFS2_ET_NO_MEMORY, "Unable to allocate"
-			" buffer for extended attribute ");
-		return OCFS2_ET_NO_MEMORY;
-	}
-	umap->um_size = xi->max_offset;
-	INIT_LIST_HEAD(&umap->um_areas);
+	o2fsck_area_init(&amap, xi->max_offset);
+	memset(good, 0, sizeof(good));
 
 	/* set xattr header as used area */
-	set_used_area(umap, 0, sizeof(struct ocfs2_xattr_header), NULL);
+	o2fsck_area_set(&amap, 0, HEADER_SIZE);
 
 	for (i = 0 ; i < xh->xh_count; i++) {
 		struct ocfs2_xattr_entry *xe = &xh->xh_entries[i];
 		uint16_t value_len;
 		uint32_t hash;
 
-		if (check_area_fits(umap, XE_OFFSET(xh, xe), ENTRY_SIZE)) {
+		if (o2fsck_area_fits(&amap, XE_OFFSET(xh, xe), ENTRY_SIZE)) {
 			if (!prompt(ost, PY, PR_XATTR_ENTRY_INVALID,
 				    "Extended attribute entry in %s #%"
 				    PRIu64" refers to a used area at %u,"
@@ -298,11 +178,11 @@ static errcode_t check_xattr_entry(o2fsck_state *ost,
 		}
 
 		/* mark the entry area as used*/
-		set_used_area(umap, XE_OFFSET(xh, xe), ENTRY_SIZE, xe);
+		o2fsck_area_set(&amap, XE_OFFSET(xh, xe), ENTRY_SIZE);
 		/* get the value's real size in inode, block or bucket */
 		value_len = ocfs2_xattr_value_real_size(xe->xe_name_len,
 							xe->xe_value_size);
-		if (check_area_fits(umap, xe->xe_name_offset, value_len)) {
+		if (o2fsck_area_fits(&amap, xe->xe_name_offset, value_len)) {
 			if (!prompt(ost, PY, PR_XATTR_VALUE_INVALID,
 				    "Extended attribute entry in %s #%"PRIu64
 				    " refers to a used area at %u,"
@@ -312,14 +192,15 @@ static errcode_t check_xattr_entry(o2fsck_state *ost,
 				ret = -1;
 				break;
 			} else {
-				clear_used_area(umap, XE_OFFSET(xh, xe),
-						ENTRY_SIZE);
+				o2fsck_area_clear(&amap, XE_OFFSET(xh, xe),
+						  ENTRY_SIZE);
 				goto wipe_entry;
 			}
 		}
 
 		/* mark the value area as used */
-		set_used_area(umap, xe->xe_name_offset, value_len, NULL);
+		o2fsck_area_set(&amap, xe->xe_name_offset, value_len);
+		ocfs2_set_bit(i, good);
 
 		/* check and fix name hash */
 		hash = ocfs2_xattr_name_hash(
@@ -347,25 +228,23 @@ wipe_entry:
 	}
 
 	if (*changed && xh->xh_count != count) {
-		struct used_area *area = NULL;
-		struct list_head *ua, *ua2;
 		/*
-		 * according to used map, remove bad entries from entry area,
-		 * and left the name+value in the object.
+		 * remove bad entries from entry area, and left the
+		 * name+value in the object.  Good entries only move
+		 * towards the front, so we can compact in place.
 		 */
-		i = 0;
-		list_for_each_safe(ua, ua2, &umap->um_areas) {
-			area = list_entry(ua, struct used_area, ua_list);
-			if (!area->ua_xe_valid)
+		for (i = 0, j = 0; i < xh->xh_count; i++) {
+			if (i >= (sizeof(good) * 8) ||
+			    !ocfs2_test_bit(i, good))
 				continue;
-			memcpy(&xh->xh_entries[i], &area->ua_xe, ENTRY_SIZE);
-			i++;
+			if (i != j)
+				memcpy(&xh->xh_entries[j], &xh->xh_entries[i],
+				       ENTRY_SIZE);
+			j++;
 		}
-		xh->xh_count = i;
+		xh->xh_count = j;
 	}
 
-	free_used_map(umap);
-	free(umap);
 	return ret;
 }
 
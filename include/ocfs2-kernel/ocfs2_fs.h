@@ -221,6 +221,24 @@
 /* Adding directory block trailers */
 #define OCFS2_TUNEFS_INPROG_DIR_TRAILER		0x0002
 
+/*
+ * The flags below, the s_tunefs_cursor fields and s_tunefs_csize_record
+ * are only used by ocfs2-tools.  They must be reserved in the kernel's
+ * copy of this file before it uses the same bits or s_reserved2 words.
+ */
+
+/* Moving suballocator groups between slots */
+#define OCFS2_TUNEFS_INPROG_REBALANCE		0x0004
+
+/* Converting inodes; s_tunefs_cursor says where to resume */
+#define OCFS2_TUNEFS_INPROG_INODE_PASS		0x0008
+
+/* Changing the cluster size; s_tunefs_csize_record says how far it got */
+#define OCFS2_TUNEFS_INPROG_CLUSTER_SIZE	0x0010
+
+/* How many inode passes s_tunefs_cursor_passes can describe */
+#define OCFS2_TUNEFS_CURSOR_MAX_PASSES		5
+
 /*
  * Flags on ocfs2_dinode.i_flags
  */
@@ -665,7 +683,19 @@ struct ocfs2_super_block {
 	__le16 s_reserved0;
 	__le32 s_dx_seed[3];		/* seed[0-2] for dx dir hash.
 					 * s_uuid_hash serves as seed[3]. */
-/*C0*/  __le64 s_reserved2[15];		/* Fill out superblock */
+/*C0*/  __le64 s_tunefs_cursor;		/* Last inode group converted by
+					   an interrupted tunefs.  Only
+					   valid if s_tunefs_flag has
+					   OCFS2_TUNEFS_INPROG_INODE_PASS */
+	__le32 s_tunefs_cursor_inodes;	/* Inode alloc bits at that time */
+	__le32 s_tunefs_cursor_passes[OCFS2_TUNEFS_CURSOR_MAX_PASSES];
+					/* crc32 of each pass name */
+/*E0*/	__le64 s_tunefs_csize_record;	/* First block of the record kept
+					   by an interrupted cluster size
+					   change.  Only valid if
+					   s_tunefs_flag has
+					   OCFS2_TUNEFS_INPROG_CLUSTER_SIZE */
+	__le64 s_reserved2[10];		/* Fill out superblock */
 /*140*/
 
 	/*
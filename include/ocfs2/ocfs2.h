@@ -70,7 +70,10 @@
 
 #define OCFS2_LIB_FEATURE_COMPAT_SUPP		OCFS2_FEATURE_COMPAT_SUPP
 
-#define OCFS2_LIB_ABORTED_TUNEFS_SUPP		OCFS2_TUNEFS_INPROG_REMOVE_SLOT
+#define OCFS2_LIB_ABORTED_TUNEFS_SUPP		(OCFS2_TUNEFS_INPROG_REMOVE_SLOT | \
+						 OCFS2_TUNEFS_INPROG_REBALANCE | \
+						 OCFS2_TUNEFS_INPROG_INODE_PASS | \
+						 OCFS2_TUNEFS_INPROG_CLUSTER_SIZE)
 
 
 /* define OCFS2_SB for ocfs2-tools */
@@ -93,6 +96,10 @@
 						 * information on block
 						 * reads. */
 #define OCFS2_FLAG_HARD_RO            0x0400
+#define OCFS2_FLAG_DEFER_ALLOC_WRITES 0x0800	/* Frees only update the
+						 * in-memory allocators.
+						 * See
+						 * ocfs2_defer_allocator_writes() */
 
 
 /* Return flags for the directory iterator functions */
@@ -145,6 +152,10 @@ typedef struct _ocfs2_cached_dquot ocfs2_cached_dquot;
 typedef struct _io_channel io_channel;
 typedef struct _ocfs2_inode_scan ocfs2_inode_scan;
 typedef struct _ocfs2_dir_scan ocfs2_dir_scan;
+typedef struct _ocfs2_dir_revmap ocfs2_dir_revmap;
+typedef struct _ocfs2_refcount_session ocfs2_refcount_session;
+typedef struct _ocfs2_write_session ocfs2_write_session;
+typedef struct _ocfs2_alloc_window ocfs2_alloc_window;
 typedef struct _ocfs2_bitmap ocfs2_bitmap;
 typedef struct _ocfs2_devices ocfs2_devices;
 
@@ -193,6 +204,14 @@ struct _ocfs2_filesys {
 	uint64_t fs_first_cg_blkno;
 	char uuid_str[OCFS2_VOL_UUID_LEN * 2 + 1];
 
+	/*
+	 * Large cluster allocations prefer to start on a cluster that
+	 * is fs_stripe_offset modulo fs_stripe_clusters.  Zero means
+	 * no preference.
+	 */
+	uint32_t fs_stripe_clusters;
+	uint32_t fs_stripe_offset;
+
 	/* Allocators */
 	ocfs2_cached_inode *fs_cluster_alloc;
 	ocfs2_cached_inode **fs_inode_allocs;
@@ -317,6 +336,7 @@ struct ocfs2_io_stats {
 	uint32_t is_cache_misses;
 	uint32_t is_cache_inserts;
 	uint32_t is_cache_removes;
+	int is_cache_backing;		/* IO_CACHE_* actually obtained */
 };
 
 void io_get_stats(io_channel *channel, struct ocfs2_io_stats *stats);
@@ -350,6 +370,21 @@ size_t io_get_cache_size(io_channel *channel);
 errcode_t io_share_cache(io_channel *from, io_channel *to);
 errcode_t io_mlock_cache(io_channel *channel);
 void io_destroy_cache(io_channel *channel);
+int io_block_validated(io_channel *channel, int64_t blkno);
+void io_set_block_validated(io_channel *channel, int64_t blkno);
+
+/*
+ * How io_init_cache() should back the cache memory.  Each is a request;
+ * the cache falls back to ordinary pages when the system can't oblige,
+ * and io_get_stats() reports what was actually obtained.
+ */
+#define IO_CACHE_HUGETLB		0x0001	/* Explicit huge pages */
+#define IO_CACHE_THP			0x0002	/* Transparent huge pages */
+#define IO_CACHE_NUMA_INTERLEAVE	0x0004	/* Spread over all nodes */
+#define IO_CACHE_NUMA_LOCAL		0x0008	/* Prefer the local node */
+void io_set_cache_backing(io_channel *channel, int flags);
+errcode_t io_parse_cache_backing(const char *str, int *flags);
+void io_snprint_cache_backing(char *buf, size_t len, int flags);
 
 
 struct io_vec_unit {
@@ -486,9 +521,27 @@ errcode_t ocfs2_increase_refcount(ocfs2_filesys *fs, uint64_t ino,
 errcode_t ocfs2_decrease_refcount(ocfs2_filesys *fs,
 				  uint64_t ino, uint32_t cpos,
 				  uint32_t len, int delete);
+errcode_t ocfs2_refcount_session_begin(ocfs2_filesys *fs,
+				       uint64_t refcount_loc,
+				       ocfs2_refcount_session **ret_rs);
+errcode_t ocfs2_refcount_session_increase(ocfs2_refcount_session *rs,
+					  uint64_t cpos, uint32_t len);
+errcode_t ocfs2_refcount_session_decrease(ocfs2_refcount_session *rs,
+					  uint64_t cpos, uint32_t len,
+					  int delete);
+errcode_t ocfs2_refcount_session_get(ocfs2_refcount_session *rs,
+				     uint64_t cpos, uint32_t len,
+				     uint32_t *refcount, uint32_t *clusters);
+errcode_t ocfs2_refcount_session_commit(ocfs2_refcount_session *rs);
+void ocfs2_refcount_session_free(ocfs2_refcount_session *rs);
 errcode_t ocfs2_refcount_cow(ocfs2_cached_inode *cinode,
 			     uint32_t cpos, uint32_t write_len,
 			     uint32_t max_cpos);
+errcode_t ocfs2_refcount_unshare_extent(ocfs2_cached_inode *cinode,
+					ocfs2_refcount_session *rs,
+					uint32_t cpos, uint32_t len,
+					uint32_t p_cluster,
+					uint32_t new_cluster);
 errcode_t ocfs2_refcount_cow_xattr(ocfs2_cached_inode *ci,
 				   char *xe_buf,
 				   uint64_t xe_blkno,
@@ -615,6 +668,15 @@ void ocfs2_close_inode_scan(ocfs2_inode_scan *scan);
 errcode_t ocfs2_get_next_inode(ocfs2_inode_scan *scan,
 			       uint64_t *blkno, char *inode);
 uint64_t ocfs2_get_max_inode_count(ocfs2_inode_scan *scan);
+/*
+ * Non-zero when the inode just returned was the last in its group.
+ * *group_blkno is set to the group descriptor.
+ */
+int ocfs2_inode_scan_group_done(ocfs2_inode_scan *scan,
+				uint64_t *group_blkno);
+/* Move a new scan past every group up to and including group_blkno */
+errcode_t ocfs2_inode_scan_seek_group(ocfs2_inode_scan *scan,
+				      uint64_t group_blkno);
 
 errcode_t ocfs2_open_dir_scan(ocfs2_filesys *fs, uint64_t dir, int flags,
 			      ocfs2_dir_scan **ret_scan);
@@ -622,6 +684,19 @@ void ocfs2_close_dir_scan(ocfs2_dir_scan *scan);
 errcode_t ocfs2_get_next_dir_entry(ocfs2_dir_scan *scan,
 				   struct ocfs2_dir_entry *dirent);
 
+errcode_t ocfs2_dir_revmap_build(ocfs2_filesys *fs,
+				 int (*want)(uint64_t ino, void *priv_data),
+				 void *priv_data,
+				 ocfs2_dir_revmap **ret_map);
+void ocfs2_dir_revmap_free(ocfs2_dir_revmap *map);
+uint64_t ocfs2_dir_revmap_bad_blocks(ocfs2_dir_revmap *map);
+errcode_t ocfs2_dir_revmap_iterate(ocfs2_dir_revmap *map, uint64_t ino,
+				   int (*func)(uint64_t ino,
+					       const char *path,
+					       int file_type,
+					       void *priv_data),
+				   void *priv_data);
+
 errcode_t ocfs2_cluster_bitmap_new(ocfs2_filesys *fs,
 				   const char *description,
 				   ocfs2_bitmap **ret_bitmap);
@@ -645,6 +720,10 @@ uint64_t ocfs2_bitmap_get_set_bits(ocfs2_bitmap *bitmap);
 errcode_t ocfs2_bitmap_alloc_range(ocfs2_bitmap *bitmap, uint64_t min,
 				   uint64_t len, uint64_t *first_bit,
 				   uint64_t *bits_found);
+errcode_t ocfs2_bitmap_alloc_range_aligned(ocfs2_bitmap *bitmap,
+					   uint64_t len, uint64_t align,
+					   uint64_t align_offset,
+					   uint64_t *first_bit);
 errcode_t ocfs2_bitmap_clear_range(ocfs2_bitmap *bitmap, uint64_t len, 
 				   uint64_t first_bit);
 
@@ -653,6 +732,15 @@ errcode_t ocfs2_get_device_size(const char *file, int blocksize,
 
 errcode_t ocfs2_get_device_sectsize(const char *file, int *sectsize);
 
+struct ocfs2_device_topology {
+	uint32_t dt_min_io;		/* Minimum I/O size, eg stripe unit */
+	uint32_t dt_opt_io;		/* Optimal I/O size, eg stripe width */
+	uint32_t dt_align_offset;	/* Byte offset of the first aligned
+					   sector */
+};
+errcode_t ocfs2_get_device_topology(const char *file,
+				    struct ocfs2_device_topology *topo);
+
 errcode_t ocfs2_check_if_mounted(const char *file, int *mount_flags);
 errcode_t ocfs2_check_mount_point(const char *device, int *mount_flags,
 		                  char *mtpt, int mtlen);
@@ -701,6 +789,12 @@ errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
 			    uint64_t *gd_blkno,
 			    uint16_t *suballoc_bit,
 			    uint64_t *bitno);
+errcode_t ocfs2_chain_alloc_near(ocfs2_filesys *fs,
+				 ocfs2_cached_inode *cinode,
+				 uint64_t goal,
+				 uint64_t *gd_blkno,
+				 uint16_t *suballoc_bit,
+				 uint64_t *bitno);
 errcode_t ocfs2_chain_free(ocfs2_filesys *fs,
 			   ocfs2_cached_inode *cinode,
 			   uint64_t bitno);
@@ -710,6 +804,12 @@ errcode_t ocfs2_chain_alloc_range(ocfs2_filesys *fs,
 				  uint64_t requested,
 				  uint64_t *start_bit,
 				  uint64_t *bits_found);
+errcode_t ocfs2_chain_alloc_range_aligned(ocfs2_filesys *fs,
+					  ocfs2_cached_inode *cinode,
+					  uint64_t len,
+					  uint64_t align,
+					  uint64_t align_offset,
+					  uint64_t *start_bit);
 errcode_t ocfs2_chain_free_range(ocfs2_filesys *fs,
 				 ocfs2_cached_inode *cinode,
 				 uint64_t len,
@@ -755,9 +855,13 @@ void ocfs2_dinode_new_extent_list(ocfs2_filesys *fs, struct ocfs2_dinode *di);
 void ocfs2_set_inode_data_inline(ocfs2_filesys *fs, struct ocfs2_dinode *di);
 errcode_t ocfs2_convert_inline_data_to_extents(ocfs2_cached_inode *ci);
 errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode);
+errcode_t ocfs2_new_inode_in_slot(ocfs2_filesys *fs, uint64_t *ino,
+				  int mode, int slot, uint64_t goal);
 errcode_t ocfs2_new_system_inode(ocfs2_filesys *fs, uint64_t *ino, int mode, int flags);
 errcode_t ocfs2_delete_inode(ocfs2_filesys *fs, uint64_t ino);
 errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno);
+errcode_t ocfs2_new_extent_block_in_slot(ocfs2_filesys *fs, uint64_t *blkno,
+					 int slot, uint64_t goal);
 errcode_t ocfs2_new_dx_root(ocfs2_filesys *fs, struct ocfs2_dinode *di, uint64_t *dr_blkno);
 errcode_t ocfs2_delete_extent_block(ocfs2_filesys *fs, uint64_t blkno);
 errcode_t ocfs2_delete_dx_root(ocfs2_filesys *fs, uint64_t dr_blkno);
@@ -803,17 +907,49 @@ errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
 			     uint32_t requested,
 			     uint64_t *start_blkno,
 			     uint32_t *clusters_found);
+errcode_t ocfs2_new_clusters_aligned(ocfs2_filesys *fs,
+				     uint32_t clusters,
+				     uint32_t align,
+				     uint64_t *start_blkno);
+void ocfs2_set_stripe_geometry(ocfs2_filesys *fs, uint64_t stripe_bytes,
+			       uint64_t offset_bytes);
 errcode_t ocfs2_test_cluster_allocated(ocfs2_filesys *fs, uint32_t cpos,
 				       int *is_allocated);
 errcode_t ocfs2_new_specific_cluster(ocfs2_filesys *fs, uint32_t cpos);
 errcode_t ocfs2_free_clusters(ocfs2_filesys *fs,
 			      uint32_t len,
 			      uint64_t start_blkno);
+errcode_t ocfs2_alloc_window_claim(ocfs2_filesys *fs, int type, int slot,
+				   uint64_t goal, uint32_t bits,
+				   ocfs2_alloc_window **ret_aw);
+uint32_t ocfs2_alloc_window_avail(ocfs2_alloc_window *aw);
+errcode_t ocfs2_alloc_window_new_clusters(ocfs2_filesys *fs,
+					  ocfs2_alloc_window *aw,
+					  uint32_t min,
+					  uint32_t requested,
+					  uint64_t *start_blkno,
+					  uint32_t *clusters_found);
+errcode_t ocfs2_alloc_window_new_inode(ocfs2_filesys *fs,
+				       ocfs2_alloc_window *aw,
+				       uint64_t *ino, int mode);
+errcode_t ocfs2_alloc_window_new_extent_block(ocfs2_filesys *fs,
+					      ocfs2_alloc_window *aw,
+					      uint64_t *blkno);
+errcode_t ocfs2_alloc_window_release(ocfs2_filesys *fs,
+				     ocfs2_alloc_window *aw);
 errcode_t ocfs2_test_clusters(ocfs2_filesys *fs,
 			      uint32_t len,
 			      uint64_t start_blkno,
 			      int test,
 			      int *matches);
+/*
+ * Between these two calls, freeing clusters, inodes and extent blocks
+ * only clears bits in the in-memory allocators instead of writing the
+ * allocator out each time.  ocfs2_write_deferred_allocators() writes
+ * each allocator that changed once and ends the deferral.
+ */
+void ocfs2_defer_allocator_writes(ocfs2_filesys *fs);
+errcode_t ocfs2_write_deferred_allocators(ocfs2_filesys *fs);
 
 errcode_t ocfs2_lookup(ocfs2_filesys *fs, uint64_t dir, const char *name,
 		       int namelen, char *buf, uint64_t *inode);
@@ -833,6 +969,14 @@ errcode_t ocfs2_file_read(ocfs2_cached_inode *ci, void *buf, uint32_t count,
 errcode_t ocfs2_file_write(ocfs2_cached_inode *ci, void *buf, uint32_t count,
 			   uint64_t offset, uint32_t *wrote);
 
+errcode_t ocfs2_write_session_begin(ocfs2_cached_inode *ci,
+				    ocfs2_write_session **ret_ws);
+errcode_t ocfs2_write_session_write(ocfs2_write_session *ws,
+				    void *buf, uint32_t count,
+				    uint64_t offset, uint32_t *wrote);
+errcode_t ocfs2_write_session_flush(ocfs2_write_session *ws);
+void ocfs2_write_session_free(ocfs2_write_session *ws);
+
 errcode_t ocfs2_fill_cluster_desc(ocfs2_filesys *fs,
 				  struct o2cb_cluster_desc *desc);
 errcode_t ocfs2_set_cluster_desc(ocfs2_filesys *fs,
@@ -942,6 +1086,9 @@ void ocfs2_compute_meta_ecc(ocfs2_filesys *fs, void *data,
 			    struct ocfs2_block_check *bc);
 errcode_t ocfs2_validate_meta_ecc(ocfs2_filesys *fs, void *data,
 				  struct ocfs2_block_check *bc);
+errcode_t ocfs2_validate_cached_meta_ecc(ocfs2_filesys *fs, uint64_t blkno,
+					 void *data,
+					 struct ocfs2_block_check *bc);
 /* Low level checksum compute functions.  Use the high-level ones. */
 extern void ocfs2_block_check_compute(void *data, size_t blocksize,
 				      struct ocfs2_block_check *bc);
@@ -33,6 +33,7 @@
 
 static errcode_t ocfs2_chain_alloc_with_io(ocfs2_filesys *fs,
 					   ocfs2_cached_inode *cinode,
+					   uint64_t goal,
 					   uint64_t *gd_blkno,
 					   uint16_t *suballoc_bit,
 					   uint64_t *bitno)
@@ -45,7 +46,8 @@ static errcode_t ocfs2_chain_alloc_with_io(ocfs2_filesys *fs,
 			return ret;
 	}
 
-	ret = ocfs2_chain_alloc(fs, cinode, gd_blkno, suballoc_bit, bitno);
+	ret = ocfs2_chain_alloc_near(fs, cinode, goal, gd_blkno,
+				     suballoc_bit, bitno);
 	if (ret)
 		return ret;
 
@@ -68,6 +70,9 @@ static errcode_t ocfs2_chain_free_with_io(ocfs2_filesys *fs,
 	if (ret)
 		return ret;
 
+	if (fs->fs_flags & OCFS2_FLAG_DEFER_ALLOC_WRITES)
+		return 0;
+
 	return ocfs2_write_chain_allocator(fs, cinode);
 }
 
@@ -220,20 +225,32 @@ static void ocfs2_init_inode(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 }
 
 static void ocfs2_init_eb(ocfs2_filesys *fs,
-			  struct ocfs2_extent_block *eb,
+			  struct ocfs2_extent_block *eb, int slot,
 			  uint64_t gd_blkno, uint16_t suballoc_bit,
 			  uint64_t blkno)
 {
 	strcpy((char *)eb->h_signature, OCFS2_EXTENT_BLOCK_SIGNATURE);
 	eb->h_fs_generation = fs->fs_super->i_fs_generation;
 	eb->h_blkno = blkno;
-	eb->h_suballoc_slot = 0;
+	eb->h_suballoc_slot = slot;
 	eb->h_suballoc_loc = gd_blkno;
 	eb->h_suballoc_bit = suballoc_bit;
 	eb->h_list.l_count = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
 }
 
-errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode)
+static int ocfs2_valid_slot(ocfs2_filesys *fs, int slot)
+{
+	return (slot >= 0) &&
+		(slot < OCFS2_RAW_SB(fs->fs_super)->s_max_slots);
+}
+
+/*
+ * Allocates from @slot's inode allocator, as close to the block @goal
+ * as its groups allow.  Callers pass the parent directory so that
+ * related inodes share groups.  A zero @goal is first-fit.
+ */
+errcode_t ocfs2_new_inode_in_slot(ocfs2_filesys *fs, uint64_t *ino,
+				  int mode, int slot, uint64_t goal)
 {
 	errcode_t ret;
 	char *buf;
@@ -241,23 +258,27 @@ errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode)
 	uint16_t suballoc_bit;
 	struct ocfs2_dinode *di;
 
+	if (!ocfs2_valid_slot(fs, slot))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
 	ret = ocfs2_malloc_block(fs->fs_io, &buf);
 	if (ret)
 		return ret;
 
-	ret = ocfs2_load_allocator(fs, INODE_ALLOC_SYSTEM_INODE, 0,
-				   &fs->fs_inode_allocs[0]);
+	ret = ocfs2_load_allocator(fs, INODE_ALLOC_SYSTEM_INODE, slot,
+				   &fs->fs_inode_allocs[slot]);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[0],
+	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[slot], goal,
 					&gd_blkno, &suballoc_bit, ino);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
-		ret = ocfs2_chain_add_group(fs, fs->fs_inode_allocs[0]);
+		ret = ocfs2_chain_add_group(fs, fs->fs_inode_allocs[slot]);
 		if (ret)
 			goto out;
-		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[0],
-						&gd_blkno, &suballoc_bit, ino);
+		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_inode_allocs[slot],
+						goal, &gd_blkno,
+						&suballoc_bit, ino);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -265,7 +286,7 @@ errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode)
 
 	memset(buf, 0, fs->fs_blocksize);
 	di = (struct ocfs2_dinode *)buf;
-	ocfs2_init_inode(fs, di, 0, gd_blkno, suballoc_bit,
+	ocfs2_init_inode(fs, di, slot, gd_blkno, suballoc_bit,
 			 *ino, mode, OCFS2_VALID_FL);
 
 	ret = ocfs2_write_inode(fs, *ino, buf);
@@ -278,6 +299,11 @@ out:
 	return ret;
 }
 
+errcode_t ocfs2_new_inode(ocfs2_filesys *fs, uint64_t *ino, int mode)
+{
+	return ocfs2_new_inode_in_slot(fs, ino, mode, 0, 0);
+}
+
 errcode_t ocfs2_new_system_inode(ocfs2_filesys *fs, uint64_t *ino,
 				 int mode, int flags)
 {
@@ -296,13 +322,13 @@ errcode_t ocfs2_new_system_inode(ocfs2_filesys *fs, uint64_t *ino,
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc,
+	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc, 0,
 					&gd_blkno, &suballoc_bit, ino);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_system_inode_alloc);
 		if (ret)
 			goto out;
-		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc,
+		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_system_inode_alloc, 0,
 						&gd_blkno, &suballoc_bit, ino);
 		if (ret)
 			goto out;
@@ -397,7 +423,9 @@ errcode_t ocfs2_test_inode_allocated(ocfs2_filesys *fs, uint64_t blkno,
 	return ret;
 }
 
-errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
+/* As ocfs2_new_inode_in_slot(), usually with the tree's owner as @goal */
+errcode_t ocfs2_new_extent_block_in_slot(ocfs2_filesys *fs, uint64_t *blkno,
+					 int slot, uint64_t goal)
 {
 	errcode_t ret;
 	char *buf;
@@ -405,24 +433,27 @@ errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
 	uint16_t suballoc_bit;
 	struct ocfs2_extent_block *eb;
 
+	if (!ocfs2_valid_slot(fs, slot))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
 	ret = ocfs2_malloc_block(fs->fs_io, &buf);
 	if (ret)
 		return ret;
 
 	ret = ocfs2_load_allocator(fs, EXTENT_ALLOC_SYSTEM_INODE,
-			   	   0, &fs->fs_eb_allocs[0]);
+			   	   slot, &fs->fs_eb_allocs[slot]);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
+	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot], goal,
 					&gd_blkno, &suballoc_bit, blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
-		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[0]);
+		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[slot]);
 		if (ret)
 			goto out;
-		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-						&gd_blkno, &suballoc_bit,
-						blkno);
+		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot],
+						goal, &gd_blkno,
+						&suballoc_bit, blkno);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -430,7 +461,7 @@ errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
 
 	memset(buf, 0, fs->fs_blocksize);
 	eb = (struct ocfs2_extent_block *)buf;
-	ocfs2_init_eb(fs, eb, gd_blkno, suballoc_bit, *blkno);
+	ocfs2_init_eb(fs, eb, slot, gd_blkno, suballoc_bit, *blkno);
 
 	ret = ocfs2_write_extent_block(fs, *blkno, buf);
 
@@ -440,6 +471,11 @@ out:
 	return ret;
 }
 
+errcode_t ocfs2_new_extent_block(ocfs2_filesys *fs, uint64_t *blkno)
+{
+	return ocfs2_new_extent_block_in_slot(fs, blkno, 0, 0);
+}
+
 errcode_t ocfs2_delete_xattr_block(ocfs2_filesys *fs, uint64_t blkno)
 {
 	errcode_t ret;
@@ -574,15 +610,16 @@ errcode_t ocfs2_new_refcount_block(ocfs2_filesys *fs, uint64_t *blkno,
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
+	/* Keep a tree's blocks near its root */
+	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0], root_blkno,
 					&gd_blkno, &suballoc_bit, blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[0]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[0],
-						&gd_blkno, &suballoc_bit,
-						blkno);
+						root_blkno, &gd_blkno,
+						&suballoc_bit, blkno);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -688,15 +725,17 @@ errcode_t ocfs2_new_dx_root(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
+	/* Next to the directory it indexes */
 	ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot],
-					&gd_blkno, &suballoc_bit, dr_blkno);
+					di->i_blkno, &gd_blkno,
+					&suballoc_bit, dr_blkno);
 	if (ret == OCFS2_ET_BIT_NOT_FOUND) {
 		ret = ocfs2_chain_add_group(fs, fs->fs_eb_allocs[slot]);
 		if (ret)
 			goto out;
 		ret = ocfs2_chain_alloc_with_io(fs, fs->fs_eb_allocs[slot],
-						&gd_blkno, &suballoc_bit,
-						dr_blkno);
+						di->i_blkno, &gd_blkno,
+						&suballoc_bit, dr_blkno);
 		if (ret)
 			goto out;
 	} else if (ret)
@@ -766,8 +805,26 @@ errcode_t ocfs2_new_clusters(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
-	ret = ocfs2_chain_alloc_range(fs, fs->fs_cluster_alloc, min, requested,
-				      &start_bit, &found);
+	/*
+	 * Requests of a full stripe or more first look for a free run
+	 * that starts on a stripe boundary, so that they don't cause
+	 * read-modify-write on the storage.  Whatever stops that, even
+	 * a request larger than the bitmap, falls back to a plain search
+	 * that may return less.
+	 */
+	ret = OCFS2_ET_BIT_NOT_FOUND;
+	if (fs->fs_stripe_clusters > 1 &&
+	    requested >= fs->fs_stripe_clusters) {
+		ret = ocfs2_chain_alloc_range_aligned(fs, fs->fs_cluster_alloc,
+						      requested,
+						      fs->fs_stripe_clusters,
+						      fs->fs_stripe_offset,
+						      &start_bit);
+		found = requested;
+	}
+	if (ret)
+		ret = ocfs2_chain_alloc_range(fs, fs->fs_cluster_alloc, min,
+					      requested, &start_bit, &found);
 	if (ret)
 		goto out;
 
@@ -785,6 +842,58 @@ out:
 	return ret;
 }
 
+/*
+ * Unlike ocfs2_new_clusters(), this never settles for less or for an
+ * unaligned run.  The run starts on a multiple of align clusters.
+ */
+errcode_t ocfs2_new_clusters_aligned(ocfs2_filesys *fs,
+				     uint32_t clusters,
+				     uint32_t align,
+				     uint64_t *start_blkno)
+{
+	errcode_t ret;
+	uint64_t start_bit;
+
+	ret = ocfs2_load_allocator(fs, GLOBAL_BITMAP_SYSTEM_INODE,
+				   0, &fs->fs_cluster_alloc);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_chain_alloc_range_aligned(fs, fs->fs_cluster_alloc,
+					      clusters, align, 0, &start_bit);
+	if (ret)
+		goto out;
+
+	*start_blkno = ocfs2_clusters_to_blocks(fs, start_bit);
+	ret = ocfs2_write_chain_allocator(fs, fs->fs_cluster_alloc);
+	if (ret)
+		ocfs2_free_clusters(fs, clusters, *start_blkno);
+
+out:
+	return ret;
+}
+
+/*
+ * Sets the alignment ocfs2_new_clusters() prefers for large requests.
+ * A stripe that is not a whole number of clusters, or an offset that
+ * doesn't fall on a cluster, disables it.
+ */
+void ocfs2_set_stripe_geometry(ocfs2_filesys *fs, uint64_t stripe_bytes,
+			       uint64_t offset_bytes)
+{
+	fs->fs_stripe_clusters = 0;
+	fs->fs_stripe_offset = 0;
+
+	if (stripe_bytes <= fs->fs_clustersize ||
+	    (stripe_bytes % fs->fs_clustersize) ||
+	    (offset_bytes % fs->fs_clustersize))
+		return;
+
+	fs->fs_stripe_clusters = stripe_bytes / fs->fs_clustersize;
+	fs->fs_stripe_offset = (offset_bytes / fs->fs_clustersize) %
+		fs->fs_stripe_clusters;
+}
+
 errcode_t ocfs2_test_cluster_allocated(ocfs2_filesys *fs, uint32_t cpos,
 				       int *is_allocated)
 {
@@ -840,12 +949,64 @@ errcode_t ocfs2_free_clusters(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
+	if (fs->fs_flags & OCFS2_FLAG_DEFER_ALLOC_WRITES)
+		goto out;
+
 	/* XXX OK, it's bad if we can't revert this after the io fails */
 	ret = ocfs2_write_chain_allocator(fs, fs->fs_cluster_alloc);
 out:
 	return ret;
 }
 
+void ocfs2_defer_allocator_writes(ocfs2_filesys *fs)
+{
+	fs->fs_flags |= OCFS2_FLAG_DEFER_ALLOC_WRITES;
+}
+
+static errcode_t ocfs2_write_loaded_allocator(ocfs2_filesys *fs,
+					      ocfs2_cached_inode *cinode)
+{
+	/* Writing a clean allocator is a no-op */
+	if (!cinode || !cinode->ci_chains)
+		return 0;
+
+	return ocfs2_write_chain_allocator(fs, cinode);
+}
+
+errcode_t ocfs2_write_deferred_allocators(ocfs2_filesys *fs)
+{
+	errcode_t ret, tmp;
+	int i, max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+
+	fs->fs_flags &= ~OCFS2_FLAG_DEFER_ALLOC_WRITES;
+
+	ret = ocfs2_write_loaded_allocator(fs, fs->fs_cluster_alloc);
+
+	tmp = ocfs2_write_loaded_allocator(fs, fs->fs_system_inode_alloc);
+	if (!ret)
+		ret = tmp;
+	tmp = ocfs2_write_loaded_allocator(fs, fs->fs_system_eb_alloc);
+	if (!ret)
+		ret = tmp;
+
+	for (i = 0; i < max_slots; i++) {
+		if (fs->fs_inode_allocs) {
+			tmp = ocfs2_write_loaded_allocator(fs,
+							fs->fs_inode_allocs[i]);
+			if (!ret)
+				ret = tmp;
+		}
+		if (fs->fs_eb_allocs) {
+			tmp = ocfs2_write_loaded_allocator(fs,
+							fs->fs_eb_allocs[i]);
+			if (!ret)
+				ret = tmp;
+		}
+	}
+
+	return ret;
+}
+
 /*
  * Test whether clusters have the specified value in the bitmap.
  * test: expected value
@@ -888,6 +1049,349 @@ out:
 	return ret;
 }
 
+/*
+ * An allocation window is a run of bits that a worker claims from a
+ * shared allocator once and then hands out privately, in the spirit
+ * of the kernel's local alloc.  A cluster window is one contiguous run
+ * of the global bitmap.  An inode or extent block window is a set of
+ * bits from one slot's suballocator, taken near a goal so that they
+ * share a group.  The claimed bits are marked in use on disk, so a
+ * worker that dies holding a window only leaks them until fsck.
+ *
+ * Only ocfs2_alloc_window_claim() and ocfs2_alloc_window_release()
+ * touch the shared allocators, and callers running several workers
+ * must serialize them.  Allocating from a window touches only the
+ * window itself and the new block.
+ */
+struct ocfs2_window_bit {
+	uint64_t wb_bitno;
+	uint64_t wb_gd_blkno;
+	uint16_t wb_suballoc_bit;
+};
+
+struct _ocfs2_alloc_window {
+	int aw_type;		/* System inode type it was claimed from */
+	int aw_slot;
+	ocfs2_cached_inode *aw_cinode;
+	uint32_t aw_bits;	/* Bits claimed */
+	uint32_t aw_used;	/* Bits handed out, always the first ones */
+	uint64_t aw_start_bit;	/* Cluster windows */
+	struct ocfs2_window_bit *aw_suballoc;	/* Suballocator windows */
+};
+
+/* Windows follow ocfs2_defer_allocator_writes() like everyone else */
+static errcode_t ocfs2_write_window_allocator(ocfs2_filesys *fs,
+					      ocfs2_cached_inode *cinode)
+{
+	if (fs->fs_flags & OCFS2_FLAG_DEFER_ALLOC_WRITES)
+		return 0;
+
+	return ocfs2_write_chain_allocator(fs, cinode);
+}
+
+static errcode_t ocfs2_claim_cluster_window(ocfs2_filesys *fs,
+					    ocfs2_alloc_window *aw,
+					    uint32_t bits)
+{
+	errcode_t ret;
+	uint64_t found;
+
+	ret = ocfs2_load_allocator(fs, GLOBAL_BITMAP_SYSTEM_INODE,
+				   0, &fs->fs_cluster_alloc);
+	if (ret)
+		return ret;
+
+	/* Like local alloc, settle for the largest run there is */
+	ret = ocfs2_chain_alloc_range(fs, fs->fs_cluster_alloc, 1, bits,
+				      &aw->aw_start_bit, &found);
+	if (ret)
+		return ret;
+
+	aw->aw_cinode = fs->fs_cluster_alloc;
+	aw->aw_bits = (uint32_t)found;
+
+	ret = ocfs2_write_window_allocator(fs, aw->aw_cinode);
+	if (ret) {
+		ocfs2_chain_free_range(fs, aw->aw_cinode, aw->aw_bits,
+				       aw->aw_start_bit);
+		aw->aw_bits = 0;
+	}
+
+	return ret;
+}
+
+static errcode_t ocfs2_claim_suballoc_window(ocfs2_filesys *fs,
+					     ocfs2_alloc_window *aw,
+					     uint64_t goal, uint32_t bits)
+{
+	errcode_t ret;
+	ocfs2_cached_inode **cinode;
+	struct ocfs2_window_bit *wb;
+	int grown = 0;
+
+	if (aw->aw_type == INODE_ALLOC_SYSTEM_INODE)
+		cinode = &fs->fs_inode_allocs[aw->aw_slot];
+	else
+		cinode = &fs->fs_eb_allocs[aw->aw_slot];
+
+	ret = ocfs2_load_allocator(fs, aw->aw_type, aw->aw_slot, cinode);
+	if (ret)
+		return ret;
+	aw->aw_cinode = *cinode;
+
+	ret = ocfs2_malloc0(sizeof(struct ocfs2_window_bit) * bits,
+			    &aw->aw_suballoc);
+	if (ret)
+		return ret;
+
+	while (aw->aw_bits < bits) {
+		wb = &aw->aw_suballoc[aw->aw_bits];
+		ret = ocfs2_chain_alloc_near(fs, aw->aw_cinode, goal,
+					     &wb->wb_gd_blkno,
+					     &wb->wb_suballoc_bit,
+					     &wb->wb_bitno);
+		if (ret == OCFS2_ET_BIT_NOT_FOUND) {
+			/* Grow an empty allocator once, else run short */
+			if (aw->aw_bits || grown)
+				break;
+			ret = ocfs2_chain_add_group(fs, aw->aw_cinode);
+			if (ret)
+				goto out;
+			grown = 1;
+			continue;
+		} else if (ret)
+			goto out;
+
+		/* Keep the rest of the window in the first bit's group */
+		goal = wb->wb_bitno;
+		aw->aw_bits++;
+	}
+
+	if (!aw->aw_bits) {
+		ret = OCFS2_ET_BIT_NOT_FOUND;
+		goto out;
+	}
+
+	ret = ocfs2_write_window_allocator(fs, aw->aw_cinode);
+
+out:
+	if (ret) {
+		while (aw->aw_bits) {
+			aw->aw_bits--;
+			ocfs2_chain_free(fs, aw->aw_cinode,
+				aw->aw_suballoc[aw->aw_bits].wb_bitno);
+		}
+		ocfs2_free(&aw->aw_suballoc);
+	}
+
+	return ret;
+}
+
+/*
+ * Claims a window of up to @bits bits.  @type is
+ * GLOBAL_BITMAP_SYSTEM_INODE for clusters, or INODE_ALLOC_SYSTEM_INODE
+ * or EXTENT_ALLOC_SYSTEM_INODE for @slot's suballocators, whose bits
+ * are taken near @goal.  The window may come back smaller than asked
+ * for when free space is fragmented.
+ */
+errcode_t ocfs2_alloc_window_claim(ocfs2_filesys *fs, int type, int slot,
+				   uint64_t goal, uint32_t bits,
+				   ocfs2_alloc_window **ret_aw)
+{
+	errcode_t ret;
+	ocfs2_alloc_window *aw = NULL;
+
+	if (!(fs->fs_flags & OCFS2_FLAG_RW))
+		return OCFS2_ET_RO_FILESYS;
+
+	if (!bits)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	if ((type != GLOBAL_BITMAP_SYSTEM_INODE) &&
+	    (((type != INODE_ALLOC_SYSTEM_INODE) &&
+	      (type != EXTENT_ALLOC_SYSTEM_INODE)) ||
+	     !ocfs2_valid_slot(fs, slot)))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_malloc0(sizeof(ocfs2_alloc_window), &aw);
+	if (ret)
+		return ret;
+
+	aw->aw_type = type;
+	aw->aw_slot = slot;
+
+	if (type == GLOBAL_BITMAP_SYSTEM_INODE)
+		ret = ocfs2_claim_cluster_window(fs, aw, bits);
+	else
+		ret = ocfs2_claim_suballoc_window(fs, aw, goal, bits);
+	if (ret) {
+		ocfs2_free(&aw);
+		return ret;
+	}
+
+	*ret_aw = aw;
+	return 0;
+}
+
+/* Bits still free in the window */
+uint32_t ocfs2_alloc_window_avail(ocfs2_alloc_window *aw)
+{
+	return aw->aw_bits - aw->aw_used;
+}
+
+/* As ocfs2_new_clusters(), but carved from the front of a cluster window */
+errcode_t ocfs2_alloc_window_new_clusters(ocfs2_filesys *fs,
+					  ocfs2_alloc_window *aw,
+					  uint32_t min,
+					  uint32_t requested,
+					  uint64_t *start_blkno,
+					  uint32_t *clusters_found)
+{
+	uint32_t avail = ocfs2_alloc_window_avail(aw);
+
+	if (aw->aw_type != GLOBAL_BITMAP_SYSTEM_INODE)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	if (!min)
+		min = 1;
+	if (avail < min)
+		return OCFS2_ET_BIT_NOT_FOUND;
+
+	*clusters_found = ocfs2_min(avail, requested);
+	*start_blkno = ocfs2_clusters_to_blocks(fs,
+						aw->aw_start_bit +
+						aw->aw_used);
+	aw->aw_used += *clusters_found;
+
+	return 0;
+}
+
+static struct ocfs2_window_bit *ocfs2_alloc_window_next(ocfs2_alloc_window *aw)
+{
+	if (!ocfs2_alloc_window_avail(aw))
+		return NULL;
+
+	return &aw->aw_suballoc[aw->aw_used++];
+}
+
+/* As ocfs2_new_inode_in_slot(), from an inode window */
+errcode_t ocfs2_alloc_window_new_inode(ocfs2_filesys *fs,
+				       ocfs2_alloc_window *aw,
+				       uint64_t *ino, int mode)
+{
+	errcode_t ret;
+	char *buf;
+	struct ocfs2_window_bit *wb;
+
+	if (aw->aw_type != INODE_ALLOC_SYSTEM_INODE)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	wb = ocfs2_alloc_window_next(aw);
+	if (!wb) {
+		ret = OCFS2_ET_BIT_NOT_FOUND;
+		goto out;
+	}
+
+	memset(buf, 0, fs->fs_blocksize);
+	ocfs2_init_inode(fs, (struct ocfs2_dinode *)buf, aw->aw_slot,
+			 wb->wb_gd_blkno, wb->wb_suballoc_bit, wb->wb_bitno,
+			 mode, OCFS2_VALID_FL);
+
+	ret = ocfs2_write_inode(fs, wb->wb_bitno, buf);
+	if (ret) {
+		/* Still the last bit handed out, so it goes back */
+		aw->aw_used--;
+		goto out;
+	}
+
+	*ino = wb->wb_bitno;
+
+out:
+	ocfs2_free(&buf);
+
+	return ret;
+}
+
+/* As ocfs2_new_extent_block_in_slot(), from an extent block window */
+errcode_t ocfs2_alloc_window_new_extent_block(ocfs2_filesys *fs,
+					      ocfs2_alloc_window *aw,
+					      uint64_t *blkno)
+{
+	errcode_t ret;
+	char *buf;
+	struct ocfs2_window_bit *wb;
+
+	if (aw->aw_type != EXTENT_ALLOC_SYSTEM_INODE)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	wb = ocfs2_alloc_window_next(aw);
+	if (!wb) {
+		ret = OCFS2_ET_BIT_NOT_FOUND;
+		goto out;
+	}
+
+	memset(buf, 0, fs->fs_blocksize);
+	ocfs2_init_eb(fs, (struct ocfs2_extent_block *)buf, aw->aw_slot,
+		      wb->wb_gd_blkno, wb->wb_suballoc_bit, wb->wb_bitno);
+
+	ret = ocfs2_write_extent_block(fs, wb->wb_bitno, buf);
+	if (ret) {
+		aw->aw_used--;
+		goto out;
+	}
+
+	*blkno = wb->wb_bitno;
+
+out:
+	ocfs2_free(&buf);
+
+	return ret;
+}
+
+/*
+ * Returns the bits the worker never used to their allocator and frees
+ * the window.  Bits already handed out belong to their new owners and
+ * are freed the usual way, e.g. by ocfs2_free_clusters().
+ */
+errcode_t ocfs2_alloc_window_release(ocfs2_filesys *fs,
+				     ocfs2_alloc_window *aw)
+{
+	errcode_t ret = 0;
+	uint32_t i;
+
+	if (!ocfs2_alloc_window_avail(aw))
+		goto out;
+
+	if (aw->aw_type == GLOBAL_BITMAP_SYSTEM_INODE)
+		ret = ocfs2_chain_free_range(fs, aw->aw_cinode,
+					     aw->aw_bits - aw->aw_used,
+					     aw->aw_start_bit + aw->aw_used);
+	else {
+		for (i = aw->aw_used; !ret && (i < aw->aw_bits); i++)
+			ret = ocfs2_chain_free(fs, aw->aw_cinode,
+					       aw->aw_suballoc[i].wb_bitno);
+	}
+	if (ret)
+		goto out;
+
+	ret = ocfs2_write_window_allocator(fs, aw->aw_cinode);
+
+out:
+	if (aw->aw_suballoc)
+		ocfs2_free(&aw->aw_suballoc);
+	ocfs2_free(&aw);
+
+	return ret;
+}
+
 #ifdef DEBUG_EXE
 #include <stdio.h>
 
@@ -896,6 +1400,104 @@ static void print_usage(void)
 	fprintf(stdout, "debug_alloc <newfile> <device>\n");
 }
 
+static errcode_t read_used(ocfs2_filesys *fs, int type, char *buf,
+			   uint32_t *used)
+{
+	errcode_t ret;
+	uint64_t blkno;
+
+	ret = ocfs2_lookup_system_inode(fs, type, 0, &blkno);
+	if (!ret)
+		ret = ocfs2_read_inode(fs, blkno, buf);
+	if (!ret)
+		*used = ((struct ocfs2_dinode *)buf)->id1.bitmap1.i_used;
+
+	return ret;
+}
+
+static errcode_t check_used(ocfs2_filesys *fs, int type, char *buf,
+			    uint32_t expect, const char *what)
+{
+	errcode_t ret;
+	uint32_t used;
+
+	ret = read_used(fs, type, buf, &used);
+	if (!ret && (used != expect)) {
+		fprintf(stderr, "%s: %"PRIu32" bits used on disk, expected "
+			"%"PRIu32"\n", what, used, expect);
+		ret = OCFS2_ET_INTERNAL_FAILURE;
+	}
+
+	return ret;
+}
+
+/*
+ * Claims a window from slot 0's inode allocator or the global bitmap,
+ * uses part of it and releases the rest.  Only the part used may stay
+ * allocated, and with deferred writes nothing reaches the disk until
+ * ocfs2_write_deferred_allocators().
+ */
+static errcode_t test_window(ocfs2_filesys *fs, int type, int defer,
+			     char *buf)
+{
+	errcode_t ret, err;
+	ocfs2_alloc_window *aw;
+	uint32_t before, bits, got = 0;
+	uint64_t blkno = 0;
+
+	ret = read_used(fs, type, buf, &before);
+	if (ret)
+		return ret;
+
+	if (defer)
+		ocfs2_defer_allocator_writes(fs);
+	ret = ocfs2_alloc_window_claim(fs, type, 0, 0, 8, &aw);
+	if (ret)
+		goto out;
+
+	bits = ocfs2_alloc_window_avail(aw);
+	ret = check_used(fs, type, buf, defer ? before : before + bits,
+			 "claim");
+	if (!ret && (type == GLOBAL_BITMAP_SYSTEM_INODE))
+		ret = ocfs2_alloc_window_new_clusters(fs, aw, 1, 3, &blkno,
+						      &got);
+	else if (!ret) {
+		ret = ocfs2_alloc_window_new_inode(fs, aw, &blkno,
+						   0644 | S_IFREG);
+		got = 1;
+	}
+	if (!ret && (ocfs2_alloc_window_avail(aw) != bits - got)) {
+		fprintf(stderr, "window: %"PRIu32" bits left, expected "
+			"%"PRIu32"\n", ocfs2_alloc_window_avail(aw),
+			bits - got);
+		ret = OCFS2_ET_INTERNAL_FAILURE;
+	}
+
+	err = ocfs2_alloc_window_release(fs, aw);
+	if (!ret)
+		ret = err;
+	if (!ret)
+		ret = check_used(fs, type, buf, defer ? before : before + got,
+				 "release");
+
+out:
+	if (defer) {
+		err = ocfs2_write_deferred_allocators(fs);
+		if (!ret)
+			ret = err;
+	}
+	if (!ret)
+		ret = check_used(fs, type, buf, before + got, "write");
+	if (!ret && (type == GLOBAL_BITMAP_SYSTEM_INODE))
+		ret = ocfs2_free_clusters(fs, got, blkno);
+	else if (!ret)
+		ret = ocfs2_delete_inode(fs, blkno);
+	if (!ret)
+		ret = check_used(fs, type, buf, before, "free");
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	errcode_t ret;
@@ -903,6 +1505,7 @@ int main(int argc, char *argv[])
 	char *buf;
 	struct ocfs2_dinode *di;
 	uint64_t blkno;
+	int i;
 
 	if (argc < 3) {
 		print_usage();
@@ -939,6 +1542,17 @@ int main(int argc, char *argv[])
 	if (ret) {
 		com_err(argv[0], ret,
 			"while linking inode %"PRIu64, blkno);
+		goto out_free;
+	}
+
+	for (i = 0; i < 4; i++) {
+		ret = test_window(fs, (i & 1) ? INODE_ALLOC_SYSTEM_INODE :
+				  GLOBAL_BITMAP_SYSTEM_INODE, i >> 1, buf);
+		if (ret) {
+			com_err(argv[0], ret,
+				"while testing allocation windows");
+			break;
+		}
 	}
 
 out_free:
@@ -650,11 +650,64 @@ struct alloc_range_args {
 	ocfs2_bitmap	*ar_bitmap;
 	uint64_t	ar_min_len;
 	uint64_t	ar_len;
+	uint64_t	ar_align;
+	uint64_t	ar_align_offset;
 	uint64_t	ar_first_bit;
 	uint64_t	ar_bits_found;
 	errcode_t	ar_ret;
 };
 
+/*
+ * Looks for ar_len clear bits starting on a bit that is ar_align_offset
+ * modulo ar_align.  There is no best fit; the caller falls back to an
+ * unaligned search.
+ */
+static errcode_t alloc_aligned_func(struct ocfs2_bitmap_region *br,
+				    void *private_data)
+{
+	struct alloc_range_args *ar = private_data;
+	uint64_t bit, skip;
+	int start, end;
+
+	if ((br->br_valid_bits - br->br_set_bits) < ar->ar_len)
+		return 0;
+
+	for (start = br->br_bitmap_start;
+	     start + ar->ar_len <= br->br_total_bits;) {
+		start = ocfs2_find_next_bit_clear(br->br_bitmap,
+						  br->br_total_bits,
+						  start);
+		if (start == br->br_total_bits)
+			break;
+
+		end = ocfs2_find_next_bit_set(br->br_bitmap,
+					      br->br_total_bits,
+					      start);
+
+		bit = br->br_start_bit + start - br->br_bitmap_start;
+		skip = (ar->ar_align_offset + ar->ar_align -
+			(bit % ar->ar_align)) % ar->ar_align;
+		if ((start + skip + ar->ar_len) <= end) {
+			start += skip;
+			end = start + ar->ar_len;
+			ar->ar_first_bit = bit + skip;
+			ar->ar_bits_found = ar->ar_len;
+
+			for (; start < end; start++)
+				set_generic_shared(ar->ar_bitmap, br,
+						   br->br_start_bit + start -
+						   br->br_bitmap_start);
+
+			ar->ar_ret = 0;
+			return OCFS2_ET_ITERATION_COMPLETE;
+		}
+
+		start = end + 1;
+	}
+
+	return 0;
+}
+
 /* Our strategy here to aid discontiguous allocation is to track the
  * largest free regions (which still fit within ar_min_len) and if the
  * max allocation fails, fall back to returning one of those. */
@@ -745,6 +798,39 @@ errcode_t ocfs2_bitmap_alloc_range_generic(ocfs2_bitmap *bitmap,
 	return ret;
 }
 
+/*
+ * Allocates len bits starting on a bit that is align_offset modulo
+ * align.  Only bitmaps using the generic region operations support
+ * this.
+ */
+errcode_t ocfs2_bitmap_alloc_range_aligned(ocfs2_bitmap *bitmap,
+					   uint64_t len, uint64_t align,
+					   uint64_t align_offset,
+					   uint64_t *first_bit)
+{
+	errcode_t ret;
+	struct alloc_range_args ar = {
+		.ar_bitmap = bitmap,
+		.ar_len = len,
+		.ar_align = align,
+		.ar_align_offset = align_offset % (align ? align : 1),
+		.ar_ret = OCFS2_ET_BIT_NOT_FOUND,
+	};
+
+	if (len == 0 || len >= bitmap->b_total_bits || align == 0 ||
+	    bitmap->b_ops->alloc_range != ocfs2_bitmap_alloc_range_generic)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_bitmap_foreach_region(bitmap, alloc_aligned_func, &ar);
+	if (ret == 0)
+		ret = ar.ar_ret;
+
+	if (ret == 0)
+		*first_bit = ar.ar_first_bit;
+
+	return ret;
+}
+
 errcode_t ocfs2_bitmap_clear_range_generic(ocfs2_bitmap *bitmap,
 					   uint64_t len,
 					   uint64_t first_bit)
@@ -333,14 +333,19 @@ void ocfs2_block_check_compute(void *data, size_t blocksize,
  * inline ocfs2_block_check structures.
  *
  * Again, the data passed in should be the on-disk endian.
+ *
+ * *fixed is set if the data only checked out after ECC fixups.
  */
-errcode_t ocfs2_block_check_validate(void *data, size_t blocksize,
-				     struct ocfs2_block_check *bc)
+static errcode_t __ocfs2_block_check_validate(void *data, size_t blocksize,
+					      struct ocfs2_block_check *bc,
+					      int *fixed)
 {
 	errcode_t err = 0;
 	struct ocfs2_block_check check;
 	uint32_t crc, ecc;
 
+	*fixed = 0;
+
 	check.bc_crc32e = le32_to_cpu(bc->bc_crc32e);
 	check.bc_ecc = le16_to_cpu(bc->bc_ecc);
 
@@ -352,6 +357,7 @@ errcode_t ocfs2_block_check_validate(void *data, size_t blocksize,
 		goto out;
 
 	/* Ok, try ECC fixups */
+	*fixed = 1;
 	ecc = ocfs2_hamming_encode_block(data, blocksize);
 	ocfs2_hamming_fix_block(data, blocksize, ecc ^ check.bc_ecc);
 
@@ -369,6 +375,14 @@ out:
 	return err;
 }
 
+errcode_t ocfs2_block_check_validate(void *data, size_t blocksize,
+				     struct ocfs2_block_check *bc)
+{
+	int fixed;
+
+	return __ocfs2_block_check_validate(data, blocksize, bc, &fixed);
+}
+
 /*
  * These are the main API.  They check the superblock flag before
  * calling the underlying operations.
@@ -394,6 +408,38 @@ errcode_t ocfs2_validate_meta_ecc(ocfs2_filesys *fs, void *data,
 	return err;
 }
 
+/*
+ * For data just read from blkno with ocfs2_read_blocks().  A block that
+ * checked out unaided is marked in the I/O cache, and is not checked
+ * again until it changes.  Fixed-up blocks are not marked, as the
+ * cached copy still holds the bad bits.
+ */
+errcode_t ocfs2_validate_cached_meta_ecc(ocfs2_filesys *fs, uint64_t blkno,
+					 void *data,
+					 struct ocfs2_block_check *bc)
+{
+	errcode_t err;
+	int fixed;
+
+	if (!ocfs2_meta_ecc(OCFS2_RAW_SB(fs->fs_super)) ||
+	    (fs->fs_flags & OCFS2_FLAG_NO_ECC_CHECKS))
+		return 0;
+
+	/* Image files map blkno elsewhere; don't bother */
+	if (fs->fs_flags & OCFS2_FLAG_IMAGE_FILE)
+		return ocfs2_block_check_validate(data, fs->fs_blocksize, bc);
+
+	if (io_block_validated(fs->fs_io, blkno))
+		return 0;
+
+	err = __ocfs2_block_check_validate(data, fs->fs_blocksize, bc,
+					   &fixed);
+	if (!err && !fixed)
+		io_set_block_validated(fs->fs_io, blkno);
+
+	return err;
+}
+
 #ifdef DEBUG_EXE
 #include <stdio.h>
 #include <string.h>
@@ -88,7 +88,7 @@ errcode_t ocfs2_read_group_desc(ocfs2_filesys *fs, uint64_t blkno,
 
 	gd = (struct ocfs2_group_desc *)blk;
 
-	ret = ocfs2_validate_meta_ecc(fs, blk, &gd->bg_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, blkno, blk, &gd->bg_check);
 	if (ret)
 		goto out;
 
@@ -366,8 +366,10 @@ errcode_t ocfs2_cache_chain_allocator_blocks(ocfs2_filesys *fs,
 		for (i = 0, j = 0; i < count; ++i) {
 			gd = (struct ocfs2_group_desc *)ivus[i].ivu_buf;
 
-			ret = ocfs2_validate_meta_ecc(fs, ivus[i].ivu_buf,
-						      &gd->bg_check);
+			ret = ocfs2_validate_cached_meta_ecc(fs,
+							ivus[i].ivu_blkno,
+							ivus[i].ivu_buf,
+							&gd->bg_check);
 			if (ret)
 				goto out;
 
@@ -486,6 +486,20 @@ errcode_t ocfs2_chain_alloc_range(ocfs2_filesys *fs,
 				        start_bit, bits_found);
 }
 
+errcode_t ocfs2_chain_alloc_range_aligned(ocfs2_filesys *fs,
+					  ocfs2_cached_inode *cinode,
+					  uint64_t len,
+					  uint64_t align,
+					  uint64_t align_offset,
+					  uint64_t *start_bit)
+{
+	if (!cinode->ci_chains)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	return ocfs2_bitmap_alloc_range_aligned(cinode->ci_chains, len, align,
+						align_offset, start_bit);
+}
+
 errcode_t ocfs2_chain_free_range(ocfs2_filesys *fs,
 				 ocfs2_cached_inode *cinode,
 				 uint64_t len,
@@ -525,23 +539,16 @@ static errcode_t chainalloc_find_gd(struct ocfs2_bitmap_region *br,
 	return 0;
 }
 
-errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
-			    ocfs2_cached_inode *cinode,
-			    uint64_t *gd_blkno,
-			    uint16_t *suballoc_bit,
-			    uint64_t *bitno)
+static errcode_t chainalloc_claim_bit(ocfs2_filesys *fs,
+				      ocfs2_cached_inode *cinode,
+				      uint64_t *gd_blkno,
+				      uint16_t *suballoc_bit,
+				      uint64_t *bitno)
 {
 	errcode_t ret;
 	int oldval;
 	struct find_gd_state state;
 
-	if (!cinode->ci_chains)
-		return OCFS2_ET_INVALID_ARGUMENT;
-
-	ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains, 0, bitno);
-	if (ret)
-		return ret;
-
 	ret = ocfs2_bitmap_set(cinode->ci_chains, *bitno, &oldval);
 	if (ret)
 		return ret;
@@ -564,6 +571,106 @@ errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
 	return ret;
 }
 
+errcode_t ocfs2_chain_alloc(ocfs2_filesys *fs,
+			    ocfs2_cached_inode *cinode,
+			    uint64_t *gd_blkno,
+			    uint16_t *suballoc_bit,
+			    uint64_t *bitno)
+{
+	errcode_t ret;
+
+	if (!cinode->ci_chains)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains, 0, bitno);
+	if (ret)
+		return ret;
+
+	return chainalloc_claim_bit(fs, cinode, gd_blkno, suballoc_bit,
+				    bitno);
+}
+
+struct find_near_state {
+	uint64_t goal;
+	uint64_t best_dist;
+	struct ocfs2_bitmap_region *best;
+};
+
+static errcode_t chainalloc_find_near(struct ocfs2_bitmap_region *br,
+				      void *private_data)
+{
+	struct find_near_state *state = private_data;
+	uint64_t start = br->br_start_bit;
+	uint64_t end = start + br->br_valid_bits;
+	uint64_t dist;
+
+	if (br->br_set_bits >= br->br_valid_bits)
+		return 0;
+
+	if (state->goal < start)
+		dist = start - state->goal;
+	else if (state->goal >= end)
+		dist = state->goal - end + 1;
+	else
+		dist = 0;
+
+	if (!state->best || (dist < state->best_dist)) {
+		state->best = br;
+		state->best_dist = dist;
+	}
+
+	return dist ? 0 : OCFS2_ET_ITERATION_COMPLETE;
+}
+
+/*
+ * Like ocfs2_chain_alloc(), but takes the free bit closest to the block
+ * @goal.  The group holding @goal wins if it has room, otherwise the
+ * nearest group with a free bit.  A zero @goal is plain first-fit.
+ */
+errcode_t ocfs2_chain_alloc_near(ocfs2_filesys *fs,
+				 ocfs2_cached_inode *cinode,
+				 uint64_t goal,
+				 uint64_t *gd_blkno,
+				 uint16_t *suballoc_bit,
+				 uint64_t *bitno)
+{
+	errcode_t ret;
+	struct find_near_state state = { 0, };
+	struct ocfs2_bitmap_region *br;
+	int bpc;
+
+	if (!goal)
+		return ocfs2_chain_alloc(fs, cinode, gd_blkno, suballoc_bit,
+					 bitno);
+
+	if (!cinode->ci_chains)
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	bpc = cinode->ci_inode->id2.i_chain.cl_bpc;
+	state.goal = chainalloc_scale_start_bit(fs, goal, bpc);
+	ret = ocfs2_bitmap_foreach_region(cinode->ci_chains,
+					  chainalloc_find_near, &state);
+	if (ret)
+		return ret;
+	br = state.best;
+	if (!br)
+		return OCFS2_ET_BIT_NOT_FOUND;
+
+	/* Prefer the bits after the goal, then the start of the region */
+	ret = OCFS2_ET_BIT_NOT_FOUND;
+	if (!state.best_dist)
+		ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains,
+						   state.goal, bitno);
+	if (ret || (*bitno >= br->br_start_bit + br->br_valid_bits))
+		ret = ocfs2_bitmap_find_next_clear(cinode->ci_chains,
+						   br->br_start_bit, bitno);
+	if (ret)
+		return ret;
+
+	return chainalloc_claim_bit(fs, cinode, gd_blkno, suballoc_bit,
+				    bitno);
+}
+
 errcode_t ocfs2_chain_free(ocfs2_filesys *fs,
 			   ocfs2_cached_inode *cinode,
 			   uint64_t bitno)
@@ -0,0 +1,652 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * dir_revmap.c
+ *
+ * Build a map from inodes back to the directory entries naming them.
+ * For the OCFS2 userspace library.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License, version 2,  as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * Answering "what is the path of this inode" by walking the namespace
+ * from the root reads every directory in tree order, which on a large
+ * volume is mostly seeks.  Instead we find the directories with an
+ * inode scan, sort all of their blocks by physical location, and read
+ * them in one sweep.  Every entry naming a directory is kept, along
+ * with the entries naming the inodes the caller is interested in.
+ * Paths are then put together in memory by following the parents.
+ */
+
+#define _XOPEN_SOURCE 600 /* Triggers magic in features.h */
+#define _LARGEFILE64_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <inttypes.h>
+
+#include "ocfs2/ocfs2.h"
+
+
+/* A run of directory blocks, physically contiguous */
+struct revmap_extent {
+	uint64_t	rx_blkno;
+	uint64_t	rx_dir;
+	uint32_t	rx_count;
+	int		rx_trailer;
+};
+
+struct revmap_entry {
+	uint64_t	re_ino;
+	uint64_t	re_parent;
+	uint64_t	re_name;	/* Offset into dr_names */
+	uint8_t		re_name_len;
+	uint8_t		re_file_type;
+};
+
+struct _ocfs2_dir_revmap {
+	ocfs2_filesys		*dr_fs;
+	int			(*dr_want)(uint64_t ino, void *priv_data);
+	void			*dr_priv;
+
+	struct revmap_extent	*dr_extents;
+	uint64_t		dr_num_extents;
+	uint64_t		dr_max_extents;
+
+	struct revmap_entry	*dr_entries;
+	uint64_t		dr_num_entries;
+	uint64_t		dr_max_entries;
+
+	char			*dr_names;
+	uint64_t		dr_names_len;
+	uint64_t		dr_names_max;
+
+	/* Directory blocks we could not use */
+	uint64_t		dr_bad_blocks;
+};
+
+/* Read at most this much of a directory extent at a time */
+#define REVMAP_READ_SIZE	(1024 * 1024)
+
+static errcode_t revmap_grow(void *ptr, uint64_t *max, uint64_t size,
+			     uint64_t min)
+{
+	errcode_t ret;
+	uint64_t new_max = *max ? *max * 2 : min;
+
+	ret = ocfs2_realloc0(new_max * size, ptr, *max * size);
+	if (!ret)
+		*max = new_max;
+
+	return ret;
+}
+
+static errcode_t revmap_add_entry(ocfs2_dir_revmap *map, uint64_t dir,
+				  struct ocfs2_dir_entry *de)
+{
+	errcode_t ret;
+	struct revmap_entry *re;
+
+	if ((de->name_len == 1) && (de->name[0] == '.'))
+		return 0;
+	if ((de->name_len == 2) && !strncmp(de->name, "..", 2))
+		return 0;
+
+	if ((de->file_type != OCFS2_FT_DIR) && map->dr_want &&
+	    !map->dr_want(de->inode, map->dr_priv))
+		return 0;
+
+	if (map->dr_num_entries == map->dr_max_entries) {
+		ret = revmap_grow(&map->dr_entries, &map->dr_max_entries,
+				  sizeof(struct revmap_entry), 1024);
+		if (ret)
+			return ret;
+	}
+
+	while ((map->dr_names_len + de->name_len) > map->dr_names_max) {
+		ret = revmap_grow(&map->dr_names, &map->dr_names_max, 1,
+				  64 * 1024);
+		if (ret)
+			return ret;
+	}
+
+	re = &map->dr_entries[map->dr_num_entries++];
+	re->re_ino = de->inode;
+	re->re_parent = dir;
+	re->re_name = map->dr_names_len;
+	re->re_name_len = de->name_len;
+	re->re_file_type = de->file_type;
+
+	memcpy(map->dr_names + map->dr_names_len, de->name, de->name_len);
+	map->dr_names_len += de->name_len;
+
+	return 0;
+}
+
+/*
+ * Walk the entries in buf[offset, end).  A corrupt entry ends the walk
+ * of this block; fsck is the place to complain about it.
+ */
+static errcode_t revmap_process_entries(ocfs2_dir_revmap *map,
+					uint64_t dir, char *buf,
+					unsigned int offset, unsigned int end)
+{
+	errcode_t ret;
+	struct ocfs2_dir_entry *de;
+
+	while (offset < end) {
+		de = (struct ocfs2_dir_entry *)(buf + offset);
+		if (((offset + de->rec_len) > end) ||
+		    (de->rec_len < OCFS2_DIR_REC_LEN(1)) ||
+		    ((de->rec_len % 4) != 0) ||
+		    (OCFS2_DIR_REC_LEN(de->name_len) > de->rec_len)) {
+			map->dr_bad_blocks++;
+			break;
+		}
+
+		if (de->inode) {
+			ret = revmap_add_entry(map, dir, de);
+			if (ret)
+				return ret;
+		}
+
+		offset += de->rec_len;
+	}
+
+	return 0;
+}
+
+static errcode_t revmap_process_block(ocfs2_dir_revmap *map,
+				      struct revmap_extent *rx,
+				      uint64_t blkno, char *buf)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = map->dr_fs;
+	unsigned int end = fs->fs_blocksize;
+	struct ocfs2_dir_block_trailer *trailer;
+
+	if (rx->rx_trailer) {
+		end = ocfs2_dir_trailer_blk_off(fs);
+		trailer = ocfs2_dir_trailer_from_block(fs, buf);
+
+		if (ocfs2_validate_meta_ecc(fs, buf, &trailer->db_check) ||
+		    memcmp(trailer->db_signature, OCFS2_DIR_TRAILER_SIGNATURE,
+			   strlen(OCFS2_DIR_TRAILER_SIGNATURE))) {
+			map->dr_bad_blocks++;
+			return 0;
+		}
+	}
+
+	ret = ocfs2_swap_dir_entries_to_cpu(buf, end);
+	if (ret) {
+		map->dr_bad_blocks++;
+		return 0;
+	}
+
+	return revmap_process_entries(map, rx->rx_dir, buf, 0, end);
+}
+
+struct revmap_extent_ctxt {
+	ocfs2_dir_revmap	*map;
+	struct ocfs2_dinode	*di;
+	uint64_t		blocks;
+	errcode_t		errcode;
+};
+
+static int revmap_extent_func(ocfs2_filesys *fs,
+			      struct ocfs2_extent_rec *rec,
+			      int tree_depth,
+			      uint32_t ccount,
+			      uint64_t ref_blkno,
+			      int ref_recno,
+			      void *priv_data)
+{
+	struct revmap_extent_ctxt *ctxt = priv_data;
+	ocfs2_dir_revmap *map = ctxt->map;
+	struct revmap_extent *rx;
+	uint64_t v_blkno, count;
+
+	v_blkno = ocfs2_clusters_to_blocks(fs, rec->e_cpos);
+	if (v_blkno >= ctxt->blocks)
+		return 0;
+
+	count = ocfs2_clusters_to_blocks(fs, rec->e_leaf_clusters);
+	if (count > (ctxt->blocks - v_blkno))
+		count = ctxt->blocks - v_blkno;
+
+	if (map->dr_num_extents == map->dr_max_extents) {
+		ctxt->errcode = revmap_grow(&map->dr_extents,
+					    &map->dr_max_extents,
+					    sizeof(struct revmap_extent),
+					    1024);
+		if (ctxt->errcode)
+			return OCFS2_EXTENT_ABORT;
+	}
+
+	rx = &map->dr_extents[map->dr_num_extents++];
+	rx->rx_blkno = rec->e_blkno;
+	rx->rx_dir = ctxt->di->i_blkno;
+	rx->rx_count = count;
+	rx->rx_trailer = ocfs2_dir_has_trailer(fs, ctxt->di);
+
+	return 0;
+}
+
+/*
+ * Inline directories are read right here.  The rest only have their
+ * extents recorded for the sweep.
+ */
+static errcode_t revmap_process_dir(ocfs2_dir_revmap *map,
+				    struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = map->dr_fs;
+	unsigned int offset;
+	struct revmap_extent_ctxt ctxt;
+
+	if (ocfs2_support_inline_data(OCFS2_RAW_SB(fs->fs_super)) &&
+	    (di->i_dyn_features & OCFS2_INLINE_DATA_FL)) {
+		offset = offsetof(struct ocfs2_dinode, id2.i_data.id_data);
+		if ((offset + di->id2.i_data.id_count) > fs->fs_blocksize) {
+			map->dr_bad_blocks++;
+			return 0;
+		}
+
+		/* ocfs2_swap_inode_to_cpu() took care of the entries */
+		return revmap_process_entries(map, di->i_blkno, (char *)di,
+					      offset,
+					      offset + di->id2.i_data.id_count);
+	}
+
+	ctxt.map = map;
+	ctxt.di = di;
+	ctxt.blocks = (di->i_size + fs->fs_blocksize - 1) /
+		fs->fs_blocksize;
+	ctxt.errcode = 0;
+
+	ret = ocfs2_extent_iterate_inode(fs, di, OCFS2_EXTENT_FLAG_DATA_ONLY,
+					 NULL, revmap_extent_func,
+					 &ctxt);
+	if (!ret)
+		ret = ctxt.errcode;
+
+	return ret;
+}
+
+static errcode_t revmap_find_dirs(ocfs2_dir_revmap *map)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = map->dr_fs;
+	uint64_t blkno;
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+	ocfs2_inode_scan *scan = NULL;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (ret)
+		goto out;
+
+	di = (struct ocfs2_dinode *)buf;
+	for (;;) {
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret || !blkno)
+			break;
+
+		if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
+			   strlen(OCFS2_INODE_SIGNATURE)))
+			continue;
+
+		ocfs2_swap_inode_to_cpu(fs, di);
+
+		if (di->i_fs_generation != fs->fs_super->i_fs_generation)
+			continue;
+
+		if (!(di->i_flags & OCFS2_VALID_FL) || !S_ISDIR(di->i_mode))
+			continue;
+
+		ret = revmap_process_dir(map, di);
+		if (ret)
+			break;
+	}
+
+out:
+	if (scan)
+		ocfs2_close_inode_scan(scan);
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+static int revmap_extent_cmp(const void *a, const void *b)
+{
+	const struct revmap_extent *l = a, *r = b;
+
+	if (l->rx_blkno < r->rx_blkno)
+		return -1;
+	if (l->rx_blkno > r->rx_blkno)
+		return 1;
+	return 0;
+}
+
+static errcode_t revmap_sweep(ocfs2_dir_revmap *map)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = map->dr_fs;
+	uint64_t i, done, want;
+	uint32_t j, max_blocks = REVMAP_READ_SIZE / fs->fs_blocksize;
+	struct revmap_extent *rx;
+	char *buf = NULL;
+
+	if (!map->dr_num_extents)
+		return 0;
+
+	qsort(map->dr_extents, map->dr_num_extents,
+	      sizeof(struct revmap_extent), revmap_extent_cmp);
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, max_blocks, &buf);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < map->dr_num_extents; i++) {
+		rx = &map->dr_extents[i];
+		for (done = 0; done < rx->rx_count; done += want) {
+			want = rx->rx_count - done;
+			if (want > max_blocks)
+				want = max_blocks;
+
+			ret = ocfs2_read_blocks_nocache(fs,
+							rx->rx_blkno + done,
+							want, buf);
+			if (ret)
+				goto out;
+
+			for (j = 0; j < want; j++) {
+				ret = revmap_process_block(map, rx,
+						rx->rx_blkno + done + j,
+						buf + j * fs->fs_blocksize);
+				if (ret)
+					goto out;
+			}
+		}
+	}
+
+out:
+	ocfs2_free(&buf);
+	return ret;
+}
+
+static int revmap_entry_cmp(const void *a, const void *b)
+{
+	const struct revmap_entry *l = a, *r = b;
+
+	if (l->re_ino < r->re_ino)
+		return -1;
+	if (l->re_ino > r->re_ino)
+		return 1;
+	if (l->re_parent < r->re_parent)
+		return -1;
+	if (l->re_parent > r->re_parent)
+		return 1;
+	return 0;
+}
+
+/* Returns the first entry naming ino, or NULL */
+static struct revmap_entry *revmap_lookup(ocfs2_dir_revmap *map,
+					  uint64_t ino)
+{
+	uint64_t lo = 0, hi = map->dr_num_entries, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (map->dr_entries[mid].re_ino < ino)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < map->dr_num_entries) && (map->dr_entries[lo].re_ino == ino))
+		return &map->dr_entries[lo];
+
+	return NULL;
+}
+
+errcode_t ocfs2_dir_revmap_build(ocfs2_filesys *fs,
+				 int (*want)(uint64_t ino, void *priv_data),
+				 void *priv_data,
+				 ocfs2_dir_revmap **ret_map)
+{
+	errcode_t ret;
+	ocfs2_dir_revmap *map;
+
+	ret = ocfs2_malloc0(sizeof(struct _ocfs2_dir_revmap), &map);
+	if (ret)
+		return ret;
+
+	map->dr_fs = fs;
+	map->dr_want = want;
+	map->dr_priv = priv_data;
+
+	ret = revmap_find_dirs(map);
+	if (ret)
+		goto out;
+
+	ret = revmap_sweep(map);
+	if (ret)
+		goto out;
+
+	/* The extents are no longer needed */
+	if (map->dr_extents)
+		ocfs2_free(&map->dr_extents);
+	map->dr_num_extents = map->dr_max_extents = 0;
+
+	if (map->dr_num_entries)
+		qsort(map->dr_entries, map->dr_num_entries,
+		      sizeof(struct revmap_entry), revmap_entry_cmp);
+
+	*ret_map = map;
+
+out:
+	if (ret)
+		ocfs2_dir_revmap_free(map);
+
+	return ret;
+}
+
+void ocfs2_dir_revmap_free(ocfs2_dir_revmap *map)
+{
+	if (!map)
+		return;
+
+	if (map->dr_extents)
+		ocfs2_free(&map->dr_extents);
+	if (map->dr_entries)
+		ocfs2_free(&map->dr_entries);
+	if (map->dr_names)
+		ocfs2_free(&map->dr_names);
+	ocfs2_free(&map);
+}
+
+uint64_t ocfs2_dir_revmap_bad_blocks(ocfs2_dir_revmap *map)
+{
+	return map->dr_bad_blocks;
+}
+
+/*
+ * Fill in the path of re, right-aligned in buf.  Returns the start of
+ * the path, or NULL if re is not reachable from the root or the
+ * system directory.
+ */
+static char *revmap_entry_path(ocfs2_dir_revmap *map,
+			       struct revmap_entry *re,
+			       char *buf, int buflen)
+{
+	ocfs2_filesys *fs = map->dr_fs;
+	char *p = buf + buflen - 1;
+	uint64_t steps = 0;
+
+	*p = '\0';
+	while (1) {
+		if ((p - buf) < (re->re_name_len + 2))
+			return NULL;
+		p -= re->re_name_len;
+		memcpy(p, map->dr_names + re->re_name, re->re_name_len);
+		*(--p) = '/';
+
+		if (re->re_parent == fs->fs_root_blkno)
+			return p;
+		if (re->re_parent == fs->fs_sysdir_blkno) {
+			*(--p) = '/';
+			return p;
+		}
+
+		/* Directories have one name; a loop means corruption. */
+		re = revmap_lookup(map, re->re_parent);
+		if (!re || (re->re_file_type != OCFS2_FT_DIR) ||
+		    (++steps > map->dr_num_entries))
+			return NULL;
+	}
+}
+
+/*
+ * Call func with every path naming ino.  The root is "/" and the
+ * system directory is "//".  Iteration stops when func returns
+ * non-zero.
+ */
+errcode_t ocfs2_dir_revmap_iterate(ocfs2_dir_revmap *map, uint64_t ino,
+				   int (*func)(uint64_t ino,
+					       const char *path,
+					       int file_type,
+					       void *priv_data),
+				   void *priv_data)
+{
+	errcode_t ret;
+	char *buf = NULL, *path;
+	struct revmap_entry *re;
+	ocfs2_filesys *fs = map->dr_fs;
+
+	if (ino == fs->fs_root_blkno) {
+		func(ino, "/", OCFS2_FT_DIR, priv_data);
+		return 0;
+	}
+	if (ino == fs->fs_sysdir_blkno) {
+		func(ino, "//", OCFS2_FT_DIR, priv_data);
+		return 0;
+	}
+
+	re = revmap_lookup(map, ino);
+	if (!re)
+		return 0;
+
+	ret = ocfs2_malloc0(PATH_MAX, &buf);
+	if (ret)
+		return ret;
+
+	for (; (re < map->dr_entries + map->dr_num_entries) &&
+	       (re->re_ino == ino); re++) {
+		path = revmap_entry_path(map, re, buf, PATH_MAX);
+		if (path && func(ino, path, re->re_file_type, priv_data))
+			break;
+	}
+
+	ocfs2_free(&buf);
+	return 0;
+}
+
+
+#ifdef DEBUG_EXE
+#include <getopt.h>
+
+static uint64_t read_number(const char *num)
+{
+	uint64_t val;
+	char *ptr;
+
+	val = strtoull(num, &ptr, 0);
+	if (!ptr || *ptr)
+		return 0;
+
+	return val;
+}
+
+static void print_usage(void)
+{
+	fprintf(stderr,
+		"Usage: dir_revmap <filename> <inode_blkno> ...\n");
+}
+
+static int print_path(uint64_t ino, const char *path, int file_type,
+		      void *priv_data)
+{
+	fprintf(stdout, "%20"PRIu64" %s\n", ino, path);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	errcode_t ret;
+	int i;
+	uint64_t blkno;
+	ocfs2_filesys *fs;
+	ocfs2_dir_revmap *map;
+
+	initialize_ocfs_error_table();
+
+	if (argc < 3) {
+		print_usage();
+		return 1;
+	}
+
+	ret = ocfs2_open(argv[1], OCFS2_FLAG_RO, 0, 0, &fs);
+	if (ret) {
+		com_err(argv[0], ret,
+			"while opening file \"%s\"", argv[1]);
+		return 1;
+	}
+
+	ret = ocfs2_dir_revmap_build(fs, NULL, NULL, &map);
+	if (ret) {
+		com_err(argv[0], ret, "while building the reverse map");
+		goto out_close;
+	}
+
+	for (i = 2; i < argc; i++) {
+		blkno = read_number(argv[i]);
+		if (!blkno) {
+			print_usage();
+			break;
+		}
+
+		ret = ocfs2_dir_revmap_iterate(map, blkno, print_path, NULL);
+		if (ret) {
+			com_err(argv[0], ret, "while looking up %"PRIu64,
+				blkno);
+			break;
+		}
+	}
+
+	ocfs2_dir_revmap_free(map);
+
+out_close:
+	ret = ocfs2_close(fs);
+	if (ret)
+		com_err(argv[0], ret, "while closing file \"%s\"", argv[1]);
+
+	return 0;
+}
+#endif  /* DEBUG_EXE */
@@ -179,7 +179,8 @@ errcode_t ocfs2_read_dir_block(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 		end = ocfs2_dir_trailer_blk_off(fs);
 		trailer = ocfs2_dir_trailer_from_block(fs, buf);
 
-		retval = ocfs2_validate_meta_ecc(fs, buf, &trailer->db_check);
+		retval = ocfs2_validate_cached_meta_ecc(fs, block, buf,
+							&trailer->db_check);
 		if (retval)
 			goto out;
 
@@ -333,7 +334,8 @@ errcode_t ocfs2_read_dx_root(ocfs2_filesys *fs, uint64_t block,
 		goto out;
 
 	dx_root = (struct ocfs2_dx_root_block *)dx_root_buf;
-	ret = ocfs2_validate_meta_ecc(fs, dx_root_buf, &dx_root->dr_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, block, dx_root_buf,
+					     &dx_root->dr_check);
 	if (ret)
 		goto out;
 
@@ -415,7 +417,8 @@ errcode_t ocfs2_read_dx_leaf(ocfs2_filesys *fs, uint64_t block,
 		return ret;
 
 	dx_leaf = (struct ocfs2_dx_leaf *)buf;
-	ret = ocfs2_validate_meta_ecc(fs, buf, &dx_leaf->dl_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, block, buf,
+					     &dx_leaf->dl_check);
 	if (ret)
 		return ret;
 
@@ -15,6 +15,7 @@
  * General Public License for more details.
  */
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
 #include <errno.h>
@@ -209,6 +210,7 @@ static void __ocfs2_init_extent_tree(struct ocfs2_extent_tree *et,
 	et->et_root_blkno = blkno;
 	et->et_root_write = write;
 	et->et_object = obj;
+	et->et_shadow = NULL;
 
 	et->et_ops->eo_fill_root_el(et);
 	if (!et->et_ops->eo_fill_max_leaf_clusters)
@@ -276,6 +278,703 @@ struct insert_ctxt {
 	struct ocfs2_extent_tree *et;
 	struct ocfs2_extent_rec rec;
 };
+
+/*
+ * Shadow copies of extent blocks.
+ *
+ * Inserts and flag changes must not write any extent block that the
+ * on-disk tree still references; otherwise a crash in the middle of a
+ * rotation leaves a half-modified tree behind.  Rather than copying
+ * the whole tree before every operation, we keep an in-memory copy of
+ * each extent block the operation writes, keyed by the block number
+ * the tree code knows it by.  The tree algorithms thus keep working
+ * with stable block numbers and never see the shadowing.
+ *
+ * At commit time every modified block that existed before the
+ * operation, along with its ancestors up to the root, is given a
+ * freshly allocated block.  The copies are written there with their
+ * child and next-leaf pointers translated.  Writing the root switches
+ * to the new tree in one step, and only then are the replaced blocks
+ * released.  The cost is proportional to the paths the operation
+ * touched, not to the size of the tree.
+ *
+ * The one pointer we cannot shadow without copying every leaf is the
+ * h_next_leaf_blk of an untouched left neighbour.  It is updated in
+ * place after the root has been written, before the old block it
+ * pointed to is freed.
+ */
+#define SHADOW_NEW	0x01	/* Allocated during this operation */
+#define SHADOW_DIRTY	0x02	/* sb_buf holds the current contents */
+#define SHADOW_FREED	0x04	/* Deleted during this operation */
+#define SHADOW_LINKED	0x08	/* Ancestors have been shadowed */
+
+struct ocfs2_shadow_block {
+	uint64_t	sb_blkno;	/* What the tree code calls it */
+	uint64_t	sb_target;	/* Where it lives after commit */
+	char		*sb_buf;
+	int		sb_flags;
+};
+
+struct ocfs2_shadow_fixup {
+	uint64_t	sf_leaf;	/* Untouched left neighbour */
+	uint64_t	sf_next;	/* Its h_next_leaf_blk before commit */
+};
+
+struct ocfs2_et_shadow {
+	ocfs2_filesys			*s_fs;
+	char				*s_root_backup;
+	struct ocfs2_shadow_block	*s_blocks;
+	int				s_num_blocks;
+	int				s_max_blocks;
+	struct ocfs2_shadow_fixup	*s_fixups;
+	int				s_num_fixups;
+	int				s_max_fixups;
+};
+
+static struct ocfs2_shadow_block *
+ocfs2_shadow_lookup(struct ocfs2_et_shadow *sh, uint64_t blkno)
+{
+	int i;
+
+	for (i = 0; i < sh->s_num_blocks; i++)
+		if (sh->s_blocks[i].sb_blkno == blkno)
+			return &sh->s_blocks[i];
+
+	return NULL;
+}
+
+static errcode_t ocfs2_shadow_get(struct ocfs2_et_shadow *sh,
+				  uint64_t blkno,
+				  struct ocfs2_shadow_block **ret_sb)
+{
+	errcode_t ret;
+	int new_max;
+	struct ocfs2_shadow_block *sb;
+
+	sb = ocfs2_shadow_lookup(sh, blkno);
+	if (sb)
+		goto out;
+
+	if (sh->s_num_blocks == sh->s_max_blocks) {
+		new_max = sh->s_max_blocks ? sh->s_max_blocks * 2 : 16;
+		ret = ocfs2_realloc0(sizeof(struct ocfs2_shadow_block) *
+				     new_max, &sh->s_blocks,
+				     sizeof(struct ocfs2_shadow_block) *
+				     sh->s_max_blocks);
+		if (ret)
+			return ret;
+		sh->s_max_blocks = new_max;
+	}
+
+	sb = &sh->s_blocks[sh->s_num_blocks++];
+	sb->sb_blkno = blkno;
+	sb->sb_target = blkno;
+
+out:
+	*ret_sb = sb;
+	return 0;
+}
+
+static inline int ocfs2_shadow_is_moved(struct ocfs2_shadow_block *sb)
+{
+	return (sb->sb_flags & (SHADOW_NEW | SHADOW_DIRTY | SHADOW_FREED)) ==
+		SHADOW_DIRTY;
+}
+
+static uint64_t ocfs2_shadow_xlate(struct ocfs2_et_shadow *sh,
+				   uint64_t blkno)
+{
+	struct ocfs2_shadow_block *sb;
+
+	if (!blkno)
+		return 0;
+
+	sb = ocfs2_shadow_lookup(sh, blkno);
+	if (sb && ocfs2_shadow_is_moved(sb))
+		return sb->sb_target;
+
+	return blkno;
+}
+
+static errcode_t ocfs2_et_read_eb(ocfs2_filesys *fs,
+				  struct ocfs2_et_shadow *sh,
+				  uint64_t blkno, char *buf)
+{
+	struct ocfs2_shadow_block *sb;
+
+	if (sh) {
+		sb = ocfs2_shadow_lookup(sh, blkno);
+		if (sb && (sb->sb_flags & SHADOW_DIRTY)) {
+			memcpy(buf, sb->sb_buf, fs->fs_blocksize);
+			return 0;
+		}
+	}
+
+	return ocfs2_read_extent_block(fs, blkno, buf);
+}
+
+static errcode_t ocfs2_et_write_eb(ocfs2_filesys *fs,
+				   struct ocfs2_et_shadow *sh,
+				   uint64_t blkno, char *buf)
+{
+	errcode_t ret;
+	struct ocfs2_shadow_block *sb;
+
+	if (!sh)
+		return ocfs2_write_extent_block(fs, blkno, buf);
+
+	ret = ocfs2_shadow_get(sh, blkno, &sb);
+	if (ret)
+		return ret;
+
+	if (!sb->sb_buf) {
+		ret = ocfs2_malloc_block(fs->fs_io, &sb->sb_buf);
+		if (ret)
+			return ret;
+	}
+
+	memcpy(sb->sb_buf, buf, fs->fs_blocksize);
+	sb->sb_flags |= SHADOW_DIRTY;
+	return 0;
+}
+
+/*
+ * A tree's extent blocks come from the slot its root was allocated
+ * from, as close to the root as that slot's groups allow.
+ */
+static errcode_t ocfs2_et_alloc_eb(ocfs2_filesys *fs,
+				   struct ocfs2_extent_tree *et,
+				   uint64_t *blkno)
+{
+	uint16_t slot = (uint16_t)OCFS2_INVALID_SLOT;
+
+	if (et->et_ops == &ocfs2_dinode_et_ops)
+		slot = ((struct ocfs2_dinode *)et->et_root_buf)->i_suballoc_slot;
+	else if (et->et_ops == &ocfs2_dx_root_et_ops)
+		slot = ((struct ocfs2_dx_root_block *)
+			et->et_root_buf)->dr_suballoc_slot;
+	else if (et->et_ops == &ocfs2_refcount_tree_et_ops)
+		slot = ((struct ocfs2_refcount_block *)
+			et->et_root_buf)->rf_suballoc_slot;
+	if (slot >= OCFS2_RAW_SB(fs->fs_super)->s_max_slots)
+		slot = 0;
+
+	return ocfs2_new_extent_block_in_slot(fs, blkno, slot,
+					      et->et_root_blkno);
+}
+
+static errcode_t ocfs2_et_new_eb(ocfs2_filesys *fs,
+				 struct ocfs2_extent_tree *et,
+				 uint64_t *blkno)
+{
+	errcode_t ret;
+	struct ocfs2_shadow_block *sb;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+
+	ret = ocfs2_et_alloc_eb(fs, et, blkno);
+	if (ret || !sh)
+		return ret;
+
+	ret = ocfs2_shadow_get(sh, *blkno, &sb);
+	if (ret) {
+		ocfs2_delete_extent_block(fs, *blkno);
+		return ret;
+	}
+
+	/* The block may have been freed and handed out again. */
+	sb->sb_flags = SHADOW_NEW;
+	sb->sb_target = *blkno;
+	return 0;
+}
+
+static errcode_t ocfs2_et_delete_eb(ocfs2_filesys *fs,
+				    struct ocfs2_et_shadow *sh,
+				    uint64_t blkno)
+{
+	errcode_t ret;
+	struct ocfs2_shadow_block *sb;
+
+	if (!sh)
+		return ocfs2_delete_extent_block(fs, blkno);
+
+	ret = ocfs2_shadow_get(sh, blkno, &sb);
+	if (ret)
+		return ret;
+
+	/*
+	 * Blocks we allocated are not referenced on disk and can go
+	 * right away.  Blocks of the old tree are released after
+	 * commit.
+	 */
+	if (sb->sb_flags & SHADOW_NEW) {
+		ret = ocfs2_delete_extent_block(fs, blkno);
+		if (ret)
+			return ret;
+		sb->sb_flags = SHADOW_FREED | SHADOW_NEW;
+	} else
+		sb->sb_flags = SHADOW_FREED;
+
+	return 0;
+}
+
+static errcode_t ocfs2_shadow_begin(ocfs2_filesys *fs,
+				    struct ocfs2_extent_tree *et)
+{
+	errcode_t ret;
+	struct ocfs2_et_shadow *sh;
+
+	assert(!et->et_shadow);
+
+	ret = ocfs2_malloc0(sizeof(struct ocfs2_et_shadow), &sh);
+	if (ret)
+		return ret;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &sh->s_root_backup);
+	if (ret) {
+		ocfs2_free(&sh);
+		return ret;
+	}
+
+	memcpy(sh->s_root_backup, et->et_root_buf, fs->fs_blocksize);
+	sh->s_fs = fs;
+	et->et_shadow = sh;
+	return 0;
+}
+
+static void ocfs2_shadow_release(struct ocfs2_extent_tree *et)
+{
+	int i;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+
+	for (i = 0; i < sh->s_num_blocks; i++)
+		if (sh->s_blocks[i].sb_buf)
+			ocfs2_free(&sh->s_blocks[i].sb_buf);
+
+	if (sh->s_blocks)
+		ocfs2_free(&sh->s_blocks);
+	if (sh->s_fixups)
+		ocfs2_free(&sh->s_fixups);
+	ocfs2_free(&sh->s_root_backup);
+	ocfs2_free(&sh);
+	et->et_shadow = NULL;
+}
+
+/*
+ * The operation failed.  Give back everything we allocated and put the
+ * root back the way we found it; the on-disk tree was never touched.
+ */
+static void ocfs2_shadow_abort(struct ocfs2_extent_tree *et)
+{
+	int i;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+	struct ocfs2_shadow_block *sb;
+
+	for (i = 0; i < sh->s_num_blocks; i++) {
+		sb = &sh->s_blocks[i];
+		if (sb->sb_flags & SHADOW_FREED)
+			continue;
+		if (sb->sb_flags & SHADOW_NEW)
+			ocfs2_delete_extent_block(sh->s_fs, sb->sb_blkno);
+		else if (sb->sb_target != sb->sb_blkno)
+			ocfs2_delete_extent_block(sh->s_fs, sb->sb_target);
+	}
+
+	memcpy(et->et_root_buf, sh->s_root_backup, sh->s_fs->fs_blocksize);
+	ocfs2_shadow_release(et);
+}
+
+static errcode_t ocfs2_shadow_add_fixup(struct ocfs2_et_shadow *sh,
+					uint64_t leaf, uint64_t next)
+{
+	errcode_t ret;
+	int new_max;
+
+	if (sh->s_num_fixups == sh->s_max_fixups) {
+		new_max = sh->s_max_fixups ? sh->s_max_fixups * 2 : 8;
+		ret = ocfs2_realloc0(sizeof(struct ocfs2_shadow_fixup) *
+				     new_max, &sh->s_fixups,
+				     sizeof(struct ocfs2_shadow_fixup) *
+				     sh->s_max_fixups);
+		if (ret)
+			return ret;
+		sh->s_max_fixups = new_max;
+	}
+
+	sh->s_fixups[sh->s_num_fixups].sf_leaf = leaf;
+	sh->s_fixups[sh->s_num_fixups].sf_next = next;
+	sh->s_num_fixups++;
+	return 0;
+}
+
+/*
+ * Search the tree being built for the block "target", recording the
+ * block numbers from the root down in chain[].  cpos is any cluster
+ * covered by target; if has_cpos is zero every branch is searched.
+ * *found is set when target is reached.
+ */
+static errcode_t ocfs2_shadow_search(ocfs2_filesys *fs,
+				     struct ocfs2_et_shadow *sh,
+				     struct ocfs2_extent_list *el,
+				     uint64_t target, int target_depth,
+				     uint32_t cpos, int has_cpos,
+				     uint64_t *chain, int index, int *found)
+{
+	int i;
+	errcode_t ret;
+	char *buf = NULL;
+	struct ocfs2_extent_rec *rec;
+	struct ocfs2_extent_block *eb;
+
+	*found = 0;
+
+	if (el->l_tree_depth <= target_depth)
+		return 0;
+
+	if (el->l_tree_depth == target_depth + 1) {
+		for (i = 0; i < el->l_next_free_rec; i++) {
+			if (el->l_recs[i].e_blkno == target) {
+				chain[index] = target;
+				*found = 1;
+				break;
+			}
+		}
+		return 0;
+	}
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	for (i = el->l_next_free_rec - 1; i >= 0; i--) {
+		rec = &el->l_recs[i];
+		if (has_cpos) {
+			if (rec->e_cpos > cpos)
+				continue;
+			if (cpos > rec->e_cpos + rec->e_int_clusters)
+				break;
+		}
+
+		ret = ocfs2_et_read_eb(fs, sh, rec->e_blkno, buf);
+		if (ret)
+			break;
+
+		eb = (struct ocfs2_extent_block *)buf;
+		chain[index] = rec->e_blkno;
+		ret = ocfs2_shadow_search(fs, sh, &eb->h_list, target,
+					  target_depth, cpos, has_cpos,
+					  chain, index + 1, found);
+		if (ret || *found)
+			break;
+	}
+
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * Find the leaf immediately to the left of the one at the end of
+ * chain[], or 0 if it is the leftmost.
+ */
+static errcode_t ocfs2_shadow_left_leaf(ocfs2_filesys *fs,
+					struct ocfs2_extent_tree *et,
+					uint64_t *chain, int len,
+					uint64_t *left)
+{
+	int i, j;
+	errcode_t ret;
+	char *buf = NULL;
+	uint64_t child;
+	struct ocfs2_extent_list *el;
+	struct ocfs2_extent_block *eb;
+
+	*left = 0;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	eb = (struct ocfs2_extent_block *)buf;
+	for (i = len - 1; i >= 0; i--) {
+		if (i == 0)
+			el = et->et_root_el;
+		else {
+			ret = ocfs2_et_read_eb(fs, et->et_shadow,
+					       chain[i - 1], buf);
+			if (ret)
+				goto out;
+			el = &eb->h_list;
+		}
+
+		for (j = 0; j < el->l_next_free_rec; j++)
+			if (el->l_recs[j].e_blkno == chain[i])
+				break;
+		if (j == el->l_next_free_rec) {
+			ret = OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+			goto out;
+		}
+		if (j == 0)
+			continue;
+
+		/* Walk down the right edge of the subtree to our left. */
+		child = el->l_recs[j - 1].e_blkno;
+		while (1) {
+			ret = ocfs2_et_read_eb(fs, et->et_shadow, child, buf);
+			if (ret)
+				goto out;
+			el = &eb->h_list;
+			if (!el->l_tree_depth)
+				break;
+			if (!el->l_next_free_rec) {
+				ret = OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+				goto out;
+			}
+			child = el->l_recs[el->l_next_free_rec - 1].e_blkno;
+		}
+		*left = child;
+		break;
+	}
+
+out:
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * Shadow every ancestor of sb that is not already part of the new
+ * tree, and remember the left neighbour of a moved leaf.
+ */
+static errcode_t ocfs2_shadow_link(ocfs2_filesys *fs,
+				   struct ocfs2_extent_tree *et,
+				   uint64_t blkno)
+{
+	int i, depth, len, has_cpos = 0, found;
+	errcode_t ret;
+	uint32_t cpos = 0;
+	uint64_t left, chain[OCFS2_MAX_PATH_DEPTH];
+	char *buf = NULL;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+	struct ocfs2_shadow_block *sb;
+	struct ocfs2_extent_list *el;
+	struct ocfs2_extent_block *eb;
+
+	sb = ocfs2_shadow_lookup(sh, blkno);
+	eb = (struct ocfs2_extent_block *)sb->sb_buf;
+	el = &eb->h_list;
+	depth = el->l_tree_depth;
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		if (ocfs2_rec_clusters(depth, &el->l_recs[i])) {
+			cpos = el->l_recs[i].e_cpos;
+			has_cpos = 1;
+			break;
+		}
+	}
+
+	ret = ocfs2_shadow_search(fs, sh, et->et_root_el, blkno, depth,
+				  cpos, has_cpos, chain, 0, &found);
+	/* Interior ranges may lag behind; fall back to a full search. */
+	if (!ret && !found && has_cpos)
+		ret = ocfs2_shadow_search(fs, sh, et->et_root_el, blkno,
+					  depth, 0, 0, chain, 0, &found);
+	if (ret)
+		return ret;
+	if (!found)
+		return OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+
+	for (len = 0; chain[len] != blkno; len++)
+		;
+	len++;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < len; i++) {
+		ret = ocfs2_shadow_get(sh, chain[i], &sb);
+		if (ret)
+			goto out;
+		sb->sb_flags |= SHADOW_LINKED;
+		if (sb->sb_flags & SHADOW_DIRTY)
+			continue;
+
+		ret = ocfs2_read_extent_block(fs, chain[i], buf);
+		if (ret)
+			goto out;
+		ret = ocfs2_et_write_eb(fs, sh, chain[i], buf);
+		if (ret)
+			goto out;
+	}
+
+	if (!depth) {
+		ret = ocfs2_shadow_left_leaf(fs, et, chain, len, &left);
+		if (!ret && left)
+			ret = ocfs2_shadow_add_fixup(sh, left, blkno);
+	}
+
+out:
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * Write out the new tree.  On return the shadows are on disk and the
+ * root buffer points at them; the caller writes the root.
+ */
+static errcode_t ocfs2_shadow_commit(ocfs2_filesys *fs,
+				     struct ocfs2_extent_tree *et)
+{
+	int i, j;
+	errcode_t ret;
+	char *buf = NULL;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+	struct ocfs2_shadow_block *sb;
+	struct ocfs2_extent_block *eb, *src;
+	struct ocfs2_extent_list *el;
+	int offset = offsetof(struct ocfs2_extent_block, h_list);
+
+	/* s_num_blocks grows as ancestors are pulled in. */
+	for (i = 0; i < sh->s_num_blocks; i++) {
+		sb = &sh->s_blocks[i];
+		if (!ocfs2_shadow_is_moved(sb) ||
+		    (sb->sb_flags & SHADOW_LINKED))
+			continue;
+		ret = ocfs2_shadow_link(fs, et, sb->sb_blkno);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < sh->s_num_blocks; i++) {
+		sb = &sh->s_blocks[i];
+		if (!ocfs2_shadow_is_moved(sb))
+			continue;
+		ret = ocfs2_et_alloc_eb(fs, et, &sb->sb_target);
+		if (ret) {
+			sb->sb_target = sb->sb_blkno;
+			return ret;
+		}
+	}
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	eb = (struct ocfs2_extent_block *)buf;
+	for (i = 0; i < sh->s_num_blocks; i++) {
+		sb = &sh->s_blocks[i];
+		if ((sb->sb_flags & (SHADOW_DIRTY | SHADOW_FREED)) !=
+		    SHADOW_DIRTY)
+			continue;
+
+		/*
+		 * A moved block keeps the header of its new home so
+		 * that h_blkno and the suballocator fields are right.
+		 */
+		src = (struct ocfs2_extent_block *)sb->sb_buf;
+		if (sb->sb_flags & SHADOW_NEW)
+			memcpy(buf, sb->sb_buf, fs->fs_blocksize);
+		else {
+			ret = ocfs2_read_extent_block(fs, sb->sb_target, buf);
+			if (ret)
+				goto out;
+			memcpy(buf + offset, sb->sb_buf + offset,
+			       fs->fs_blocksize - offset);
+		}
+
+		eb->h_next_leaf_blk = ocfs2_shadow_xlate(sh,
+							 src->h_next_leaf_blk);
+		el = &eb->h_list;
+		if (el->l_tree_depth)
+			for (j = 0; j < el->l_next_free_rec; j++)
+				el->l_recs[j].e_blkno =
+					ocfs2_shadow_xlate(sh,
+						el->l_recs[j].e_blkno);
+
+		ret = ocfs2_write_extent_block(fs, sb->sb_target, buf);
+		if (ret)
+			goto out;
+	}
+
+	el = et->et_root_el;
+	if (el->l_tree_depth)
+		for (j = 0; j < el->l_next_free_rec; j++)
+			el->l_recs[j].e_blkno =
+				ocfs2_shadow_xlate(sh, el->l_recs[j].e_blkno);
+	ocfs2_et_set_last_eb_blk(et,
+			ocfs2_shadow_xlate(sh, ocfs2_et_get_last_eb_blk(et)));
+
+out:
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * The new root is on disk.  Point untouched left neighbours at the
+ * moved leaves and release the blocks the old tree used.  Failures
+ * here only leak blocks, which fsck will reclaim.
+ */
+static void ocfs2_shadow_finish(ocfs2_filesys *fs,
+				struct ocfs2_extent_tree *et)
+{
+	int i;
+	char *buf = NULL;
+	struct ocfs2_et_shadow *sh = et->et_shadow;
+	struct ocfs2_shadow_block *sb;
+	struct ocfs2_shadow_fixup *sf;
+	struct ocfs2_extent_block *eb;
+
+	if (!ocfs2_malloc_block(fs->fs_io, &buf)) {
+		eb = (struct ocfs2_extent_block *)buf;
+		for (i = 0; i < sh->s_num_fixups; i++) {
+			sf = &sh->s_fixups[i];
+			sb = ocfs2_shadow_lookup(sh, sf->sf_leaf);
+			if (sb && (sb->sb_flags & SHADOW_DIRTY))
+				continue;
+			if (ocfs2_read_extent_block(fs, sf->sf_leaf, buf))
+				continue;
+			if (eb->h_next_leaf_blk != sf->sf_next)
+				continue;
+			eb->h_next_leaf_blk = ocfs2_shadow_xlate(sh,
+								 sf->sf_next);
+			ocfs2_write_extent_block(fs, sf->sf_leaf, buf);
+		}
+		ocfs2_free(&buf);
+	}
+
+	for (i = 0; i < sh->s_num_blocks; i++) {
+		sb = &sh->s_blocks[i];
+		if (sb->sb_flags & SHADOW_NEW)
+			continue;
+		if ((sb->sb_flags & SHADOW_FREED) || ocfs2_shadow_is_moved(sb))
+			ocfs2_delete_extent_block(fs, sb->sb_blkno);
+	}
+
+	ocfs2_shadow_release(et);
+}
+
+/*
+ * Finish a shadowed operation.  If ret is set the operation failed and
+ * everything is rolled back.  Otherwise the new tree is written and the
+ * root buffer is written through et_root_write.  If the caller didn't
+ * initialize the write function, it is responsible for writing the
+ * root buffer.
+ */
+static errcode_t ocfs2_shadow_end(ocfs2_filesys *fs,
+				  struct ocfs2_extent_tree *et,
+				  errcode_t ret)
+{
+	if (!ret)
+		ret = ocfs2_shadow_commit(fs, et);
+	if (!ret && et->et_root_write)
+		ret = et->et_root_write(fs, et->et_root_blkno,
+					et->et_root_buf);
+	if (ret) {
+		ocfs2_shadow_abort(et);
+		return ret;
+	}
+
+	ocfs2_shadow_finish(fs, et);
+	return 0;
+}
+
 /*
  * Reset the actual path elements so that we can re-use the structure
  * to build another path. Generally, this involves freeing the buffer
@@ -427,7 +1126,8 @@ static inline void ocfs2_path_insert_eb(struct ocfs2_path *path, int index,
 
 static struct ocfs2_path *ocfs2_new_path(char *buf,
 					 struct ocfs2_extent_list *root_el,
-					 uint64_t blkno)
+					 uint64_t blkno,
+					 struct ocfs2_et_shadow *sh)
 {
 	struct ocfs2_path *path = NULL;
 
@@ -439,6 +1139,7 @@ static struct ocfs2_path *ocfs2_new_path(char *buf,
 		path->p_node[0].blkno = blkno;
 		path->p_node[0].buf = buf;
 		path->p_node[0].el = root_el;
+		path->p_shadow = sh;
 	}
 
 	return path;
@@ -447,13 +1148,13 @@ static struct ocfs2_path *ocfs2_new_path(char *buf,
 static struct ocfs2_path *ocfs2_new_path_from_path(struct ocfs2_path *path)
 {
 	return ocfs2_new_path(path_root_buf(path), path_root_el(path),
-			      path_root_blkno(path));
+			      path_root_blkno(path), path->p_shadow);
 }
 
 struct ocfs2_path *ocfs2_new_path_from_et(struct ocfs2_extent_tree *et)
 {
 	return ocfs2_new_path(et->et_root_buf, et->et_root_el,
-			      et->et_root_blkno);
+			      et->et_root_blkno, et->et_shadow);
 }
 /* Write all the extent block information to the disk.
  * We write all paths furthur down than subtree_index.
@@ -466,9 +1167,9 @@ static errcode_t ocfs2_write_path_eb(ocfs2_filesys *fs,
 	int i;
 
 	for (i = path->p_tree_depth; i > sub_index; i--) {
-		ret = ocfs2_write_extent_block(fs,
-					       path->p_node[i].blkno,
-					       path->p_node[i].buf);
+		ret = ocfs2_et_write_eb(fs, path->p_shadow,
+					path->p_node[i].blkno,
+					path->p_node[i].buf);
 		if (ret)
 			return ret;
 	}
@@ -511,7 +1212,7 @@ static errcode_t ocfs2_sync_path_to_disk(ocfs2_filesys *fs,
 		/* subtree_index indicates an extent block. */
 		path = right_path ? right_path : left_path;
 
-		ret = ocfs2_write_extent_block(fs,
+		ret = ocfs2_et_write_eb(fs, path->p_shadow,
 					path->p_node[subtree_index].blkno,
 					path->p_node[subtree_index].buf);
 		if (ret)
@@ -714,11 +1415,11 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 			return ret;
 		new_eb_bufs[i] = buf;
 
-		ret = ocfs2_new_extent_block(fs, &new_blknos[i]);
+		ret = ocfs2_et_new_eb(fs, et, &new_blknos[i]);
 		if (ret)
 			goto bail;
 
-		ret = ocfs2_read_extent_block(fs, new_blknos[i], buf);
+		ret = ocfs2_et_read_eb(fs, et->et_shadow, new_blknos[i], buf);
 		if (ret)
 			goto bail;
 	}
@@ -783,7 +1484,7 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 	 */
 	for(i = 0; i < new_blocks; i++) {
 		buf = new_eb_bufs[i];
-		ret = ocfs2_write_extent_block(fs, new_blknos[i], buf);
+		ret = ocfs2_et_write_eb(fs, et->et_shadow, new_blknos[i], buf);
 		if (ret)
 			goto bail;
 	}
@@ -793,13 +1494,14 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 	 */
 	eb = (struct ocfs2_extent_block *)(*last_eb_buf);
 	eb->h_next_leaf_blk = new_last_eb_blk;
-	ret = ocfs2_write_extent_block(fs, eb->h_blkno, *last_eb_buf);
+	ret = ocfs2_et_write_eb(fs, et->et_shadow, eb->h_blkno, *last_eb_buf);
 	if (ret)
 		goto bail;
 
 	if (eb_buf) {
 		eb = (struct ocfs2_extent_block *)eb_buf;
-		ret = ocfs2_write_extent_block(fs, eb->h_blkno, eb_buf);
+		ret = ocfs2_et_write_eb(fs, et->et_shadow, eb->h_blkno,
+					eb_buf);
 		if (ret)
 			goto bail;
 	}
@@ -810,8 +1512,8 @@ static int ocfs2_add_branch(ocfs2_filesys *fs,
 	 */
 	memcpy(*last_eb_buf, new_eb_bufs[0], fs->fs_blocksize);
 
-	/* The inode information isn't updated since we use duplicated extent
-	 * block in the insertion and it may fail in other steps.
+	/* The inode information isn't updated since the extent blocks are
+	 * only shadowed here and the insertion may fail in other steps.
 	 */
 	ret = 0;
 bail:
@@ -825,7 +1527,8 @@ bail:
 	if (ret && new_blknos)
 		for (i = 0; i < new_blocks; i++)
 			if (new_blknos[i])
-				ocfs2_delete_extent_block(fs, new_blknos[i]);
+				ocfs2_et_delete_eb(fs, et->et_shadow,
+						   new_blknos[i]);
 
 	if (new_blknos)
 		ocfs2_free(&new_blknos);
@@ -879,7 +1582,7 @@ static errcode_t ocfs2_find_branch_target(ocfs2_filesys *fs,
 			goto bail;
 		}
 
-		ret = ocfs2_read_extent_block(fs, blkno, buf);
+		ret = ocfs2_et_read_eb(fs, et->et_shadow, blkno, buf);
 		if (ret)
 			goto bail;
 
@@ -1073,6 +1776,7 @@ typedef errcode_t (path_insert_t)(void *, char *);
  * case it will return the rightmost path.
  */
 static errcode_t __ocfs2_find_path(ocfs2_filesys *fs,
+				   struct ocfs2_et_shadow *sh,
 				   struct ocfs2_extent_list *root_el,
 				   uint32_t cpos,
 				   path_insert_t *func,
@@ -1119,7 +1823,7 @@ static errcode_t __ocfs2_find_path(ocfs2_filesys *fs,
 		if (ret)
 			return ret;
 
-		ret = ocfs2_read_extent_block(fs, blkno, buf);
+		ret = ocfs2_et_read_eb(fs, sh, blkno, buf);
 		if (ret)
 			goto out;
 
@@ -1200,7 +1904,7 @@ int ocfs2_find_path(ocfs2_filesys *fs, struct ocfs2_path *path,
 
 	data.index = 1;
 	data.path = path;
-	return __ocfs2_find_path(fs, path_root_el(path), cpos,
+	return __ocfs2_find_path(fs, path->p_shadow, path_root_el(path), cpos,
 				 find_path_ins, &data);
 }
 
@@ -1220,7 +1924,7 @@ int ocfs2_tree_find_leaf(ocfs2_filesys *fs, struct ocfs2_extent_list *el,
 
 	assert(el->l_tree_depth > 0);
 
-	path = ocfs2_new_path(el_blk, el, el_blkno);
+	path = ocfs2_new_path(el_blk, el, el_blkno, NULL);
 	if (!path) {
 		ret = OCFS2_ET_NO_MEMORY;
 		goto out;
@@ -1773,7 +2477,8 @@ static errcode_t ocfs2_unlink_path(ocfs2_filesys *fs,
 
 		el->l_next_free_rec = 0;
 		memset(&el->l_recs[0], 0, sizeof(struct ocfs2_extent_rec));
-		ret = ocfs2_delete_extent_block(fs, path->p_node[i].blkno);
+		ret = ocfs2_et_delete_eb(fs, path->p_shadow,
+					 path->p_node[i].blkno);
 		if (ret)
 			return ret;
 	}
@@ -2111,8 +2816,9 @@ out:
 	 * so re-read them.
 	 */
 	for (i = 1; i <= path->p_tree_depth; i++) {
-		ret = ocfs2_read_extent_block(fs, path->p_node[i].blkno,
-					      path->p_node[i].buf);
+		ret = ocfs2_et_read_eb(fs, path->p_shadow,
+				       path->p_node[i].blkno,
+				       path->p_node[i].buf);
 		if (ret)
 			break;
 	}
@@ -2233,9 +2939,9 @@ rightmost_no_delete:
 
 		/* we have to synchronize the modified extent block to disk. */
 		if (path->p_tree_depth > 0) {
-			ret = ocfs2_write_extent_block(fs,
-						       path_leaf_blkno(path),
-						       path_leaf_buf(path));
+			ret = ocfs2_et_write_eb(fs, path->p_shadow,
+						path_leaf_blkno(path),
+						path_leaf_buf(path));
 		}
 
 		goto out;
@@ -2524,9 +3230,9 @@ static int ocfs2_try_to_merge_extent(ocfs2_filesys *fs,
 
 		/* we have to synchronize the modified extent block to disk. */
 		if (left_path->p_tree_depth > 0) {
-			ret = ocfs2_write_extent_block(fs,
-					       path_leaf_blkno(left_path),
-					       path_leaf_buf(left_path));
+			ret = ocfs2_et_write_eb(fs, left_path->p_shadow,
+					path_leaf_blkno(left_path),
+					path_leaf_buf(left_path));
 			if (ret)
 				goto out;
 		}
@@ -2594,11 +3300,11 @@ static errcode_t shift_tree_depth(ocfs2_filesys *fs,
 	if (ret)
 		return ret;
 
-	ret = ocfs2_new_extent_block(fs, &blkno);
+	ret = ocfs2_et_new_eb(fs, et, &blkno);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_read_extent_block(fs, blkno, buf);
+	ret = ocfs2_et_read_eb(fs, et->et_shadow, blkno, buf);
 	if (ret)
 		goto out;
 
@@ -2621,7 +3327,7 @@ static errcode_t shift_tree_depth(ocfs2_filesys *fs,
 	if (el->l_tree_depth == 1)
 		ocfs2_et_set_last_eb_blk(et, blkno);
 
-	ret = ocfs2_write_extent_block(fs, blkno, buf);
+	ret = ocfs2_et_write_eb(fs, et->et_shadow, blkno, buf);
 	if (!ret)
 		*new_eb = buf;
 out:
@@ -2776,7 +3482,7 @@ static int ocfs2_figure_insert_type(struct insert_ctxt *ctxt,
 		 * may want it later.
 		 */
 		assert(buf);
-		ret = ocfs2_read_extent_block(fs, last_eb_blk, buf);
+		ret = ocfs2_et_read_eb(fs, et->et_shadow, last_eb_blk, buf);
 		if (ret)
 			goto out;
 
@@ -3252,205 +3958,6 @@ out:
 	return ret;
 }
 
-struct duplicate_ctxt {
-	struct ocfs2_extent_tree *et;
-	uint64_t next_leaf_blk;
-};
-
-static errcode_t duplicate_extent_block(ocfs2_filesys *fs,
-					struct ocfs2_extent_list *old_el,
-					struct ocfs2_extent_list *new_el,
-					struct duplicate_ctxt *ctxt)
-{
-	int i;
-	errcode_t ret;
-	uint64_t blkno, new_blkno;
-	struct ocfs2_extent_rec *rec = NULL;
-	char *eb_buf = NULL, *new_eb_buf = NULL;
-	struct ocfs2_extent_block *eb = NULL;
-	struct ocfs2_extent_list *child_old_el = NULL, *child_new_el = NULL;
-
-	assert (old_el->l_tree_depth > 0);
-
-	/* empty the whole extent list at first. */
-	*new_el = *old_el;
-	new_el->l_next_free_rec = 0;
-	memset(new_el->l_recs, 0,
-	       sizeof(struct ocfs2_extent_rec) * new_el->l_count);
-
-	if (old_el->l_next_free_rec == 0) {
-		/* XXX:
-		 * We have a tree depth > 0 and no extent record in it,
-		 * should it be a corrupted block?
-		 */
-		ret = OCFS2_ET_CORRUPT_EXTENT_BLOCK;
-		goto bail;
-	}
-
-	ret = ocfs2_malloc_block(fs->fs_io, &eb_buf);
-	if (ret)
-		goto bail;
-	ret = ocfs2_malloc_block(fs->fs_io, &new_eb_buf);
-	if (ret)
-		goto bail;
-
-	/* we iterate the extent list from the last one for recording
-	 * the next_leaf_blk for the previous leaf.
-	 */
-	for (i = old_el->l_next_free_rec - 1; i >= 0; i--) {
-		rec = &old_el->l_recs[i];
-
-		if (!ocfs2_rec_clusters(old_el->l_tree_depth, rec))
-			continue;
-
-		blkno = rec->e_blkno;
-		ret = ocfs2_read_extent_block(fs, blkno, eb_buf);
-		if (ret)
-			goto bail;
-
-		/* First make the new_buf the same as the old buf. */
-		memcpy(new_eb_buf, eb_buf, fs->fs_blocksize);
-
-		eb = (struct ocfs2_extent_block *)eb_buf;
-		child_old_el = &eb->h_list;
-		eb = (struct ocfs2_extent_block *)new_eb_buf;
-		child_new_el = &eb->h_list;
-
-		if (child_old_el->l_tree_depth > 0) {
-			/* the extent record in our list still has child extent
-			 * block, so we have to iterate it.
-			 */
-			ret = duplicate_extent_block(fs,
-						     child_old_el,
-						     child_new_el,
-						     ctxt);
-			if (ret)
-				goto bail;
-		}
-
-		/* now we allocate a new extent block and save it. */
-		ret = ocfs2_new_extent_block(fs, &new_blkno);
-		if (ret)
-			goto bail;
-
-		eb = (struct ocfs2_extent_block *)new_eb_buf;
-		eb->h_blkno = new_blkno;
-		if (child_old_el->l_tree_depth == 0) {
-			/*
-			 * This is the leaf blkno, we have to set its
-			 * h_next_leaf_blk and then record itself for
-			 * future use.
-			 */
-			eb->h_next_leaf_blk = ctxt->next_leaf_blk;
-			ctxt->next_leaf_blk = new_blkno;
-		}
-
-		ret = ocfs2_write_extent_block(fs, new_blkno, new_eb_buf);
-		if (ret)
-			goto bail;
-
-		memcpy(&new_el->l_recs[i], rec, sizeof(struct ocfs2_extent_rec));
-		new_el->l_recs[i].e_blkno = new_blkno;
-
-		eb = (struct ocfs2_extent_block *)new_eb_buf;
-		/* set the new i_last_eb_blk in the new dinode. */
-		if (ocfs2_et_get_last_eb_blk(ctxt->et) == blkno)
-			ocfs2_et_set_last_eb_blk(ctxt->et, new_blkno);
-	}
-
-	new_el->l_next_free_rec = old_el->l_next_free_rec;
-	ret = 0;
-
-bail:
-	if (eb_buf)
-		ocfs2_free(&eb_buf);
-	if (new_eb_buf)
-		ocfs2_free(&new_eb_buf);
-	/* Free all the extent block we allocate. */
-	if (ret) {
-		for (i = 0; i < old_el->l_next_free_rec; i++) {
-			rec = &new_el->l_recs[i];
-			if (rec->e_blkno)
-				ocfs2_delete_extent_block(fs, rec->e_blkno);
-		}
-	}
-
-	return ret;
-}
-
-static errcode_t duplicate_extent_block_et(ocfs2_filesys *fs,
-					   struct ocfs2_extent_tree *et)
-{
-	errcode_t ret = 0;
-	struct ocfs2_extent_list *old_el = NULL, *new_el = NULL;
-	char *old_buf, *new_buf;
-	struct duplicate_ctxt ctxt;
-
-	ret = ocfs2_malloc_block(fs->fs_io, &old_buf);
-	if (ret)
-		return ret;
-
-	memcpy(old_buf, et->et_root_buf, fs->fs_blocksize);
-	new_buf = et->et_root_buf;
-	new_el = et->et_root_el;
-	old_el = (struct ocfs2_extent_list *)
-			(old_buf + ((char *)new_el - new_buf));
-
-	assert(old_el->l_tree_depth > 0);
-
-	/* empty the whole extent list at first. */
-	*new_el = *old_el;
-	memset(new_el->l_recs, 0,
-	       sizeof(struct ocfs2_extent_rec) * new_el->l_count);
-	new_el->l_next_free_rec = 0;
-
-	memset(&ctxt, 0, sizeof(ctxt));
-	ctxt.et = et;
-	ctxt.next_leaf_blk = 0;
-	ret = duplicate_extent_block(fs, old_el, new_el, &ctxt);
-
-	ocfs2_free(&old_buf);
-	return ret;
-}
-
-static void free_duplicated_extent_block(ocfs2_filesys *fs,
-					struct ocfs2_extent_list *el)
-{
-	int i;
-	errcode_t ret;
-	char *buf = NULL;
-	struct ocfs2_extent_rec *rec;
-	struct ocfs2_extent_list *child_el;
-	struct ocfs2_extent_block *eb;
-
-	assert(el->l_tree_depth > 0);
-
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
-	if (ret)
-		return;
-
-	for (i = 0; i < el->l_next_free_rec; i ++) {
-		rec = &el->l_recs[i];
-
-		if (!ocfs2_rec_clusters(el->l_tree_depth, rec))
-			continue;
-
-		ret = ocfs2_read_extent_block(fs, rec->e_blkno, buf);
-		if (ret)
-			continue;
-
-		eb = (struct ocfs2_extent_block *)buf;
-		child_el = &eb->h_list;
-		if (child_el->l_tree_depth > 0)
-			free_duplicated_extent_block(fs, child_el);
-
-		ocfs2_delete_extent_block(fs, rec->e_blkno);
-	}
-
-	if(buf)
-		ocfs2_free(&buf);
-}
-
 /*
  * Grow a b-tree so that it has more records.
  *
@@ -3523,39 +4030,20 @@ errcode_t ocfs2_tree_insert_extent(ocfs2_filesys *fs,
 	struct insert_ctxt ctxt;
 	struct ocfs2_insert_type insert = {0, };
 	char *last_eb = NULL;
-	char *backup_buf = NULL;
-	char *root_buf = et->et_root_buf;
 	int free_records = 0;
 
 	ctxt.fs = fs;
 	ctxt.et = et;
 
-	/* In order to orderize the written block sequence and avoid
-	 * the corruption for the b-tree, we duplicate the extent block
-	 * here and do the insertion in the duplicated ones.
-	 *
-	 * Note: we only do this in case the b-tree has extent blocks.
-	 * And if the duplicate process fails, we should go on the normal
-	 * insert process.
+	/*
+	 * In order to orderize the written block sequence and avoid
+	 * the corruption for the b-tree, the extent blocks we touch
+	 * are shadowed and only written to new locations.  The root
+	 * buffer switches over to them in ocfs2_shadow_end().
 	 */
-	if (et->et_root_el->l_tree_depth) {
-		ret = ocfs2_malloc_block(fs->fs_io, &backup_buf);
-		if (ret)
-			goto bail;
-
-		memcpy(backup_buf, root_buf, fs->fs_blocksize);
-
-		/* duplicate the extent block. If it succeeds, di_buf
-		 * will point to the new allocated extent blocks, and
-		 * the following insertion will happens to the new ones.
-		 */
-		ret = duplicate_extent_block_et(fs, et);
-		if (ret) {
-			memcpy(root_buf, backup_buf, fs->fs_blocksize);
-			ocfs2_free(&backup_buf);
-			backup_buf = NULL;
-		}
-	}
+	ret = ocfs2_shadow_begin(fs, et);
+	if (ret)
+		return ret;
 
 	memset(&ctxt.rec, 0, sizeof(struct ocfs2_extent_rec));
 	ctxt.rec.e_cpos = cpos;
@@ -3565,7 +4053,7 @@ errcode_t ocfs2_tree_insert_extent(ocfs2_filesys *fs,
 
 	ret = ocfs2_malloc_block(fs->fs_io, &last_eb);
 	if (ret)
-		return ret;
+		goto bail;
 
 	ret = ocfs2_figure_insert_type(&ctxt, &last_eb, &free_records, &insert);
 	if (ret)
@@ -3580,41 +4068,12 @@ errcode_t ocfs2_tree_insert_extent(ocfs2_filesys *fs,
 
 	/* Finally, we can add clusters. This might rotate the tree for us. */
 	ret = ocfs2_do_insert_extent(&ctxt, &insert);
-	if (ret)
-		goto bail;
 
 bail:
-	if (backup_buf) {
-		struct ocfs2_extent_list *free_el;
-		int offset = (char *)et->et_root_el - et->et_root_buf;
-		/* we have duplicated the extent block during the insertion.
-		 * so if it succeeds, we should free the old ones, and if fails,
-		 * the duplicate ones should be freed.
-		 */
-
-		if (ret)
-			free_el = (struct ocfs2_extent_list *)
-						(et->et_root_buf + offset);
-		else
-			free_el = (struct ocfs2_extent_list *)
-						(backup_buf + offset);
-
-		free_duplicated_extent_block(fs, free_el);
-		ocfs2_free(&backup_buf);
-	}
-
 	if (last_eb)
 		ocfs2_free(&last_eb);
 
-	/*
-	 * Write the root buffer here.
-	 * If the caller don't initialize the write function, it should
-	 * be responsible for write the root buffer.
-	 */
-	if (!ret && et->et_root_write)
-		ret = et->et_root_write(fs, et->et_root_blkno, root_buf);
-
-	return ret;
+	return ocfs2_shadow_end(fs, et, ret);
 }
 
 static void ocfs2_make_right_split_rec(ocfs2_filesys *fs,
@@ -3778,7 +4237,7 @@ static int ocfs2_split_extent(struct insert_ctxt *insert_ctxt,
 	 * rightmost extent list.
 	 */
 	if (path->p_tree_depth) {
-		ret = ocfs2_read_extent_block(fs,
+		ret = ocfs2_et_read_eb(fs, path->p_shadow,
 				ocfs2_et_get_last_eb_blk(insert_ctxt->et),
 				last_eb_buf);
 		if (ret)
@@ -3801,7 +4260,7 @@ static int ocfs2_split_extent(struct insert_ctxt *insert_ctxt,
 			 * the write of the root to the caller.
 			 */
 			if (path->p_tree_depth)
-				ret = ocfs2_write_extent_block(fs,
+				ret = ocfs2_et_write_eb(fs, path->p_shadow,
 							path_leaf_blkno(path),
 							path_leaf_buf(path));
 		} else
@@ -3841,34 +4300,11 @@ int ocfs2_change_extent_flag(ocfs2_filesys *fs,
 	struct ocfs2_extent_list *el;
 	struct insert_ctxt ctxt;
 	struct ocfs2_extent_rec *rec;
-	char *backup_buf = NULL;
 
-	/* In order to orderize the written block sequence and avoid
-	 * the corruption for the inode, we duplicate the extent block
-	 * here and do the insertion in the duplicated ones.
-	 *
-	 * Note: we only do this in case the file has extent blocks.
-	 * And if the duplicate process fails, we should go on the normal
-	 * insert process.
-	 */
-	if (et->et_root_el->l_tree_depth) {
-		ret = ocfs2_malloc_block(fs->fs_io, &backup_buf);
-		if (ret)
-			goto out;
-
-		memcpy(backup_buf, et->et_root_buf, fs->fs_blocksize);
-
-		/* duplicate the extent block. If it succeeds, di_buf
-		 * will point to the new allocated extent blocks, and
-		 * the following insertion will happens to the new ones.
-		 */
-		ret = duplicate_extent_block_et(fs, et);
-		if (ret) {
-			memcpy(et->et_root_buf, backup_buf, fs->fs_blocksize);
-			ocfs2_free(&backup_buf);
-			backup_buf = NULL;
-		}
-	}
+	/* The extent blocks are shadowed as in ocfs2_tree_insert_extent(). */
+	ret = ocfs2_shadow_begin(fs, et);
+	if (ret)
+		return ret;
 
 	left_path = ocfs2_new_path_from_et(et);
 	if (!left_path) {
@@ -3910,38 +4346,10 @@ int ocfs2_change_extent_flag(ocfs2_filesys *fs,
 		ctxt.rec.e_flags &= ~clear_flags;
 
 	ret = ocfs2_split_extent(&ctxt, left_path, index);
-	if (ret)
-		goto out;
-
-	/*
-	 * Write the root buffer here.
-	 * If the caller don't initialize the write function, it should
-	 * be responsible for write the root buffer.
-	 */
-	if (!ret && et->et_root_write)
-		ret = et->et_root_write(fs, et->et_root_blkno, et->et_root_buf);
 
 out:
-	if (backup_buf) {
-		struct ocfs2_extent_list *free_el;
-		int offset = (char *)et->et_root_el - et->et_root_buf;
-		/* we have duplicated the extent block during the insertion.
-		 * so if it succeeds, we should free the old ones, and if fails,
-		 * the duplicate ones should be freed.
-		 */
-
-		if (ret)
-			free_el = (struct ocfs2_extent_list *)
-					(et->et_root_buf + offset);
-		else
-			free_el = (struct ocfs2_extent_list *)
-						(backup_buf + offset);
-
-		free_duplicated_extent_block(fs, free_el);
-		ocfs2_free(&backup_buf);
-	}
 	ocfs2_free_path(left_path);
-	return ret;
+	return ocfs2_shadow_end(fs, et, ret);
 }
 
 static int ocfs2_split_tree(ocfs2_filesys *fs,
@@ -3973,9 +4381,9 @@ static int ocfs2_split_tree(ocfs2_filesys *fs,
 
 	depth = path->p_tree_depth;
 	if (depth > 0) {
-		ret = ocfs2_read_extent_block(fs,
-					      ocfs2_et_get_last_eb_blk(et),
-					      last_eb_buf);
+		ret = ocfs2_et_read_eb(fs, et->et_shadow,
+				       ocfs2_et_get_last_eb_blk(et),
+				       last_eb_buf);
 		if (ret)
 			goto out;
 
@@ -15,6 +15,8 @@
  * General Public License for more details.
  */
 
+struct ocfs2_et_shadow;
+
 /* Useful typedef for passing around writing functions for extent tree root. */
 typedef errcode_t (*ocfs2_root_write_func)(ocfs2_filesys *fs,
 					   uint64_t blkno,
@@ -27,6 +29,7 @@ struct ocfs2_extent_tree {
 	struct ocfs2_extent_list		*et_root_el;
 	void					*et_object;
 	uint32_t				et_max_leaf_clusters;
+	struct ocfs2_et_shadow			*et_shadow;
 };
 
 enum ocfs2_contig_type {
@@ -157,6 +160,7 @@ struct ocfs2_path_item {
 
 struct ocfs2_path {
 	int			p_tree_depth;
+	struct ocfs2_et_shadow	*p_shadow;
 	struct ocfs2_path_item	p_node[OCFS2_MAX_PATH_DEPTH];
 };
 
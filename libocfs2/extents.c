@@ -135,7 +135,7 @@ errcode_t ocfs2_read_extent_block_nocheck(ocfs2_filesys *fs,
 
 	eb = (struct ocfs2_extent_block *)blk;
 
-	ret = ocfs2_validate_meta_ecc(fs, blk, &eb->h_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, blkno, blk, &eb->h_check);
 	if (ret)
 		goto out;
 
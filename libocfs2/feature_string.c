@@ -330,6 +330,18 @@ static struct flag_name ocfs2_tunefs_flag_names[] = {
 		.fl_name = "dir-trailer",
 		.fl_flag = OCFS2_TUNEFS_INPROG_DIR_TRAILER,
 	},
+	{
+		.fl_name = "rebalance",
+		.fl_flag = OCFS2_TUNEFS_INPROG_REBALANCE,
+	},
+	{
+		.fl_name = "inode-pass",
+		.fl_flag = OCFS2_TUNEFS_INPROG_INODE_PASS,
+	},
+	{
+		.fl_name = "cluster-size",
+		.fl_flag = OCFS2_TUNEFS_INPROG_CLUSTER_SIZE,
+	},
 	{
 		.fl_name = NULL,
 	},
@@ -835,7 +847,10 @@ static void print_tunefs_flags(void)
 
 	err = ocfs2_snprint_tunefs_flags(buf, PATH_MAX,
 					 OCFS2_TUNEFS_INPROG_REMOVE_SLOT |
-					 OCFS2_TUNEFS_INPROG_DIR_TRAILER);
+					 OCFS2_TUNEFS_INPROG_DIR_TRAILER |
+					 OCFS2_TUNEFS_INPROG_REBALANCE |
+					 OCFS2_TUNEFS_INPROG_INODE_PASS |
+					 OCFS2_TUNEFS_INPROG_CLUSTER_SIZE);
 	if (err)
 		snprintf(buf, PATH_MAX, "An error occurred: %s",
 			 error_message(err));
@@ -33,6 +33,7 @@
 #include <inttypes.h>
 
 #include "ocfs2/ocfs2.h"
+#include "extent_tree.h"
 #include "refcount.h"
 
 struct read_whole_context {
@@ -243,20 +244,23 @@ static errcode_t empty_blocks(ocfs2_filesys *fs,
 {
 	errcode_t ret;
 	char *buf = NULL;
+	uint64_t n, bpc = ocfs2_clusters_to_blocks(fs, 1);
 
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	n = ocfs2_min(num_blocks, bpc);
+	ret = ocfs2_malloc_blocks(fs->fs_io, n, &buf);
 	if (ret)
 		goto bail;
 
-	memset(buf, 0, fs->fs_blocksize);
+	memset(buf, 0, n * fs->fs_blocksize);
 
 	while (num_blocks) {
-		ret = io_write_block(fs->fs_io, start_blk, 1, buf);
+		n = ocfs2_min(num_blocks, bpc);
+		ret = io_write_block(fs->fs_io, start_blk, n, buf);
 		if (ret)
 			goto bail;
 
-		num_blocks--;
-		start_blk++;
+		num_blocks -= n;
+		start_blk += n;
 	}
 
 bail:
@@ -288,191 +292,209 @@ static errcode_t ocfs2_inline_data_write(struct ocfs2_dinode *di, void *buf,
 	return 0;
 }
 
-static errcode_t ocfs2_file_block_write(ocfs2_cached_inode *ci,
-					void *buf, uint32_t count,
-					uint64_t offset, uint32_t *wrote)
+/*
+ * Write num_blocks blocks of data into freshly filled clusters starting
+ * at p_start.  The first head blocks of the first cluster and whatever
+ * is left of the last cluster are zeroed.
+ */
+static errcode_t fill_clusters(ocfs2_filesys *fs, uint64_t p_start,
+			       uint64_t head, uint64_t num_blocks, char *ptr)
 {
-	ocfs2_filesys	*fs = ci->ci_fs;
-	errcode_t	ret = 0;
-	char		*ptr = (char *) buf;
-	uint32_t	wanted_blocks;
-	uint64_t	contig_blocks;
-	uint64_t	v_blkno;
-	uint64_t	p_blkno, p_start, p_end;
-	uint64_t	begin_blocks = 0, end_blocks = 0;
-	uint32_t	tmp;
-	uint64_t	num_blocks;
-	int		bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
-	uint32_t	n_clusters, cluster_begin, cluster_end;
-	uint64_t	bpc = fs->fs_clustersize/fs->fs_blocksize;
-	int		insert = 0;
-	uint16_t	extent_flags = 0;
-
-	/* o_direct requires aligned io */
-	tmp = fs->fs_blocksize - 1;
-	if ((count & tmp) || (offset & (uint64_t)tmp) ||
-	    ((unsigned long)ptr & tmp))
-		return OCFS2_ET_INVALID_ARGUMENT;
-
-	wanted_blocks = count >> bs_bits;
-	v_blkno = offset >> bs_bits;
-	*wrote = 0;
+	errcode_t ret = 0;
+	uint64_t bpc = ocfs2_clusters_to_blocks(fs, 1);
+	uint64_t tail = (head + num_blocks) & (bpc - 1);
+
+	if (head)
+		ret = empty_blocks(fs, p_start, head);
+	if (!ret)
+		ret = io_write_block(fs->fs_io, p_start + head, num_blocks,
+				     ptr);
+	if (!ret && tail)
+		ret = empty_blocks(fs, p_start + head + num_blocks,
+				   bpc - tail);
 
-	num_blocks = (ci->ci_inode->i_size + fs->fs_blocksize - 1) >> bs_bits;
-
-	if (v_blkno >= num_blocks)
-		return 0;
+	return ret;
+}
 
-	if (v_blkno + wanted_blocks > num_blocks)
-		wanted_blocks = (uint32_t) (num_blocks - v_blkno);
+/*
+ * Write num_blocks blocks from ptr at v_blkno.  Each hole in the range
+ * is allocated as a whole, and unwritten extents are marked written
+ * once their data is down.  The extent tree changes are made on the
+ * cached inode, which is written once at the end.
+ */
+static errcode_t ocfs2_file_write_blocks(ocfs2_cached_inode *ci,
+					 uint64_t v_blkno,
+					 uint64_t num_blocks, char *ptr)
+{
+	ocfs2_filesys	*fs = ci->ci_fs;
+	errcode_t	ret = 0, tmp;
+	struct ocfs2_extent_tree et;
+	uint64_t	bpc = ocfs2_clusters_to_blocks(fs, 1);
+	uint64_t	p_blkno, p_start, contig_blocks, begin_blocks;
+	uint32_t	cpos, n_clusters, got;
+	uint16_t	extent_flags;
+	int		dirty = 0;
 
-	if (ocfs2_refcount_tree(OCFS2_RAW_SB(fs->fs_super)) &&
-	    (ci->ci_inode->i_dyn_features & OCFS2_HAS_REFCOUNT_FL)) {
-		cluster_begin = ocfs2_blocks_to_clusters(fs, v_blkno);
-		cluster_end = ocfs2_blocks_to_clusters(fs,
-					       v_blkno + wanted_blocks - 1);
-		n_clusters = cluster_end - cluster_begin + 1;
-		ret = ocfs2_refcount_cow(ci, cluster_begin, n_clusters, UINT_MAX);
-		if (ret)
-			return ret;
-	}
+	ocfs2_init_dinode_extent_tree(&et, fs, (char *)ci->ci_inode,
+				      ci->ci_blkno);
+	/* We write the inode ourselves, once. */
+	et.et_root_write = NULL;
 
-	while(wanted_blocks) {
+	while (num_blocks) {
 		ret = ocfs2_extent_map_get_blocks(ci, v_blkno, 1,
 						  &p_blkno, &contig_blocks,
 						  &extent_flags);
 		if (ret)
-			return ret;
+			break;
 
-		if (contig_blocks > wanted_blocks)
-			contig_blocks = wanted_blocks;
+		if (contig_blocks > num_blocks)
+			contig_blocks = num_blocks;
+
+		begin_blocks = v_blkno & (bpc - 1);
+		cpos = ocfs2_blocks_to_clusters(fs, v_blkno);
+		n_clusters = ocfs2_clusters_in_blocks(fs,
+						begin_blocks + contig_blocks);
 
-		begin_blocks = 0;
-		end_blocks = 0;
-		p_end = 0;
-	 	if (!p_blkno) {
+		if (!p_blkno) {
 			/*
-			 * We meet with a hole here, so we allocate clusters
-			 * and empty the both ends in case.
-			 *
-			 * We will postpone the extent insertion after we
-			 * successfully write the extent block, so that and
-			 * problems happens in block writing would not affect
-			 * the file.
+			 * A hole.  Fill it with as few allocations as the
+			 * bitmap allows.  The extent is only inserted once
+			 * its data is written, so that a failed write does
+			 * not affect the file.
 			 */
-			cluster_begin = ocfs2_blocks_to_clusters(fs, v_blkno);
-			cluster_end = ocfs2_blocks_to_clusters(fs,
-						v_blkno + contig_blocks -1);
-			n_clusters = cluster_end - cluster_begin + 1;
 			ret = ocfs2_new_clusters(fs, 1, n_clusters, &p_start,
-						 &n_clusters);
-			if (ret || n_clusters == 0)
-				return ret;
+						 &got);
+			if (ret)
+				break;
 
-			begin_blocks = v_blkno & (bpc - 1);
-			p_blkno = p_start + begin_blocks;
-			contig_blocks = n_clusters * bpc - begin_blocks;
-			if (contig_blocks > wanted_blocks) {
-				end_blocks = contig_blocks - wanted_blocks;
-				contig_blocks = wanted_blocks;
-				p_end = p_blkno + wanted_blocks;
-			}
+			if (got < n_clusters)
+				contig_blocks = got * bpc - begin_blocks;
 
-			insert = 1;
+			ret = fill_clusters(fs, p_start, begin_blocks,
+					    contig_blocks, ptr);
+			if (!ret)
+				ret = ocfs2_tree_insert_extent(fs, &et, cpos,
+							       p_start, got,
+							       0);
+			if (ret) {
+				ocfs2_free_clusters(fs, got, p_start);
+				break;
+			}
+			dirty = 1;
 		} else if (extent_flags & OCFS2_EXT_UNWRITTEN) {
-			begin_blocks = v_blkno & (bpc - 1);
 			p_start = p_blkno - begin_blocks;
-			p_end = p_blkno + wanted_blocks;
-			end_blocks = (p_end & (bpc - 1)) ?
-						 bpc - (p_end & (bpc - 1 )) : 0;
-		}
-
-		if (begin_blocks) {
-			/*
-			 * The user don't write the first blocks,
-			 * so we have to empty them.
-			 */
-			ret = empty_blocks(fs, p_start, begin_blocks);
+			ret = fill_clusters(fs, p_start, begin_blocks,
+					    contig_blocks, ptr);
+			if (!ret)
+				ret = ocfs2_change_extent_flag(fs, &et, cpos,
+							n_clusters, p_start,
+							0, OCFS2_EXT_UNWRITTEN);
 			if (ret)
-				return ret;
-		}
-
-		if (end_blocks) {
-			/*
-			 * we don't need to write that many blocks,
-			 * so empty the blocks at the bottom.
-			 */
-			ret = empty_blocks(fs, p_end, end_blocks);
+				break;
+			dirty = 1;
+		} else {
+			ret = io_write_block(fs->fs_io, p_blkno,
+					     contig_blocks, ptr);
 			if (ret)
-				return ret;
+				break;
 		}
 
-		ret = io_write_block(fs->fs_io, p_blkno, contig_blocks, ptr);
-		if (ret)
-			return ret;
+		ptr += contig_blocks * fs->fs_blocksize;
+		v_blkno += contig_blocks;
+		num_blocks -= contig_blocks;
+	}
 
-		if (insert) {
-			ret = ocfs2_cached_inode_insert_extent(ci,
-					ocfs2_blocks_to_clusters(fs,v_blkno),
-					p_start, n_clusters, 0);
-			if (ret) {
-				/*
-				 * XXX: We don't wan't to overwrite the error
-				 * from insert_extent().  But we probably need
-				 * to BE LOUDLY UPSET.
-				 */
-				ocfs2_free_clusters(fs, n_clusters, p_start);
-				return ret;
-			}
+	if (dirty) {
+		tmp = ocfs2_write_cached_inode(fs, ci);
+		if (!ret)
+			ret = tmp;
+	}
 
-			/* save up what we have done. */
-			ret = ocfs2_write_cached_inode(fs, ci);
-			if (ret)
-				return ret;
+	return ret;
+}
 
-			ret = ocfs2_extent_map_get_blocks(ci, v_blkno, 1,
-						&p_blkno, NULL, NULL);
-			/* now we shouldn't find a hole. */
-			if (!p_blkno || p_blkno != p_start + begin_blocks)
-				ret = OCFS2_ET_INTERNAL_FAILURE;
-			if (ret)
-				return ret;
+/*
+ * Check an aligned write and trim it to i_size.  Any refcounted
+ * clusters it touches are CoWed here.  On return *wanted_blocks may be
+ * zero.
+ */
+static errcode_t ocfs2_file_block_write_begin(ocfs2_cached_inode *ci,
+					      void *buf, uint32_t count,
+					      uint64_t offset,
+					      uint64_t *v_blkno,
+					      uint32_t *wanted_blocks)
+{
+	ocfs2_filesys	*fs = ci->ci_fs;
+	uint32_t	tmp;
+	uint64_t	num_blocks;
+	int		bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
+	uint32_t	n_clusters, cluster_begin, cluster_end;
 
-			insert = 0;
-		} else if (extent_flags & OCFS2_EXT_UNWRITTEN) {
-			cluster_begin = ocfs2_blocks_to_clusters(fs, v_blkno);
-			cluster_end = ocfs2_blocks_to_clusters(fs,
-						v_blkno + contig_blocks -1);
-			n_clusters = cluster_end - cluster_begin + 1;
-			ret = ocfs2_mark_extent_written(fs, ci->ci_inode,
-					cluster_begin, n_clusters,
-					p_blkno & ~(bpc - 1));
-			if (ret)
-				return ret;
-			/*
-			 * We don't cache in the library right now, so any
-			 * work done in mark_extent_written won't be reflected
-			 * in our now stale copy. So refresh it.
-			 */
-			ret = ocfs2_refresh_cached_inode(fs, ci);
-			if (ret)
-				return ret;
-		}
+	/* o_direct requires aligned io */
+	tmp = fs->fs_blocksize - 1;
+	if ((count & tmp) || (offset & (uint64_t)tmp) ||
+	    ((unsigned long)buf & tmp))
+		return OCFS2_ET_INVALID_ARGUMENT;
 
-		*wrote += (contig_blocks << bs_bits);
-		wanted_blocks -= contig_blocks;
+	*wanted_blocks = count >> bs_bits;
+	*v_blkno = offset >> bs_bits;
 
-		if (wanted_blocks) {
-			ptr += (contig_blocks << bs_bits);
-			v_blkno += (uint64_t)contig_blocks;
-		} else {
-			if (*wrote + offset > ci->ci_inode->i_size)
-				*wrote = (uint32_t) (ci->ci_inode->i_size - offset);
-			/* break */
-		}
+	num_blocks = (ci->ci_inode->i_size + fs->fs_blocksize - 1) >> bs_bits;
+
+	if (*v_blkno >= num_blocks) {
+		*wanted_blocks = 0;
+		return 0;
+	}
+
+	if (*v_blkno + *wanted_blocks > num_blocks)
+		*wanted_blocks = (uint32_t) (num_blocks - *v_blkno);
 
+	if (*wanted_blocks &&
+	    ocfs2_refcount_tree(OCFS2_RAW_SB(fs->fs_super)) &&
+	    (ci->ci_inode->i_dyn_features & OCFS2_HAS_REFCOUNT_FL)) {
+		cluster_begin = ocfs2_blocks_to_clusters(fs, *v_blkno);
+		cluster_end = ocfs2_blocks_to_clusters(fs,
+					*v_blkno + *wanted_blocks - 1);
+		n_clusters = cluster_end - cluster_begin + 1;
+		return ocfs2_refcount_cow(ci, cluster_begin, n_clusters,
+					  UINT_MAX);
 	}
 
+	return 0;
+}
+
+static uint32_t ocfs2_file_block_wrote(ocfs2_cached_inode *ci,
+				       uint64_t offset,
+				       uint32_t wanted_blocks)
+{
+	uint32_t wrote = wanted_blocks <<
+		OCFS2_RAW_SB(ci->ci_fs->fs_super)->s_blocksize_bits;
+
+	if (wrote && (wrote + offset > ci->ci_inode->i_size))
+		wrote = (uint32_t) (ci->ci_inode->i_size - offset);
+
+	return wrote;
+}
+
+static errcode_t ocfs2_file_block_write(ocfs2_cached_inode *ci,
+					void *buf, uint32_t count,
+					uint64_t offset, uint32_t *wrote)
+{
+	errcode_t	ret;
+	uint64_t	v_blkno;
+	uint32_t	wanted_blocks;
+
+	*wrote = 0;
+
+	ret = ocfs2_file_block_write_begin(ci, buf, count, offset,
+					   &v_blkno, &wanted_blocks);
+	if (ret || !wanted_blocks)
+		return ret;
+
+	ret = ocfs2_file_write_blocks(ci, v_blkno, wanted_blocks, buf);
+	if (!ret)
+		*wrote = ocfs2_file_block_wrote(ci, offset, wanted_blocks);
+
 	return ret;
 }
 
@@ -630,6 +652,123 @@ out:
 	return ret;
 }
 
+/*
+ * A write session gathers sequential writes to one file and hands them
+ * to ocfs2_file_write_blocks() in large runs, so a file written in
+ * small pieces gets few extents and few inode writes.  Data still in
+ * the session is not visible to ocfs2_file_read(); flush first.
+ */
+#define OCFS2_WRITE_SESSION_BYTES	(8 * 1024 * 1024)
+
+struct _ocfs2_write_session {
+	ocfs2_cached_inode *ws_ci;
+	char *ws_buf;
+	uint32_t ws_max_blocks;
+	uint64_t ws_v_blkno;	/* First block of the pending run */
+	uint32_t ws_blocks;	/* Blocks in the pending run */
+};
+
+errcode_t ocfs2_write_session_begin(ocfs2_cached_inode *ci,
+				    ocfs2_write_session **ret_ws)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ci->ci_fs;
+	ocfs2_write_session *ws = NULL;
+
+	if (!(fs->fs_flags & OCFS2_FLAG_RW))
+		return OCFS2_ET_RO_FILESYS;
+
+	ret = ocfs2_malloc0(sizeof(ocfs2_write_session), &ws);
+	if (ret)
+		return ret;
+
+	ws->ws_ci = ci;
+	ws->ws_max_blocks = OCFS2_WRITE_SESSION_BYTES / fs->fs_blocksize;
+	ret = ocfs2_malloc_blocks(fs->fs_io, ws->ws_max_blocks, &ws->ws_buf);
+	if (ret) {
+		ocfs2_free(&ws);
+		return ret;
+	}
+
+	*ret_ws = ws;
+	return 0;
+}
+
+errcode_t ocfs2_write_session_flush(ocfs2_write_session *ws)
+{
+	errcode_t ret;
+
+	if (!ws->ws_blocks)
+		return 0;
+
+	ret = ocfs2_file_write_blocks(ws->ws_ci, ws->ws_v_blkno,
+				      ws->ws_blocks, ws->ws_buf);
+	ws->ws_blocks = 0;
+	return ret;
+}
+
+/*
+ * Like ocfs2_file_write(), but data going to the extent list is held
+ * until the pending run is full, or a write does not continue it.
+ */
+errcode_t ocfs2_write_session_write(ocfs2_write_session *ws,
+				    void *buf, uint32_t count,
+				    uint64_t offset, uint32_t *wrote)
+{
+	errcode_t ret;
+	ocfs2_cached_inode *ci = ws->ws_ci;
+	ocfs2_filesys *fs = ci->ci_fs;
+	uint64_t v_blkno;
+	uint32_t wanted_blocks;
+
+	*wrote = 0;
+
+	/* Pending data means the inode is going to have extents */
+	if (!ws->ws_blocks &&
+	    ocfs2_support_inline_data(OCFS2_RAW_SB(fs->fs_super))) {
+		ret = ocfs2_try_to_write_inline_data(ci, buf, count, offset);
+		if (ret != OCFS2_ET_CANNOT_INLINE_DATA) {
+			if (!ret)
+				*wrote = count;
+			return ret;
+		}
+	}
+
+	ret = ocfs2_file_block_write_begin(ci, buf, count, offset,
+					   &v_blkno, &wanted_blocks);
+	if (ret || !wanted_blocks)
+		return ret;
+
+	if (ws->ws_blocks &&
+	    ((v_blkno != ws->ws_v_blkno + ws->ws_blocks) ||
+	     (ws->ws_blocks + wanted_blocks > ws->ws_max_blocks))) {
+		ret = ocfs2_write_session_flush(ws);
+		if (ret)
+			return ret;
+	}
+
+	if (wanted_blocks >= ws->ws_max_blocks) {
+		ret = ocfs2_file_write_blocks(ci, v_blkno, wanted_blocks, buf);
+	} else {
+		if (!ws->ws_blocks)
+			ws->ws_v_blkno = v_blkno;
+		memcpy(ws->ws_buf + ws->ws_blocks * fs->fs_blocksize, buf,
+		       wanted_blocks * fs->fs_blocksize);
+		ws->ws_blocks += wanted_blocks;
+	}
+
+	if (!ret)
+		*wrote = ocfs2_file_block_wrote(ci, offset, wanted_blocks);
+	return ret;
+}
+
+/* Anything not flushed is dropped. */
+void ocfs2_write_session_free(ocfs2_write_session *ws)
+{
+	ocfs2_free(&ws->ws_buf);
+	ocfs2_free(&ws);
+}
+
 /*
  * FIXME: port the reset of e2fsprogs/lib/ext2fs/fileio.c
  */
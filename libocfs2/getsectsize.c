@@ -1,5 +1,5 @@
 /*
- * getsectsize.c --- get the sector size of a device.
+ * getsectsize.c --- get the sector size and I/O topology of a device.
  * 
  * Copyright (C) 1995, 1995 Theodore Ts'o.
  * Copyright (C) 2003 VMware, Inc.
@@ -21,6 +21,7 @@
 #define _LARGEFILE64_SOURCE
 
 #include <stdio.h>
+#include <string.h>
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -37,6 +38,12 @@
 #define BLKSSZGET  _IO(0x12,104)/* get block device sector size */
 #endif
 
+#if defined(__linux__) && defined(_IO) && !defined(BLKIOMIN)
+#define BLKIOMIN    _IO(0x12,120)/* get minimum I/O size */
+#define BLKIOOPT    _IO(0x12,121)/* get optimal I/O size */
+#define BLKALIGNOFF _IO(0x12,122)/* get alignment offset */
+#endif
+
 #include "ocfs2/ocfs2.h"
 
 /*
@@ -68,11 +75,49 @@ errcode_t ocfs2_get_device_sectsize(const char *file, int *sectsize)
 	return ret;
 }
 
+/*
+ * Returns the I/O topology the device reports.  Devices that report
+ * nothing, such as regular files, get zeroes.
+ */
+errcode_t ocfs2_get_device_topology(const char *file,
+				    struct ocfs2_device_topology *topo)
+{
+	int	fd;
+	unsigned int val;
+	int	off;
+
+	memset(topo, 0, sizeof(struct ocfs2_device_topology));
+
+#ifdef HAVE_OPEN64
+	fd = open64(file, O_RDONLY);
+#else
+	fd = open(file, O_RDONLY);
+#endif
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return OCFS2_ET_NAMED_DEVICE_NOT_FOUND;
+		else
+			return OCFS2_ET_IO;
+	}
+
+#ifdef BLKIOMIN
+	if (ioctl(fd, BLKIOMIN, &val) >= 0)
+		topo->dt_min_io = val;
+	if (ioctl(fd, BLKIOOPT, &val) >= 0)
+		topo->dt_opt_io = val;
+	if ((ioctl(fd, BLKALIGNOFF, &off) >= 0) && (off > 0))
+		topo->dt_align_offset = off;
+#endif
+	close(fd);
+	return 0;
+}
+
 #ifdef DEBUG_EXE
 int main(int argc, char **argv)
 {
 	int     sectsize;
 	int     retval;
+	struct ocfs2_device_topology topo;
 
 	if (argc < 2) {
 		fprintf(stderr, "Usage: %s device\n", argv[0]);
@@ -87,6 +132,15 @@ int main(int argc, char **argv)
 	}
 	printf("Device %s has a hardware sector size of %d.\n",
 	       argv[1], sectsize);
+
+	retval = ocfs2_get_device_topology(argv[1], &topo);
+	if (retval) {
+		com_err(argv[0], retval,
+			"while calling ocfs2_get_device_topology");
+		exit(1);
+	}
+	printf("Minimum I/O %u, optimal I/O %u, alignment offset %u.\n",
+	       topo.dt_min_io, topo.dt_opt_io, topo.dt_align_offset);
 	exit(0);
 }
 #endif
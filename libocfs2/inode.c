@@ -117,6 +117,7 @@ static void ocfs2_swap_inode_second(struct ocfs2_dinode *di)
 	 * first the ones that are explicitly marked with flags.. */ 
 	if (di->i_flags & OCFS2_SUPER_BLOCK_FL) {
 		struct ocfs2_super_block *sb = &di->id2.i_super;
+		int i;
 
 		sb->s_major_rev_level     = bswap_16(sb->s_major_rev_level);
 		sb->s_minor_rev_level     = bswap_16(sb->s_minor_rev_level);
@@ -142,6 +143,14 @@ static void ocfs2_swap_inode_second(struct ocfs2_dinode *di)
 		sb->s_dx_seed[0]          = bswap_32(sb->s_dx_seed[0]);
 		sb->s_dx_seed[1]          = bswap_32(sb->s_dx_seed[1]);
 		sb->s_dx_seed[2]          = bswap_32(sb->s_dx_seed[2]);
+		sb->s_tunefs_cursor       = bswap_64(sb->s_tunefs_cursor);
+		sb->s_tunefs_cursor_inodes =
+			bswap_32(sb->s_tunefs_cursor_inodes);
+		for (i = 0; i < OCFS2_TUNEFS_CURSOR_MAX_PASSES; i++)
+			sb->s_tunefs_cursor_passes[i] =
+				bswap_32(sb->s_tunefs_cursor_passes[i]);
+		sb->s_tunefs_csize_record =
+			bswap_64(sb->s_tunefs_csize_record);
 
 	} else if (di->i_flags & OCFS2_LOCAL_ALLOC_FL) {
 		struct ocfs2_local_alloc *la = &di->id2.i_lab;
@@ -309,7 +318,7 @@ errcode_t ocfs2_read_inode(ocfs2_filesys *fs, uint64_t blkno,
 
 	memcpy(inode_buf, blk, fs->fs_blocksize);
 
-	ret = ocfs2_validate_meta_ecc(fs, blk, &di->i_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, blkno, blk, &di->i_check);
 	if (ret)
 		goto out;
 
@@ -308,6 +308,59 @@ errcode_t ocfs2_get_next_inode(ocfs2_inode_scan *scan,
 	return 0;
 }
 
+int ocfs2_inode_scan_group_done(ocfs2_inode_scan *scan,
+				uint64_t *group_blkno)
+{
+	if (!scan->cur_desc || scan->blocks_in_buffer ||
+	    (scan->b_offset != scan->cur_desc->bg_bits))
+		return 0;
+
+	*group_blkno = scan->cur_desc->bg_blkno;
+	return 1;
+}
+
+/*
+ * Walks the same chains as ocfs2_get_next_inode(), but only reads the
+ * group descriptors.  If group_blkno isn't found, the scan is left at
+ * the end and OCFS2_ET_ITERATION_COMPLETE is returned.
+ */
+errcode_t ocfs2_inode_scan_seek_group(ocfs2_inode_scan *scan,
+				      uint64_t group_blkno)
+{
+	errcode_t ret;
+	unsigned int skip;
+
+	if (scan->blocks_in_buffer)
+		abort();
+
+	for (;;) {
+		if (!scan->blocks_left && get_next_inode_alloc(scan))
+			return OCFS2_ET_ITERATION_COMPLETE;
+
+		if (!scan->cur_rec || (scan->count == scan->cur_rec->c_total)) {
+			ret = get_next_chain(scan);
+			if (ret)
+				return ret;
+		}
+
+		ret = get_next_group(scan);
+		if (ret)
+			return ret;
+
+		skip = scan->cur_desc->bg_bits - scan->b_offset;
+		if ((skip > scan->blocks_left) ||
+		    (scan->count + skip > scan->cur_rec->c_total))
+			return OCFS2_ET_CORRUPT_CHAIN;
+
+		scan->count += skip;
+		scan->blocks_left -= skip;
+		scan->b_offset = scan->cur_desc->bg_bits;
+
+		if (scan->cur_desc->bg_blkno == group_blkno)
+			return 0;
+	}
+}
+
 errcode_t ocfs2_open_inode_scan(ocfs2_filesys *fs,
 				ocfs2_inode_scan **ret_scan)
 {
@@ -314,6 +314,7 @@ static errcode_t ocfs2_format_journal(ocfs2_filesys *fs,
 	int bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
 	uint64_t offset = 0;
 	uint32_t wrote, count, jrnl_blocks;
+	ocfs2_write_session *ws = NULL;
 
 #define BUFLEN	1048576
 	ret = ocfs2_malloc_blocks(fs->fs_io, (BUFLEN >> bs_bits), &buf);
@@ -321,17 +322,25 @@ static errcode_t ocfs2_format_journal(ocfs2_filesys *fs,
 		goto out;
 	memset(buf, 0, BUFLEN);
 
+	ret = ocfs2_write_session_begin(ci, &ws);
+	if (ret)
+		goto out;
+
 	io_set_nocache(fs->fs_io, true);
 	count = (uint32_t) ci->ci_inode->i_size;
 	while (count) {
-		ret = ocfs2_file_write(ci, buf, ocfs2_min((uint32_t) BUFLEN, count),
-				       offset, &wrote);
+		ret = ocfs2_write_session_write(ws, buf,
+					ocfs2_min((uint32_t) BUFLEN, count),
+					offset, &wrote);
 		if (ret)
 			break;
 		offset += wrote;
 		count -= wrote;
 	}
+	if (!ret)
+		ret = ocfs2_write_session_flush(ws);
 	io_set_nocache(fs->fs_io, false);
+	ocfs2_write_session_free(ws);
 	if (ret)
 		goto out;
 
@@ -278,6 +278,7 @@ errcode_t ocfs2_open(const char *name, int flags,
 	int i, len;
 	char *ptr;
 	unsigned char *raw_uuid;
+	struct ocfs2_device_topology topo;
 
 	ret = ocfs2_malloc0(sizeof(ocfs2_filesys), &fs);
 	if (ret)
@@ -452,6 +453,13 @@ errcode_t ocfs2_open(const char *name, int flags,
 	fs->fs_first_cg_blkno = 
 		OCFS2_RAW_SB(fs->fs_super)->s_first_cluster_group;
 
+	/* Align large allocations to what the device reports, if anything */
+	if (!(flags & OCFS2_FLAG_IMAGE_FILE) &&
+	    !ocfs2_get_device_topology(name, &topo))
+		ocfs2_set_stripe_geometry(fs, topo.dt_opt_io ? topo.dt_opt_io :
+					  topo.dt_min_io,
+					  topo.dt_align_offset);
+
 	raw_uuid = OCFS2_RAW_SB(fs->fs_super)->s_uuid;
 	for (i = 0, ptr = fs->uuid_str; i < OCFS2_VOL_UUID_LEN; i++) {
 		/* print with null */
@@ -32,13 +32,41 @@
 #include "extent_tree.h"
 #include "refcount.h"
 
+/*
+ * A refcount session pins the root of one refcount tree and keeps the
+ * most recently used leaves in memory across a batch of refcount changes.
+ * Record updates only dirty the cached copy; the dirty leaves are written
+ * in block order when the session is committed (or when a dirty leaf is
+ * evicted).  Changes to the shape of the tree (expanding the root, adding
+ * or removing a leaf) still go to disk immediately, so the tree never
+ * points at a block that has not been written.
+ *
+ * Only one session may be open on a given tree at a time.
+ */
+#define OCFS2_REFCOUNT_SESSION_LEAVES	16
+
+struct ocfs2_rs_leaf {
+	uint64_t sl_blkno;
+	char *sl_buf;
+	int sl_dirty;
+	unsigned long sl_stamp;
+};
+
+struct _ocfs2_refcount_session {
+	ocfs2_filesys *rs_fs;
+	uint64_t rs_root_blkno;
+	char *rs_root_buf;
+	int rs_root_dirty;
+	unsigned long rs_clock;
+	struct ocfs2_rs_leaf rs_leaves[OCFS2_REFCOUNT_SESSION_LEAVES];
+};
+
 struct ocfs2_cow_context {
 	ocfs2_filesys *fs;
 	uint32_t cow_start;
 	uint32_t cow_len;
 	struct ocfs2_extent_tree data_et;
-	char *ref_root_buf;
-	uint64_t ref_root_blkno;
+	ocfs2_refcount_session *ref_session;
 	void *cow_object;
 	struct ocfs2_post_refcount *post_refcount;
 	int (*get_clusters)(struct ocfs2_cow_context *context,
@@ -156,7 +184,7 @@ errcode_t ocfs2_read_refcount_block_nocheck(ocfs2_filesys *fs,
 
 	rb = (struct ocfs2_refcount_block *)blk;
 
-	ret = ocfs2_validate_meta_ecc(fs, blk, &rb->rf_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, blkno, blk, &rb->rf_check);
 	if (ret)
 		goto out;
 
@@ -276,6 +304,236 @@ out:
 	*index = i;
 }
 
+static struct ocfs2_rs_leaf *ocfs2_rs_lookup(ocfs2_refcount_session *rs,
+					     uint64_t blkno)
+{
+	int i;
+
+	for (i = 0; i < OCFS2_REFCOUNT_SESSION_LEAVES; i++)
+		if (rs->rs_leaves[i].sl_buf &&
+		    rs->rs_leaves[i].sl_blkno == blkno)
+			return &rs->rs_leaves[i];
+
+	return NULL;
+}
+
+/*
+ * Find a slot for blkno, evicting the least recently used leaf if the
+ * cache is full.  A dirty victim is written out first.
+ */
+static errcode_t ocfs2_rs_grab(ocfs2_refcount_session *rs, uint64_t blkno,
+			       struct ocfs2_rs_leaf **ret_leaf)
+{
+	errcode_t ret;
+	int i;
+	struct ocfs2_rs_leaf *leaf, *victim = NULL;
+
+	for (i = 0; i < OCFS2_REFCOUNT_SESSION_LEAVES; i++) {
+		leaf = &rs->rs_leaves[i];
+		if (!leaf->sl_buf || !leaf->sl_blkno) {
+			victim = leaf;
+			break;
+		}
+		if (!victim || leaf->sl_stamp < victim->sl_stamp)
+			victim = leaf;
+	}
+
+	if (!victim->sl_buf) {
+		ret = ocfs2_malloc_block(rs->rs_fs->fs_io, &victim->sl_buf);
+		if (ret)
+			return ret;
+	} else if (victim->sl_dirty) {
+		ret = ocfs2_write_refcount_block(rs->rs_fs, victim->sl_blkno,
+						 victim->sl_buf);
+		if (ret)
+			return ret;
+	}
+
+	victim->sl_blkno = blkno;
+	victim->sl_dirty = 0;
+	victim->sl_stamp = ++rs->rs_clock;
+	*ret_leaf = victim;
+	return 0;
+}
+
+/* Copy the leaf at blkno into buf, reading it into the cache if needed. */
+static errcode_t ocfs2_rs_read_leaf(ocfs2_refcount_session *rs,
+				    uint64_t blkno, char *buf)
+{
+	errcode_t ret;
+	struct ocfs2_rs_leaf *leaf;
+
+	if (blkno == rs->rs_root_blkno) {
+		memcpy(buf, rs->rs_root_buf, rs->rs_fs->fs_blocksize);
+		return 0;
+	}
+
+	leaf = ocfs2_rs_lookup(rs, blkno);
+	if (!leaf) {
+		ret = ocfs2_rs_grab(rs, blkno, &leaf);
+		if (ret)
+			return ret;
+
+		ret = ocfs2_read_refcount_block(rs->rs_fs, blkno,
+						leaf->sl_buf);
+		if (ret) {
+			leaf->sl_blkno = 0;
+			return ret;
+		}
+	}
+
+	leaf->sl_stamp = ++rs->rs_clock;
+	memcpy(buf, leaf->sl_buf, rs->rs_fs->fs_blocksize);
+	return 0;
+}
+
+/*
+ * Store buf as the new contents of the leaf at blkno.  If sync is
+ * set the block goes to disk now, otherwise it is written at commit.
+ */
+static errcode_t ocfs2_rs_write_leaf(ocfs2_refcount_session *rs,
+				     uint64_t blkno, char *buf, int sync)
+{
+	errcode_t ret;
+	struct ocfs2_rs_leaf *leaf;
+
+	if (blkno == rs->rs_root_blkno) {
+		if (buf != rs->rs_root_buf)
+			memcpy(rs->rs_root_buf, buf, rs->rs_fs->fs_blocksize);
+		if (!sync) {
+			rs->rs_root_dirty = 1;
+			return 0;
+		}
+		rs->rs_root_dirty = 0;
+		return ocfs2_write_refcount_block(rs->rs_fs, blkno,
+						  rs->rs_root_buf);
+	}
+
+	leaf = ocfs2_rs_lookup(rs, blkno);
+	if (!leaf) {
+		ret = ocfs2_rs_grab(rs, blkno, &leaf);
+		if (ret)
+			return ret;
+	}
+
+	leaf->sl_stamp = ++rs->rs_clock;
+	memcpy(leaf->sl_buf, buf, rs->rs_fs->fs_blocksize);
+	if (!sync) {
+		leaf->sl_dirty = 1;
+		return 0;
+	}
+
+	leaf->sl_dirty = 0;
+	return ocfs2_write_refcount_block(rs->rs_fs, blkno, leaf->sl_buf);
+}
+
+/* Drop a leaf that is about to be freed; its pending changes are moot. */
+static void ocfs2_rs_forget_leaf(ocfs2_refcount_session *rs, uint64_t blkno)
+{
+	struct ocfs2_rs_leaf *leaf = ocfs2_rs_lookup(rs, blkno);
+
+	if (leaf) {
+		leaf->sl_blkno = 0;
+		leaf->sl_dirty = 0;
+	}
+}
+
+errcode_t ocfs2_refcount_session_begin(ocfs2_filesys *fs,
+				       uint64_t refcount_loc,
+				       ocfs2_refcount_session **ret_rs)
+{
+	errcode_t ret;
+	ocfs2_refcount_session *rs = NULL;
+
+	if (!(fs->fs_flags & OCFS2_FLAG_RW))
+		return OCFS2_ET_RO_FILESYS;
+
+	ret = ocfs2_malloc0(sizeof(ocfs2_refcount_session), &rs);
+	if (ret)
+		return ret;
+
+	rs->rs_fs = fs;
+	rs->rs_root_blkno = refcount_loc;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &rs->rs_root_buf);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_read_refcount_block(fs, refcount_loc, rs->rs_root_buf);
+	if (ret)
+		goto out;
+
+	*ret_rs = rs;
+	rs = NULL;
+out:
+	if (rs)
+		ocfs2_refcount_session_free(rs);
+	return ret;
+}
+
+static int ocfs2_rs_leaf_cmp(const void *a, const void *b)
+{
+	const struct ocfs2_rs_leaf *l = *(struct ocfs2_rs_leaf * const *)a;
+	const struct ocfs2_rs_leaf *r = *(struct ocfs2_rs_leaf * const *)b;
+
+	if (l->sl_blkno < r->sl_blkno)
+		return -1;
+	if (l->sl_blkno > r->sl_blkno)
+		return 1;
+	return 0;
+}
+
+/*
+ * Write every dirty leaf in block order, then the root.  The session
+ * stays usable afterwards.
+ */
+errcode_t ocfs2_refcount_session_commit(ocfs2_refcount_session *rs)
+{
+	errcode_t ret;
+	int i, dirty = 0;
+	struct ocfs2_rs_leaf *leaves[OCFS2_REFCOUNT_SESSION_LEAVES];
+
+	for (i = 0; i < OCFS2_REFCOUNT_SESSION_LEAVES; i++)
+		if (rs->rs_leaves[i].sl_dirty)
+			leaves[dirty++] = &rs->rs_leaves[i];
+
+	qsort(leaves, dirty, sizeof(struct ocfs2_rs_leaf *),
+	      ocfs2_rs_leaf_cmp);
+
+	for (i = 0; i < dirty; i++) {
+		ret = ocfs2_write_refcount_block(rs->rs_fs,
+						 leaves[i]->sl_blkno,
+						 leaves[i]->sl_buf);
+		if (ret)
+			return ret;
+		leaves[i]->sl_dirty = 0;
+	}
+
+	if (rs->rs_root_dirty) {
+		ret = ocfs2_write_refcount_block(rs->rs_fs, rs->rs_root_blkno,
+						 rs->rs_root_buf);
+		if (ret)
+			return ret;
+		rs->rs_root_dirty = 0;
+	}
+
+	return 0;
+}
+
+/* Release the session.  Anything not committed is discarded. */
+void ocfs2_refcount_session_free(ocfs2_refcount_session *rs)
+{
+	int i;
+
+	for (i = 0; i < OCFS2_REFCOUNT_SESSION_LEAVES; i++)
+		if (rs->rs_leaves[i].sl_buf)
+			ocfs2_free(&rs->rs_leaves[i].sl_buf);
+
+	if (rs->rs_root_buf)
+		ocfs2_free(&rs->rs_root_buf);
+	ocfs2_free(&rs);
+}
+
 /*
  * Given a cpos and len, try to find the refcount record which contains cpos.
  * 1. If cpos can be found in one refcount record, return the record.
@@ -283,12 +541,13 @@ out:
  *    and end at a small value between cpos+len and start of the next record.
  *    This fake record has r_refcount = 0.
  */
-int ocfs2_get_refcount_rec(ocfs2_filesys *fs,
-			   char *ref_root_buf,
-			   uint64_t cpos, unsigned int len,
-			   struct ocfs2_refcount_rec *ret_rec,
-			   int *index,
-			   char *ret_buf)
+static int __ocfs2_get_refcount_rec(ocfs2_filesys *fs,
+				    ocfs2_refcount_session *rs,
+				    char *ref_root_buf,
+				    uint64_t cpos, unsigned int len,
+				    struct ocfs2_refcount_rec *ret_rec,
+				    int *index,
+				    char *ret_buf)
 {
 	int ret = 0, i, found;
 	uint32_t low_cpos;
@@ -343,6 +602,16 @@ int ocfs2_get_refcount_rec(ocfs2_filesys *fs,
 			len = tmp->e_cpos - cpos;
 	}
 
+	if (rs) {
+		ret = ocfs2_rs_read_leaf(rs, rec->e_blkno, ret_buf);
+		if (ret)
+			goto out;
+
+		ocfs2_find_refcount_rec_in_rl(ret_buf, cpos, len,
+					      ret_rec, index);
+		goto out;
+	}
+
 	ret = ocfs2_malloc_block(fs->fs_io, &ref_leaf_buf);
 	if (ret)
 		goto out;
@@ -364,6 +633,26 @@ out:
 	return ret;
 }
 
+int ocfs2_get_refcount_rec(ocfs2_filesys *fs,
+			   char *ref_root_buf,
+			   uint64_t cpos, unsigned int len,
+			   struct ocfs2_refcount_rec *ret_rec,
+			   int *index,
+			   char *ret_buf)
+{
+	return __ocfs2_get_refcount_rec(fs, NULL, ref_root_buf, cpos, len,
+					ret_rec, index, ret_buf);
+}
+
+static int ocfs2_rs_get_rec(ocfs2_refcount_session *rs,
+			    uint64_t cpos, unsigned int len,
+			    struct ocfs2_refcount_rec *ret_rec,
+			    int *index, char *ret_buf)
+{
+	return __ocfs2_get_refcount_rec(rs->rs_fs, rs, rs->rs_root_buf,
+					cpos, len, ret_rec, index, ret_buf);
+}
+
 enum ocfs2_ref_rec_contig {
 	REF_CONTIG_NONE = 0,
 	REF_CONTIG_LEFT,
@@ -457,7 +746,7 @@ static void ocfs2_refcount_rec_merge(struct ocfs2_refcount_block *rb,
  * Change the refcount indexed by "index" in rb.
  * If refcount reaches 0, remove it.
  */
-static int ocfs2_change_refcount_rec(ocfs2_filesys *fs,
+static int ocfs2_change_refcount_rec(ocfs2_refcount_session *rs,
 				     char *ref_leaf_buf,
 				     int index, int merge, int change)
 {
@@ -481,14 +770,15 @@ static int ocfs2_change_refcount_rec(ocfs2_filesys *fs,
 	} else if (merge)
 		ocfs2_refcount_rec_merge(rb, index);
 
-	return ocfs2_write_refcount_block(fs, rb->rf_blkno, ref_leaf_buf);
+	return ocfs2_rs_write_leaf(rs, rb->rf_blkno, ref_leaf_buf, 0);
 }
 
-static int ocfs2_expand_inline_ref_root(ocfs2_filesys *fs,
-					char *ref_root_buf,
+static int ocfs2_expand_inline_ref_root(ocfs2_refcount_session *rs,
 					char *ret_leaf_buf)
 {
 	int ret;
+	ocfs2_filesys *fs = rs->rs_fs;
+	char *ref_root_buf = rs->rs_root_buf;
 	uint64_t new_blkno;
 	char *new_buf = NULL;
 	struct ocfs2_refcount_block *new_rb;
@@ -534,11 +824,11 @@ static int ocfs2_expand_inline_ref_root(ocfs2_filesys *fs,
 	 * We write the new allocated refcount block first. If the write
 	 * fails, skip update the root.
 	 */
-	ret = ocfs2_write_refcount_block(fs, new_rb->rf_blkno, new_buf);
+	ret = ocfs2_rs_write_leaf(rs, new_rb->rf_blkno, new_buf, 1);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_write_refcount_block(fs, root_rb->rf_blkno, ref_root_buf);
+	ret = ocfs2_rs_write_leaf(rs, root_rb->rf_blkno, ref_root_buf, 1);
 	if (ret)
 		goto out;
 
@@ -689,11 +979,12 @@ static int ocfs2_divide_leaf_refcount_block(char *ref_leaf_buf,
 	return 0;
 }
 
-static int ocfs2_new_leaf_refcount_block(ocfs2_filesys *fs,
-					 char *ref_root_buf,
+static int ocfs2_new_leaf_refcount_block(ocfs2_refcount_session *rs,
 					 char *ref_leaf_buf)
 {
 	int ret;
+	ocfs2_filesys *fs = rs->rs_fs;
+	char *ref_root_buf = rs->rs_root_buf;
 	uint32_t new_cpos;
 	uint64_t new_blkno;
 	struct ocfs2_refcount_block *root_rb =
@@ -733,11 +1024,11 @@ static int ocfs2_new_leaf_refcount_block(ocfs2_filesys *fs,
 	 * the refcounted clusters we have moved to the new refcount block.
 	 */
 	rb = (struct ocfs2_refcount_block *)ref_leaf_buf;
-	ret = ocfs2_write_refcount_block(fs, rb->rf_blkno, ref_leaf_buf);
+	ret = ocfs2_rs_write_leaf(rs, rb->rf_blkno, ref_leaf_buf, 1);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_write_refcount_block(fs, new_blkno, new_buf);
+	ret = ocfs2_rs_write_leaf(rs, new_blkno, new_buf, 1);
 	if (ret)
 		goto out;
 out:
@@ -746,13 +1037,12 @@ out:
 	return ret;
 }
 
-static int ocfs2_expand_refcount_tree(ocfs2_filesys *fs,
-				      char *ref_root_buf,
+static int ocfs2_expand_refcount_tree(ocfs2_refcount_session *rs,
 				      char *ref_leaf_buf)
 {
 	int ret;
 	struct ocfs2_refcount_block *root_rb =
-			(struct ocfs2_refcount_block *)ref_root_buf;
+			(struct ocfs2_refcount_block *)rs->rs_root_buf;
 	struct ocfs2_refcount_block *leaf_rb =
 			(struct ocfs2_refcount_block *)ref_leaf_buf;
 
@@ -761,14 +1051,13 @@ static int ocfs2_expand_refcount_tree(ocfs2_filesys *fs,
 		 * the old root bh hasn't been expanded to a b-tree,
 		 * so expand it first.
 		 */
-		ret = ocfs2_expand_inline_ref_root(fs, ref_root_buf,
-						   ref_leaf_buf);
+		ret = ocfs2_expand_inline_ref_root(rs, ref_leaf_buf);
 		if (ret)
 			goto out;
 	}
 
 	/* Now add a new refcount block into the tree.*/
-	ret = ocfs2_new_leaf_refcount_block(fs, ref_root_buf, ref_leaf_buf);
+	ret = ocfs2_new_leaf_refcount_block(rs, ref_leaf_buf);
 out:
 	return ret;
 }
@@ -779,12 +1068,13 @@ out:
  * Only called when we have inserted a new refcount rec at index 0
  * which means ocfs2_extent_rec.e_cpos may need some change.
  */
-static int ocfs2_adjust_refcount_rec(ocfs2_filesys *fs,
-				     char *ref_root_buf,
+static int ocfs2_adjust_refcount_rec(ocfs2_refcount_session *rs,
 				     char *ref_leaf_buf,
 				     struct ocfs2_refcount_rec *rec)
 {
 	int ret = 0, i;
+	ocfs2_filesys *fs = rs->rs_fs;
+	char *ref_root_buf = rs->rs_root_buf;
 	uint32_t new_cpos, old_cpos;
 	struct ocfs2_path *path = NULL;
 	struct ocfs2_extent_list *el;
@@ -833,14 +1123,13 @@ static int ocfs2_adjust_refcount_rec(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
-	ret = ocfs2_write_refcount_block(fs, rb->rf_blkno, ref_leaf_buf);
+	ret = ocfs2_rs_write_leaf(rs, rb->rf_blkno, ref_leaf_buf, 1);
 out:
 	ocfs2_free_path(path);
 	return ret;
 }
 
-static int ocfs2_insert_refcount_rec(ocfs2_filesys *fs,
-				     char *ref_root_buf,
+static int ocfs2_insert_refcount_rec(ocfs2_refcount_session *rs,
 				     char *ref_leaf_buf,
 				     struct ocfs2_refcount_rec *rec,
 				     int index, int merge)
@@ -856,14 +1145,12 @@ static int ocfs2_insert_refcount_rec(ocfs2_filesys *fs,
 		uint64_t cpos = rec->r_cpos;
 		uint32_t len = rec->r_clusters;
 
-		ret = ocfs2_expand_refcount_tree(fs, ref_root_buf,
-						 ref_leaf_buf);
+		ret = ocfs2_expand_refcount_tree(rs, ref_leaf_buf);
 		if (ret)
 			goto out;
 
-		ret = ocfs2_get_refcount_rec(fs, ref_root_buf,
-					     cpos, len, NULL, &index,
-					     ref_leaf_buf);
+		ret = ocfs2_rs_get_rec(rs, cpos, len, NULL, &index,
+				       ref_leaf_buf);
 		if (ret)
 			goto out;
 	}
@@ -881,13 +1168,12 @@ static int ocfs2_insert_refcount_rec(ocfs2_filesys *fs,
 	if (merge)
 		ocfs2_refcount_rec_merge(rb, index);
 
-	ret = ocfs2_write_refcount_block(fs, rb->rf_blkno, ref_leaf_buf);
+	ret = ocfs2_rs_write_leaf(rs, rb->rf_blkno, ref_leaf_buf, 0);
 	if (ret)
 		goto out;
 
 	if (index == 0)
-		ret = ocfs2_adjust_refcount_rec(fs, ref_root_buf,
-						ref_leaf_buf, rec);
+		ret = ocfs2_adjust_refcount_rec(rs, ref_leaf_buf, rec);
 out:
 	return ret;
 }
@@ -901,8 +1187,7 @@ out:
  * If split_rec->r_refcount == 0, we are punching a hole in current refcount
  * rec( in case we decrease a refcount to zero).
  */
-static int ocfs2_split_refcount_rec(ocfs2_filesys *fs,
-				    char *ref_root_buf,
+static int ocfs2_split_refcount_rec(ocfs2_refcount_session *rs,
 				    char *ref_leaf_buf,
 				    struct ocfs2_refcount_rec *split_rec,
 				    int index, int merge)
@@ -945,8 +1230,7 @@ static int ocfs2_split_refcount_rec(ocfs2_filesys *fs,
 		struct ocfs2_refcount_rec tmp_rec;
 		uint64_t cpos = orig_rec->r_cpos;
 		len = orig_rec->r_clusters;
-		ret = ocfs2_expand_refcount_tree(fs, ref_root_buf,
-						 ref_leaf_buf);
+		ret = ocfs2_expand_refcount_tree(rs, ref_leaf_buf);
 		if (ret)
 			goto out;
 
@@ -954,9 +1238,8 @@ static int ocfs2_split_refcount_rec(ocfs2_filesys *fs,
 		 * We have to re-get it since now cpos may be moved to
 		 * another leaf block.
 		 */
-		ret = ocfs2_get_refcount_rec(fs, ref_root_buf,
-					     cpos, len, &tmp_rec, &index,
-					     ref_leaf_buf);
+		ret = ocfs2_rs_get_rec(rs, cpos, len, &tmp_rec, &index,
+				       ref_leaf_buf);
 		if (ret)
 			goto out;
 
@@ -1013,14 +1296,13 @@ static int ocfs2_split_refcount_rec(ocfs2_filesys *fs,
 			ocfs2_refcount_rec_merge(rb, index);
 	}
 
-	ret = ocfs2_write_refcount_block(fs, rb->rf_blkno, ref_leaf_buf);
+	ret = ocfs2_rs_write_leaf(rs, rb->rf_blkno, ref_leaf_buf, 0);
 
 out:
 	return ret;
 }
 
-static int __ocfs2_increase_refcount(ocfs2_filesys *fs,
-				     char *ref_root_buf,
+static int __ocfs2_increase_refcount(ocfs2_refcount_session *rs,
 				     uint64_t cpos, uint32_t len, int merge,
 				     int value)
 {
@@ -1028,18 +1310,14 @@ static int __ocfs2_increase_refcount(ocfs2_filesys *fs,
 	char *ref_leaf_buf = NULL;
 	struct ocfs2_refcount_rec rec;
 	unsigned int set_len = 0;
-	struct ocfs2_refcount_block *root_rb, *rb;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &ref_leaf_buf);
+	ret = ocfs2_malloc_block(rs->rs_fs->fs_io, &ref_leaf_buf);
 	if (ret)
 		return ret;
 
-	root_rb = (struct ocfs2_refcount_block *)ref_root_buf;
-	rb = (struct ocfs2_refcount_block *)ref_leaf_buf;
 	while (len) {
-		ret = ocfs2_get_refcount_rec(fs, ref_root_buf,
-					     cpos, len, &rec, &index,
-					     ref_leaf_buf);
+		ret = ocfs2_rs_get_rec(rs, cpos, len, &rec, &index,
+				       ref_leaf_buf);
 		if (ret)
 			goto out;
 
@@ -1056,15 +1334,14 @@ static int __ocfs2_increase_refcount(ocfs2_filesys *fs,
 		 *    it.
 		 */
 		if (rec.r_refcount && rec.r_cpos == cpos && set_len <= len) {
-			ret = ocfs2_change_refcount_rec(fs, ref_leaf_buf, index,
+			ret = ocfs2_change_refcount_rec(rs, ref_leaf_buf, index,
 							merge, value);
 			if (ret)
 				goto out;
 		} else if (!rec.r_refcount) {
 			rec.r_refcount = value;
 
-			ret = ocfs2_insert_refcount_rec(fs, ref_root_buf,
-							ref_leaf_buf,
+			ret = ocfs2_insert_refcount_rec(rs, ref_leaf_buf,
 							&rec, index, merge);
 			if (ret)
 				goto out;
@@ -1075,8 +1352,7 @@ static int __ocfs2_increase_refcount(ocfs2_filesys *fs,
 			rec.r_clusters = set_len;
 			rec.r_refcount += value;
 
-			ret = ocfs2_split_refcount_rec(fs, ref_root_buf,
-						       ref_leaf_buf,
+			ret = ocfs2_split_refcount_rec(rs, ref_leaf_buf,
 						       &rec, index, merge);
 			if (ret)
 				goto out;
@@ -1084,9 +1360,6 @@ static int __ocfs2_increase_refcount(ocfs2_filesys *fs,
 
 		cpos += set_len;
 		len -= set_len;
-		/* In user space, we have to sync the buf by ourselves. */
-		if (rb->rf_blkno == root_rb->rf_blkno)
-			memcpy(ref_root_buf, ref_leaf_buf, fs->fs_blocksize);
 	}
 
 out:
@@ -1094,17 +1367,26 @@ out:
 	return ret;
 }
 
-errcode_t ocfs2_increase_refcount(ocfs2_filesys *fs, uint64_t ino,
-				  uint64_t cpos, uint32_t len)
+errcode_t ocfs2_refcount_session_increase(ocfs2_refcount_session *rs,
+					  uint64_t cpos, uint32_t len)
+{
+	return __ocfs2_increase_refcount(rs, cpos, len, 1, 1);
+}
+
+/*
+ * Open a one-shot session on the refcount tree of inode ino.
+ */
+static errcode_t ocfs2_inode_refcount_session(ocfs2_filesys *fs,
+					      uint64_t ino,
+					      ocfs2_refcount_session **ret_rs)
 {
 	errcode_t ret;
-	char *ref_root_buf = NULL;
 	char *di_buf = NULL;
 	struct ocfs2_dinode *di;
 
 	ret = ocfs2_malloc_block(fs->fs_io, &di_buf);
 	if (ret)
-		goto out;
+		return ret;
 
 	ret = ocfs2_read_inode(fs, ino, di_buf);
 	if (ret)
@@ -1115,29 +1397,36 @@ errcode_t ocfs2_increase_refcount(ocfs2_filesys *fs, uint64_t ino,
 	assert(di->i_dyn_features & OCFS2_HAS_REFCOUNT_FL);
 	assert(di->i_refcount_loc);
 
-	ret = ocfs2_malloc_block(fs->fs_io, &ref_root_buf);
-	if (ret)
-		goto out;
+	ret = ocfs2_refcount_session_begin(fs, di->i_refcount_loc, ret_rs);
+out:
+	ocfs2_free(&di_buf);
+	return ret;
+}
+
+errcode_t ocfs2_increase_refcount(ocfs2_filesys *fs, uint64_t ino,
+				  uint64_t cpos, uint32_t len)
+{
+	errcode_t ret;
+	ocfs2_refcount_session *rs = NULL;
 
-	ret = ocfs2_read_refcount_block(fs, di->i_refcount_loc, ref_root_buf);
+	ret = ocfs2_inode_refcount_session(fs, ino, &rs);
 	if (ret)
-		goto out;
+		return ret;
 
-	ret =  __ocfs2_increase_refcount(fs, ref_root_buf,
-					 cpos, len, 1, 1);
-out:
-	if (ref_root_buf)
-		ocfs2_free(&ref_root_buf);
-	if (di_buf)
-		ocfs2_free(&di_buf);
+	ret = ocfs2_refcount_session_increase(rs, cpos, len);
+	if (!ret)
+		ret = ocfs2_refcount_session_commit(rs);
+
+	ocfs2_refcount_session_free(rs);
 	return ret;
 }
 
-static int ocfs2_remove_refcount_extent(ocfs2_filesys *fs,
-					char *ref_root_buf,
+static int ocfs2_remove_refcount_extent(ocfs2_refcount_session *rs,
 					char *ref_leaf_buf)
 {
 	int ret;
+	ocfs2_filesys *fs = rs->rs_fs;
+	char *ref_root_buf = rs->rs_root_buf;
 	struct ocfs2_refcount_block *rb =
 			(struct ocfs2_refcount_block *)ref_leaf_buf;
 	struct ocfs2_refcount_block *root_rb =
@@ -1152,6 +1441,7 @@ static int ocfs2_remove_refcount_extent(ocfs2_filesys *fs,
 	if (ret)
 		goto out;
 
+	ocfs2_rs_forget_leaf(rs, rb->rf_blkno);
 	ret = ocfs2_delete_refcount_block(fs, rb->rf_blkno);
 
 	root_rb->rf_clusters -= 1;
@@ -1172,13 +1462,12 @@ static int ocfs2_remove_refcount_extent(ocfs2_filesys *fs,
 				ocfs2_refcount_recs_per_rb(fs->fs_blocksize);
 	}
 
-	ret = ocfs2_write_refcount_block(fs, root_rb->rf_blkno, ref_root_buf);
+	ret = ocfs2_rs_write_leaf(rs, root_rb->rf_blkno, ref_root_buf, 1);
 out:
 	return ret;
 }
 
-static int ocfs2_decrease_refcount_rec(ocfs2_filesys *fs,
-				char *ref_root_buf,
+static int ocfs2_decrease_refcount_rec(ocfs2_refcount_session *rs,
 				char *ref_leaf_buf,
 				int index, uint64_t cpos, unsigned int len,
 				int value)
@@ -1186,15 +1475,13 @@ static int ocfs2_decrease_refcount_rec(ocfs2_filesys *fs,
 	int ret;
 	struct ocfs2_refcount_block *rb =
 			(struct ocfs2_refcount_block *)ref_leaf_buf;
-	struct ocfs2_refcount_block *root_rb =
-			(struct ocfs2_refcount_block *)ref_root_buf;
 	struct ocfs2_refcount_rec *rec = &rb->rf_records.rl_recs[index];
 
 	assert(cpos >= rec->r_cpos);
 	assert(cpos + len <= rec->r_cpos + rec->r_clusters);
 
 	if (cpos == rec->r_cpos && len == rec->r_clusters)
-		ret = ocfs2_change_refcount_rec(fs, ref_leaf_buf,
+		ret = ocfs2_change_refcount_rec(rs, ref_leaf_buf,
 						index, 1, -value);
 	else {
 		struct ocfs2_refcount_rec split = *rec;
@@ -1203,32 +1490,28 @@ static int ocfs2_decrease_refcount_rec(ocfs2_filesys *fs,
 
 		split.r_refcount -= value;
 
-		ret = ocfs2_split_refcount_rec(fs, ref_root_buf, ref_leaf_buf,
+		ret = ocfs2_split_refcount_rec(rs, ref_leaf_buf,
 					       &split, index, 1);
 	}
 	if (ret)
 		goto out;
 
-	/* In user space, we have to sync the buf by ourselves. */
-	if (rb->rf_blkno == root_rb->rf_blkno)
-		memcpy(ref_root_buf, ref_leaf_buf, fs->fs_blocksize);
-
 	/* Remove the leaf refcount block if it contains no refcount record. */
 	if (!rb->rf_records.rl_used &&
-	    rb->rf_blkno != root_rb->rf_blkno) {
-		ret = ocfs2_remove_refcount_extent(fs, ref_root_buf,
-						   ref_leaf_buf);
+	    rb->rf_blkno != rs->rs_root_blkno) {
+		ret = ocfs2_remove_refcount_extent(rs, ref_leaf_buf);
 	}
 
 out:
 	return ret;
 }
 
-static int __ocfs2_decrease_refcount(ocfs2_filesys *fs, char *ref_root_buf,
+static int __ocfs2_decrease_refcount(ocfs2_refcount_session *rs,
 				     uint64_t cpos, uint32_t len,
 				     int delete)
 {
 	int ret = 0, index = 0;
+	ocfs2_filesys *fs = rs->rs_fs;
 	struct ocfs2_refcount_rec rec;
 	unsigned int r_count = 0, r_len;
 	char *ref_leaf_buf = NULL;
@@ -1238,9 +1521,8 @@ static int __ocfs2_decrease_refcount(ocfs2_filesys *fs, char *ref_root_buf,
 		return ret;
 
 	while (len) {
-		ret = ocfs2_get_refcount_rec(fs, ref_root_buf,
-					     cpos, len, &rec, &index,
-					     ref_leaf_buf);
+		ret = ocfs2_rs_get_rec(rs, cpos, len, &rec, &index,
+				       ref_leaf_buf);
 		if (ret)
 			goto out;
 
@@ -1252,8 +1534,7 @@ static int __ocfs2_decrease_refcount(ocfs2_filesys *fs, char *ref_root_buf,
 		r_len = ocfs2_min((uint64_t)(cpos + len),
 				(uint64_t)(rec.r_cpos + rec.r_clusters)) - cpos;
 
-		ret = ocfs2_decrease_refcount_rec(fs, ref_root_buf,
-						  ref_leaf_buf, index,
+		ret = ocfs2_decrease_refcount_rec(rs, ref_leaf_buf, index,
 						  cpos, r_len, 1);
 		if (ret)
 			goto out;
@@ -1274,42 +1555,29 @@ out:
 	return ret;
 }
 
+errcode_t ocfs2_refcount_session_decrease(ocfs2_refcount_session *rs,
+					  uint64_t cpos, uint32_t len,
+					  int delete)
+{
+	return __ocfs2_decrease_refcount(rs, cpos, len, delete);
+}
+
 errcode_t ocfs2_decrease_refcount(ocfs2_filesys *fs,
 				  uint64_t ino, uint32_t cpos,
 				  uint32_t len, int delete)
 {
 	errcode_t ret;
-	char *ref_root_buf = NULL;
-	char *di_buf = NULL;
-	struct ocfs2_dinode *di;
-
-	ret = ocfs2_malloc_block(fs->fs_io, &di_buf);
-	if (ret)
-		goto out;
-
-	ret = ocfs2_read_inode(fs, ino, di_buf);
-	if (ret)
-		goto out;
-
-	di = (struct ocfs2_dinode *)di_buf;
-
-	assert(di->i_dyn_features & OCFS2_HAS_REFCOUNT_FL);
-	assert(di->i_refcount_loc);
+	ocfs2_refcount_session *rs = NULL;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &ref_root_buf);
+	ret = ocfs2_inode_refcount_session(fs, ino, &rs);
 	if (ret)
-		goto out;
+		return ret;
 
-	ret = ocfs2_read_refcount_block(fs, di->i_refcount_loc, ref_root_buf);
-	if (ret)
-		goto out;
+	ret = ocfs2_refcount_session_decrease(rs, cpos, len, delete);
+	if (!ret)
+		ret = ocfs2_refcount_session_commit(rs);
 
-	ret = __ocfs2_decrease_refcount(fs, ref_root_buf, cpos, len, delete);
-out:
-	if (ref_root_buf)
-		ocfs2_free(&ref_root_buf);
-	if (di_buf)
-		ocfs2_free(&di_buf);
+	ocfs2_refcount_session_free(rs);
 	return ret;
 }
 
@@ -1651,10 +1919,9 @@ static int ocfs2_make_clusters_writable(struct ocfs2_cow_context *context,
 		return ret;
 
 	while (num_clusters) {
-		ret = ocfs2_get_refcount_rec(context->fs,
-					     context->ref_root_buf,
-					     p_cluster, num_clusters,
-					     &rec, &index, ref_leaf_buf);
+		ret = ocfs2_rs_get_rec(context->ref_session,
+				       p_cluster, num_clusters,
+				       &rec, &index, ref_leaf_buf);
 		if (ret)
 			goto out;
 
@@ -1694,8 +1961,7 @@ static int ocfs2_make_clusters_writable(struct ocfs2_cow_context *context,
 			set_len = new_len;
 		}
 
-		ret = __ocfs2_decrease_refcount(context->fs,
-						context->ref_root_buf,
+		ret = __ocfs2_decrease_refcount(context->ref_session,
 						p_cluster, set_len,
 						delete);
 		if (ret)
@@ -1761,6 +2027,7 @@ static int ocfs2_replace_cow(struct ocfs2_cow_context *context)
  * unrefcounted extent.
  */
 static int ocfs2_refcount_cow_hunk(ocfs2_cached_inode *cinode,
+				   ocfs2_refcount_session *rs,
 				   uint32_t cpos, uint32_t write_len,
 				   uint32_t max_cpos)
 {
@@ -1789,20 +2056,9 @@ static int ocfs2_refcount_cow_hunk(ocfs2_cached_inode *cinode,
 	context.fs = cinode->ci_fs;
 	context.get_clusters = ocfs2_di_get_clusters;
 	context.cow_object = cinode;
-
-	ret = ocfs2_malloc_block(cinode->ci_fs->fs_io, &context.ref_root_buf);
-	if (ret)
-		goto out;
-
-	ret = ocfs2_read_refcount_block(cinode->ci_fs,
-					cinode->ci_inode->i_refcount_loc,
-					context.ref_root_buf);
-	if (ret)
-		goto out;
+	context.ref_session = rs;
 
 	ret = ocfs2_replace_cow(&context);
-
-	ocfs2_free(&context.ref_root_buf);
 out:
 	return ret;
 }
@@ -1819,6 +2075,7 @@ errcode_t ocfs2_refcount_cow(ocfs2_cached_inode *cinode,
 	int ret = 0;
 	uint32_t p_cluster, num_clusters;
 	uint16_t ext_flags;
+	ocfs2_refcount_session *rs = NULL;
 
 	while (write_len) {
 		ret = ocfs2_get_clusters(cinode, cpos, &p_cluster,
@@ -1830,7 +2087,15 @@ errcode_t ocfs2_refcount_cow(ocfs2_cached_inode *cinode,
 			num_clusters = write_len;
 
 		if (ext_flags & OCFS2_EXT_REFCOUNTED) {
-			ret = ocfs2_refcount_cow_hunk(cinode, cpos,
+			/* One session covers every hunk of this write. */
+			if (!rs) {
+				ret = ocfs2_refcount_session_begin(cinode->ci_fs,
+					cinode->ci_inode->i_refcount_loc, &rs);
+				if (ret)
+					break;
+			}
+
+			ret = ocfs2_refcount_cow_hunk(cinode, rs, cpos,
 						      num_clusters, max_cpos);
 			if (ret)
 				break;
@@ -1840,12 +2105,77 @@ errcode_t ocfs2_refcount_cow(ocfs2_cached_inode *cinode,
 		cpos += num_clusters;
 	}
 
+	if (rs) {
+		if (!ret)
+			ret = ocfs2_refcount_session_commit(rs);
+		ocfs2_refcount_session_free(rs);
+	}
+
 	if (!ret)
 		ret = ocfs2_write_cached_inode(cinode->ci_fs, cinode);
 
 	return ret;
 }
 
+/*
+ * Return the refcount of physical cluster cpos in *refcount, and in
+ * *clusters how many of the len clusters from cpos share it.  Clusters
+ * without a refcount record have a refcount of zero.
+ */
+errcode_t ocfs2_refcount_session_get(ocfs2_refcount_session *rs,
+				     uint64_t cpos, uint32_t len,
+				     uint32_t *refcount, uint32_t *clusters)
+{
+	errcode_t ret;
+	int index;
+	char *buf = NULL;
+	struct ocfs2_refcount_rec rec;
+
+	ret = ocfs2_malloc_block(rs->rs_fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	ret = ocfs2_rs_get_rec(rs, cpos, len, &rec, &index, buf);
+	if (!ret) {
+		*refcount = rec.r_refcount;
+		*clusters = ocfs2_min((uint64_t)cpos + len,
+				      (uint64_t)rec.r_cpos + rec.r_clusters) -
+				cpos;
+	}
+
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * Make the refcounted extent (cpos, len) of cinode, which sits at
+ * physical cluster p_cluster, private to cinode.  If new_cluster is
+ * not p_cluster, the caller has already copied the data there and the
+ * extent is moved.  Otherwise cinode keeps p_cluster, and it must be
+ * the last owner.  Either way one reference to p_cluster is dropped
+ * in rs.  The caller writes out cinode.
+ */
+errcode_t ocfs2_refcount_unshare_extent(ocfs2_cached_inode *cinode,
+					ocfs2_refcount_session *rs,
+					uint32_t cpos, uint32_t len,
+					uint32_t p_cluster,
+					uint32_t new_cluster)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = cinode->ci_fs;
+	struct ocfs2_extent_tree et;
+
+	ocfs2_init_dinode_extent_tree(&et, fs, (char *)cinode->ci_inode,
+				      cinode->ci_blkno);
+
+	ret = __ocfs2_clear_ext_refcount(fs, &et, cpos, new_cluster, len, 0);
+	if (ret)
+		return ret;
+
+	return __ocfs2_decrease_refcount(rs, p_cluster, len,
+					 new_cluster != p_cluster);
+}
+
 errcode_t ocfs2_refcount_tree_get_rec(ocfs2_filesys *fs,
 				      struct ocfs2_refcount_block *rb,
 				      uint32_t phys_cpos,
@@ -1905,26 +2235,24 @@ errcode_t ocfs2_refcount_punch_hole(ocfs2_filesys *fs, uint64_t rf_blkno,
 				    uint64_t p_start, uint32_t len)
 {
 	errcode_t ret;
-	char *root_buf = NULL, *buf = NULL;
+	char *buf = NULL;
+	ocfs2_refcount_session *rs = NULL;
 	struct ocfs2_refcount_rec rec;
 	int index;
 	uint32_t dec_len;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &root_buf);
-	if (ret)
-		goto out;
-
 	ret = ocfs2_malloc_block(fs->fs_io, &buf);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_read_refcount_block(fs, rf_blkno, root_buf);
+	ret = ocfs2_refcount_session_begin(fs, rf_blkno, &rs);
 	if (ret)
 		goto out;
 
 	while (len) {
-		ret = ocfs2_get_refcount_rec(fs, root_buf, p_start,
-					     len, &rec, &index, buf);
+		ret = ocfs2_rs_get_rec(rs, p_start, len, &rec, &index, buf);
+		if (ret)
+			goto out;
 		if (!rec.r_refcount) {
 			/* There is no refcount for p_start. */
 			len -= rec.r_clusters;
@@ -1934,17 +2262,18 @@ errcode_t ocfs2_refcount_punch_hole(ocfs2_filesys *fs, uint64_t rf_blkno,
 
 		dec_len = (p_start + len < rec.r_cpos + rec.r_clusters) ?
 				len : (rec.r_cpos + rec.r_clusters - p_start);
-		ret = ocfs2_decrease_refcount_rec(fs, root_buf, buf,
-						  index, p_start, dec_len,
-						  rec.r_refcount);
+		ret = ocfs2_decrease_refcount_rec(rs, buf, index, p_start,
+						  dec_len, rec.r_refcount);
 		if (ret)
 			goto out;
 		len -= dec_len;
 		p_start += dec_len;
 	}
+
+	ret = ocfs2_refcount_session_commit(rs);
 out:
-	if (root_buf)
-		ocfs2_free(&root_buf);
+	if (rs)
+		ocfs2_refcount_session_free(rs);
 	if (buf)
 		ocfs2_free(&buf);
 	return ret;
@@ -1955,35 +2284,36 @@ errcode_t ocfs2_change_refcount(ocfs2_filesys *fs, uint64_t rf_blkno,
 				uint32_t refcount)
 {
 	errcode_t ret;
-	char *root_buf = NULL, *buf = NULL;
+	char *buf = NULL;
+	ocfs2_refcount_session *rs = NULL;
 	struct ocfs2_refcount_rec rec;
 	int index, value;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &root_buf);
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	ret = ocfs2_refcount_session_begin(fs, rf_blkno, &rs);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_read_refcount_block(fs, rf_blkno, root_buf);
+	ret = ocfs2_rs_get_rec(rs, p_start, len, &rec, &index, buf);
 	if (ret)
 		goto out;
-
-	ret = ocfs2_get_refcount_rec(fs, root_buf, p_start,
-				     len, &rec, &index, buf);
 	assert(rec.r_refcount != refcount &&
 	       rec.r_cpos <= p_start &&
 	       rec.r_cpos + rec.r_clusters >= p_start + len);
 
 	value = refcount;
 	value -= rec.r_refcount;
-	ret = __ocfs2_increase_refcount(fs, root_buf, p_start, len,
-					1, value);
+	ret = __ocfs2_increase_refcount(rs, p_start, len, 1, value);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_refcount_session_commit(rs);
 out:
-	if (root_buf)
-		ocfs2_free(&root_buf);
+	if (rs)
+		ocfs2_refcount_session_free(rs);
 	if (buf)
 		ocfs2_free(&buf);
 	return ret;
@@ -2353,17 +2683,17 @@ errcode_t ocfs2_refcount_cow_xattr(ocfs2_cached_inode *ci,
 	context.get_clusters = ocfs2_xattr_value_get_clusters;
 	context.cow_object = &value_obj;
 
-	ret = ocfs2_malloc_block(ci->ci_fs->fs_io, &context.ref_root_buf);
+	ret = ocfs2_refcount_session_begin(ci->ci_fs,
+					   ci->ci_inode->i_refcount_loc,
+					   &context.ref_session);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_read_refcount_block(ci->ci_fs,
-					ci->ci_inode->i_refcount_loc,
-					context.ref_root_buf);
+	ret = ocfs2_replace_cow(&context);
 	if (ret)
 		goto out;
 
-	ret = ocfs2_replace_cow(&context);
+	ret = ocfs2_refcount_session_commit(context.ref_session);
 	if (ret)
 		goto out;
 
@@ -2372,7 +2702,7 @@ errcode_t ocfs2_refcount_cow_xattr(ocfs2_cached_inode *ci,
 					       xe_blkno, xe_buf);
 
 out:
-	if (&context.ref_root_buf)
-		ocfs2_free(&context.ref_root_buf);
+	if (context.ref_session)
+		ocfs2_refcount_session_free(context.ref_session);
 	return ret;
 }
@@ -44,25 +44,74 @@ struct truncate_ctxt {
 				   uint64_t start_blkno,
 				   void *free_data);
 	void *free_data;
+	ocfs2_refcount_session *ref_session;
 };
 
 static int ocfs2_truncate_clusters(ocfs2_filesys *fs,
 				   struct ocfs2_extent_rec *rec,
-				   uint64_t ino,
+				   struct truncate_ctxt *ctxt,
 				   uint32_t len,
 				   uint64_t start)
 {
+	errcode_t ret;
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+
 	if (!ocfs2_refcount_tree(OCFS2_RAW_SB(fs->fs_super)) ||
 	    !(rec->e_flags & OCFS2_EXT_REFCOUNTED))
 		return ocfs2_free_clusters(fs, len, start);
 
-	assert(ino);
+	assert(ctxt->ino);
 
-	return ocfs2_decrease_refcount(fs, ino,
+	/*
+	 * All the refcounted records of one truncate share a session,
+	 * so the refcount leaves are written once at the end.
+	 */
+	if (!ctxt->ref_session) {
+		ret = ocfs2_malloc_block(fs->fs_io, &buf);
+		if (ret)
+			return ret;
+
+		ret = ocfs2_read_inode(fs, ctxt->ino, buf);
+		if (!ret) {
+			di = (struct ocfs2_dinode *)buf;
+			assert(di->i_dyn_features & OCFS2_HAS_REFCOUNT_FL);
+			ret = ocfs2_refcount_session_begin(fs,
+						di->i_refcount_loc,
+						&ctxt->ref_session);
+		}
+		ocfs2_free(&buf);
+		if (ret)
+			return ret;
+	}
+
+	return ocfs2_refcount_session_decrease(ctxt->ref_session,
 				ocfs2_blocks_to_clusters(fs, start),
 				len, 1);
 }
 
+/*
+ * Flush and drop the refcount session of a truncate, if it opened one.
+ * The session is committed even when the truncate failed: the records
+ * it covers are already gone from the tree, so their decrements must
+ * reach the disk.  The truncate's own error wins.
+ */
+static errcode_t ocfs2_truncate_end_refcount(struct truncate_ctxt *ctxt,
+					     errcode_t ret)
+{
+	errcode_t tmp;
+
+	if (!ctxt->ref_session)
+		return ret;
+
+	tmp = ocfs2_refcount_session_commit(ctxt->ref_session);
+	if (!ret)
+		ret = tmp;
+	ocfs2_refcount_session_free(ctxt->ref_session);
+	ctxt->ref_session = NULL;
+	return ret;
+}
+
 /*
  * Delete and free clusters if needed.  This only works with DEPTH_TRAVERSE.
  */
@@ -151,7 +200,7 @@ static int truncate_iterate(ocfs2_filesys *fs,
 			ret = ctxt->free_clusters(fs, len, start,
 						  ctxt->free_data);
 		else
-			ret = ocfs2_truncate_clusters(fs, rec, ctxt->ino,
+			ret = ocfs2_truncate_clusters(fs, rec, ctxt,
 						      len, start);
 		if (ret)
 			goto bail;
@@ -254,6 +303,7 @@ static errcode_t ocfs2_zero_tail_and_truncate_full(ocfs2_filesys *fs,
 	uint64_t new_size_in_blocks;
 	struct truncate_ctxt ctxt;
 
+	memset(&ctxt, 0, sizeof(struct truncate_ctxt));
 	new_size_in_blocks = ocfs2_blocks_in_bytes(fs, new_i_size);
 	ctxt.ino = ci->ci_blkno;
 	ctxt.new_i_clusters = ci->ci_inode->i_clusters;
@@ -266,6 +316,7 @@ static errcode_t ocfs2_zero_tail_and_truncate_full(ocfs2_filesys *fs,
 					 OCFS2_EXTENT_FLAG_DEPTH_TRAVERSE,
 					 NULL, truncate_iterate,
 					 &ctxt);
+	ret = ocfs2_truncate_end_refcount(&ctxt, ret);
 	if (ret)
 		goto out;
 
@@ -420,18 +471,21 @@ errcode_t ocfs2_truncate(ocfs2_filesys *fs, uint64_t ino, uint64_t new_i_size)
 errcode_t ocfs2_xattr_value_truncate(ocfs2_filesys *fs, uint64_t ino,
 				     struct ocfs2_xattr_value_root *xv)
 {
+	errcode_t ret;
 	struct truncate_ctxt ctxt;
 	int changed;
 	struct ocfs2_extent_list *el = &xv->xr_list;
 
+	memset(&ctxt, 0, sizeof(struct truncate_ctxt));
 	ctxt.ino = ino;
 	ctxt.new_i_clusters = xv->xr_clusters;
 	ctxt.new_size_in_clusters = 0;
 
-	return ocfs2_extent_iterate_xattr(fs, el, xv->xr_last_eb_blk,
-					OCFS2_EXTENT_FLAG_DEPTH_TRAVERSE,
-					truncate_iterate,
-					&ctxt, &changed);
+	ret = ocfs2_extent_iterate_xattr(fs, el, xv->xr_last_eb_blk,
+					 OCFS2_EXTENT_FLAG_DEPTH_TRAVERSE,
+					 truncate_iterate,
+					 &ctxt, &changed);
+	return ocfs2_truncate_end_refcount(&ctxt, ret);
 }
 
 errcode_t ocfs2_xattr_tree_truncate(ocfs2_filesys *fs,
@@ -445,6 +499,7 @@ errcode_t ocfs2_xattr_tree_truncate(ocfs2_filesys *fs,
 	 * ino is used to find refcount tree, as we never use refcount
 	 * in xattr tree, so set it to 0.
 	 */
+	memset(&ctxt, 0, sizeof(struct truncate_ctxt));
 	ctxt.ino = 0;
 	ctxt.new_i_clusters = xt->xt_clusters;
 	ctxt.new_size_in_clusters = 0;
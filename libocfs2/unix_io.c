@@ -31,6 +31,7 @@
 #define _GNU_SOURCE /* Because libc really doesn't want us using O_DIRECT? */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
@@ -45,7 +46,11 @@
 #include <libaio.h>
 #endif
 #include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #include <inttypes.h>
+#include <stdio.h>
 
 #include "ocfs2/kernel-rbtree.h"
 
@@ -74,6 +79,7 @@ struct io_cache_block {
 	struct list_head icb_list;
 	uint64_t icb_blkno;
 	char *icb_buf;
+	int icb_validated;	/* The metaecc of icb_buf checked out */
 };
 
 struct io_cache {
@@ -86,6 +92,9 @@ struct io_cache {
 	unsigned long ic_metadata_buffer_len;
 	char *ic_data_buffer;
 	unsigned long ic_data_buffer_len;
+	unsigned long ic_metadata_map_len;	/* 0 if malloc()d */
+	unsigned long ic_data_map_len;
+	int ic_backing;			/* IO_CACHE_* obtained */
 	int ic_locked;
 	int ic_use_count;
 
@@ -103,6 +112,7 @@ struct _io_channel {
 	int io_error;
 	int io_fd;
 	bool io_nocache;
+	int io_cache_flags;		/* IO_CACHE_* for io_init_cache() */
 	struct io_cache *io_cache;
 
 	/* stats */
@@ -353,6 +363,7 @@ static struct io_cache_block *io_cache_pop_lru(struct io_cache *ic)
 
 	icb = list_entry(ic->ic_lru.next, struct io_cache_block, icb_list);
 	io_cache_disconnect(ic, icb);
+	icb->icb_validated = 0;
 	ic->ic_removes++;
 
 	return icb;
@@ -397,7 +408,10 @@ static errcode_t io_cache_vec_read_blocks(io_channel *channel,
 				io_cache_insert(ic, icb);
 			}
 
-			memcpy(icb->icb_buf, buf, blksize);
+			if (memcmp(icb->icb_buf, buf, blksize)) {
+				memcpy(icb->icb_buf, buf, blksize);
+				icb->icb_validated = 0;
+			}
 
 			if (nocache)
 				io_cache_unsee(ic, icb);
@@ -567,6 +581,7 @@ static errcode_t io_cache_write_blocks(io_channel *channel, int64_t blkno,
 		}
 
 		memcpy(icb->icb_buf, data, channel->io_blksize);
+		icb->icb_validated = 0;
 		if (nocache)
 			io_cache_unsee(ic, icb);
 		else
@@ -597,13 +612,21 @@ static void io_free_cache(struct io_cache *ic)
 			if (ic->ic_locked)
 				munlock(ic->ic_data_buffer,
 					ic->ic_data_buffer_len);
-			ocfs2_free(&ic->ic_data_buffer);
+			if (ic->ic_data_map_len)
+				munmap(ic->ic_data_buffer,
+				       ic->ic_data_map_len);
+			else
+				ocfs2_free(&ic->ic_data_buffer);
 		}
 		if (ic->ic_metadata_buffer) {
 			if (ic->ic_locked)
 				munlock(ic->ic_metadata_buffer,
 					ic->ic_metadata_buffer_len);
-			ocfs2_free(&ic->ic_metadata_buffer);
+			if (ic->ic_metadata_map_len)
+				munmap(ic->ic_metadata_buffer,
+				       ic->ic_metadata_map_len);
+			else
+				ocfs2_free(&ic->ic_metadata_buffer);
 		}
 		ocfs2_free(&ic);
 	}
@@ -659,9 +682,225 @@ errcode_t io_mlock_cache(io_channel *channel)
 	return 0;
 }
 
-errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
+/*
+ * fsck wants caches of many gigabytes.  Backing them with 4K pages
+ * costs a TLB miss on nearly every lookup, and on a NUMA box the pages
+ * all land on whichever node first touched them.  If the caller asked
+ * via io_set_cache_backing(), we map the cache ourselves and ask for
+ * something better.  Every request is best effort.
+ */
+
+/* From <linux/mempolicy.h>; we don't want a libnuma dependency */
+#define IO_MPOL_PREFERRED	1
+#define IO_MPOL_INTERLEAVE	3
+#define IO_MAX_NUMNODES		1024
+
+static unsigned long io_hugepage_size(void)
+{
+	FILE *f;
+	char line[128];
+	unsigned long kb = 0;
+
+	f = fopen("/proc/meminfo", "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+				break;
+		}
+		fclose(f);
+	}
+
+	return kb ? kb * 1024 : 2 * ONE_MEGABYTE;
+}
+
+/*
+ * madvise(MADV_HUGEPAGE) succeeds even when THP is off, so look at the
+ * selected mode, eg "always [madvise] never".
+ */
+static int io_thp_enabled(void)
 {
+	FILE *f;
+	char line[128];
+	int enabled = 0;
+
+	f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (f) {
+		if (fgets(line, sizeof(line), f))
+			enabled = strstr(line, "[always]") ||
+				strstr(line, "[madvise]");
+		fclose(f);
+	}
+
+	return enabled;
+}
+
+/* Fills nodemask from /sys/devices/system/node/online, eg "0-3,6" */
+static int io_online_nodes(unsigned long *nodemask)
+{
+	FILE *f;
+	char line[256], *p;
+	unsigned long first, last, n;
+	int nr = 0;
+
+	memset(nodemask, 0, IO_MAX_NUMNODES / 8);
+	f = fopen("/sys/devices/system/node/online", "r");
+	if (!f)
+		return 0;
+	p = fgets(line, sizeof(line), f);
+	fclose(f);
+
+	while (p && *p && *p != '\n') {
+		first = strtoul(p, &p, 10);
+		last = first;
+		if (*p == '-')
+			last = strtoul(p + 1, &p, 10);
+		for (n = first; n <= last && n < IO_MAX_NUMNODES; n++, nr++)
+			nodemask[n / (8 * sizeof(unsigned long))] |=
+				1UL << (n % (8 * sizeof(unsigned long)));
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	return nr;
+}
+
+/* Must run before the pages are first touched */
+static int io_cache_set_policy(void *addr, unsigned long len, int flags)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+	unsigned long nodemask[IO_MAX_NUMNODES / (8 * sizeof(unsigned long))];
+
+	if (flags & IO_CACHE_NUMA_INTERLEAVE) {
+		if (io_online_nodes(nodemask) < 2)
+			return 0;
+		if (!syscall(SYS_mbind, addr, len, IO_MPOL_INTERLEAVE,
+			     nodemask, IO_MAX_NUMNODES + 1, 0))
+			return IO_CACHE_NUMA_INTERLEAVE;
+	} else if (flags & IO_CACHE_NUMA_LOCAL) {
+		/* MPOL_PREFERRED with no nodes means "the local node" */
+		if (!syscall(SYS_mbind, addr, len, IO_MPOL_PREFERRED,
+			     NULL, 0, 0))
+			return IO_CACHE_NUMA_LOCAL;
+	}
+#endif
+	return 0;
+}
+
+/*
+ * Maps len bytes of zeroed memory.  Explicit huge pages are tried
+ * first, then ordinary pages with a transparent huge page hint.
+ * *map_len is what must be handed to munmap(), and *backing gets the
+ * IO_CACHE_* flags that actually took.
+ */
+static errcode_t io_cache_map(unsigned long len, int flags, void *ptr,
+			      unsigned long *map_len, int *backing)
+{
+	void *addr = MAP_FAILED;
+	unsigned long hlen;
+
+	*backing = 0;
+
+#ifdef MAP_HUGETLB
+	if (flags & IO_CACHE_HUGETLB) {
+		hlen = io_hugepage_size();
+		hlen = (len + hlen - 1) / hlen * hlen;
+		addr = mmap(NULL, hlen, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (addr != MAP_FAILED) {
+			*map_len = hlen;
+			*backing |= IO_CACHE_HUGETLB;
+		}
+	}
+#endif
+
+	if (addr == MAP_FAILED) {
+		*map_len = len;
+		addr = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return OCFS2_ET_NO_MEMORY;
+#ifdef MADV_HUGEPAGE
+		if ((flags & IO_CACHE_THP) &&
+		    !madvise(addr, len, MADV_HUGEPAGE) && io_thp_enabled())
+			*backing |= IO_CACHE_THP;
+#endif
+	}
+
+	*backing |= io_cache_set_policy(addr, *map_len, flags);
+
+	*(void **)ptr = addr;
+	return 0;
+}
+
+void io_set_cache_backing(io_channel *channel, int flags)
+{
+	channel->io_cache_flags = flags;
+}
+
+static struct {
+	const char *name;
+	int flag;
+} io_cache_backings[] = {
+	{ "hugetlb",	IO_CACHE_HUGETLB },
+	{ "thp",	IO_CACHE_THP },
+	{ "interleave",	IO_CACHE_NUMA_INTERLEAVE },
+	{ "local",	IO_CACHE_NUMA_LOCAL },
+	{ NULL,		0 },
+};
+
+/* Parses a comma separated list such as "thp,interleave" */
+errcode_t io_parse_cache_backing(const char *str, int *flags)
+{
+	const char *p = str;
+	size_t len;
 	int i;
+
+	*flags = 0;
+	while (*p) {
+		len = strcspn(p, ",");
+		for (i = 0; io_cache_backings[i].name; i++) {
+			if ((strlen(io_cache_backings[i].name) == len) &&
+			    !strncmp(p, io_cache_backings[i].name, len))
+				break;
+		}
+		if (!io_cache_backings[i].name)
+			return OCFS2_ET_INVALID_ARGUMENT;
+		*flags |= io_cache_backings[i].flag;
+		p += len;
+		if (*p)
+			p++;
+	}
+
+	if ((*flags & IO_CACHE_NUMA_INTERLEAVE) &&
+	    (*flags & IO_CACHE_NUMA_LOCAL))
+		return OCFS2_ET_INVALID_ARGUMENT;
+
+	return 0;
+}
+
+void io_snprint_cache_backing(char *buf, size_t len, int flags)
+{
+	int i, off = 0;
+
+	if (!len)
+		return;
+	*buf = '\0';
+	for (i = 0; io_cache_backings[i].name; i++) {
+		if (!(flags & io_cache_backings[i].flag))
+			continue;
+		off += snprintf(buf + off, len - off, "%s%s",
+				off ? "," : "", io_cache_backings[i].name);
+		if (off >= len)
+			return;
+	}
+	if (!off)
+		snprintf(buf, len, "pages");
+}
+
+errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
+{
+	int i, backing;
 	struct io_cache *ic;
 	char *dbuf;
 	struct io_cache_block *icb_list;
@@ -675,18 +914,42 @@ errcode_t io_init_cache(io_channel *channel, size_t nr_blocks)
 	ic->ic_lookup = RB_ROOT;
 	INIT_LIST_HEAD(&ic->ic_lru);
 
-	ret = ocfs2_malloc_blocks(channel, nr_blocks, &ic->ic_data_buffer);
-	if (ret)
-		goto out;
 	ic->ic_data_buffer_len = (unsigned long)nr_blocks * channel->io_blksize;
-
-	ret = ocfs2_malloc0(sizeof(struct io_cache_block) * nr_blocks,
-			    &ic->ic_metadata_buffer);
-	if (ret)
-		goto out;
 	ic->ic_metadata_buffer_len =
 		(unsigned long)nr_blocks * sizeof(struct io_cache_block);
 
+	if (!channel->io_cache_flags) {
+		ret = ocfs2_malloc_blocks(channel, nr_blocks,
+					  &ic->ic_data_buffer);
+		if (ret)
+			goto out;
+
+		ret = ocfs2_malloc0(ic->ic_metadata_buffer_len,
+				    &ic->ic_metadata_buffer);
+		if (ret)
+			goto out;
+	} else {
+		/* mmap() is page aligned, which satisfies O_DIRECT */
+		ret = io_cache_map(ic->ic_data_buffer_len,
+				   channel->io_cache_flags,
+				   &ic->ic_data_buffer, &ic->ic_data_map_len,
+				   &ic->ic_backing);
+		if (ret)
+			goto out;
+
+		/*
+		 * The descriptors are walked on every lookup, so they
+		 * want the same treatment.  We report the data region's
+		 * backing; it's the one that matters.
+		 */
+		ret = io_cache_map(ic->ic_metadata_buffer_len,
+				   channel->io_cache_flags,
+				   &ic->ic_metadata_buffer,
+				   &ic->ic_metadata_map_len, &backing);
+		if (ret)
+			goto out;
+	}
+
 	icb_list = ic->ic_metadata_buffer;
 	dbuf = ic->ic_data_buffer;
 	for (i = 0; i < nr_blocks; i++) {
@@ -919,9 +1182,40 @@ void io_get_stats(io_channel *channel, struct ocfs2_io_stats *stats)
 		stats->is_cache_misses = ioc->ic_misses;
 		stats->is_cache_inserts = ioc->ic_inserts;
 		stats->is_cache_removes = ioc->ic_removes;
+		stats->is_cache_backing = ioc->ic_backing;
 	}
 }
 
+/*
+ * Typed readers check the metaecc of every block they read, even when
+ * it came straight out of the cache.  Once a block passes, the reader
+ * can mark the cached copy.  The mark goes away when the block is
+ * written or leaves the cache, so while it is set the block is known
+ * to be unchanged since it was checked.
+ */
+int io_block_validated(io_channel *channel, int64_t blkno)
+{
+	struct io_cache_block *icb;
+
+	if (!channel->io_cache)
+		return 0;
+
+	icb = io_cache_lookup(channel->io_cache, blkno);
+	return icb && icb->icb_validated;
+}
+
+void io_set_block_validated(io_channel *channel, int64_t blkno)
+{
+	struct io_cache_block *icb;
+
+	if (!channel->io_cache)
+		return;
+
+	icb = io_cache_lookup(channel->io_cache, blkno);
+	if (icb)
+		icb->icb_validated = 1;
+}
+
 /*
  * If a channel is set to 'nocache', it will use the _nocache() functions
  * even if called via the regular functions.  This allows control of
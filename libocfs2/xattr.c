@@ -285,7 +285,7 @@ errcode_t ocfs2_read_xattr_block(ocfs2_filesys *fs,
 
 	xb = (struct ocfs2_xattr_block *)blk;
 
-	ret = ocfs2_validate_meta_ecc(fs, blk, &xb->xb_check);
+	ret = ocfs2_validate_cached_meta_ecc(fs, blkno, blk, &xb->xb_check);
 	if (ret)
 		goto out;
 
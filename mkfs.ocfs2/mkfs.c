@@ -45,6 +45,9 @@ static int alloc_bytes_from_bitmap(State *s, uint64_t bytes,
 				   uint64_t *num);
 static int alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 			     uint64_t *start, uint64_t *num);
+static int alloc_from_bitmap_align(State *s, uint64_t num_bits,
+				   AllocBitmap *bitmap, int align,
+				   uint64_t *start, uint64_t *num);
 static uint64_t alloc_inode(State *s, uint16_t *suballoc_bit);
 static DirData *alloc_directory(State *s);
 static void free_directory(DirData *dir);
@@ -127,6 +130,8 @@ enum {
 	CLUSTER_STACK_OPTION,
 	CLUSTER_NAME_OPTION,
 	GLOBAL_HEARTBEAT_OPTION,
+	STRIPE_UNIT_OPTION,
+	STRIPE_WIDTH_OPTION,
 };
 
 static uint64_t align_bytes_to_clusters_ceil(State *s,
@@ -143,6 +148,16 @@ static uint64_t align_bytes_to_clusters_ceil(State *s,
 	return ret;
 }
 
+static uint64_t align_bytes_to_stripe_ceil(State *s, uint64_t bytes)
+{
+	uint64_t stripe = (uint64_t)s->stripe_clusters << s->cluster_size_bits;
+
+	if (!stripe)
+		return bytes;
+
+	return ((bytes + stripe - 1) / stripe) * stripe;
+}
+
 /*
  *	Translate 32 bytes uuid to 36 bytes uuid format.
  *	for example:
@@ -481,6 +496,11 @@ static void finish_normal_format(State *s)
 		exit(1);
 	}
 
+	/* The journals and allocator groups use the same alignment */
+	ocfs2_set_stripe_geometry(fs,
+			(uint64_t)s->stripe_clusters << s->cluster_size_bits,
+			(uint64_t)s->stripe_offset << s->cluster_size_bits);
+
 	/* 8MB should cover an allocator and some other stuff */
 	ret = io_init_cache_size(fs->fs_io, 8 * 1024 * 1024);
 	if (ret)
@@ -737,7 +757,10 @@ main(int argc, char **argv)
 	tmprec = &(record[HEARTBEAT_SYSTEM_INODE][0]);
 	need = (O2NM_MAX_NODES + 1) << s->blocksize_bits;
 
-	alloc_bytes_from_bitmap(s, need, s->global_bm, &tmprec->extent_off, &tmprec->extent_len);
+	/* Every node writes its heartbeat slot, so keep it on a stripe */
+	alloc_from_bitmap_align(s, (need + s->global_bm->unit - 1) >>
+				s->global_bm->unit_bits, s->global_bm, 1,
+				&tmprec->extent_off, &tmprec->extent_len);
 	tmprec->file_size = need;
 
 	if (!hb_dev_skip(s, ORPHAN_DIR_SYSTEM_INODE)) {
@@ -884,6 +907,7 @@ get_state(int argc, char **argv)
 	uint64_t val;
 	uint64_t journal_size_in_bytes = 0;
 	int journal64 = 0;
+	uint32_t stripe_unit = 0, stripe_width = 0;
 	enum ocfs2_mkfs_types fs_type = OCFS2_MKFSTYPE_DEFAULT;
 	int mount = -1;
 	int no_backup_super = -1;
@@ -909,6 +933,8 @@ get_state(int argc, char **argv)
 		{ "cluster-stack=", 1, 0, CLUSTER_STACK_OPTION },
 		{ "cluster-name=", 1, 0, CLUSTER_NAME_OPTION },
 		{ "global-heartbeat", 0, 0, GLOBAL_HEARTBEAT_OPTION },
+		{ "stripe-unit", 1, 0, STRIPE_UNIT_OPTION },
+		{ "stripe-width", 1, 0, STRIPE_WIDTH_OPTION },
 		{ 0, 0, 0, 0}
 	};
 
@@ -1103,6 +1129,23 @@ get_state(int argc, char **argv)
 			globalhb = 1;
 			break;
 
+		case STRIPE_UNIT_OPTION:
+		case STRIPE_WIDTH_OPTION:
+			ret = get_number(optarg, &val);
+			if (ret || !val || (val & 511) || val > UINT32_MAX) {
+				com_err(progname, 0,
+					"Specify the stripe %s in bytes as a "
+					"multiple of 512",
+					c == STRIPE_UNIT_OPTION ? "unit" :
+					"width");
+				exit(1);
+			}
+			if (c == STRIPE_UNIT_OPTION)
+				stripe_unit = val;
+			else
+				stripe_width = val;
+			break;
+
 		default:
 			usage(progname);
 			break;
@@ -1165,6 +1208,14 @@ get_state(int argc, char **argv)
 	s->journal_size_in_bytes = journal_size_in_bytes;
 	s->journal64 = journal64;
 
+	if (stripe_unit && stripe_width && (stripe_width % stripe_unit)) {
+		com_err(progname, 0, "The stripe width must be a multiple of "
+			"the stripe unit");
+		exit(1);
+	}
+	s->stripe_unit = stripe_unit;
+	s->stripe_width = stripe_width;
+
 	s->hb_dev = hb_dev;
 
 	s->fs_type = fs_type;
@@ -1399,6 +1450,7 @@ usage(const char *progname)
 		"\n\t\t[--fs-feature-level=[default|max-compat|max-features]] "
 		"\n\t\t[--fs-features=[[no]sparse,...]] [--global-heartbeat]"
 		"\n\t\t[--cluster-stack=stackname] [--cluster-name=clustername]"
+		"\n\t\t[--stripe-unit=bytes] [--stripe-width=bytes]"
 		"\n\t\t[--no-backup-super] device [blocks-count]\n", progname);
 	exit(1);
 }
@@ -1538,9 +1590,63 @@ static uint64_t figure_journal_size(uint64_t size, State *s)
 			exit(1);
 		}
 	}
+
+	/* Whole stripes keep the journals after this one aligned too */
+	if (s->stripe_clusters) {
+		uint64_t aligned = align_bytes_to_stripe_ceil(s, ret);
+
+		if (journal_size_valid(aligned >> s->blocksize_bits, s))
+			ret = aligned;
+	}
 	return ret;
 }
 
+/*
+ * Large allocations are aligned to the stripe width, or to the stripe
+ * unit if that's all we know.  The geometry comes from the options or,
+ * failing that, from what the device reports.
+ */
+static void figure_stripe_geometry(State *s)
+{
+	errcode_t err;
+	struct ocfs2_device_topology topo;
+	uint32_t stripe;
+
+	if (s->hb_dev)
+		return;
+
+	if (!s->stripe_unit && !s->stripe_width) {
+		err = ocfs2_get_device_topology(s->device_name, &topo);
+		if (err) {
+			com_err(s->progname, err,
+				"while getting the I/O topology of device %s",
+				s->device_name);
+			exit(1);
+		}
+		s->stripe_unit = topo.dt_min_io;
+		s->stripe_width = topo.dt_opt_io;
+		s->align_offset = topo.dt_align_offset;
+	}
+
+	stripe = s->stripe_width ? s->stripe_width : s->stripe_unit;
+	if (stripe <= s->cluster_size)
+		return;
+
+	if ((stripe % s->cluster_size) || (s->align_offset % s->cluster_size)) {
+		if (!s->quiet)
+			fprintf(stderr, "%s: Warning: The stripe (%u bytes, "
+				"offset %u) does not fall on %u byte "
+				"clusters; allocations will not be aligned\n",
+				s->progname, stripe, s->align_offset,
+				s->cluster_size);
+		return;
+	}
+
+	s->stripe_clusters = stripe >> s->cluster_size_bits;
+	s->stripe_offset = (s->align_offset >> s->cluster_size_bits) %
+		s->stripe_clusters;
+}
+
 static uint32_t cluster_size_default(State *s)
 {
 	uint32_t cluster_size, cluster_size_bits;
@@ -1810,6 +1916,8 @@ fill_defaults(State *s)
 		  s->vol_label = strdup("");
 	}
 
+	figure_stripe_geometry(s);
+
 	s->journal_size_in_bytes = figure_journal_size(s->journal_size_in_bytes, s);
 
 	s->extent_alloc_size_in_clusters = figure_extent_alloc_size(s);
@@ -2094,9 +2202,52 @@ alloc_bytes_from_bitmap(State *s, uint64_t bytes, AllocBitmap *bitmap,
 	return alloc_from_bitmap(s, num_bits, bitmap, start, num);
 }
 
+/*
+ * Like find_clear_bits(), but the run must start on a stripe boundary.
+ * The first group starts at cluster 0, the others at their descriptor.
+ */
+static uint32_t
+find_aligned_clear_bits(State *s, struct ocfs2_group_desc *gd,
+			uint32_t num_bits)
+{
+	uint64_t first_cluster = 0;
+	uint32_t off, bit;
+
+	if (gd->bg_blkno != s->first_cluster_group_blkno)
+		first_cluster = (gd->bg_blkno << s->blocksize_bits) >>
+			s->cluster_size_bits;
+
+	off = (s->stripe_offset + s->stripe_clusters -
+	       (first_cluster % s->stripe_clusters)) % s->stripe_clusters;
+	while (off + num_bits <= gd->bg_bits) {
+		bit = find_clear_bits(gd->bg_bitmap, gd->bg_bits, num_bits,
+				      off);
+		if (bit == off || bit == (uint32_t)-1)
+			return bit;
+		off += ((bit - off + s->stripe_clusters - 1) /
+			s->stripe_clusters) * s->stripe_clusters;
+	}
+
+	return (uint32_t)-1;
+}
+
+/* Runs of a stripe or more from the global bitmap start on a stripe */
 static int
 alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 		  uint64_t *start, uint64_t *num)
+{
+	return alloc_from_bitmap_align(s, num_bits, bitmap,
+				       num_bits >= s->stripe_clusters,
+				       start, num);
+}
+
+/*
+ * With align set, a run from the global bitmap starts on a stripe
+ * boundary if one is free, whatever its length.
+ */
+static int
+alloc_from_bitmap_align(State *s, uint64_t num_bits, AllocBitmap *bitmap,
+			int align, uint64_t *start, uint64_t *num)
 {
 	uint32_t start_bit = (uint32_t) - 1;
 	void *buf = NULL;
@@ -2104,6 +2255,8 @@ alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 	AllocGroup *group;
 	struct ocfs2_group_desc *gd = NULL;
 	unsigned int size;
+	int aligned = align && (bitmap == s->global_bm) &&
+		s->stripe_clusters;
 
 	found = 0;
 	for(i = 0; i < bitmap->num_chains && !found; i++) {
@@ -2113,8 +2266,12 @@ alloc_from_bitmap(State *s, uint64_t num_bits, AllocBitmap *bitmap,
 			if (gd->bg_free_bits_count >= num_bits) {
 				buf = gd->bg_bitmap;
 				size = gd->bg_bits;
-				start_bit = find_clear_bits(buf, size,
-							    num_bits, 0);
+				if (aligned)
+					start_bit = find_aligned_clear_bits(s,
+								gd, num_bits);
+				if (start_bit == (uint32_t)-1)
+					start_bit = find_clear_bits(buf, size,
+								num_bits, 0);
 				found = 1;
 				break;
 			}
@@ -2969,6 +3126,10 @@ print_state(State *s)
 	       s->global_cpg);
 	printf("Extent allocator size: %"PRIu64" (%u groups)\n",
 	       extsize, numgrps);
+	if (s->stripe_clusters)
+		printf("Stripe alignment: %"PRIu64" (%u clusters, offset %u)\n",
+		       (uint64_t)s->stripe_clusters << s->cluster_size_bits,
+		       s->stripe_clusters, s->stripe_offset);
 	if (s->hb_dev)
 		printf("Heartbeat device\n");
 	else
@@ -214,6 +214,12 @@ struct _State {
 	uint64_t journal_size_in_bytes;
 	int journal64;
 
+	uint32_t stripe_unit;
+	uint32_t stripe_width;
+	uint32_t align_offset;
+	uint32_t stripe_clusters;	/* 0 if allocations aren't aligned */
+	uint32_t stripe_offset;		/* in clusters */
+
 	uint32_t extent_alloc_size_in_clusters;
 
 	char *vol_label;
@@ -26,11 +26,18 @@
 
 #define OCFS2_CLUSTER_STACK_ARG		"cluster_stack="
 
+/* Most volumes a batch mounts at the same time */
+#define MOUNT_BATCH_MAX			16
+
 int verbose = 0;
 int mount_quiet = 0;
 char *progname = NULL;
 
 static int nomtab = 0;
+static int mount_all = 0;
+static char *fstab_filter = NULL;
+static char **batch_argv = NULL;
+static int batch_argc = 0;
 
 struct mount_options {
 	char *dev;
@@ -61,11 +68,15 @@ static void read_options(int argc, char **argv, struct mount_options *mo)
 		return;
 
 	while(1) {
-		c = getopt(argc, argv, "vno:t:");
+		c = getopt(argc, argv, "avno:O:t:");
 		if (c == -1)
 			break;
 
 		switch (c) {
+		case 'a':
+			++mount_all;
+			break;
+
 		case 'v':
 			++verbose;
 			break;
@@ -79,6 +90,11 @@ static void read_options(int argc, char **argv, struct mount_options *mo)
 				mo->opts = xstrdup(optarg);
 			break;
 
+		case 'O':
+			if (optarg)
+				fstab_filter = xstrdup(optarg);
+			break;
+
 		case 't':
 			if (optarg)
 				mo->type = xstrdup(optarg);
@@ -89,6 +105,10 @@ static void read_options(int argc, char **argv, struct mount_options *mo)
 		}
 	}
 
+	/* More than one device and mountpoint pair is a batch */
+	batch_argv = &argv[optind];
+	batch_argc = argc - optind;
+
 	if (optind < argc && argv[optind])
 		mo->dev = xstrdup(argv[optind]);
 
@@ -302,10 +322,15 @@ static void change_local_hb_io_priority(ocfs2_filesys *fs, char *dev)
 		run_hb_ctl(hb_ctl_path, dev, "-P");
 }
 
-int main(int argc, char **argv)
+
+/*
+ * Probes the device, joins the heartbeat group and mounts one volume.
+ * On success the signals are left blocked and *mtab_opts holds the
+ * options to record in mtab; the caller records the mount and unblocks.
+ */
+static errcode_t mount_volume(struct mount_options *mo, char **mtab_opts)
 {
 	errcode_t ret = 0;
-	struct mount_options mo;
 	ocfs2_filesys *fs = NULL;
 	struct o2cb_cluster_desc cluster;
 	struct o2cb_region_desc desc;
@@ -313,42 +338,21 @@ int main(int argc, char **argv)
 	int group_join = 0;
 	struct stat statbuf;
 	const char *spec;
-	char *opts_string = NULL;
-
-	initialize_ocfs_error_table();
-	initialize_o2dl_error_table();
-	initialize_o2cb_error_table();
-
-	setbuf(stdout, NULL);
-	setbuf(stderr, NULL);
 
-	if (signal(SIGTERM, handle_signal) == SIG_ERR) {
-		fprintf(stderr, "Could not set SIGTERM\n");
-		exit(1);
-	}
-
-	if (signal(SIGINT, handle_signal) == SIG_ERR) {
-		fprintf(stderr, "Could not set SIGINT\n");
-		exit(1);
-	}
-
-	memset(&mo, 0, sizeof(mo));
-	read_options (argc, argv, &mo);
-
-	ret = process_options(&mo);
+	ret = process_options(mo);
 	if (ret)
 		goto bail;
 
-	ret = ocfs2_open(mo.dev, OCFS2_FLAG_RO, 0, 0, &fs); //O_EXCL?
+	ret = ocfs2_open(mo->dev, OCFS2_FLAG_RO, 0, 0, &fs); //O_EXCL?
 	if (ret) {
-		com_err(progname, ret, "while opening device %s", mo.dev);
+		com_err(progname, ret, "while opening device %s", mo->dev);
 		goto bail;
 	}
 
 	clustered = (0 == ocfs2_mount_local(fs));
 
 	if (ocfs2_is_hard_readonly(fs) && (clustered ||
-					   !(mo.flags & MS_RDONLY))) {
+					   !(mo->flags & MS_RDONLY))) {
 		ret = OCFS2_ET_IO;
 		com_err(progname, ret,
 			"while mounting read-only device in %s mode",
@@ -357,7 +361,7 @@ int main(int argc, char **argv)
 	}
 
 	if (verbose)
-		printf("device=%s\n", mo.dev);
+		printf("device=%s\n", mo->dev);
 
 	ret = o2cb_setup_stack((char *)OCFS2_RAW_SB(fs->fs_super)->s_cluster_info.ci_stack);
 	if (ret) {
@@ -389,30 +393,33 @@ int main(int argc, char **argv)
 		desc.r_service = OCFS2_FS_NAME;
 	}
 
-	ret = add_mount_options(fs, &cluster, &mo.xtra_opts);
+	ret = add_mount_options(fs, &cluster, &mo->xtra_opts);
 	if (ret) {
 		com_err(progname, ret, "while adding mount options");
 		goto bail;
 	}
 
 	/* validate mount dir */
-	if (lstat(mo.dir, &statbuf)) {
+	if (lstat(mo->dir, &statbuf)) {
 		com_err(progname, 0, "mount directory %s does not exist",
-			mo.dir);
+			mo->dir);
+		ret = OCFS2_ET_INVALID_ARGUMENT;
 		goto bail;
-	} else if (stat(mo.dir, &statbuf)) {
+	} else if (stat(mo->dir, &statbuf)) {
 		com_err(progname, 0, "mount directory %s is a broken symbolic "
-			"link", mo.dir);
+			"link", mo->dir);
+		ret = OCFS2_ET_INVALID_ARGUMENT;
 		goto bail;
 	} else if (!S_ISDIR(statbuf.st_mode)) {
 		com_err(progname, 0, "mount directory %s is not a directory",
-			mo.dir);
+			mo->dir);
+		ret = OCFS2_ET_INVALID_ARGUMENT;
 		goto bail;
 	}
 
 	block_signals (SIG_BLOCK);
 
-	if (clustered && !(mo.flags & MS_REMOUNT)) {
+	if (clustered && !(mo->flags & MS_REMOUNT)) {
 		ret = o2cb_begin_group_join(&cluster, &desc);
 		if (ret) {
 			block_signals (SIG_UNBLOCK);
@@ -422,20 +429,21 @@ int main(int argc, char **argv)
 		}
 		group_join = 1;
 	}
-	spec = canonicalize(mo.dev);
-	ret = mount(spec, mo.dir, OCFS2_FS_NAME, mo.flags & ~MS_NOSYS,
-		    mo.xtra_opts);
+	spec = canonicalize(mo->dev);
+	ret = mount(spec, mo->dir, OCFS2_FS_NAME, mo->flags & ~MS_NOSYS,
+		    mo->xtra_opts);
+	my_free(spec);
 	if (ret) {
 		ret = errno;
 		if (group_join) {
 			/* We ignore the return code because the mount
 			 * failure is the important error.
 			 * complete_group_join() will handle cleaning up */
-			o2cb_complete_group_join(&cluster, &desc, errno);
+			o2cb_complete_group_join(&cluster, &desc, ret);
 		}
 		block_signals (SIG_UNBLOCK);
 		com_err(progname, ret, "while mounting %s on %s. Check 'dmesg' "
-			"for more information on this error.", mo.dev, mo.dir);
+			"for more information on this error.", mo->dev, mo->dir);
 		goto bail;
 	}
 	if (group_join) {
@@ -452,31 +460,441 @@ int main(int argc, char **argv)
 		}
 	}
 
-	change_local_hb_io_priority(fs, mo.dev);
+	change_local_hb_io_priority(fs, mo->dev);
+
+	*mtab_opts = fix_opts_string(((mo->flags & ~MS_NOMTAB) |
+				      (clustered ? MS_NETDEV : 0)),
+				     mo->xtra_opts, NULL);
+
+bail:
+	if (fs)
+		ocfs2_close(fs);
+
+	return ret;
+}
+
+static void free_mount_options(struct mount_options *mo)
+{
+	my_free(mo->dev);
+	my_free(mo->dir);
+	my_free(mo->opts);
+	my_free(mo->xtra_opts);
+	my_free(mo->type);
+	memset(mo, 0, sizeof(*mo));
+}
+
+/*
+ * Batch mode.  Each volume is mounted by its own child so that the
+ * device probes, heartbeat starts and group joins of all the volumes
+ * overlap.  A child hands its mtab options back over a pipe and the
+ * parent appends every entry to mtab under a single lock hold.
+ */
+struct mount_batch_entry {
+	struct mount_options	be_mo;
+	pid_t			be_pid;
+	int			be_fd;
+	int			be_status;
+	char			*be_mtab_opts;
+};
+
+static void batch_add(struct mount_batch_entry **batch, int *count,
+		      const char *dev, const char *dir, const char *opts)
+{
+	struct mount_batch_entry *be;
+
+	*batch = xrealloc(*batch, (*count + 1) * sizeof(**batch));
+	be = &(*batch)[*count];
+	memset(be, 0, sizeof(*be));
+	be->be_mo.dev = xstrdup(dev);
+	be->be_mo.dir = xstrdup(dir);
+	if (opts && *opts)
+		be->be_mo.opts = xstrdup(opts);
+	be->be_fd = -1;
+	be->be_status = -1;
+	(*count)++;
+}
+
+static int is_mounted_dir(const char *dir)
+{
+	struct mntentchn *mc, *mc0;
+	char *node = canonicalize(dir);
+	int found = 0;
+
+	mc0 = mtab_head();
+	for (mc = mc0->nxt; mc && mc != mc0; mc = mc->nxt) {
+		if (streq(mc->m.mnt_dir, node)) {
+			found = 1;
+			break;
+		}
+	}
+	my_free(node);
+
+	return found;
+}
+
+/*
+ * Collects the ocfs2 entries in fstab that -a should mount: not noauto,
+ * matching the -O filter and not already mounted.  Options given with
+ * -o are appended to those in fstab.
+ */
+static int batch_read_fstab(const char *cmd_opts, const char *filter,
+			    struct mount_batch_entry **batch, int *count)
+{
+	mntFILE *mfp;
+	struct my_mntent *ent, me;
+	char *opts;
+	int flags;
+	char *extra;
+
+	mfp = my_setmntent(_PATH_FSTAB, "r");
+	if (mfp == NULL || mfp->mntent_fp == NULL) {
+		com_err(progname, OCFS2_ET_IO, "%s, %s", _PATH_FSTAB,
+			strerror(errno));
+		return -1;
+	}
+
+	while ((ent = my_getmntent(mfp)) != NULL) {
+		/* Reading mtab below reuses my_getmntent()'s entry */
+		me = *ent;
+
+		if (strcmp(me.mnt_type, OCFS2_FS_NAME))
+			goto next;
+
+		flags = 0;
+		extra = NULL;
+		opts = xstrdup(me.mnt_opts);
+		parse_opts(opts, &flags, &extra);
+		my_free(opts);
+		my_free(extra);
+		if (flags & MS_NOAUTO)
+			goto next;
+
+		if (!matching_opts(me.mnt_opts, filter))
+			goto next;
+
+		if (!strncmp(me.mnt_fsname, "LABEL=", 6) ||
+		    !strncmp(me.mnt_fsname, "UUID=", 5)) {
+			com_err(progname, OCFS2_ET_BAD_DEVICE_NAME,
+				"%s: LABEL= and UUID= are resolved by "
+				"mount(8), skipping", me.mnt_fsname);
+			goto next;
+		}
+
+		if (is_mounted_dir(me.mnt_dir)) {
+			if (verbose)
+				printf("%s already mounted on %s\n",
+				       me.mnt_fsname, me.mnt_dir);
+			goto next;
+		}
+
+		if (cmd_opts && *cmd_opts) {
+			opts = xstrconcat3(xstrdup(me.mnt_opts), ",",
+					   cmd_opts);
+			batch_add(batch, count, me.mnt_fsname, me.mnt_dir,
+				  opts);
+			my_free(opts);
+		} else
+			batch_add(batch, count, me.mnt_fsname, me.mnt_dir,
+				  me.mnt_opts);
+next:
+		my_free(me.mnt_fsname);
+		my_free(me.mnt_dir);
+		my_free(me.mnt_type);
+		my_free(me.mnt_opts);
+	}
+
+	my_endmntent(mfp);
+
+	return 0;
+}
+
+static void batch_child(struct mount_batch_entry *be, int fd)
+{
+	char *mtab_opts = NULL;
+	errcode_t ret;
+	size_t len;
+
+	ret = mount_volume(&be->be_mo, &mtab_opts);
+	if (ret)
+		exit(1);
+
+	/* The mount stands even if the parent never records it */
+	len = strlen(mtab_opts);
+	if (write(fd, mtab_opts, len) != (ssize_t)len)
+		exit(2);
+
+	exit(0);
+}
+
+/* Reads the child's mtab options and reaps it */
+static void batch_reap(struct mount_batch_entry *be, int status)
+{
+	char buf[4096];
+	char *opts = NULL;
+	size_t len = 0;
+	ssize_t rc;
+
+	while ((rc = read(be->be_fd, buf, sizeof(buf))) != 0) {
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		opts = xrealloc(opts, len + rc + 1);
+		memcpy(opts + len, buf, rc);
+		len += rc;
+		opts[len] = '\0';
+	}
+	close(be->be_fd);
+	be->be_fd = -1;
+	be->be_pid = 0;
+
+	if (WIFEXITED(status))
+		be->be_status = WEXITSTATUS(status);
+	else
+		be->be_status = 1;
+
+	if (be->be_status == 2)
+		com_err(progname, OCFS2_ET_IO,
+			"while recording the mount of %s on %s. The volume "
+			"is mounted but missing from %s", be->be_mo.dev,
+			be->be_mo.dir, MOUNTED);
+
+	if (!be->be_status && opts)
+		be->be_mtab_opts = opts;
+	else
+		my_free(opts);
+}
+
+static void batch_wait_one(struct mount_batch_entry *batch, int count)
+{
+	int i, status;
+	pid_t pid;
+
+	do {
+		pid = waitpid(-1, &status, 0);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid < 0)
+		return;
+
+	/*
+	 * A child writes its options before exiting and they fit in
+	 * the pipe, so they are all there to be read now.
+	 */
+	for (i = 0; i < count; i++) {
+		if (batch[i].be_pid == pid) {
+			batch_reap(&batch[i], status);
+			break;
+		}
+	}
+}
+
+/*
+ * Appends all the new mounts to mtab under one lock hold.  Remounts
+ * rewrite existing lines and go through update_mtab_entry() instead.
+ */
+static void batch_update_mtab(struct mount_batch_entry *batch, int count)
+{
+	struct my_mntent mnt;
+	mntFILE *mfp = NULL;
+	int i, locked = 0;
+
+	for (i = 0; i < count; i++) {
+		if (!batch[i].be_mtab_opts)
+			continue;
+
+		if (batch[i].be_mo.flags & MS_REMOUNT) {
+			update_mtab_entry(batch[i].be_mo.dev,
+					  batch[i].be_mo.dir, OCFS2_FS_NAME,
+					  batch[i].be_mtab_opts,
+					  batch[i].be_mo.flags, 0, 0);
+			continue;
+		}
+
+		mnt.mnt_fsname = canonicalize(batch[i].be_mo.dev);
+		mnt.mnt_dir = canonicalize(batch[i].be_mo.dir);
+		mnt.mnt_type = OCFS2_FS_NAME;
+		mnt.mnt_opts = batch[i].be_mtab_opts;
+		mnt.mnt_freq = 0;
+		mnt.mnt_passno = 0;
+
+		if (verbose)
+			print_one(&mnt);
+
+		if (!nomtab && mtab_is_writable()) {
+			if (!locked) {
+				lock_mtab();
+				locked = 1;
+				mfp = my_setmntent(MOUNTED, "a+");
+				if (mfp == NULL || mfp->mntent_fp == NULL)
+					com_err(progname, OCFS2_ET_IO,
+						"%s, %s", MOUNTED,
+						strerror(errno));
+			}
+			if (mfp && mfp->mntent_fp &&
+			    (my_addmntent(mfp, &mnt) == 1))
+				com_err(progname, OCFS2_ET_IO, "%s, %s",
+					MOUNTED, strerror(errno));
+		}
+
+		my_free(mnt.mnt_fsname);
+		my_free(mnt.mnt_dir);
+	}
+
+	if (locked) {
+		my_endmntent(mfp);
+		unlock_mtab();
+	}
+}
+
+static int mount_batch(struct mount_batch_entry *batch, int count)
+{
+	int i, running = 0, mounted = 0;
+	int pipefd[2];
+	pid_t pid;
+
+	for (i = 0; i < count; i++) {
+		while (running >= MOUNT_BATCH_MAX) {
+			batch_wait_one(batch, i);
+			running--;
+		}
+
+		if (pipe(pipefd)) {
+			com_err(progname, errno,
+				"while creating a pipe for %s",
+				batch[i].be_mo.dev);
+			continue;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			com_err(progname, errno, "while forking to mount %s",
+				batch[i].be_mo.dev);
+			close(pipefd[0]);
+			close(pipefd[1]);
+			continue;
+		}
+
+		if (!pid) {
+			close(pipefd[0]);
+			batch_child(&batch[i], pipefd[1]);
+		}
+
+		close(pipefd[1]);
+		batch[i].be_pid = pid;
+		batch[i].be_fd = pipefd[0];
+		running++;
+	}
+
+	while (running) {
+		batch_wait_one(batch, count);
+		running--;
+	}
+
+	/*
+	 * The children parsed their own copies of the options; redo it
+	 * here so batch_update_mtab() knows which entries are remounts.
+	 */
+	block_signals (SIG_BLOCK);
+	for (i = 0; i < count; i++) {
+		if (!batch[i].be_mtab_opts)
+			continue;
+		mounted++;
+		if (batch[i].be_mo.opts)
+			parse_opts(batch[i].be_mo.opts, &batch[i].be_mo.flags,
+				   &batch[i].be_mo.xtra_opts);
+	}
+	batch_update_mtab(batch, count);
+	block_signals (SIG_UNBLOCK);
+
+	if (mounted == count)
+		return 0;
+
+	return mounted ? EX_SOMEOK : EX_FAIL;
+}
+
+int main(int argc, char **argv)
+{
+	errcode_t ret = 0;
+	struct mount_options mo;
+	struct mount_batch_entry *batch = NULL;
+	int i, count = 0;
+	char *opts_string = NULL;
+
+	initialize_ocfs_error_table();
+	initialize_o2dl_error_table();
+	initialize_o2cb_error_table();
+
+	setbuf(stdout, NULL);
+	setbuf(stderr, NULL);
+
+	if (signal(SIGTERM, handle_signal) == SIG_ERR) {
+		fprintf(stderr, "Could not set SIGTERM\n");
+		exit(1);
+	}
+
+	if (signal(SIGINT, handle_signal) == SIG_ERR) {
+		fprintf(stderr, "Could not set SIGINT\n");
+		exit(1);
+	}
+
+	memset(&mo, 0, sizeof(mo));
+	read_options (argc, argv, &mo);
+
+	if (mount_all || (batch_argc > 2)) {
+		if (mo.type && strcmp(mo.type, OCFS2_FS_NAME)) {
+			com_err(progname, OCFS2_ET_UNKNOWN_FILESYSTEM, "%s",
+				mo.type);
+			ret = EX_USAGE;
+			goto bail;
+		}
+
+		if (mount_all) {
+			if (batch_read_fstab(mo.opts, fstab_filter, &batch,
+					     &count)) {
+				ret = EX_FILEIO;
+				goto bail;
+			}
+		} else {
+			if (batch_argc % 2) {
+				com_err(progname, OCFS2_ET_INVALID_ARGUMENT,
+					"no mountpoint specified for %s",
+					batch_argv[batch_argc - 1]);
+				ret = EX_USAGE;
+				goto bail;
+			}
+			for (i = 0; i < batch_argc; i += 2)
+				batch_add(&batch, &count, batch_argv[i],
+					  batch_argv[i + 1], mo.opts);
+		}
+
+		if (count)
+			ret = mount_batch(batch, count);
+		goto bail;
+	}
+
+	ret = mount_volume(&mo, &opts_string);
+	if (ret)
+		goto bail;
 
-	opts_string = fix_opts_string(((mo.flags & ~MS_NOMTAB) |
-			(clustered ? MS_NETDEV : 0)),
-			mo.xtra_opts, NULL);
 	update_mtab_entry(mo.dev, mo.dir, OCFS2_FS_NAME, opts_string,
 			mo.flags, 0, 0);
 
 	block_signals (SIG_UNBLOCK);
 
 bail:
-	if (fs)
-		ocfs2_close(fs);
-	if (mo.dev)
-		free(mo.dev);
-	if (mo.dir)
-		free(mo.dir);
-	if (mo.opts)
-		free(mo.opts);
-	if (mo.xtra_opts)
-		free(mo.xtra_opts);
-	if (mo.type)
-		free(mo.type);
-	if (opts_string)
-		free(opts_string);
+	for (i = 0; i < count; i++) {
+		free_mount_options(&batch[i].be_mo);
+		my_free(batch[i].be_mtab_opts);
+	}
+	my_free(batch);
+	free_mount_options(&mo);
+	my_free(fstab_filter);
+	my_free(opts_string);
+
+	if (mount_all || (batch_argc > 2))
+		return ret;
 
 	return ret ? 1 : 0;
 }
@@ -40,6 +40,7 @@ struct dx_dirs_context {
 	uint64_t dx_dirs_nr;
 	struct list_head inodes;
 	struct tools_progress *prog;
+	struct tools_progress *feature_prog;
 };
 
 /*
@@ -55,6 +56,7 @@ static errcode_t build_dx_dir(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	if (!S_ISDIR(di->i_mode))
 		goto bail;
 
+	tunefs_block_signals();
 	if (di->i_dyn_features & OCFS2_INDEXED_DIR_FL) {
 		verbosef(VL_APP,
 			"Directory inode %llu already has an indexed tree, "
@@ -70,7 +72,7 @@ static errcode_t build_dx_dir(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	if (ret) {
 		ret = TUNEFS_ET_INSTALL_DIR_TRAILER_FAILED;
 		tcom_err(ret, "while enable indexed-dirs");
-		goto bail;
+		goto unblock;
 	}
 
 	ret = ocfs2_dx_dir_build(fs, di->i_blkno);
@@ -79,23 +81,57 @@ static errcode_t build_dx_dir(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 		tcom_err(ret, "while enable indexed-dirs");
 	}
 
+unblock:
+	tunefs_unblock_signals();
 bail:
 	tools_progress_step(ctxt->prog, 1);
 	return ret;
 }
 
+static int finish_enable_indexed_dirs(ocfs2_filesys *fs, errcode_t err,
+				      void *user_data)
+{
+	struct dx_dirs_context *ctxt = user_data;
+
+	if (err && (err != TUNEFS_ET_OPERATION_FAILED))
+		tcom_err(err, "while building indexed trees");
+	tools_progress_stop(ctxt->prog);
+	tools_progress_step(ctxt->feature_prog, 1);
+	tools_progress_stop(ctxt->feature_prog);
+	ocfs2_free(&ctxt);
+
+	return err;
+}
+
+static struct tunefs_inode_pass build_dx_pass = {
+	.ip_name	= "indexed-dirs",
+	.ip_flags	= TUNEFS_PASS_WRITES_INODES | TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= build_dx_dir,
+	.ip_finish	= finish_enable_indexed_dirs,
+};
+
 static int enable_indexed_dirs(ocfs2_filesys *fs, int flags)
 {
+	int rc, resume = 0;
 	errcode_t ret = 0;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct tools_progress *prog = NULL;
-	struct dx_dirs_context ctxt;
+	struct dx_dirs_context *ctxt = NULL;
+
+	/* Index directories as the features before us left them */
+	rc = tunefs_flush_inode_passes(fs);
+	if (rc)
+		return rc;
 
+	/* The superblock is set up before the trees are built */
 	if (ocfs2_supports_indexed_dirs(super)) {
-		verbosef(VL_APP,
-			 "Directory indexing feature is already enabled; "
-			 "nothing to enable\n");
-		goto out;
+		resume = tunefs_inode_pass_interrupted(fs,
+						       build_dx_pass.ip_name);
+		if (!resume) {
+			verbosef(VL_APP,
+				 "Directory indexing feature is already "
+				 "enabled; nothing to enable\n");
+			goto out;
+		}
 	}
 
 	if (!tools_interact("Enable the directory indexing feature on "
@@ -103,20 +139,35 @@ static int enable_indexed_dirs(ocfs2_filesys *fs, int flags)
 			    fs->fs_devname))
 		goto out;
 
-	prog = tools_progress_start("Enable directory indexing", "dir idx", 2);
-	if (!prog) {
+	ret = ocfs2_malloc0(sizeof(struct dx_dirs_context), &ctxt);
+	if (ret) {
+		tcom_err(ret, "while allocating the directory context");
+		goto out;
+	}
+	INIT_LIST_HEAD(&ctxt->inodes);
+
+	ctxt->feature_prog = tools_progress_start("Enable directory indexing",
+						  "dir idx", 2);
+	if (!ctxt->feature_prog) {
 		ret = TUNEFS_ET_NO_MEMORY;
 		tcom_err(ret, "while initializing the progress display");
 		goto out;
 	}
 
-	memset(&ctxt, 0, sizeof(struct dx_dirs_context));
-	ctxt.prog = tools_progress_start("Building indexed trees", "building", 0);
-	if (!ctxt.prog) {
+	ctxt->prog = tools_progress_start("Building indexed trees",
+					  "building", 0);
+	if (!ctxt->prog) {
 		ret = TUNEFS_ET_NO_MEMORY;
 		goto out;
 	}
 
+	if (resume) {
+		verbosef(VL_APP,
+			 "Resuming the indexing of directories on device "
+			 "\"%s\"\n", fs->fs_devname);
+		goto queue;
+	}
+
 	/* s_uuid_hash is also used by xattr */
 	if (!OCFS2_HAS_INCOMPAT_FEATURE(super, OCFS2_FEATURE_INCOMPAT_XATTR))
 		super->s_uuid_hash =
@@ -132,23 +183,27 @@ static int enable_indexed_dirs(ocfs2_filesys *fs, int flags)
 
 	tunefs_block_signals();
 	ret = ocfs2_write_super(fs);
+	tunefs_unblock_signals();
 	if (ret) {
 		ret = TUNEFS_ET_IO_WRITE_FAILED;
 		tcom_err(ret, "while writing out the superblock");
-		goto unblock_out;
+		goto out;
 	}
-	tools_progress_step(prog, 1);
-	ret = tunefs_foreach_inode(fs, build_dx_dir, &ctxt);
-	if (ret)
-		tcom_err(ret, "while building indexed trees");
-unblock_out:
-	tunefs_unblock_signals();
-	tools_progress_step(prog, 1);
-	if (ctxt.prog)
-		tools_progress_stop(ctxt.prog);
+
+queue:
+	tools_progress_step(ctxt->feature_prog, 1);
+
+	build_dx_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &build_dx_pass);
+
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->prog)
+			tools_progress_stop(ctxt->prog);
+		if (ctxt->feature_prog)
+			tools_progress_stop(ctxt->feature_prog);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
@@ -183,35 +238,6 @@ bail:
 }
 
 
-static errcode_t find_indexed_dirs(ocfs2_filesys *fs,
-				   struct dx_dirs_context *ctxt)
-{
-	errcode_t ret;
-
-	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning", 0);
-	if (!ctxt->prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		goto bail;
-	}
-
-	ret = tunefs_foreach_inode(fs, dx_dir_iterate, ctxt);
-	if (ret) {
-		if (ret != TUNEFS_ET_NO_MEMORY)
-			ret = TUNEFS_ET_DX_DIRS_SCAN_FAILED;
-		goto bail;
-	}
-
-	verbosef(VL_APP,
-		"We have %"PRIu64" indexed %s to truncate.\n",
-		ctxt->dx_dirs_nr,
-		(ctxt->dx_dirs_nr > 1)?"directories":"directory");
-
-bail:
-	if (ctxt->prog)
-		tools_progress_stop(ctxt->prog);
-
-	return ret;
-}
 
 static errcode_t clean_indexed_dirs(ocfs2_filesys *fs,
 				    struct dx_dirs_context *ctxt)
@@ -266,50 +292,60 @@ static void release_dx_dirs_context(struct dx_dirs_context *ctxt)
 	}
 }
 
-static int disable_indexed_dirs(ocfs2_filesys *fs, int flags)
+/* Truncates the directories found so far */
+static errcode_t checkpoint_disable_indexed_dirs(ocfs2_filesys *fs,
+						 void *user_data)
 {
-	errcode_t ret = 0;
-	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct dx_dirs_context ctxt;
-	struct tools_progress *prog = NULL;
+	errcode_t ret;
+	struct dx_dirs_context *ctxt = user_data;
 
-	if (!ocfs2_supports_indexed_dirs(super)) {
-		verbosef(VL_APP,
-			"Directory indexing feature is not enabled; "
-			"nothing to disable\n");
-		goto out;
-	}
+	if (list_empty(&ctxt->inodes))
+		return 0;
 
-	if (!tools_interact("Disabling the directory indexing feature on "
-			    "device \"%s\"? ",
-			    fs->fs_devname))
-		goto out;
+	verbosef(VL_APP,
+		"We have %"PRIu64" indexed %s to truncate.\n",
+		ctxt->dx_dirs_nr,
+		(ctxt->dx_dirs_nr > 1)?"directories":"directory");
 
-	prog = tools_progress_start("Disable directory indexing", "no dir idx", 2);
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
-		goto out;
+	tunefs_block_signals();
+	ret = clean_indexed_dirs(fs, ctxt);
+	tunefs_unblock_signals();
+	if (ret) {
+		tcom_err(ret, "while truncate indexed directories");
 	}
 
-	memset(&ctxt, 0, sizeof (struct dx_dirs_context));
-	INIT_LIST_HEAD(&ctxt.inodes);
-	ret = find_indexed_dirs(fs, &ctxt);
-	if (ret) {
+	release_dx_dirs_context(ctxt);
+	ctxt->dx_dirs_nr = 0;
+
+	return ret;
+}
+
+static int finish_disable_indexed_dirs(ocfs2_filesys *fs, errcode_t err,
+				       void *user_data)
+{
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct dx_dirs_context *ctxt = user_data;
+
+	tools_progress_stop(ctxt->prog);
+	if (ret == TUNEFS_ET_OPERATION_FAILED)
+		goto out;
+	/* A failed checkpoint has already truncated some trees */
+	if (ret && (ret != TUNEFS_ET_DX_DIRS_TRUNCATE_FAILED)) {
+		if (ret != TUNEFS_ET_NO_MEMORY)
+			ret = TUNEFS_ET_DX_DIRS_SCAN_FAILED;
 		tcom_err(ret, "while scanning indexed directories");
-		goto out_cleanup;
+		goto out;
 	}
 
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->feature_prog, 1);
 
-	tunefs_block_signals();
-	ret = clean_indexed_dirs(fs, &ctxt);
-	if (ret) {
-		tcom_err(ret, "while truncate indexed directories");
-	}
+	if (!ret)
+		checkpoint_disable_indexed_dirs(fs, ctxt);
 
 	/* We already touched file system, must disable dx dirs flag here.
 	 * fsck.ocfs2 will handle the orphan indexed trees. */
+	tunefs_block_signals();
 	OCFS2_CLEAR_INCOMPAT_FEATURE(super,
 				     OCFS2_FEATURE_INCOMPAT_INDEXED_DIRS);
 
@@ -326,23 +362,87 @@ static int disable_indexed_dirs(ocfs2_filesys *fs, int flags)
 		tcom_err(ret, "while writing super block");
 	}
 
-	tools_progress_step(prog, 1);
-out_cleanup:
-	release_dx_dirs_context(&ctxt);
+	tools_progress_step(ctxt->feature_prog, 1);
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	release_dx_dirs_context(ctxt);
+	tools_progress_stop(ctxt->feature_prog);
+	ocfs2_free(&ctxt);
+
+	return ret;
+}
+
+static struct tunefs_inode_pass dx_dirs_pass = {
+	.ip_name	= "noindexed-dirs",
+	.ip_flags	= TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= dx_dir_iterate,
+	.ip_finish	= finish_disable_indexed_dirs,
+	.ip_checkpoint	= checkpoint_disable_indexed_dirs,
+};
+
+static int disable_indexed_dirs(ocfs2_filesys *fs, int flags)
+{
+	errcode_t ret = 0;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct dx_dirs_context *ctxt = NULL;
+
+	if (!ocfs2_supports_indexed_dirs(super)) {
+		verbosef(VL_APP,
+			"Directory indexing feature is not enabled; "
+			"nothing to disable\n");
+		goto out;
+	}
+
+	if (!tools_interact("Disabling the directory indexing feature on "
+			    "device \"%s\"? ",
+			    fs->fs_devname))
+		goto out;
+
+	ret = ocfs2_malloc0(sizeof(struct dx_dirs_context), &ctxt);
+	if (ret) {
+		tcom_err(ret, "while allocating the directory context");
+		goto out;
+	}
+	INIT_LIST_HEAD(&ctxt->inodes);
+
+	ctxt->feature_prog = tools_progress_start("Disable directory indexing",
+						  "no dir idx", 2);
+	if (!ctxt->feature_prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
+		goto out;
+	}
+
+	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
+					  0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while scanning indexed directories");
+		goto out;
+	}
+
+	dx_dirs_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &dx_dirs_pass);
+
+out:
+	if (ctxt) {
+		if (ctxt->feature_prog)
+			tools_progress_stop(ctxt->feature_prog);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
 
 /*
  * TUNEFS_FLAG_ALLOCATION because disabling will want to dealloc
- * blocks.
+ * blocks.  TUNEFS_FLAG_LARGECACHE so that we open the filesystem like
+ * the other features that share our inode scan.
  */
 DEFINE_TUNEFS_FEATURE_INCOMPAT(indexed_dirs,
 			       OCFS2_FEATURE_INCOMPAT_INDEXED_DIRS,
-			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION,
+			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
+			       TUNEFS_FLAG_LARGECACHE |
+			       TUNEFS_FLAG_INODE_PASS,
 			       enable_indexed_dirs,
 			       disable_indexed_dirs);
 
@@ -45,6 +45,7 @@ struct inline_data_context {
 	uint32_t more_clusters;
 	struct list_head inodes;
 	struct tools_progress *prog;
+	struct tools_progress *disable_prog;
 };
 
 
@@ -119,22 +120,23 @@ bail:
 	return ret;
 }
 
-static errcode_t find_inline_data(ocfs2_filesys *fs,
-				  struct inline_data_context *ctxt)
+/* One cluster per inline inode, counted before any checkpoint */
+static errcode_t inline_count(ocfs2_filesys *fs, struct ocfs2_dinode *di,
+			      uint64_t *clusters, void *user_data)
 {
-	errcode_t ret;
-	uint32_t free_clusters = 0;
+	if ((S_ISREG(di->i_mode) || S_ISDIR(di->i_mode)) &&
+	    (di->i_dyn_features & OCFS2_INLINE_DATA_FL))
+		(*clusters)++;
 
-	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
-					  0);
-	if (!ctxt->prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		goto bail;
-	}
+	return 0;
+}
 
-	ret = tunefs_foreach_inode(fs, inline_iterate, ctxt);
-	if (ret)
-		goto bail;
+/* Called with the files inline_iterate() has found so far */
+static errcode_t check_inline_data_space(ocfs2_filesys *fs,
+					 struct inline_data_context *ctxt)
+{
+	errcode_t ret;
+	uint32_t free_clusters = 0;
 
 	ret = tunefs_get_free_clusters(fs, &free_clusters);
 	if (ret)
@@ -149,9 +151,6 @@ static errcode_t find_inline_data(ocfs2_filesys *fs,
 		ret = OCFS2_ET_NO_SPACE;
 
 bail:
-	if (ctxt->prog)
-		tools_progress_stop(ctxt->prog);
-
 	return ret;
 }
 
@@ -182,7 +181,7 @@ static errcode_t expand_inline_data(ocfs2_filesys *fs,
 
 	prog = tools_progress_start("Expanding inline files", "expanding",
 				    ctxt->more_clusters);
-	if (!ctxt->prog)
+	if (!prog)
 		return TUNEFS_ET_NO_MEMORY;
 
 	ret = ocfs2_load_fs_quota_info(fs);
@@ -233,59 +232,66 @@ out:
 	return ret;
 }
 
-static int disable_inline_data(ocfs2_filesys *fs, int flags)
+/* Expands the files found so far */
+static errcode_t checkpoint_disable_inline_data(ocfs2_filesys *fs,
+						void *user_data)
 {
-	errcode_t ret = 0;
-	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct inline_data_context ctxt;
-	struct tools_progress *prog = NULL;
+	errcode_t ret;
+	struct inline_data_context *ctxt = user_data;
 
-	if (!ocfs2_support_inline_data(super)) {
-		verbosef(VL_APP,
-			 "The inline data feature is not enabled; "
-			 "nothing to disable\n");
-		goto out;
+	if (list_empty(&ctxt->inodes))
+		return 0;
+
+	ret = check_inline_data_space(fs, ctxt);
+	if (ret == OCFS2_ET_NO_SPACE)
+		errorf("There is not enough space to expand all of "
+		       "the inline data on device \"%s\"\n",
+		       fs->fs_devname);
+	else if (ret)
+		tcom_err(ret, "while trying to find files with inline data");
+	else {
+		ret = expand_inline_data(fs, ctxt);
+		if (ret)
+			tcom_err(ret,
+				 "while trying to expand the inline data on "
+				 "device \"%s\"",
+				 fs->fs_devname);
 	}
 
-	if (!tools_interact("Disable the inline data feature on device "
-			    "\"%s\"? ",
-			    fs->fs_devname))
-		goto out;
+	empty_inline_data_context(ctxt);
+	ctxt->more_clusters = 0;
 
-	prog = tools_progress_start("Disabling inline-data", "noinline-data", 3);
+	return ret ? TUNEFS_ET_OPERATION_FAILED : 0;
+}
 
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
-		goto out;
-	}
+static int finish_disable_inline_data(ocfs2_filesys *fs, errcode_t err,
+				      void *user_data)
+{
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct inline_data_context *ctxt = user_data;
+
+	tools_progress_stop(ctxt->prog);
+	ctxt->prog = NULL;
 
-	memset(&ctxt, 0, sizeof(ctxt));
-	INIT_LIST_HEAD(&ctxt.inodes);
-	ret = find_inline_data(fs, &ctxt);
 	if (ret) {
 		if (ret == OCFS2_ET_NO_SPACE)
 			errorf("There is not enough space to expand all of "
 			       "the inline data on device \"%s\"\n",
 			       fs->fs_devname);
-		else
+		else if (ret != TUNEFS_ET_OPERATION_FAILED)
 			tcom_err(ret,
 				 "while trying to find files with inline data");
-		goto out_cleanup;
+		goto out;
 	}
 
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
 
-	ret = expand_inline_data(fs, &ctxt);
-	if (ret) {
-		tcom_err(ret,
-			 "while trying to expand the inline data on device "
-			 "\"%s\"",
-			 fs->fs_devname);
-		goto out_cleanup;
-	}
+	ret = checkpoint_disable_inline_data(fs, ctxt);
+	if (ret)
+		goto out;
 
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
 
 	OCFS2_CLEAR_INCOMPAT_FEATURE(super,
 				     OCFS2_FEATURE_INCOMPAT_INLINE_DATA);
@@ -295,14 +301,75 @@ static int disable_inline_data(ocfs2_filesys *fs, int flags)
 	if (ret)
 		tcom_err(ret, "while writing out the superblock");
 
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
+
+out:
+	empty_inline_data_context(ctxt);
+	tools_progress_stop(ctxt->disable_prog);
+	ocfs2_free(&ctxt);
+
+	return ret;
+}
+
+static struct tunefs_inode_pass inline_pass = {
+	.ip_name	= "noinline-data",
+	.ip_flags	= TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= inline_iterate,
+	.ip_finish	= finish_disable_inline_data,
+	.ip_checkpoint	= checkpoint_disable_inline_data,
+	.ip_count	= inline_count,
+};
+
+static int disable_inline_data(ocfs2_filesys *fs, int flags)
+{
+	errcode_t ret = 0;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct inline_data_context *ctxt = NULL;
 
-out_cleanup:
-	empty_inline_data_context(&ctxt);
+	if (!ocfs2_support_inline_data(super)) {
+		verbosef(VL_APP,
+			 "The inline data feature is not enabled; "
+			 "nothing to disable\n");
+		goto out;
+	}
+
+	if (!tools_interact("Disable the inline data feature on device "
+			    "\"%s\"? ",
+			    fs->fs_devname))
+		goto out;
+
+	ret = ocfs2_malloc0(sizeof(struct inline_data_context), &ctxt);
+	if (ret) {
+		tcom_err(ret, "while allocating the inline data context");
+		goto out;
+	}
+	INIT_LIST_HEAD(&ctxt->inodes);
+
+	ctxt->disable_prog = tools_progress_start("Disabling inline-data",
+						  "noinline-data", 3);
+	if (!ctxt->disable_prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
+		goto out;
+	}
+
+	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
+					  0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while trying to find files with inline data");
+		goto out;
+	}
+
+	inline_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &inline_pass);
 
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->disable_prog)
+			tools_progress_stop(ctxt->disable_prog);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
@@ -310,7 +377,8 @@ out:
 DEFINE_TUNEFS_FEATURE_INCOMPAT(inline_data,
 			       OCFS2_FEATURE_INCOMPAT_INLINE_DATA,
 			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-			       TUNEFS_FLAG_LARGECACHE,
+			       TUNEFS_FLAG_LARGECACHE |
+			       TUNEFS_FLAG_INODE_PASS,
 			       enable_inline_data,
 			       disable_inline_data);
 
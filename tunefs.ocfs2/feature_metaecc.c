@@ -729,6 +729,29 @@ static errcode_t write_ecc_blocks(ocfs2_filesys *fs,
 	return ret;
 }
 
+/*
+ * Everything find_blocks() and find_chain_blocks() gathered gets
+ * rewritten, and so does every block of a directory gaining trailers.
+ */
+static void estimate_metaecc(ocfs2_filesys *fs, struct add_ecc_context *ctxt)
+{
+	struct list_head *pos;
+	struct tunefs_trailer_context *tc;
+	struct tunefs_estimate est = {
+		.te_write_blocks = ctxt->ae_blockcount +
+			tunefs_super_blocks(fs),
+		.te_alloc_clusters = ctxt->ae_clusters,
+	};
+
+	list_for_each(pos, &ctxt->ae_dirs) {
+		tc = list_entry(pos, struct tunefs_trailer_context, d_list);
+		est.te_write_blocks += tc->d_blocks_needed +
+			ocfs2_blocks_in_bytes(fs, tc->d_di->i_size);
+	}
+
+	tunefs_estimate_report("metaecc", &est);
+}
+
 static int enable_metaecc(ocfs2_filesys *fs, int flags)
 {
 	errcode_t ret = 0;
@@ -743,7 +766,8 @@ static int enable_metaecc(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
-	if (!tools_interact("Enable the metadata ECC feature on device "
+	if (!(flags & TUNEFS_FLAG_ESTIMATE) &&
+	    !tools_interact("Enable the metadata ECC feature on device "
 			    "\"%s\"? ",
 			    fs->fs_devname))
 		goto out;
@@ -773,6 +797,13 @@ static int enable_metaecc(ocfs2_filesys *fs, int flags)
 	}
 	tools_progress_step(prog, 1);
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		ret = find_chain_blocks(fs, &ctxt);
+		if (!ret)
+			estimate_metaecc(fs, &ctxt);
+		goto out_cleanup;
+	}
+
 	ret = tunefs_set_in_progress(fs, OCFS2_TUNEFS_INPROG_DIR_TRAILER);
 	if (ret)
 		goto out_cleanup;
@@ -838,6 +869,11 @@ static int disable_metaecc(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		tunefs_estimate_super(fs, "nometaecc");
+		goto out;
+	}
+
 	if (!tools_interact("Disable the metadata ECC feature on device "
 			    "\"%s\"? ",
 			    fs->fs_devname))
@@ -871,7 +907,7 @@ out:
 DEFINE_TUNEFS_FEATURE_INCOMPAT(metaecc,
 			       OCFS2_FEATURE_INCOMPAT_META_ECC,
 			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-			       TUNEFS_FLAG_LARGECACHE,
+			       TUNEFS_FLAG_LARGECACHE | TUNEFS_FLAG_ESTIMATE,
 			       enable_metaecc,
 			       disable_metaecc);
 
@@ -36,19 +36,42 @@ struct refcount_file {
 	uint64_t blkno;
 };
 
+/* One refcounted data extent of a file */
+struct refcount_extent {
+	uint64_t ino;
+	uint32_t cpos;
+	uint32_t p_cluster;
+	uint32_t clusters;
+	uint16_t flags;
+	/*
+	 * New clusters set aside for copying the rest of the extent, so
+	 * that the copy stays contiguous across unshared ranges.
+	 * res_next is the shared cluster that res_cluster will replace.
+	 */
+	uint32_t res_next;
+	uint32_t res_cluster;
+	uint32_t res_left;
+};
+
 struct refcount_block {
 	struct rb_node ref_node;
 	uint64_t blkno;
 	struct list_head files_list;
+	struct refcount_extent *extents;
+	int nr_extents;
+	int max_extents;
 };
 
 struct disable_refcount_ctxt {
 	errcode_t ret;
 	struct tools_progress *prog;
+	struct tools_progress *disable_prog;
 	uint32_t more_clusters;
 	uint32_t more_ebs;
 	struct rb_root ref_blknos;
 	int files_count;
+	int extents_count;
+	struct tunefs_estimate *est;	/* Set if we're only estimating */
 };
 
 /* See if the recount_file rbtree has the given ref_blkno.  */
@@ -110,11 +133,43 @@ static void empty_refcount_file_context(struct disable_refcount_ctxt *ctxt)
 			ocfs2_free(&file);
 		}
 
+		if (ref_blk->extents)
+			ocfs2_free(&ref_blk->extents);
 		rb_erase(&ref_blk->ref_node, &ctxt->ref_blknos);
 		ocfs2_free(&ref_blk);
 	}
 }
 
+static errcode_t add_refcount_extent(struct refcount_block *ref_blk,
+				     uint64_t ino, uint32_t cpos,
+				     uint32_t p_cluster, uint32_t clusters,
+				     uint16_t flags)
+{
+	errcode_t ret;
+	struct refcount_extent *ext;
+
+	if (ref_blk->nr_extents == ref_blk->max_extents) {
+		ret = ocfs2_realloc(sizeof(struct refcount_extent) *
+				    (ref_blk->max_extents + 256),
+				    &ref_blk->extents);
+		if (ret)
+			return ret;
+		ref_blk->max_extents += 256;
+	}
+
+	ext = &ref_blk->extents[ref_blk->nr_extents++];
+	ext->ino = ino;
+	ext->cpos = cpos;
+	ext->p_cluster = p_cluster;
+	ext->clusters = clusters;
+	ext->flags = flags;
+	ext->res_next = 0;
+	ext->res_cluster = 0;
+	ext->res_left = 0;
+
+	return 0;
+}
+
 static int ocfs2_xattr_get_refcount_clusters(ocfs2_cached_inode *ci,
 					     char *xe_buf,
 					     uint64_t xe_blkno,
@@ -161,8 +216,14 @@ static int ocfs2_xattr_get_refcount_clusters(ocfs2_cached_inode *ci,
 	return 0;
 }
 
+/*
+ * Count the refcounted clusters of the file.  The refcounted data
+ * extents are also remembered in ref_blk so they can be unshared in
+ * disk order.
+ */
 static errcode_t ocfs2_find_refcounted_clusters(ocfs2_filesys *fs,
 						uint64_t blkno,
+						struct refcount_block *ref_blk,
 						uint32_t *clusters)
 {
 	errcode_t ret;
@@ -184,12 +245,24 @@ static errcode_t ocfs2_find_refcounted_clusters(ocfs2_filesys *fs,
 			if (ret)
 				break;
 
-			if (ext_flags & OCFS2_EXT_REFCOUNTED)
+			if (num_clusters > len)
+				num_clusters = len;
+
+			if (ext_flags & OCFS2_EXT_REFCOUNTED) {
 				*clusters += num_clusters;
+				ret = add_refcount_extent(ref_blk, blkno,
+							  cpos, p_cluster,
+							  num_clusters,
+							  ext_flags);
+				if (ret)
+					break;
+			}
 
 			len -= num_clusters;
 			cpos += num_clusters;
 		}
+		if (ret)
+			goto out;
 	}
 
 	if (ci->ci_inode->i_dyn_features & OCFS2_HAS_XATTR_FL)
@@ -213,6 +286,7 @@ static errcode_t refcount_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	struct refcount_block *ref_blk = NULL;
 	struct disable_refcount_ctxt *ctxt = user_data;
 	uint32_t recs_per_eb = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
+	int nr_extents;
 
 	if (!S_ISREG(di->i_mode))
 		goto bail;
@@ -223,11 +297,6 @@ static errcode_t refcount_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	if (!(di->i_dyn_features & OCFS2_HAS_REFCOUNT_FL))
 		goto bail;
 
-	ret = ocfs2_find_refcounted_clusters(fs, di->i_blkno,
-					     &clusters);
-	if (ret)
-		goto bail;
-
 	ret = ocfs2_malloc0(sizeof(struct refcount_file), &file);
 	if (ret)
 		goto bail;
@@ -245,7 +314,15 @@ static errcode_t refcount_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 		INIT_LIST_HEAD(&ref_blk->files_list);
 		refcount_block_insert(ctxt, ref_blk);
 	}
+
+	nr_extents = ref_blk->nr_extents;
+	ret = ocfs2_find_refcounted_clusters(fs, di->i_blkno, ref_blk,
+					     &clusters);
+	if (ret)
+		goto bail;
+
 	list_add_tail(&file->list, &ref_blk->files_list);
+	ctxt->extents_count += ref_blk->nr_extents - nr_extents;
 
 	ctxt->more_clusters += clusters;
 	blk_num = (clusters + recs_per_eb - 1) / recs_per_eb;
@@ -263,23 +340,13 @@ bail:
 	return ret;
 }
 
-static errcode_t find_refcounted_files(ocfs2_filesys *fs,
-				       struct disable_refcount_ctxt *ctxt)
+/* Called once refcount_iterate() has seen every inode */
+static errcode_t check_refcount_space(ocfs2_filesys *fs,
+				      struct disable_refcount_ctxt *ctxt)
 {
 	errcode_t ret;
 	uint32_t free_clusters = 0;
 
-	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
-					  0);
-	if (!ctxt->prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		goto bail;
-	}
-
-	ret = tunefs_foreach_inode(fs, refcount_iterate, ctxt);
-	if (ret)
-		goto bail;
-
 	ret = tunefs_get_free_clusters(fs, &free_clusters);
 	if (ret)
 		goto bail;
@@ -295,11 +362,6 @@ static errcode_t find_refcounted_files(ocfs2_filesys *fs,
 		ret = OCFS2_ET_NO_SPACE;
 
 bail:
-	if (ctxt->prog) {
-		tools_progress_stop(ctxt->prog);
-		ctxt->prog = NULL;
-	}
-
 	return ret;
 }
 
@@ -390,6 +452,301 @@ out:
 	return ret;
 }
 
+/*
+ * Unsharing file by file reads the shared clusters once per clone, in
+ * the order of each file's logical offsets.  Instead, we gather every
+ * refcounted data extent of a tree and walk them in physical order.
+ * Each range of shared clusters is read once and written to a new
+ * home for every owner but the last, who keeps the original.  What is
+ * left for refcount_one_file() is the xattrs and the inode flags.
+ */
+#define UNSHARE_IO_BYTES	(4 * 1024 * 1024)
+
+struct unshare_ctxt {
+	ocfs2_filesys *fs;
+	ocfs2_refcount_session *rs;
+	char *buf;
+	uint32_t buf_clusters;
+	struct refcount_extent **owners;
+	int nr_owners;
+	int max_owners;
+};
+
+static int refcount_extent_cmp(const void *a, const void *b)
+{
+	const struct refcount_extent *l = a, *r = b;
+
+	if (l->p_cluster < r->p_cluster)
+		return -1;
+	if (l->p_cluster > r->p_cluster)
+		return 1;
+	if (l->ino < r->ino)
+		return -1;
+	if (l->ino > r->ino)
+		return 1;
+	if (l->cpos < r->cpos)
+		return -1;
+	if (l->cpos > r->cpos)
+		return 1;
+	return 0;
+}
+
+static errcode_t add_owner(struct unshare_ctxt *uc,
+			   struct refcount_extent *ext)
+{
+	errcode_t ret;
+
+	if (uc->nr_owners == uc->max_owners) {
+		ret = ocfs2_realloc(sizeof(struct refcount_extent *) *
+				    (uc->max_owners + 16), &uc->owners);
+		if (ret)
+			return ret;
+		uc->max_owners += 16;
+	}
+
+	uc->owners[uc->nr_owners++] = ext;
+	return 0;
+}
+
+/* Give back whatever is left of an extent's reservation */
+static errcode_t release_reservation(ocfs2_filesys *fs,
+				     struct refcount_extent *ext)
+{
+	errcode_t ret = 0;
+
+	if (ext->res_left)
+		ret = ocfs2_free_clusters(fs, ext->res_left,
+				ocfs2_clusters_to_blocks(fs,
+							 ext->res_cluster));
+	ext->res_left = 0;
+	return ret;
+}
+
+static errcode_t unshare_one_owner(struct unshare_ctxt *uc,
+				   struct refcount_extent *ext,
+				   uint32_t p_cluster, uint32_t len,
+				   int copy, int have_data)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = uc->fs;
+	ocfs2_cached_inode *ci = NULL;
+	uint32_t cpos = ext->cpos + (p_cluster - ext->p_cluster);
+	uint32_t ext_end = ext->p_cluster + ext->clusters;
+	uint32_t done = 0, got, n;
+	uint64_t blkno;
+
+	ret = ocfs2_read_cached_inode(fs, ext->ino, &ci);
+	if (ret)
+		goto out;
+
+	if (!copy) {
+		ret = release_reservation(fs, ext);
+		if (!ret)
+			ret = ocfs2_refcount_unshare_extent(ci, uc->rs, cpos,
+							    len, p_cluster,
+							    p_cluster);
+		goto write;
+	}
+
+	while (done < len) {
+		if (!ext->res_left || (ext->res_next != (p_cluster + done))) {
+			ret = release_reservation(fs, ext);
+			if (ret)
+				break;
+
+			ret = ocfs2_new_clusters(fs, 1,
+						 ext_end - (p_cluster + done),
+						 &blkno, &got);
+			if (ret)
+				break;
+			ext->res_next = p_cluster + done;
+			ext->res_cluster = ocfs2_blocks_to_clusters(fs, blkno);
+			ext->res_left = got;
+		}
+
+		n = ocfs2_min(len - done, ext->res_left);
+		if (have_data && !(ext->flags & OCFS2_EXT_UNWRITTEN)) {
+			ret = io_write_block_nocache(fs->fs_io,
+					ocfs2_clusters_to_blocks(fs,
+							ext->res_cluster),
+					ocfs2_clusters_to_blocks(fs, n),
+					uc->buf + done * fs->fs_clustersize);
+			if (ret)
+				break;
+		}
+
+		ret = ocfs2_refcount_unshare_extent(ci, uc->rs, cpos + done,
+						    n, p_cluster + done,
+						    ext->res_cluster);
+		if (ret)
+			break;
+
+		ext->res_next += n;
+		ext->res_cluster += n;
+		ext->res_left -= n;
+		done += n;
+	}
+
+write:
+	if (!ret)
+		ret = ocfs2_write_cached_inode(fs, ci);
+out:
+	if (ci)
+		ocfs2_free_cached_inode(fs, ci);
+	return ret;
+}
+
+/* Give every owner of len clusters at p_cluster its own copy */
+static errcode_t unshare_range(struct unshare_ctxt *uc, uint32_t p_cluster,
+			       uint32_t len)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = uc->fs;
+	uint32_t refcount, todo;
+	int i, need_data, have_data;
+
+	while (len) {
+		ret = ocfs2_refcount_session_get(uc->rs, p_cluster, len,
+						 &refcount, &todo);
+		if (ret)
+			break;
+
+		/* The tree must know about at least this many owners */
+		if (refcount < uc->nr_owners) {
+			ret = OCFS2_ET_INTERNAL_FAILURE;
+			break;
+		}
+
+		if (todo > uc->buf_clusters)
+			todo = uc->buf_clusters;
+
+		need_data = 0;
+		for (i = 0; i < uc->nr_owners; i++)
+			if (!(uc->owners[i]->flags & OCFS2_EXT_UNWRITTEN))
+				need_data = 1;
+
+		/* Read the shared clusters once for all the copies */
+		have_data = 0;
+		if (need_data && (uc->nr_owners > 1)) {
+			ret = io_read_block_nocache(fs->fs_io,
+					ocfs2_clusters_to_blocks(fs, p_cluster),
+					ocfs2_clusters_to_blocks(fs, todo),
+					uc->buf);
+			if (ret)
+				break;
+			have_data = 1;
+		}
+
+		/*
+		 * The last owner we visit keeps the original even if the
+		 * tree counts more owners than we found, so that the
+		 * clusters are never left behind with nobody to free them.
+		 */
+		for (i = 0; i < uc->nr_owners; i++) {
+			ret = unshare_one_owner(uc, uc->owners[i], p_cluster,
+						todo, i < (uc->nr_owners - 1),
+						have_data);
+			if (ret)
+				goto out;
+		}
+
+		p_cluster += todo;
+		len -= todo;
+	}
+
+out:
+	return ret;
+}
+
+static errcode_t unshare_refcount_extents(ocfs2_filesys *fs,
+					  struct refcount_block *ref_blk,
+					  struct tools_progress *prog)
+{
+	errcode_t ret;
+	int i, j, next = 0;
+	uint32_t pos = 0, end;
+	struct refcount_extent *ext;
+	struct unshare_ctxt uc = {
+		.fs = fs,
+	};
+
+	if (!ref_blk->nr_extents)
+		return 0;
+
+	qsort(ref_blk->extents, ref_blk->nr_extents,
+	      sizeof(struct refcount_extent), refcount_extent_cmp);
+
+	uc.buf_clusters = ocfs2_clusters_in_bytes(fs, UNSHARE_IO_BYTES);
+	ret = ocfs2_malloc_blocks(fs->fs_io,
+				  ocfs2_clusters_to_blocks(fs,
+							   uc.buf_clusters),
+				  &uc.buf);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_refcount_session_begin(fs, ref_blk->blkno, &uc.rs);
+	if (ret)
+		goto out;
+
+	/*
+	 * Sweep the sorted extents.  uc.owners holds every extent that
+	 * covers pos.  Each step handles the range up to the next place
+	 * where an extent starts or ends, so all owners of a range are
+	 * unshared together.
+	 */
+	while ((next < ref_blk->nr_extents) || uc.nr_owners) {
+		if (!uc.nr_owners)
+			pos = ref_blk->extents[next].p_cluster;
+
+		while ((next < ref_blk->nr_extents) &&
+		       (ref_blk->extents[next].p_cluster == pos)) {
+			ret = add_owner(&uc, &ref_blk->extents[next++]);
+			if (ret)
+				goto out;
+		}
+
+		end = UINT32_MAX;
+		if (next < ref_blk->nr_extents)
+			end = ref_blk->extents[next].p_cluster;
+		for (i = 0; i < uc.nr_owners; i++) {
+			ext = uc.owners[i];
+			if ((ext->p_cluster + ext->clusters) < end)
+				end = ext->p_cluster + ext->clusters;
+		}
+
+		ret = unshare_range(&uc, pos, end - pos);
+		if (!ret)
+			ret = ocfs2_refcount_session_commit(uc.rs);
+		if (ret)
+			goto out;
+
+		pos = end;
+		for (i = 0, j = 0; i < uc.nr_owners; i++) {
+			ext = uc.owners[i];
+			if ((ext->p_cluster + ext->clusters) == pos) {
+				ret = release_reservation(fs, ext);
+				if (ret)
+					goto out;
+				tools_progress_step(prog, 1);
+				continue;
+			}
+			uc.owners[j++] = ext;
+		}
+		uc.nr_owners = j;
+	}
+
+out:
+	for (i = 0; i < uc.nr_owners; i++)
+		release_reservation(fs, uc.owners[i]);
+	if (uc.rs)
+		ocfs2_refcount_session_free(uc.rs);
+	if (uc.owners)
+		ocfs2_free(&uc.owners);
+	if (uc.buf)
+		ocfs2_free(&uc.buf);
+	return ret;
+}
+
 static errcode_t free_refcount_tree(ocfs2_filesys *fs,
 				    struct refcount_block *ref_blk)
 {
@@ -430,7 +787,7 @@ static errcode_t replace_refcounted_files(ocfs2_filesys *fs,
 	struct list_head *p, *next;
 
 	prog = tools_progress_start("Replacing files", "replacing",
-				    ctxt->files_count);
+				    ctxt->extents_count + ctxt->files_count);
 	if (!prog) {
 		ret = TUNEFS_ET_NO_MEMORY;
 		goto out;
@@ -439,6 +796,10 @@ static errcode_t replace_refcounted_files(ocfs2_filesys *fs,
 	while ((node = rb_first(&ctxt->ref_blknos)) != NULL) {
 		ref_blk = rb_entry(node, struct refcount_block, ref_node);
 
+		ret = unshare_refcount_extents(fs, ref_blk, prog);
+		if (ret)
+			goto out;
+
 		list_for_each_safe(p, next, &ref_blk->files_list) {
 			file = list_entry(p, struct refcount_file, list);
 			ret = refcount_one_file(fs, file);
@@ -450,6 +811,8 @@ static errcode_t replace_refcounted_files(ocfs2_filesys *fs,
 		ret = free_refcount_tree(fs, ref_blk);
 		if (ret)
 			goto out;
+		if (ref_blk->extents)
+			ocfs2_free(&ref_blk->extents);
 		rb_erase(&ref_blk->ref_node, &ctxt->ref_blknos);
 		ocfs2_free(&ref_blk);
 	}
@@ -461,54 +824,53 @@ out:
 	return ret;
 }
 
-static int disable_refcount(ocfs2_filesys *fs, int flags)
+static int finish_disable_refcount(ocfs2_filesys *fs, errcode_t err,
+				   void *user_data)
 {
-	errcode_t ret = 0;
+	errcode_t ret = err;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct disable_refcount_ctxt ctxt;
-	struct tools_progress *prog = NULL;
-
-	if (!ocfs2_refcount_tree(super)) {
-		verbosef(VL_APP,
-			 "Refcount feature is not enabled; "
-			 "nothing to disable\n");
-		goto out;
-	}
-
-	if (!tools_interact("Disable the refcount feature on device "
-			    "\"%s\"? ", fs->fs_devname))
-		goto out;
-
-	prog = tools_progress_start("Disabling refcount", "norefcount", 3);
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
+	struct disable_refcount_ctxt *ctxt = user_data;
+	struct tunefs_estimate *est = ctxt->est;
+
+	tools_progress_stop(ctxt->prog);
+	ctxt->prog = NULL;
+
+	/*
+	 * Every refcounted cluster is counted as copied, though the
+	 * last owner of a cluster gets to keep it.
+	 */
+	if (!ret && est) {
+		est->te_write_blocks = ctxt->files_count +
+			ocfs2_clusters_to_blocks(fs, ctxt->more_ebs) +
+			tunefs_super_blocks(fs);
+		est->te_alloc_clusters = ctxt->more_clusters + ctxt->more_ebs;
+		est->te_copy_bytes = (uint64_t)ctxt->more_clusters *
+			fs->fs_clustersize;
+		tunefs_estimate_report("norefcount", est);
 		goto out;
 	}
 
-	memset(&ctxt, 0, sizeof(ctxt));
-	ctxt.ref_blknos = RB_ROOT;
-
-	ret = find_refcounted_files(fs, &ctxt);
+	if (!ret)
+		ret = check_refcount_space(fs, ctxt);
 	if (ret) {
 		if (ret == OCFS2_ET_NO_SPACE)
 			errorf("There is not enough space to fill all of "
 			       "the refcounted files on device \"%s\"\n",
 			       fs->fs_devname);
-		else
+		else if (ret != TUNEFS_ET_OPERATION_FAILED)
 			tcom_err(ret, "while trying to find refcounted files");
-		goto out_cleanup;
+		goto out;
 	}
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
 
-	ret = replace_refcounted_files(fs, &ctxt);
+	ret = replace_refcounted_files(fs, ctxt);
 	if (ret) {
 		tcom_err(ret,
 			 "while trying to replace refcounted files on device "
 			 "\"%s\"", fs->fs_devname);
-		goto out_cleanup;
+		goto out;
 	}
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
 
 	OCFS2_CLEAR_INCOMPAT_FEATURE(super,
 				     OCFS2_FEATURE_INCOMPAT_REFCOUNT_TREE);
@@ -518,14 +880,79 @@ static int disable_refcount(ocfs2_filesys *fs, int flags)
 	if (ret)
 		tcom_err(ret, "while writing out the superblock");
 
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->disable_prog, 1);
+
+out:
+	empty_refcount_file_context(ctxt);
+	tools_progress_stop(ctxt->disable_prog);
+	if (est)
+		ocfs2_free(&est);
+	ocfs2_free(&ctxt);
+
+	return ret;
+}
 
-out_cleanup:
-	empty_refcount_file_context(&ctxt);
+static struct tunefs_inode_pass refcount_pass = {
+	.ip_name	= "norefcount",
+	.ip_visit	= refcount_iterate,
+	.ip_finish	= finish_disable_refcount,
+};
+
+static int disable_refcount(ocfs2_filesys *fs, int flags)
+{
+	errcode_t ret = 0;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct disable_refcount_ctxt *ctxt = NULL;
+
+	if (!ocfs2_refcount_tree(super)) {
+		verbosef(VL_APP,
+			 "Refcount feature is not enabled; "
+			 "nothing to disable\n");
+		goto out;
+	}
+
+	if (!(flags & TUNEFS_FLAG_ESTIMATE) &&
+	    !tools_interact("Disable the refcount feature on device "
+			    "\"%s\"? ", fs->fs_devname))
+		goto out;
+
+	ret = ocfs2_malloc0(sizeof(struct disable_refcount_ctxt), &ctxt);
+	if (!ret && (flags & TUNEFS_FLAG_ESTIMATE))
+		ret = ocfs2_malloc0(sizeof(struct tunefs_estimate),
+				    &ctxt->est);
+	if (ret) {
+		tcom_err(ret, "while allocating the refcount context");
+		goto out;
+	}
+	ctxt->ref_blknos = RB_ROOT;
+
+	ctxt->disable_prog = tools_progress_start("Disabling refcount",
+						  "norefcount", 3);
+	if (!ctxt->disable_prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
+		goto out;
+	}
+
+	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
+					  0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while trying to find refcounted files");
+		goto out;
+	}
+
+	refcount_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &refcount_pass);
 
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->disable_prog)
+			tools_progress_stop(ctxt->disable_prog);
+		if (ctxt->est)
+			ocfs2_free(&ctxt->est);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
@@ -543,6 +970,11 @@ static int enable_refcount(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		tunefs_estimate_super(fs, "refcount");
+		goto out;
+	}
+
 	if (!tools_interact("Enable the refcount feature on "
 			    "device \"%s\"? ",
 			    fs->fs_devname))
@@ -572,7 +1004,9 @@ out:
 DEFINE_TUNEFS_FEATURE_INCOMPAT(refcount,
 			       OCFS2_FEATURE_INCOMPAT_REFCOUNT_TREE,
 			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-			       TUNEFS_FLAG_LARGECACHE,
+			       TUNEFS_FLAG_LARGECACHE |
+			       TUNEFS_FLAG_INODE_PASS |
+			       TUNEFS_FLAG_ESTIMATE,
 			       enable_refcount,
 			       disable_refcount);
 
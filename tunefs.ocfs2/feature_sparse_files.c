@@ -59,10 +59,12 @@ struct sparse_file {
 struct fill_hole_context {
 	errcode_t ret;
 	struct tools_progress *prog;
+	struct tools_progress *disable_prog;
 	uint32_t more_clusters;
 	uint32_t more_ebs;
 	struct list_head files;
 	uint64_t holecount;
+	struct tunefs_estimate *est;	/* Set if we're only estimating */
 };
 
 /*
@@ -113,6 +115,102 @@ out:
 	return ret;
 }
 
+static int finish_enable_sparse_files(ocfs2_filesys *fs, errcode_t err,
+				      void *user_data)
+{
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct tools_progress *prog = user_data;
+
+	if (ret) {
+		if (ret != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(ret, "while trying to remove any extraneous "
+				 "allocation");
+		goto out;
+	}
+
+	OCFS2_SET_INCOMPAT_FEATURE(super,
+				   OCFS2_FEATURE_INCOMPAT_SPARSE_ALLOC);
+	tunefs_block_signals();
+	ret = ocfs2_write_super(fs);
+	tunefs_unblock_signals();
+	if (ret)
+		tcom_err(ret, "while writing out the superblock");
+
+	tools_progress_step(prog, 1);
+
+out:
+	tools_progress_stop(prog);
+
+	return ret;
+}
+
+static struct tunefs_inode_pass truncate_pass = {
+	.ip_name	= "sparse",
+	.ip_flags	= TUNEFS_PASS_WRITES_INODES | TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= truncate_to_i_size,
+	.ip_finish	= finish_enable_sparse_files,
+};
+
+static errcode_t find_holes_in_file(ocfs2_filesys *fs,
+				    struct ocfs2_dinode *di,
+				    struct sparse_file *file,
+				    int unwritten_ok);
+
+/* Counts the files truncate_to_i_size() would change */
+static errcode_t truncate_estimate_iterate(ocfs2_filesys *fs,
+					   struct ocfs2_dinode *di,
+					   void *user_data)
+{
+	errcode_t ret;
+	struct sparse_file file;
+	struct hole_list *hole;
+	struct list_head *n, *pos;
+	struct tunefs_estimate *est = user_data;
+
+	if (!S_ISREG(di->i_mode) || (di->i_flags & OCFS2_SYSTEM_FL) ||
+	    (di->i_dyn_features & OCFS2_INLINE_DATA_FL))
+		return 0;
+
+	memset(&file, 0, sizeof(file));
+	INIT_LIST_HEAD(&file.holes);
+	ret = find_holes_in_file(fs, di, &file, 0);
+	if (!ret && file.truncate)
+		est->te_write_blocks++;
+
+	list_for_each_safe(pos, n, &file.holes) {
+		hole = list_entry(pos, struct hole_list, list);
+		list_del(&hole->list);
+		ocfs2_free(&hole);
+	}
+
+	return ret;
+}
+
+static int finish_estimate_sparse_files(ocfs2_filesys *fs, errcode_t err,
+					void *user_data)
+{
+	struct tunefs_estimate *est = user_data;
+
+	if (err) {
+		if (err != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(err, "while estimating the sparse feature");
+	} else {
+		est->te_write_blocks += tunefs_super_blocks(fs);
+		tunefs_estimate_report("sparse", est);
+	}
+
+	ocfs2_free(&est);
+
+	return err;
+}
+
+static struct tunefs_inode_pass truncate_estimate_pass = {
+	.ip_name	= "sparse",
+	.ip_visit	= truncate_estimate_iterate,
+	.ip_finish	= finish_estimate_sparse_files,
+};
+
 static int enable_sparse_files(ocfs2_filesys *fs, int flags)
 {
 	errcode_t ret = 0;
@@ -126,6 +224,16 @@ static int enable_sparse_files(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		ret = ocfs2_malloc0(sizeof(struct tunefs_estimate),
+				    &truncate_estimate_pass.ip_data);
+		if (ret) {
+			tcom_err(ret, "while estimating the sparse feature");
+			goto out;
+		}
+		return tunefs_queue_inode_pass(fs, &truncate_estimate_pass);
+	}
+
 	if (!tools_interact("Enable the sparse file feature on device "
 			    "\"%s\"? ",
 			    fs->fs_devname))
@@ -138,22 +246,8 @@ static int enable_sparse_files(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
-	ret = tunefs_foreach_inode(fs, truncate_to_i_size, prog);
-	if (ret) {
-		tcom_err(ret,
-			 "while trying to remove any extraneous allocation");
-		goto out;
-	}
-
-	OCFS2_SET_INCOMPAT_FEATURE(super,
-				   OCFS2_FEATURE_INCOMPAT_SPARSE_ALLOC);
-	tunefs_block_signals();
-	ret = ocfs2_write_super(fs);
-	tunefs_unblock_signals();
-	if (ret)
-		tcom_err(ret, "while writing out the superblock");
-
-	tools_progress_step(prog, 1);
+	truncate_pass.ip_data = prog;
+	return tunefs_queue_inode_pass(fs, &truncate_pass);
 
 out:
 	if (prog)
@@ -212,10 +306,13 @@ static void empty_fill_hole_context(struct fill_hole_context *ctxt)
 
 /*
  * Walk the allocations of a file, filling in the struct sparse_file.
+ * Unwritten extents are an error unless unwritten_ok says they will
+ * have been written by the time we fill the holes.
  */
 static errcode_t find_holes_in_file(ocfs2_filesys *fs,
 				    struct ocfs2_dinode *di,
-				    struct sparse_file *file)
+				    struct sparse_file *file,
+				    int unwritten_ok)
 {
 	errcode_t ret;
 	uint32_t clusters, v_cluster = 0, p_cluster, num_clusters;
@@ -250,7 +347,7 @@ static errcode_t find_holes_in_file(ocfs2_filesys *fs,
 				goto bail;
 		}
 
-		if (extent_flags & OCFS2_EXT_UNWRITTEN) {
+		if ((extent_flags & OCFS2_EXT_UNWRITTEN) && !unwritten_ok) {
 			ret = TUNEFS_ET_UNWRITTEN_PRESENT;
 			goto bail;
 		}
@@ -277,14 +374,51 @@ bail:
 }
 
 
+/*
+ * We have  "hole_num" holes, so more extent records are needed,
+ * and more extent blocks may needed here.
+ * In order to simplify the estimation process, we take it for
+ * granted that one hole need one extent record, so that we can
+ * calculate the extent block we need roughly.
+ */
+static uint32_t sparse_file_ebs(ocfs2_filesys *fs, struct sparse_file *file)
+{
+	uint32_t recs_per_eb = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
+	uint64_t blk_num = (file->holes_num + recs_per_eb - 1) / recs_per_eb;
+
+	return ocfs2_clusters_in_blocks(fs, blk_num);
+}
+
+/* Space to fill this file, for the count before any checkpoint */
+static errcode_t hole_count(ocfs2_filesys *fs, struct ocfs2_dinode *di,
+			    uint64_t *clusters, void *user_data)
+{
+	errcode_t ret;
+	struct sparse_file *file = NULL;
+
+	if (!S_ISREG(di->i_mode) || (di->i_flags & OCFS2_SYSTEM_FL) ||
+	    (di->i_dyn_features & OCFS2_INLINE_DATA_FL))
+		return 0;
+
+	ret = ocfs2_malloc0(sizeof(struct sparse_file), &file);
+	if (ret)
+		return ret;
+
+	INIT_LIST_HEAD(&file->list);
+	INIT_LIST_HEAD(&file->holes);
+	ret = find_holes_in_file(fs, di, file, 0);
+	if (!ret)
+		*clusters += file->hole_clusters + sparse_file_ebs(fs, file);
+	free_sparse_file(file);
+
+	return ret;
+}
+
 static errcode_t hole_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 			      void *user_data)
 {
 	errcode_t ret = 0;
-	uint64_t blk_num;
-	uint32_t clusters;
 	struct sparse_file *file = NULL;
-	uint32_t recs_per_eb = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
 	struct fill_hole_context *ctxt = user_data;
 
 	if (!S_ISREG(di->i_mode))
@@ -303,7 +437,7 @@ static errcode_t hole_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	file->blkno = di->i_blkno;
 	INIT_LIST_HEAD(&file->holes);
 	file->old_clusters = di->i_clusters;
-	ret = find_holes_in_file(fs, di, file);
+	ret = find_holes_in_file(fs, di, file, ctxt->est != NULL);
 	if (ret)
 		goto bail;
 
@@ -314,16 +448,7 @@ static errcode_t hole_iterate(ocfs2_filesys *fs, struct ocfs2_dinode *di,
 	if (list_empty(&file->holes) && !file->truncate)
 		goto bail;
 
-	/*
-	 * We have  "hole_num" holes, so more extent records are needed,
-	 * and more extent blocks may needed here.
-	 * In order to simplify the estimation process, we take it for
-	 * granted that one hole need one extent record, so that we can
-	 * calculate the extent block we need roughly.
-	 */
-	blk_num = (file->holes_num + recs_per_eb - 1) / recs_per_eb;
-	clusters = ocfs2_clusters_in_blocks(fs, blk_num);
-	ctxt->more_ebs += clusters;
+	ctxt->more_ebs += sparse_file_ebs(fs, file);
 
 	list_add_tail(&file->list, &ctxt->files);
 	ctxt->holecount += file->holes_num;
@@ -341,23 +466,13 @@ bail:
 	return ret;
 }
 
-static errcode_t find_sparse_files(ocfs2_filesys *fs,
-				   struct fill_hole_context *ctxt)
+/* Called with the files hole_iterate() has found so far */
+static errcode_t check_sparse_space(ocfs2_filesys *fs,
+				    struct fill_hole_context *ctxt)
 {
 	errcode_t ret;
 	uint32_t free_clusters = 0;
 
-	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
-					  0);
-	if (!ctxt->prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		goto bail;
-	}
-
-	ret = tunefs_foreach_inode(fs, hole_iterate, ctxt);
-	if (ret)
-		goto bail;
-
 	ret = tunefs_get_free_clusters(fs, &free_clusters);
 	if (ret)
 		goto bail;
@@ -373,11 +488,6 @@ static errcode_t find_sparse_files(ocfs2_filesys *fs,
 		ret = OCFS2_ET_NO_SPACE;
 
 bail:
-	if (ctxt->prog) {
-		tools_progress_stop(ctxt->prog);
-		ctxt->prog = NULL;
-	}
-
 	return ret;
 }
 
@@ -524,12 +634,122 @@ out:
 	return ret;
 }
 
+/* Fills the files found so far */
+static errcode_t checkpoint_disable_sparse_files(ocfs2_filesys *fs,
+						 void *user_data)
+{
+	errcode_t ret;
+	struct fill_hole_context *ctxt = user_data;
+
+	if (list_empty(&ctxt->files))
+		return 0;
+
+	ret = check_sparse_space(fs, ctxt);
+	if (ret == OCFS2_ET_NO_SPACE)
+		errorf("There is not enough space to fill all of "
+		       "the sparse files on device \"%s\"\n",
+		       fs->fs_devname);
+	else if (ret)
+		tcom_err(ret, "while trying to find sparse files");
+	else {
+		ret = fill_sparse_files(fs, ctxt);
+		if (ret)
+			tcom_err(ret,
+				 "while trying to fill the sparse files on "
+				 "device \"%s\"",
+				 fs->fs_devname);
+	}
+
+	empty_fill_hole_context(ctxt);
+	ctxt->more_clusters = 0;
+	ctxt->more_ebs = 0;
+	ctxt->holecount = 0;
+
+	return ret ? TUNEFS_ET_OPERATION_FAILED : 0;
+}
+
+static int finish_disable_sparse_files(ocfs2_filesys *fs, errcode_t err,
+				       void *user_data)
+{
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct fill_hole_context *ctxt = user_data;
+	struct tunefs_estimate *est = ctxt->est;
+	struct list_head *pos;
+
+	tools_progress_stop(ctxt->prog);
+	ctxt->prog = NULL;
+
+	if (ret) {
+		if (ret == OCFS2_ET_NO_SPACE)
+			errorf("There is not enough space to fill all of "
+			       "the sparse files on device \"%s\"\n",
+			       fs->fs_devname);
+		else if (ret != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(ret, "while trying to find sparse files");
+		goto out;
+	}
+
+	/* Every file found gets its inode and new extent blocks written */
+	if (est) {
+		list_for_each(pos, &ctxt->files)
+			est->te_write_blocks++;
+		est->te_write_blocks +=
+			ocfs2_clusters_to_blocks(fs, ctxt->more_ebs) +
+			tunefs_super_blocks(fs);
+		est->te_alloc_clusters = ctxt->more_clusters + ctxt->more_ebs;
+		est->te_zero_bytes = (uint64_t)ctxt->more_clusters *
+			fs->fs_clustersize;
+		tunefs_estimate_report("nosparse", est);
+		goto out;
+	}
+	tools_progress_step(ctxt->disable_prog, 1);
+
+	ret = checkpoint_disable_sparse_files(fs, ctxt);
+	if (ret)
+		goto out;
+	tools_progress_step(ctxt->disable_prog, 1);
+
+	OCFS2_CLEAR_INCOMPAT_FEATURE(super,
+				     OCFS2_FEATURE_INCOMPAT_SPARSE_ALLOC);
+	tunefs_block_signals();
+	ret = ocfs2_write_super(fs);
+	tunefs_unblock_signals();
+	if (ret)
+		tcom_err(ret, "while writing out the superblock");
+
+	tools_progress_step(ctxt->disable_prog, 1);
+
+out:
+	empty_fill_hole_context(ctxt);
+	tools_progress_stop(ctxt->disable_prog);
+	if (est)
+		ocfs2_free(&est);
+	ocfs2_free(&ctxt);
+
+	return ret;
+}
+
+static struct tunefs_inode_pass hole_pass = {
+	.ip_name	= "nosparse",
+	.ip_flags	= TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= hole_iterate,
+	.ip_finish	= finish_disable_sparse_files,
+	.ip_checkpoint	= checkpoint_disable_sparse_files,
+	.ip_count	= hole_count,
+};
+
 static int disable_sparse_files(ocfs2_filesys *fs, int flags)
 {
+	int rc;
 	errcode_t ret = 0;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct fill_hole_context ctxt;
-	struct tools_progress *prog = NULL;
+	struct fill_hole_context *ctxt = NULL;
+
+	/* We need to see unwritten extents disabled first */
+	rc = tunefs_flush_inode_passes(fs);
+	if (rc)
+		return rc;
 
 	if (!ocfs2_sparse_alloc(super)) {
 		verbosef(VL_APP,
@@ -538,7 +758,9 @@ static int disable_sparse_files(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
-	if (ocfs2_writes_unwritten_extents(super)) {
+	/* An estimate assumes nounwritten will run first */
+	if (ocfs2_writes_unwritten_extents(super) &&
+	    !(flags & TUNEFS_FLAG_ESTIMATE)) {
 		errorf("Unwritten extents are enabled on device \"%s\"; "
 		       "sparse files cannot be disabled\n",
 		       fs->fs_devname);
@@ -546,58 +768,49 @@ static int disable_sparse_files(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
-	if (!tools_interact("Disable the sparse file feature on device "
+	if (!(flags & TUNEFS_FLAG_ESTIMATE) &&
+	    !tools_interact("Disable the sparse file feature on device "
 			    "\"%s\"? ",
 			    fs->fs_devname))
 		goto out;
 
-	prog = tools_progress_start("Disabling sparse", "nosparse", 3);
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
+	ret = ocfs2_malloc0(sizeof(struct fill_hole_context), &ctxt);
+	if (!ret && (flags & TUNEFS_FLAG_ESTIMATE))
+		ret = ocfs2_malloc0(sizeof(struct tunefs_estimate),
+				    &ctxt->est);
+	if (ret) {
+		tcom_err(ret, "while allocating the hole context");
 		goto out;
 	}
+	INIT_LIST_HEAD(&ctxt->files);
 
-	memset(&ctxt, 0, sizeof(ctxt));
-	INIT_LIST_HEAD(&ctxt.files);
-	ret = find_sparse_files(fs, &ctxt);
-	if (ret) {
-		if (ret == OCFS2_ET_NO_SPACE)
-			errorf("There is not enough space to fill all of "
-			       "the sparse files on device \"%s\"\n",
-			       fs->fs_devname);
-		else
-			tcom_err(ret, "while trying to find sparse files");
-		goto out_cleanup;
+	ctxt->disable_prog = tools_progress_start("Disabling sparse",
+						  "nosparse", 3);
+	if (!ctxt->disable_prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
+		goto out;
 	}
-	tools_progress_step(prog, 1);
 
-	ret = fill_sparse_files(fs, &ctxt);
-	if (ret) {
-		tcom_err(ret,
-			 "while trying to fill the sparse files on device "
-			 "\"%s\"",
-			 fs->fs_devname);
-		goto out_cleanup;
+	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
+					  0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while trying to find sparse files");
+		goto out;
 	}
-	tools_progress_step(prog, 1);
 
-	OCFS2_CLEAR_INCOMPAT_FEATURE(super,
-				     OCFS2_FEATURE_INCOMPAT_SPARSE_ALLOC);
-	tunefs_block_signals();
-	ret = ocfs2_write_super(fs);
-	tunefs_unblock_signals();
-	if (ret)
-		tcom_err(ret, "while writing out the superblock");
-
-	tools_progress_step(prog, 1);
-
-out_cleanup:
-	empty_fill_hole_context(&ctxt);
+	hole_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &hole_pass);
 
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->disable_prog)
+			tools_progress_stop(ctxt->disable_prog);
+		if (ctxt->est)
+			ocfs2_free(&ctxt->est);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
@@ -605,7 +818,9 @@ out:
 DEFINE_TUNEFS_FEATURE_INCOMPAT(sparse_files,
 			       OCFS2_FEATURE_INCOMPAT_SPARSE_ALLOC,
 			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-			       TUNEFS_FLAG_LARGECACHE,
+			       TUNEFS_FLAG_LARGECACHE |
+			       TUNEFS_FLAG_INODE_PASS |
+			       TUNEFS_FLAG_ESTIMATE,
 			       enable_sparse_files,
 			       disable_sparse_files);
 
@@ -33,10 +33,16 @@
 
 static int enable_unwritten_extents(ocfs2_filesys *fs, int flags)
 {
+	int rc;
 	errcode_t ret = 0;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
 	struct tools_progress *prog;
 
+	/* Enabling sparse files may still be queued */
+	rc = tunefs_flush_inode_passes(fs);
+	if (rc)
+		return rc;
+
 	if (ocfs2_writes_unwritten_extents(super)) {
 		verbosef(VL_APP,
 			 "Unwritten extents feature is already enabled; "
@@ -52,6 +58,11 @@ static int enable_unwritten_extents(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		tunefs_estimate_super(fs, "unwritten");
+		goto out;
+	}
+
 	if (!tools_interact("Enable the unwritten extents feature on "
 			    "device \"%s\"? ",
 			    fs->fs_devname))
@@ -78,6 +89,11 @@ out:
 	return ret;
 }
 
+struct unwritten_context {
+	struct tools_progress *prog;
+	struct tunefs_estimate *est;	/* Set if we're only estimating */
+};
+
 static errcode_t unwritten_iterate(ocfs2_filesys *fs,
 				   struct ocfs2_dinode *di,
 				   void *user_data)
@@ -87,7 +103,9 @@ static errcode_t unwritten_iterate(ocfs2_filesys *fs,
 	uint16_t extent_flags;
 	uint64_t p_blkno;
 	ocfs2_cached_inode *ci = NULL;
-	struct tools_progress *prog = user_data;
+	struct unwritten_context *ctxt = user_data;
+	struct tunefs_estimate *est = ctxt->est;
+	int written = 0;
 
 	if (!S_ISREG(di->i_mode))
 		goto bail;
@@ -112,14 +130,20 @@ static errcode_t unwritten_iterate(ocfs2_filesys *fs,
 		if (ret)
 			break;
 
-		if (extent_flags & OCFS2_EXT_UNWRITTEN) {
+		if ((extent_flags & OCFS2_EXT_UNWRITTEN) && est) {
+			/* Each extent rewrites its leaf, give or take */
+			est->te_zero_bytes += (uint64_t)num_clusters *
+				fs->fs_clustersize;
+			est->te_write_blocks++;
+			written = 1;
+		} else if (extent_flags & OCFS2_EXT_UNWRITTEN) {
 			p_blkno = ocfs2_clusters_to_blocks(fs, p_cluster);
 			ret = tunefs_empty_clusters(fs, p_blkno,
 						    num_clusters);
 			if (ret)
 				break;
 
-			tools_progress_step(prog, 1);
+			tools_progress_step(ctxt->prog, 1);
 			tunefs_block_signals();
 			ret = ocfs2_mark_extent_written(fs, di, v_cluster,
 							num_clusters,
@@ -127,31 +151,77 @@ static errcode_t unwritten_iterate(ocfs2_filesys *fs,
 			tunefs_unblock_signals();
 			if (ret)
 				break;
-			tools_progress_step(prog, 1);
+			tools_progress_step(ctxt->prog, 1);
 		}
 
 		v_cluster += num_clusters;
 	}
 
+	/* And the inode */
+	if (written)
+		est->te_write_blocks++;
+
 bail:
 	if (ci)
 		ocfs2_free_cached_inode(fs, ci);
-	tools_progress_step(prog, 1);
+	tools_progress_step(ctxt->prog, 1);
 
 	return ret;
 }
 
-static errcode_t clear_unwritten_extents(ocfs2_filesys *fs,
-					 struct tools_progress *prog)
+static int finish_disable_unwritten_extents(ocfs2_filesys *fs,
+					    errcode_t err, void *user_data)
 {
-	return tunefs_foreach_inode(fs, unwritten_iterate, prog);
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct unwritten_context *ctxt = user_data;
+	struct tunefs_estimate *est = ctxt->est;
+
+	if (ret) {
+		if (ret != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(ret,
+				 "while trying to clear the unwritten "
+				 "extents on device \"%s\"",
+				 fs->fs_devname);
+		goto out;
+	}
+
+	if (est) {
+		est->te_write_blocks += tunefs_super_blocks(fs);
+		tunefs_estimate_report("nounwritten", est);
+		goto out;
+	}
+
+	OCFS2_CLEAR_RO_COMPAT_FEATURE(super,
+				      OCFS2_FEATURE_RO_COMPAT_UNWRITTEN);
+	tunefs_block_signals();
+	ret = ocfs2_write_super(fs);
+	tunefs_unblock_signals();
+	if (ret)
+		tcom_err(ret, "while writing out the superblock");
+
+	tools_progress_step(ctxt->prog, 1);
+
+out:
+	tools_progress_stop(ctxt->prog);
+	if (est)
+		ocfs2_free(&est);
+	ocfs2_free(&ctxt);
+	return ret;
 }
 
+static struct tunefs_inode_pass unwritten_pass = {
+	.ip_name	= "nounwritten",
+	.ip_flags	= TUNEFS_PASS_WRITES_INODES | TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= unwritten_iterate,
+	.ip_finish	= finish_disable_unwritten_extents,
+};
+
 static int disable_unwritten_extents(ocfs2_filesys *fs, int flags)
 {
 	errcode_t ret = 0;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct tools_progress *prog = NULL;
+	struct unwritten_context *ctxt = NULL;
 
 	if (!ocfs2_writes_unwritten_extents(super)) {
 		verbosef(VL_APP,
@@ -160,47 +230,47 @@ static int disable_unwritten_extents(ocfs2_filesys *fs, int flags)
 		goto out;
 	}
 
-	if (!tools_interact("Disable the unwritten extents feature on "
+	if (!(flags & TUNEFS_FLAG_ESTIMATE) &&
+	    !tools_interact("Disable the unwritten extents feature on "
 			    "device \"%s\"? ",
 			    fs->fs_devname))
 		goto out;
 
-	prog = tools_progress_start("Disabling unwritten", "nounwritten", 0);
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
+	ret = ocfs2_malloc0(sizeof(struct unwritten_context), &ctxt);
+	if (!ret && (flags & TUNEFS_FLAG_ESTIMATE))
+		ret = ocfs2_malloc0(sizeof(struct tunefs_estimate),
+				    &ctxt->est);
+	if (ret) {
+		tcom_err(ret, "while allocating the unwritten context");
 		goto out;
 	}
 
-	ret = clear_unwritten_extents(fs, prog);
-	if (ret) {
-		tcom_err(ret,
-			 "while trying to clear the unwritten extents on "
-			 "device \"%s\"",
-			 fs->fs_devname);
+	ctxt->prog = tools_progress_start("Disabling unwritten",
+					  "nounwritten", 0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
 		goto out;
 	}
 
-	OCFS2_CLEAR_RO_COMPAT_FEATURE(super,
-				      OCFS2_FEATURE_RO_COMPAT_UNWRITTEN);
-	tunefs_block_signals();
-	ret = ocfs2_write_super(fs);
-	tunefs_unblock_signals();
-	if (ret)
-		tcom_err(ret, "while writing out the superblock");
-
-	tools_progress_step(prog, 1);
+	unwritten_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &unwritten_pass);
 
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->est)
+			ocfs2_free(&ctxt->est);
+		ocfs2_free(&ctxt);
+	}
 	return ret;
 }
 
 DEFINE_TUNEFS_FEATURE_RO_COMPAT(unwritten_extents,
 				OCFS2_FEATURE_RO_COMPAT_UNWRITTEN,
 				TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-				TUNEFS_FLAG_LARGECACHE,
+				TUNEFS_FLAG_LARGECACHE |
+				TUNEFS_FLAG_INODE_PASS |
+				TUNEFS_FLAG_ESTIMATE,
 				enable_unwritten_extents,
 				disable_unwritten_extents);
 
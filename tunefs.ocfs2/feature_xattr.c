@@ -36,6 +36,7 @@ struct xattr_context {
 	errcode_t ret;
 	struct list_head inodes;
 	struct tools_progress *prog;
+	struct tools_progress *disable_prog;
 	uint64_t inode_count;
 };
 
@@ -374,15 +375,85 @@ out:
 	return ret;
 }
 
+/* Removes the attributes of the files found so far */
+static errcode_t checkpoint_disable_xattr(ocfs2_filesys *fs,
+					  void *user_data)
+{
+	errcode_t ret;
+	struct xattr_context *ctxt = user_data;
+
+	if (list_empty(&ctxt->inodes))
+		return 0;
+
+	ret = remove_xattr(fs, ctxt);
+	if (ret) {
+		tcom_err(ret, "while trying to remove extended attributes");
+		ret = TUNEFS_ET_OPERATION_FAILED;
+	}
+
+	empty_xattr_context(ctxt);
+	ctxt->inode_count = 0;
+
+	return ret;
+}
+
+static int finish_disable_xattr(ocfs2_filesys *fs, errcode_t err,
+				void *user_data)
+{
+	errcode_t ret = err;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	struct xattr_context *ctxt = user_data;
+
+	tools_progress_stop(ctxt->prog);
+	if (ret) {
+		if (ret != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(ret, "while trying to find files with"
+				 " extended attributes ");
+		goto out;
+	}
+	tools_progress_step(ctxt->disable_prog, 1);
+
+	ret = checkpoint_disable_xattr(fs, ctxt);
+	if (ret)
+		goto out;
+	tools_progress_step(ctxt->disable_prog, 1);
+
+	/* s_uuid_hash is also used by Indexed Dirs */
+	if (!OCFS2_HAS_INCOMPAT_FEATURE(super,
+					OCFS2_FEATURE_INCOMPAT_INDEXED_DIRS))
+		super->s_uuid_hash = 0;
+	super->s_xattr_inline_size = 0;
+	OCFS2_CLEAR_INCOMPAT_FEATURE(super, OCFS2_FEATURE_INCOMPAT_XATTR);
+
+	tunefs_block_signals();
+	ret = ocfs2_write_super(fs);
+	tunefs_unblock_signals();
+	if (ret)
+		tcom_err(ret, "while writing out the superblock");
+
+	tools_progress_step(ctxt->disable_prog, 1);
+
+out:
+	empty_xattr_context(ctxt);
+	tools_progress_stop(ctxt->disable_prog);
+	ocfs2_free(&ctxt);
+
+	return ret;
+}
+
+static struct tunefs_inode_pass xattr_pass = {
+	.ip_name	= "noxattr",
+	.ip_flags	= TUNEFS_PASS_RESUMABLE,
+	.ip_visit	= xattr_iterate,
+	.ip_finish	= finish_disable_xattr,
+	.ip_checkpoint	= checkpoint_disable_xattr,
+};
+
 static int disable_xattr(ocfs2_filesys *fs, int flag)
 {
 	errcode_t ret = 0;
 	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
-	struct xattr_context ctxt = {
-		.prog = NULL,
-		.inode_count = 0,
-	};
-	struct tools_progress *prog = NULL;
+	struct xattr_context *ctxt = NULL;
 
 	if (!ocfs2_support_xattr(super)) {
 		verbosef(VL_APP,
@@ -396,57 +467,38 @@ static int disable_xattr(ocfs2_filesys *fs, int flag)
 			     fs->fs_devname))
 		goto out;
 
-	prog = tools_progress_start("Disabling extended attribute",
-				    "noxattr", 3);
-	if (!prog) {
-		ret = TUNEFS_ET_NO_MEMORY;
-		tcom_err(ret, "while initializing the progress display");
+	ret = ocfs2_malloc0(sizeof(struct xattr_context), &ctxt);
+	if (ret) {
+		tcom_err(ret, "while allocating the extended attribute "
+			 "context");
 		goto out;
 	}
+	INIT_LIST_HEAD(&ctxt->inodes);
 
-	ctxt.prog = tools_progress_start("Scanning filesystem", "scanning",
-					 0);
-	if (!ctxt.prog) {
+	ctxt->disable_prog = tools_progress_start("Disabling extended "
+						  "attribute", "noxattr", 3);
+	if (!ctxt->disable_prog) {
 		ret = TUNEFS_ET_NO_MEMORY;
+		tcom_err(ret, "while initializing the progress display");
 		goto out;
 	}
-	INIT_LIST_HEAD(&ctxt.inodes);
-	ret = tunefs_foreach_inode(fs, xattr_iterate, &ctxt);
-	tools_progress_stop(ctxt.prog);
-	if (ret) {
-		tcom_err(ret, "while trying to find files with"
-			 " extended attributes ");
-		goto out_cleanup;
-	}
-	tools_progress_step(prog, 1);
 
-	ret = remove_xattr(fs, &ctxt);
-	if (ret) {
-		tcom_err(ret, "while trying to remove extended attributes");
-		goto out_cleanup;
+	ctxt->prog = tools_progress_start("Scanning filesystem", "scanning",
+					  0);
+	if (!ctxt->prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		goto out;
 	}
-	tools_progress_step(prog, 1);
 
-	/* s_uuid_hash is also used by Indexed Dirs */
-	if (!OCFS2_HAS_INCOMPAT_FEATURE(super,
-					OCFS2_FEATURE_INCOMPAT_INDEXED_DIRS))
-		super->s_uuid_hash = 0;
-	super->s_xattr_inline_size = 0;
-	OCFS2_CLEAR_INCOMPAT_FEATURE(super, OCFS2_FEATURE_INCOMPAT_XATTR);
+	xattr_pass.ip_data = ctxt;
+	return tunefs_queue_inode_pass(fs, &xattr_pass);
 
-	tunefs_block_signals();
-	ret = ocfs2_write_super(fs);
-	tunefs_unblock_signals();
-	if (ret)
-		tcom_err(ret, "while writing out the superblock");
-
-	tools_progress_step(prog, 1);
-
-out_cleanup:
-	empty_xattr_context(&ctxt);
 out:
-	if (prog)
-		tools_progress_stop(prog);
+	if (ctxt) {
+		if (ctxt->disable_prog)
+			tools_progress_stop(ctxt->disable_prog);
+		ocfs2_free(&ctxt);
+	}
 
 	return ret;
 }
@@ -454,7 +506,8 @@ out:
 DEFINE_TUNEFS_FEATURE_INCOMPAT(xattr,
 			       OCFS2_FEATURE_INCOMPAT_XATTR,
 			       TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-			       TUNEFS_FLAG_LARGECACHE,
+			       TUNEFS_FLAG_LARGECACHE |
+			       TUNEFS_FLAG_INODE_PASS,
 			       enable_xattr,
 			       disable_xattr);
 
@@ -33,6 +33,8 @@
 #include <limits.h>
 #include <getopt.h>
 #include <assert.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "ocfs2/ocfs2.h"
 #include "ocfs2/bitops.h"
@@ -82,6 +84,12 @@ struct tunefs_filesystem_state {
 	 */
 	uint32_t	ts_fs_clusters;
 
+	/*
+	 * Non-zero if the cluster size changed.  The master's copy of
+	 * the allocators is stale, so the bitmap was checked then.
+	 */
+	int		ts_geometry_changed;
+
 	/* Size of the largest journal seen in tunefs_journal_check() */
 	uint32_t	ts_journal_clusters;
 
@@ -109,6 +117,18 @@ static unsigned int blocked_signals_count;
 /* For DEBUG_EXE programs */
 static const char *usage_string;
 
+/* State for tunefs.ocfs2 --estimate */
+struct tunefs_estimate_state {
+	int			es_active;
+	int			es_blocksize;
+	struct timeval		es_start;
+	uint64_t		es_scan_blocks;	/* What our scans read */
+	struct tunefs_estimate	es_total;	/* What operations
+						   reported */
+};
+
+static struct tunefs_estimate_state estimate_state;
+
 
 /*
  * Code to manage the fs_private state.
@@ -453,148 +473,1261 @@ bail:
 	return ret;
 }
 
-errcode_t tunefs_empty_clusters(ocfs2_filesys *fs, uint64_t start_blk,
-				uint32_t num_clusters)
+errcode_t tunefs_empty_clusters(ocfs2_filesys *fs, uint64_t start_blk,
+				uint32_t num_clusters)
+{
+	errcode_t ret;
+	char *buf = NULL;
+	uint64_t bpc = ocfs2_clusters_to_blocks(fs, 1);
+	uint64_t total_blocks = ocfs2_clusters_to_blocks(fs, num_clusters);
+	uint64_t io_blocks = total_blocks;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
+	if (ret == OCFS2_ET_NO_MEMORY) {
+		io_blocks = bpc;
+		ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
+	}
+	if (ret)
+		goto bail;
+
+	memset(buf, 0, io_blocks * fs->fs_blocksize);
+
+	while (total_blocks) {
+		ret = io_write_block_nocache(fs->fs_io, start_blk,
+					     io_blocks, buf);
+		if (ret)
+			goto bail;
+
+		total_blocks -= io_blocks;
+		start_blk += io_blocks;
+	}
+
+bail:
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+errcode_t tunefs_get_free_clusters(ocfs2_filesys *fs, uint32_t *clusters)
+{
+	errcode_t ret;
+	uint64_t blkno;
+	char *buf = NULL;
+	struct ocfs2_dinode *di = NULL;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto bail;
+
+	ret = ocfs2_lookup_system_inode(fs, GLOBAL_BITMAP_SYSTEM_INODE,
+					0, &blkno);
+	if (ret)
+		goto bail;
+
+	ret = ocfs2_read_inode(fs, blkno, buf);
+	if (ret)
+		goto bail;
+
+	di = (struct ocfs2_dinode *)buf;
+	if (clusters)
+		*clusters = di->id1.bitmap1.i_total - di->id1.bitmap1.i_used;
+bail:
+	if (buf)
+		ocfs2_free(&buf);
+	return ret;
+}
+
+uint16_t tunefs_link_group_chain(struct ocfs2_dinode *di)
+{
+	uint16_t cr_pos;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+
+	/* calculate the insert position. */
+	if (cl->cl_next_free_rec < cl->cl_count)
+		cr_pos = cl->cl_next_free_rec;
+	else {
+		/* Now we have all the chain record filled with some groups.
+		 * so we figure out all the groups we have and then calculate
+		 * the proper place for our insert.
+		 */
+		cr_pos = di->id1.bitmap1.i_total / (cl->cl_cpg * cl->cl_bpc);
+		cr_pos %= cl->cl_count;
+	}
+
+	return cr_pos;
+}
+
+static void tunefs_account_linked_group(ocfs2_filesys *fs,
+					struct ocfs2_group_desc *gd,
+					struct ocfs2_dinode *di)
+{
+	uint32_t clusters;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+	struct ocfs2_chain_rec *cr = &cl->cl_recs[gd->bg_chain];
+
+	cr->c_total += gd->bg_bits;
+	cr->c_free += gd->bg_free_bits_count;
+
+	/* If the chain isn't full, increase the free_rec. */
+	if (cl->cl_next_free_rec != cl->cl_count)
+		cl->cl_next_free_rec++;
+
+	/* Discontiguous groups may be short */
+	clusters = gd->bg_bits / cl->cl_bpc;
+	di->id1.bitmap1.i_total += gd->bg_bits;
+	di->id1.bitmap1.i_used += gd->bg_bits - gd->bg_free_bits_count;
+	di->i_clusters += clusters;
+	di->i_size += (uint64_t)clusters * fs->fs_clustersize;
+}
+
+void tunefs_link_group(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+		       struct ocfs2_dinode *di)
+{
+	uint16_t cr_pos = tunefs_link_group_chain(di);
+	struct ocfs2_chain_rec *cr = &di->id2.i_chain.cl_recs[cr_pos];
+
+	gd->bg_chain = cr_pos;
+	gd->bg_parent_dinode = di->i_blkno;
+	gd->bg_next_group = cr->c_blkno;
+
+	cr->c_blkno = gd->bg_blkno;
+	tunefs_account_linked_group(fs, gd, di);
+}
+
+void tunefs_link_group_tail(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+			    struct ocfs2_group_desc *tail,
+			    struct ocfs2_dinode *di)
+{
+	uint16_t cr_pos = tunefs_link_group_chain(di);
+	struct ocfs2_chain_rec *cr = &di->id2.i_chain.cl_recs[cr_pos];
+
+	gd->bg_chain = cr_pos;
+	gd->bg_parent_dinode = di->i_blkno;
+	gd->bg_next_group = 0;
+
+	if (tail)
+		tail->bg_next_group = gd->bg_blkno;
+	else
+		cr->c_blkno = gd->bg_blkno;
+	tunefs_account_linked_group(fs, gd, di);
+}
+
+void tunefs_unlink_group(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+			 struct ocfs2_group_desc *prev,
+			 struct ocfs2_dinode *di)
+{
+	uint32_t clusters;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+	struct ocfs2_chain_rec *cr = &cl->cl_recs[gd->bg_chain];
+
+	if (prev)
+		prev->bg_next_group = gd->bg_next_group;
+	else
+		cr->c_blkno = gd->bg_next_group;
+
+	cr->c_total -= gd->bg_bits;
+	cr->c_free -= gd->bg_free_bits_count;
+
+	clusters = gd->bg_bits / cl->cl_bpc;
+	di->id1.bitmap1.i_total -= gd->bg_bits;
+	di->id1.bitmap1.i_used -= gd->bg_bits - gd->bg_free_bits_count;
+	di->i_clusters -= clusters;
+	di->i_size -= (uint64_t)clusters * fs->fs_clustersize;
+
+	gd->bg_next_group = 0;
+}
+
+errcode_t tunefs_set_suballoc_slot(ocfs2_filesys *fs, uint64_t blkno,
+				   uint16_t slot, char *buf)
+{
+	errcode_t ret;
+
+	ret = ocfs2_read_blocks(fs, blkno, 1, buf);
+	if (ret)
+		return ret;
+
+	switch (ocfs2_detect_block(buf)) {
+	case OCFS2_BLOCK_INODE:
+		ret = ocfs2_read_inode(fs, blkno, buf);
+		if (!ret) {
+			((struct ocfs2_dinode *)buf)->i_suballoc_slot = slot;
+			ret = ocfs2_write_inode(fs, blkno, buf);
+		}
+		break;
+
+	case OCFS2_BLOCK_EXTENT_BLOCK:
+		ret = ocfs2_read_extent_block(fs, blkno, buf);
+		if (!ret) {
+			((struct ocfs2_extent_block *)buf)->h_suballoc_slot =
+				slot;
+			ret = ocfs2_write_extent_block(fs, blkno, buf);
+		}
+		break;
+
+	case OCFS2_BLOCK_XATTR:
+		ret = ocfs2_read_xattr_block(fs, blkno, buf);
+		if (!ret) {
+			((struct ocfs2_xattr_block *)buf)->xb_suballoc_slot =
+				slot;
+			ret = ocfs2_write_xattr_block(fs, blkno, buf);
+		}
+		break;
+
+	case OCFS2_BLOCK_REFCOUNT:
+		ret = ocfs2_read_refcount_block(fs, blkno, buf);
+		if (!ret) {
+			((struct ocfs2_refcount_block *)buf)->rf_suballoc_slot =
+				slot;
+			ret = ocfs2_write_refcount_block(fs, blkno, buf);
+		}
+		break;
+
+	case OCFS2_BLOCK_DXROOT:
+		ret = ocfs2_read_dx_root(fs, blkno, buf);
+		if (!ret) {
+			((struct ocfs2_dx_root_block *)buf)->dr_suballoc_slot =
+				slot;
+			ret = ocfs2_write_dx_root(fs, blkno, buf);
+		}
+		break;
+
+	default:
+		ret = OCFS2_ET_CORRUPT_CHAIN;
+		break;
+	}
+
+	return ret;
+}
+
+#define tunefs_blocks_needed(count, per_block)	\
+	(((count) + (per_block) - 1) / (per_block))
+
+struct tunefs_tree_node {
+	uint32_t tn_cpos;
+	uint32_t tn_end;
+	uint64_t tn_blkno;
+};
+
+uint32_t tunefs_extent_tree_layout(ocfs2_filesys *fs,
+				   struct ocfs2_dinode *di,
+				   uint32_t num_recs, uint16_t *depth)
+{
+	uint16_t eb_count = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
+	uint32_t blocks = 0, level = num_recs;
+
+	*depth = 0;
+	while (level > di->id2.i_list.l_count) {
+		level = tunefs_blocks_needed(level, eb_count);
+		blocks += level;
+		(*depth)++;
+	}
+
+	return blocks;
+}
+
+/*
+ * Interior records run up to the start of their right neighbour, and
+ * the leftmost one starts at zero, as the kernel builds them.
+ */
+static void tunefs_fill_interior(struct ocfs2_extent_list *el,
+				 struct tunefs_tree_node *nodes,
+				 uint32_t start, uint32_t count,
+				 uint32_t total)
+{
+	struct ocfs2_extent_rec *rec;
+	uint32_t i, end;
+
+	for (i = 0; i < count; i++) {
+		rec = &el->l_recs[i];
+		if (i + start + 1 < total)
+			end = nodes[i + start + 1].tn_cpos;
+		else
+			end = nodes[i + start].tn_end;
+		rec->e_cpos = nodes[i + start].tn_cpos;
+		rec->e_int_clusters = end - rec->e_cpos;
+		rec->e_blkno = nodes[i + start].tn_blkno;
+	}
+	el->l_next_free_rec = count;
+}
+
+static errcode_t tunefs_write_tree_eb(ocfs2_filesys *fs, char *buf,
+				      uint64_t blkno, uint16_t tree_depth,
+				      uint64_t next_leaf,
+				      struct ocfs2_extent_rec *recs,
+				      struct tunefs_tree_node *nodes,
+				      uint32_t start, uint32_t count,
+				      uint32_t total)
+{
+	errcode_t ret;
+	struct ocfs2_extent_block *eb;
+	struct ocfs2_extent_list *el;
+
+	/* Keep the suballocator fields set at allocation */
+	ret = ocfs2_read_extent_block(fs, blkno, buf);
+	if (ret)
+		return ret;
+
+	eb = (struct ocfs2_extent_block *)buf;
+	el = &eb->h_list;
+	memset(el->l_recs, 0, el->l_count * sizeof(struct ocfs2_extent_rec));
+	el->l_tree_depth = tree_depth;
+	eb->h_next_leaf_blk = next_leaf;
+
+	if (recs) {
+		memcpy(el->l_recs, recs + start,
+		       count * sizeof(struct ocfs2_extent_rec));
+		el->l_next_free_rec = count;
+	} else
+		tunefs_fill_interior(el, nodes, start, count, total);
+
+	return ocfs2_write_extent_block(fs, blkno, buf);
+}
+
+/*
+ * Builds the tree bottom-up in the blocks at blknos, then points the
+ * inode at it.  nodes ends up holding the level that fits in the
+ * inode.
+ */
+static errcode_t tunefs_build_tree(ocfs2_filesys *fs,
+				   struct ocfs2_dinode *di,
+				   struct ocfs2_extent_rec *recs,
+				   uint32_t num_recs, uint16_t depth,
+				   uint64_t *blknos,
+				   struct tunefs_tree_node *nodes)
+{
+	errcode_t ret;
+	struct ocfs2_extent_list *root = &di->id2.i_list;
+	struct ocfs2_extent_rec *rec;
+	uint16_t eb_count = ocfs2_extent_recs_per_eb(fs->fs_blocksize);
+	uint16_t level;
+	uint32_t count = num_recs, blocks, i, start, n;
+	uint64_t next_leaf, last_leaf = 0;
+	char *buf = NULL;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		return ret;
+
+	for (level = 0; level < depth; level++) {
+		blocks = tunefs_blocks_needed(count, eb_count);
+		for (i = 0; i < blocks; i++) {
+			start = i * eb_count;
+			n = ocfs2_min(count - start, (uint32_t)eb_count);
+			next_leaf = (!level && (i + 1 < blocks)) ?
+				blknos[i + 1] : 0;
+
+			if (!level) {
+				rec = &recs[start + n - 1];
+				ret = tunefs_write_tree_eb(fs, buf, blknos[i],
+							   0, next_leaf, recs,
+							   NULL, start, n,
+							   count);
+				nodes[i].tn_cpos = i ? recs[start].e_cpos : 0;
+				nodes[i].tn_end =
+					rec->e_cpos + rec->e_leaf_clusters;
+			} else {
+				ret = tunefs_write_tree_eb(fs, buf, blknos[i],
+							   level, 0, NULL,
+							   nodes, start, n,
+							   count);
+				/* Parents reuse the node slots in order */
+				nodes[i].tn_cpos = nodes[start].tn_cpos;
+				nodes[i].tn_end = nodes[start + n - 1].tn_end;
+			}
+			if (ret)
+				goto out;
+			nodes[i].tn_blkno = blknos[i];
+			if (!level)
+				last_leaf = blknos[i];
+		}
+		blknos += blocks;
+		count = blocks;
+	}
+
+	memset(root->l_recs, 0,
+	       root->l_count * sizeof(struct ocfs2_extent_rec));
+	root->l_tree_depth = depth;
+	if (depth)
+		tunefs_fill_interior(root, nodes, 0, count, count);
+	else {
+		memcpy(root->l_recs, recs,
+		       count * sizeof(struct ocfs2_extent_rec));
+		root->l_next_free_rec = count;
+	}
+	di->i_last_eb_blk = last_leaf;
+
+	ret = ocfs2_write_inode(fs, di->i_blkno, (char *)di);
+
+out:
+	ocfs2_free(&buf);
+	return ret;
+}
+
+errcode_t tunefs_rebuild_extent_tree(ocfs2_filesys *fs,
+				     struct ocfs2_dinode *di,
+				     struct ocfs2_extent_rec *recs,
+				     uint32_t num_recs)
+{
+	errcode_t ret = 0;
+	uint16_t depth;
+	uint32_t blocks, i, allocated = 0;
+	uint64_t *blknos = NULL;
+	struct tunefs_tree_node *nodes = NULL;
+	int slot;
+
+	blocks = tunefs_extent_tree_layout(fs, di, num_recs, &depth);
+	if (blocks) {
+		ret = ocfs2_malloc0(blocks * sizeof(uint64_t), &blknos);
+		if (ret)
+			goto out;
+		/* Leaves need the most nodes; each parent overwrites a child */
+		ret = ocfs2_malloc0(num_recs * sizeof(struct tunefs_tree_node),
+				    &nodes);
+		if (ret)
+			goto out;
+	}
+
+	/* The new blocks stay with the inode's slot and near the inode */
+	slot = di->i_suballoc_slot;
+	if (slot >= OCFS2_RAW_SB(fs->fs_super)->s_max_slots)
+		slot = 0;
+
+	for (allocated = 0; allocated < blocks; allocated++) {
+		ret = ocfs2_new_extent_block_in_slot(fs, blknos + allocated,
+						     slot, di->i_blkno);
+		if (ret)
+			break;
+	}
+	if (!ret)
+		ret = tunefs_build_tree(fs, di, recs, num_recs, depth,
+					blknos, nodes);
+	if (ret) {
+		/* The inode still points at the old tree */
+		for (i = 0; i < allocated; i++)
+			ocfs2_delete_extent_block(fs, blknos[i]);
+	}
+
+out:
+	if (blknos)
+		ocfs2_free(&blknos);
+	if (nodes)
+		ocfs2_free(&nodes);
+
+	return ret;
+}
+
+static errcode_t tunefs_validate_inode(ocfs2_filesys *fs,
+				       struct ocfs2_dinode *di)
+{
+	if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
+		    strlen(OCFS2_INODE_SIGNATURE)))
+		return OCFS2_ET_BAD_INODE_MAGIC;
+
+	ocfs2_swap_inode_to_cpu(fs, di);
+
+	if (di->i_fs_generation != fs->fs_super->i_fs_generation)
+		return OCFS2_ET_INODE_NOT_VALID;
+
+	if (!(di->i_flags & OCFS2_VALID_FL))
+		return OCFS2_ET_INODE_NOT_VALID;
+
+	return 0;
+}
+
+errcode_t tunefs_foreach_inode(ocfs2_filesys *fs,
+			       errcode_t (*func)(ocfs2_filesys *fs,
+						 struct ocfs2_dinode *di,
+						 void *user_data),
+			       void *user_data)
+{
+	errcode_t ret;
+	uint64_t blkno;
+	char *buf;
+	struct ocfs2_dinode *di;
+	ocfs2_inode_scan *scan;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret) {
+		verbosef(VL_LIB,
+			 "%s while allocating a buffer for inode scanning\n",
+			 error_message(ret));
+		goto out;
+	}
+
+	di = (struct ocfs2_dinode *)buf;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (ret) {
+		verbosef(VL_LIB,
+			 "%s while opening inode scan\n",
+			 error_message(ret));
+		goto out_free;
+	}
+
+	for(;;) {
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret) {
+			verbosef(VL_LIB, "%s while getting next inode\n",
+				 error_message(ret));
+			break;
+		}
+		if (blkno == 0)
+			break;
+
+		ret = tunefs_validate_inode(fs, di);
+		if (ret)
+			continue;
+
+		if (func) {
+			ret = func(fs, di, user_data);
+			if (ret)
+				break;
+		}
+	}
+
+	ocfs2_close_inode_scan(scan);
+out_free:
+	ocfs2_free(&buf);
+
+out:
+	return ret;
+}
+
+/*
+ * Shared inode passes.  While a batch is open, features with
+ * TUNEFS_FLAG_INODE_PASS run against pb_fs and their passes wait on
+ * pb_passes.
+ */
+struct tunefs_pass_batch {
+	int			pb_active;
+	ocfs2_filesys		*pb_fs;
+	int			pb_open_flags;	/* tf_open_flags for pb_fs */
+	int			pb_flags;	/* Flags passed to features */
+	struct list_head	pb_passes;
+};
+
+static struct tunefs_pass_batch pass_batch;
+
+/* Seconds of scanning between saves of the inode pass cursor */
+#define TUNEFS_CURSOR_INTERVAL	60
+
+static uint32_t tunefs_pass_crc(const char *name)
+{
+	return crc32_le(~0, (unsigned char const *)name, strlen(name));
+}
+
+/*
+ * Fills crcs with the pass names.  Returns zero if the passes can't
+ * share a cursor.
+ */
+static int tunefs_cursor_passes(struct list_head *passes, uint32_t *crcs)
+{
+	int i = 0;
+	struct list_head *p;
+	struct tunefs_inode_pass *pass;
+
+	memset(crcs, 0, sizeof(uint32_t) * OCFS2_TUNEFS_CURSOR_MAX_PASSES);
+	list_for_each(p, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		if (!(pass->ip_flags & TUNEFS_PASS_RESUMABLE) ||
+		    (i == OCFS2_TUNEFS_CURSOR_MAX_PASSES))
+			return 0;
+		crcs[i++] = tunefs_pass_crc(pass->ip_name);
+	}
+
+	return i;
+}
+
+int tunefs_inode_pass_interrupted(ocfs2_filesys *fs, const char *name)
+{
+	int i;
+	uint32_t crc = tunefs_pass_crc(name);
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+
+	if (!(super->s_tunefs_flag & OCFS2_TUNEFS_INPROG_INODE_PASS))
+		return 0;
+
+	for (i = 0; i < OCFS2_TUNEFS_CURSOR_MAX_PASSES; i++) {
+		if (super->s_tunefs_cursor_passes[i] == crc)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * The saved cursor is only good for the same passes over the same
+ * inode allocators.  Anything else starts from the first inode.
+ */
+static uint64_t tunefs_get_cursor(ocfs2_filesys *fs, uint32_t *crcs,
+				  uint32_t inodes)
+{
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+
+	if (!(super->s_tunefs_flag & OCFS2_TUNEFS_INPROG_INODE_PASS) ||
+	    !super->s_tunefs_cursor)
+		return 0;
+
+	if (memcmp(super->s_tunefs_cursor_passes, crcs,
+		   sizeof(super->s_tunefs_cursor_passes)) ||
+	    (super->s_tunefs_cursor_inodes != inodes)) {
+		verbosef(VL_APP,
+			 "Ignoring the inode scan cursor left by a different "
+			 "operation\n");
+		return 0;
+	}
+
+	return super->s_tunefs_cursor;
+}
+
+static errcode_t tunefs_save_cursor(ocfs2_filesys *fs, uint64_t group,
+				    uint32_t *crcs, uint32_t inodes)
+{
+	errcode_t ret;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+
+	verbosef(VL_DEBUG, "Saving inode scan cursor at group %"PRIu64"\n",
+		 group);
+
+	super->s_tunefs_cursor = group;
+	super->s_tunefs_cursor_inodes = inodes;
+	memcpy(super->s_tunefs_cursor_passes, crcs,
+	       sizeof(super->s_tunefs_cursor_passes));
+
+	tunefs_block_signals();
+	ret = tunefs_set_in_progress(fs, OCFS2_TUNEFS_INPROG_INODE_PASS);
+	tunefs_unblock_signals();
+
+	return ret;
+}
+
+static errcode_t tunefs_clear_cursor(ocfs2_filesys *fs)
+{
+	errcode_t ret;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+
+	if (!(super->s_tunefs_flag & OCFS2_TUNEFS_INPROG_INODE_PASS))
+		return 0;
+
+	super->s_tunefs_cursor = 0;
+	super->s_tunefs_cursor_inodes = 0;
+	memset(super->s_tunefs_cursor_passes, 0,
+	       sizeof(super->s_tunefs_cursor_passes));
+
+	tunefs_block_signals();
+	ret = tunefs_clear_in_progress(fs, OCFS2_TUNEFS_INPROG_INODE_PASS);
+	tunefs_unblock_signals();
+
+	return ret;
+}
+
+/* Non-zero if every pass has finished the inodes it has seen */
+static int tunefs_checkpoint_inode_passes(ocfs2_filesys *fs,
+					  struct list_head *passes)
+{
+	int done = 1;
+	struct list_head *p;
+	struct tunefs_inode_pass *pass;
+
+	list_for_each(p, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		if (!pass->ip_err && pass->ip_checkpoint)
+			pass->ip_err = pass->ip_checkpoint(fs,
+							   pass->ip_data);
+		if (pass->ip_err)
+			done = 0;
+	}
+
+	return done;
+}
+
+/*
+ * Checkpoints spend space before the scan has seen every inode, so the
+ * passes that need space count all of it first.  The count starts where
+ * the scan will, as everything before the cursor is done.  A shortfall
+ * fails the counting passes before anything is written.
+ */
+static errcode_t tunefs_count_inode_passes(ocfs2_filesys *fs,
+					   struct list_head *passes,
+					   uint64_t group)
+{
+	errcode_t ret;
+	uint64_t blkno, need = 0;
+	uint32_t free_clusters;
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+	ocfs2_inode_scan *scan = NULL;
+	struct list_head *p;
+	struct tunefs_inode_pass *pass;
+	int counting = 0;
+
+	list_for_each(p, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		if (pass->ip_count)
+			counting = 1;
+	}
+	if (!counting)
+		return 0;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto out;
+	di = (struct ocfs2_dinode *)buf;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (!ret && group)
+		ret = ocfs2_inode_scan_seek_group(scan, group);
+	if (ret)
+		goto out;
+
+	verbosef(VL_APP, "Counting the space the inode passes need\n");
+	for (;;) {
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret || !blkno)
+			break;
+
+		if (tunefs_validate_inode(fs, di))
+			continue;
+
+		list_for_each(p, passes) {
+			pass = list_entry(p, struct tunefs_inode_pass,
+					  ip_list);
+			if (!pass->ip_count)
+				continue;
+			ret = pass->ip_count(fs, di, &need, pass->ip_data);
+			if (ret)
+				goto out;
+		}
+	}
+	if (ret)
+		goto out;
+
+	ret = tunefs_get_free_clusters(fs, &free_clusters);
+	if (ret)
+		goto out;
+
+	verbosef(VL_APP,
+		 "We have %u clusters free, and need %"PRIu64" clusters "
+		 "for every inode pass\n",
+		 free_clusters, need);
+
+	if (need > free_clusters) {
+		list_for_each(p, passes) {
+			pass = list_entry(p, struct tunefs_inode_pass,
+					  ip_list);
+			if (pass->ip_count)
+				pass->ip_err = OCFS2_ET_NO_SPACE;
+		}
+	}
+
+out:
+	if (scan)
+		ocfs2_close_inode_scan(scan);
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+static errcode_t tunefs_scan_inode_passes(ocfs2_filesys *fs,
+					  struct list_head *passes)
+{
+	errcode_t ret;
+	uint64_t blkno, group;
+	char *buf = NULL, *copy = NULL;
+	struct ocfs2_dinode *di;
+	ocfs2_inode_scan *scan;
+	struct list_head *p;
+	struct tunefs_inode_pass *pass;
+	int stale, resumable, saving;
+	uint32_t crcs[OCFS2_TUNEFS_CURSOR_MAX_PASSES], inodes = 0;
+	time_t saved = 0;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &copy);
+	if (ret) {
+		verbosef(VL_LIB,
+			 "%s while allocating buffers for inode scanning\n",
+			 error_message(ret));
+		goto out_free;
+	}
+
+	di = (struct ocfs2_dinode *)buf;
+
+	ret = ocfs2_open_inode_scan(fs, &scan);
+	if (ret) {
+		verbosef(VL_LIB,
+			 "%s while opening inode scan\n",
+			 error_message(ret));
+		goto out_free;
+	}
+
+	/* Estimates leave the superblock alone */
+	resumable = saving = !estimate_state.es_active &&
+		tunefs_cursor_passes(passes, crcs);
+	if (resumable) {
+		inodes = ocfs2_get_max_inode_count(scan);
+		group = tunefs_get_cursor(fs, crcs, inodes);
+		if (group)
+			ret = ocfs2_inode_scan_seek_group(scan, group);
+		if (group && !ret)
+			verbosef(VL_APP,
+				 "Resuming the inode scan after group "
+				 "%"PRIu64"\n", group);
+		else if (group) {
+			verbosef(VL_APP,
+				 "%s while looking for inode group "
+				 "%"PRIu64"; scanning every inode\n",
+				 error_message(ret), group);
+			group = 0;
+			ocfs2_close_inode_scan(scan);
+			ret = ocfs2_open_inode_scan(fs, &scan);
+			if (ret) {
+				verbosef(VL_LIB,
+					 "%s while opening inode scan\n",
+					 error_message(ret));
+				goto out_free;
+			}
+		}
+
+		ret = tunefs_count_inode_passes(fs, passes, group);
+		if (ret) {
+			verbosef(VL_LIB,
+				 "%s while counting the space the inode "
+				 "passes need\n",
+				 error_message(ret));
+			goto out_close;
+		}
+		saved = time(NULL);
+	}
+
+	for (;;) {
+		if (saving && ocfs2_inode_scan_group_done(scan, &group) &&
+		    (time(NULL) - saved >= TUNEFS_CURSOR_INTERVAL)) {
+			saving = tunefs_checkpoint_inode_passes(fs, passes);
+			if (saving) {
+				ret = tunefs_save_cursor(fs, group, crcs,
+							 inodes);
+				if (ret) {
+					verbosef(VL_LIB,
+						 "%s while saving the inode "
+						 "scan cursor\n",
+						 error_message(ret));
+					break;
+				}
+			}
+			saved = time(NULL);
+		}
+
+		ret = ocfs2_get_next_inode(scan, &blkno, buf);
+		if (ret) {
+			verbosef(VL_LIB, "%s while getting next inode\n",
+				 error_message(ret));
+			break;
+		}
+		if (blkno == 0)
+			break;
+
+		if (tunefs_validate_inode(fs, di))
+			continue;
+
+		stale = 0;
+		list_for_each(p, passes) {
+			pass = list_entry(p, struct tunefs_inode_pass,
+					  ip_list);
+			if (pass->ip_err)
+				continue;
+
+			/* An earlier visitor changed the inode */
+			if (stale) {
+				ret = ocfs2_read_inode(fs, blkno, buf);
+				if (ret) {
+					verbosef(VL_LIB,
+						 "%s while rereading inode "
+						 "%"PRIu64"\n",
+						 error_message(ret), blkno);
+					goto out_close;
+				}
+				stale = 0;
+				if (!(di->i_flags & OCFS2_VALID_FL))
+					break;
+			}
+
+			memcpy(copy, buf, fs->fs_blocksize);
+			pass->ip_err = pass->ip_visit(fs,
+						(struct ocfs2_dinode *)copy,
+						pass->ip_data);
+			if (pass->ip_flags & TUNEFS_PASS_WRITES_INODES)
+				stale = 1;
+		}
+	}
+
+	/*
+	 * Finish the stragglers while the cursor still covers them.  If
+	 * a pass could not, the last saved cursor is where a rerun must
+	 * pick up, so it stays.
+	 */
+	if (!ret && resumable && tunefs_checkpoint_inode_passes(fs, passes)) {
+		ret = tunefs_clear_cursor(fs);
+		if (ret)
+			verbosef(VL_LIB,
+				 "%s while clearing the inode scan cursor\n",
+				 error_message(ret));
+	}
+
+out_close:
+	ocfs2_close_inode_scan(scan);
+out_free:
+	if (copy)
+		ocfs2_free(&copy);
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+static int tunefs_run_inode_passes(ocfs2_filesys *fs,
+				   struct list_head *passes)
 {
+	int rc = 0;
 	errcode_t ret;
-	char *buf = NULL;
-	uint64_t bpc = ocfs2_clusters_to_blocks(fs, 1);
-	uint64_t total_blocks = ocfs2_clusters_to_blocks(fs, num_clusters);
-	uint64_t io_blocks = total_blocks;
+	struct list_head *p, *n;
+	struct tunefs_inode_pass *pass;
 
-	ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
-	if (ret == OCFS2_ET_NO_MEMORY) {
-		io_blocks = bpc;
-		ret = ocfs2_malloc_blocks(fs->fs_io, io_blocks, &buf);
+	if (list_empty(passes))
+		return 0;
+
+	list_for_each(p, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		verbosef(VL_DEBUG, "Scanning inodes for \"%s\"\n",
+			 pass->ip_name);
 	}
-	if (ret)
-		goto bail;
 
-	memset(buf, 0, io_blocks * fs->fs_blocksize);
+	/* A scan failure fails every pass that was still going */
+	ret = tunefs_scan_inode_passes(fs, passes);
+	list_for_each(p, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		if (!pass->ip_err)
+			pass->ip_err = ret;
+	}
 
-	while (total_blocks) {
-		ret = io_write_block_nocache(fs->fs_io, start_blk,
-					     io_blocks, buf);
-		if (ret)
-			goto bail;
+	list_for_each_safe(p, n, passes) {
+		pass = list_entry(p, struct tunefs_inode_pass, ip_list);
+		list_del(&pass->ip_list);
+		if (rc)
+			pass->ip_err = TUNEFS_ET_OPERATION_FAILED;
+		if (pass->ip_finish(fs, pass->ip_err, pass->ip_data))
+			rc = 1;
+	}
 
-		total_blocks -= io_blocks;
-		start_blk += io_blocks;
+	return rc;
+}
+
+int tunefs_queue_inode_pass(ocfs2_filesys *fs,
+			    struct tunefs_inode_pass *pass)
+{
+	struct list_head passes;
+
+	pass->ip_err = 0;
+	if (pass_batch.pb_active && (fs == pass_batch.pb_fs)) {
+		verbosef(VL_DEBUG, "Queueing inode pass \"%s\"\n",
+			 pass->ip_name);
+		list_add_tail(&pass->ip_list, &pass_batch.pb_passes);
+		return 0;
 	}
 
-bail:
-	if (buf)
-		ocfs2_free(&buf);
+	INIT_LIST_HEAD(&passes);
+	list_add_tail(&pass->ip_list, &passes);
+	return tunefs_run_inode_passes(fs, &passes);
+}
 
-	return ret;
+int tunefs_flush_inode_passes(ocfs2_filesys *fs)
+{
+	if (!pass_batch.pb_active || (fs != pass_batch.pb_fs))
+		return 0;
+
+	return tunefs_run_inode_passes(fs, &pass_batch.pb_passes);
 }
 
-errcode_t tunefs_get_free_clusters(ocfs2_filesys *fs, uint32_t *clusters)
+int tunefs_inode_pass_batch_flush(void)
 {
-	errcode_t ret;
-	uint64_t blkno;
-	char *buf = NULL;
-	struct ocfs2_dinode *di = NULL;
+	if (!pass_batch.pb_active || !pass_batch.pb_fs)
+		return 0;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
-	if (ret)
-		goto bail;
+	return tunefs_run_inode_passes(pass_batch.pb_fs,
+				       &pass_batch.pb_passes);
+}
 
-	ret = ocfs2_lookup_system_inode(fs, GLOBAL_BITMAP_SYSTEM_INODE,
-					0, &blkno);
-	if (ret)
-		goto bail;
+/* Flushes the batch and closes its filesystem */
+static errcode_t tunefs_pass_batch_close(void)
+{
+	int rc;
+	errcode_t err;
 
-	ret = ocfs2_read_inode(fs, blkno, buf);
-	if (ret)
-		goto bail;
+	if (!pass_batch.pb_fs)
+		return 0;
 
-	di = (struct ocfs2_dinode *)buf;
-	if (clusters)
-		*clusters = di->id1.bitmap1.i_total - di->id1.bitmap1.i_used;
-bail:
-	if (buf)
-		ocfs2_free(&buf);
-	return ret;
+	rc = tunefs_run_inode_passes(pass_batch.pb_fs,
+				     &pass_batch.pb_passes);
+	err = tunefs_close(pass_batch.pb_fs);
+	pass_batch.pb_fs = NULL;
+	if (rc)
+		err = TUNEFS_ET_OPERATION_FAILED;
+
+	return err;
 }
 
-static errcode_t tunefs_validate_inode(ocfs2_filesys *fs,
-				       struct ocfs2_dinode *di)
+void tunefs_inode_pass_batch_begin(void)
 {
-	if (memcmp(di->i_signature, OCFS2_INODE_SIGNATURE,
-		    strlen(OCFS2_INODE_SIGNATURE)))
-		return OCFS2_ET_BAD_INODE_MAGIC;
+	pass_batch.pb_active = 1;
+	pass_batch.pb_fs = NULL;
+	INIT_LIST_HEAD(&pass_batch.pb_passes);
+}
 
-	ocfs2_swap_inode_to_cpu(fs, di);
+errcode_t tunefs_inode_pass_batch_end(void)
+{
+	errcode_t err;
 
-	if (di->i_fs_generation != fs->fs_super->i_fs_generation)
-		return OCFS2_ET_INODE_NOT_VALID;
+	if (!pass_batch.pb_active)
+		return 0;
 
-	if (!(di->i_flags & OCFS2_VALID_FL))
-		return OCFS2_ET_INODE_NOT_VALID;
+	err = tunefs_pass_batch_close();
+	pass_batch.pb_active = 0;
 
-	return 0;
+	return err;
 }
 
-errcode_t tunefs_foreach_inode(ocfs2_filesys *fs,
-			       errcode_t (*func)(ocfs2_filesys *fs,
-						 struct ocfs2_dinode *di,
-						 void *user_data),
-			       void *user_data)
+/*
+ * Estimates.  The costs operations report are totalled with the
+ * blocks our scans read, and tunefs_estimate_end() turns them into a
+ * runtime with a quick probe of the device.
+ */
+
+/* Random single-block reads for the latency probe */
+#define TUNEFS_PROBE_BLOCKS	256
+/* Sequential reads for the bandwidth probe */
+#define TUNEFS_PROBE_CHUNK	(1024 * 1024)
+#define TUNEFS_PROBE_CHUNKS	64
+
+void tunefs_estimate_begin(void)
+{
+	estimate_state.es_active = 1;
+	gettimeofday(&estimate_state.es_start, NULL);
+}
+
+/* The flags an operation is run with, given the flags it opened with */
+static int tunefs_run_flags(int open_flags)
+{
+	int flags = open_flags & ~(TUNEFS_FLAG_ONLINE |
+				   TUNEFS_FLAG_NOCLUSTER |
+				   TUNEFS_FLAG_ESTIMATE);
+
+	if (estimate_state.es_active)
+		flags = (flags & ~(TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION)) |
+			TUNEFS_FLAG_ESTIMATE;
+
+	return flags;
+}
+
+static void tunefs_estimate_reads(ocfs2_filesys *fs)
+{
+	struct ocfs2_io_stats stats;
+
+	io_get_stats(fs->fs_io, &stats);
+	estimate_state.es_scan_blocks +=
+		stats.is_bytes_read / fs->fs_blocksize;
+}
+
+static char *tunefs_estimate_bytes(uint64_t bytes, char *buf, size_t len)
+{
+	int i = 0;
+	double val = bytes;
+	const char *units = "BKMGTP";
+
+	while ((val >= 1024) && units[i + 1]) {
+		val /= 1024;
+		i++;
+	}
+
+	if (i)
+		snprintf(buf, len, "%.1f%c", val, units[i]);
+	else
+		snprintf(buf, len, "%"PRIu64"B", bytes);
+
+	return buf;
+}
+
+void tunefs_estimate_report(const char *name, struct tunefs_estimate *est)
+{
+	char zero[16], copy[16];
+	struct tunefs_estimate *total = &estimate_state.es_total;
+
+	printf("%s: %"PRIu64" blocks to write, %"PRIu64" clusters to "
+	       "allocate, %s to zero, %s to copy\n",
+	       name, est->te_write_blocks, est->te_alloc_clusters,
+	       tunefs_estimate_bytes(est->te_zero_bytes, zero, sizeof(zero)),
+	       tunefs_estimate_bytes(est->te_copy_bytes, copy, sizeof(copy)));
+
+	total->te_write_blocks += est->te_write_blocks;
+	total->te_alloc_clusters += est->te_alloc_clusters;
+	total->te_zero_bytes += est->te_zero_bytes;
+	total->te_copy_bytes += est->te_copy_bytes;
+}
+
+int tunefs_super_blocks(ocfs2_filesys *fs)
+{
+	uint64_t blocks[OCFS2_MAX_BACKUP_SUPERBLOCKS];
+
+	if (!OCFS2_HAS_COMPAT_FEATURE(OCFS2_RAW_SB(fs->fs_super),
+				      OCFS2_FEATURE_COMPAT_BACKUP_SB))
+		return 1;
+
+	return 1 + ocfs2_get_backup_super_offsets(fs, blocks,
+						  ARRAY_SIZE(blocks));
+}
+
+void tunefs_estimate_super(ocfs2_filesys *fs, const char *name)
+{
+	struct tunefs_estimate est = {
+		.te_write_blocks = tunefs_super_blocks(fs),
+	};
+
+	tunefs_estimate_report(name, &est);
+}
+
+static double tunefs_elapsed(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_usec - start->tv_usec) / 1000000.0;
+}
+
+/*
+ * Times random single-block reads, then sequential reads from the
+ * middle of the device.
+ */
+static errcode_t tunefs_probe_device(const char *device, int blocksize,
+				     double *block_secs, double *seq_rate)
 {
 	errcode_t ret;
-	uint64_t blkno;
-	char *buf;
-	struct ocfs2_dinode *di;
-	ocfs2_inode_scan *scan;
+	int i, chunks;
+	int chunk = TUNEFS_PROBE_CHUNK / blocksize;
+	uint64_t dev_blocks, blkno;
+	io_channel *channel = NULL;
+	char *buf = NULL;
+	struct timeval start;
+	double secs;
 
-	ret = ocfs2_malloc_block(fs->fs_io, &buf);
-	if (ret) {
-		verbosef(VL_LIB,
-			 "%s while allocating a buffer for inode scanning\n",
-			 error_message(ret));
+	ret = ocfs2_get_device_size(device, blocksize, &dev_blocks);
+	if (ret)
+		goto out;
+
+	chunks = ocfs2_min((uint64_t)TUNEFS_PROBE_CHUNKS, dev_blocks / chunk);
+	if (!chunks) {
+		ret = OCFS2_ET_SHORT_READ;
 		goto out;
 	}
 
-	di = (struct ocfs2_dinode *)buf;
+	ret = io_open(device, OCFS2_FLAG_RO, &channel);
+	if (ret)
+		goto out;
 
-	ret = ocfs2_open_inode_scan(fs, &scan);
-	if (ret) {
-		verbosef(VL_LIB,
-			 "%s while opening inode scan\n",
-			 error_message(ret));
-		goto out_free;
-	}
+	ret = io_set_blksize(channel, blocksize);
+	if (ret)
+		goto out;
 
-	for(;;) {
-		ret = ocfs2_get_next_inode(scan, &blkno, buf);
-		if (ret) {
-			verbosef(VL_LIB, "%s while getting next inode\n",
-				 error_message(ret));
-			break;
-		}
-		if (blkno == 0)
-			break;
+	ret = ocfs2_malloc_blocks(channel, chunk, &buf);
+	if (ret)
+		goto out;
 
-		ret = tunefs_validate_inode(fs, di);
+	srandom(time(NULL));
+	gettimeofday(&start, NULL);
+	for (i = 0; i < TUNEFS_PROBE_BLOCKS; i++) {
+		blkno = (((uint64_t)random() << 31) | random()) % dev_blocks;
+		ret = io_read_block_nocache(channel, blkno, 1, buf);
 		if (ret)
-			continue;
-
-		if (func) {
-			ret = func(fs, di, user_data);
-			if (ret)
-				break;
-		}
+			goto out;
 	}
+	*block_secs = tunefs_elapsed(&start) / TUNEFS_PROBE_BLOCKS;
 
-	ocfs2_close_inode_scan(scan);
-out_free:
-	ocfs2_free(&buf);
+	blkno = (dev_blocks - (uint64_t)chunks * chunk) / 2;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < chunks; i++) {
+		ret = io_read_block_nocache(channel, blkno, chunk, buf);
+		if (ret)
+			goto out;
+		blkno += chunk;
+	}
+	secs = tunefs_elapsed(&start);
+	if (secs <= 0)
+		secs = 0.000001;
+	*seq_rate = (double)chunks * TUNEFS_PROBE_CHUNK / secs;
 
 out:
+	if (buf)
+		ocfs2_free(&buf);
+	if (channel)
+		io_close(channel);
+
 	return ret;
 }
 
+/*
+ * The scan we just did stands in for the one the real run will do.
+ * Scattered metadata writes cost what a random block read costs, and
+ * zeroing or copying data runs at the sequential read rate.  Writes
+ * may well be slower, so this is a lower bound.
+ */
+errcode_t tunefs_estimate_end(const char *device)
+{
+	errcode_t ret;
+	uint64_t secs;
+	double scan_secs, block_secs = 0, seq_rate = 0;
+	char zero[16], copy[16], rate[16];
+	struct tunefs_estimate *total = &estimate_state.es_total;
+
+	if (!estimate_state.es_active || !estimate_state.es_blocksize)
+		return 0;
+
+	scan_secs = tunefs_elapsed(&estimate_state.es_start);
+
+	ret = tunefs_probe_device(device, estimate_state.es_blocksize,
+				  &block_secs, &seq_rate);
+	if (ret) {
+		tcom_err(ret, "while probing the speed of device \"%s\"",
+			 device);
+		return ret;
+	}
+
+	secs = scan_secs +
+		total->te_write_blocks * block_secs +
+		(total->te_zero_bytes + 2 * total->te_copy_bytes) / seq_rate;
+
+	printf("Estimate for device \"%s\":\n", device);
+	printf("\t%"PRIu64" blocks to read (read in %.1f seconds while "
+	       "estimating)\n",
+	       estimate_state.es_scan_blocks, scan_secs);
+	printf("\t%"PRIu64" blocks to write\n", total->te_write_blocks);
+	printf("\t%"PRIu64" clusters to allocate\n",
+	       total->te_alloc_clusters);
+	printf("\t%s to zero, %s to copy\n",
+	       tunefs_estimate_bytes(total->te_zero_bytes, zero,
+				     sizeof(zero)),
+	       tunefs_estimate_bytes(total->te_copy_bytes, copy,
+				     sizeof(copy)));
+	printf("Device speed: %.3f ms per random block, %s/s sequential\n",
+	       block_secs * 1000,
+	       tunefs_estimate_bytes((uint64_t)seq_rate, rate, sizeof(rate)));
+	printf("Projected runtime: at least %"PRIu64":%02"PRIu64":%02"PRIu64
+	       "\n", secs / 3600, (secs / 60) % 60, secs % 60);
+
+	return 0;
+}
+
 /* A dirblock we have to add a trailer to */
 struct tunefs_trailer_dirblock {
 	struct list_head db_list;
@@ -1666,6 +2799,11 @@ static errcode_t tunefs_open_bitmap_check(ocfs2_filesys *fs)
 	if (!(tp->tp_open_flags & TUNEFS_FLAG_ALLOCATION))
 		return 0;
 
+	/* The bitmap of an interrupted cluster size change is half done */
+	if (OCFS2_RAW_SB(fs->fs_super)->s_tunefs_flag &
+	    OCFS2_TUNEFS_INPROG_CLUSTER_SIZE)
+		return 0;
+
 	state->ts_allocation = 1;
 	return tunefs_global_bitmap_check(fs);
 }
@@ -1685,13 +2823,23 @@ void tunefs_update_fs_clusters(ocfs2_filesys *fs)
 	state->ts_fs_clusters = fs->fs_clusters;
 }
 
+errcode_t tunefs_update_fs_geometry(ocfs2_filesys *fs)
+{
+	struct tunefs_filesystem_state *state = tunefs_get_state(fs);
+
+	tunefs_update_fs_clusters(fs);
+	state->ts_geometry_changed = 1;
+
+	return tunefs_global_bitmap_check(fs);
+}
+
 static errcode_t tunefs_close_bitmap_check(ocfs2_filesys *fs)
 {
 	errcode_t ret;
 	uint32_t old_clusters;
 	struct tunefs_filesystem_state *state = tunefs_get_state(fs);
 
-	if (!state->ts_allocation)
+	if (!state->ts_allocation || state->ts_geometry_changed)
 		return 0;
 
 	if (state->ts_master != fs)
@@ -2009,13 +3157,18 @@ static int tunefs_special_errorp(errcode_t err)
 errcode_t tunefs_open(const char *device, int flags,
 		      ocfs2_filesys **ret_fs)
 {
-	int rw = flags & TUNEFS_FLAG_RW;
+	int rw;
 	errcode_t err, tmp;
 	int open_flags;
 	ocfs2_filesys *fs = NULL;
 
 	verbosef(VL_LIB, "Opening device \"%s\"\n", device);
 
+	if (estimate_state.es_active)
+		flags &= ~(TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
+			   TUNEFS_FLAG_ONLINE);
+	rw = flags & TUNEFS_FLAG_RW;
+
 	open_flags = OCFS2_FLAG_HEARTBEAT_DEV_OK;
 	if (rw)
 		open_flags |= OCFS2_FLAG_RW | OCFS2_FLAG_STRICT_COMPAT_CHECK;
@@ -2030,6 +3183,16 @@ errcode_t tunefs_open(const char *device, int flags,
 	if (err)
 		goto out;
 
+	/*
+	 * An estimate should read what the real run would, so it gets
+	 * the same cache.  Nothing is locked, but nothing is written
+	 * either.
+	 */
+	if (estimate_state.es_active) {
+		estimate_state.es_blocksize = fs->fs_blocksize;
+		tunefs_init_cache(fs);
+	}
+
 	if (!rw)
 		goto out;
 
@@ -2045,10 +3208,22 @@ errcode_t tunefs_open(const char *device, int flags,
 		goto out;
 	}
 
-	if (OCFS2_RAW_SB(fs->fs_super)->s_feature_incompat &
-	    OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG) {
-		err = TUNEFS_ET_TUNEFS_IN_PROGRESS;
-		goto out;
+	/*
+	 * An interrupted inode pass leaves every inode consistent, and
+	 * running it again resumes it.  An interrupted cluster size
+	 * change can only be finished by the operation that started it.
+	 */
+	if ((OCFS2_RAW_SB(fs->fs_super)->s_feature_incompat &
+	     OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG) &&
+	    (OCFS2_RAW_SB(fs->fs_super)->s_tunefs_flag !=
+	     OCFS2_TUNEFS_INPROG_INODE_PASS)) {
+		if (OCFS2_RAW_SB(fs->fs_super)->s_tunefs_flag !=
+		    OCFS2_TUNEFS_INPROG_CLUSTER_SIZE)
+			err = TUNEFS_ET_TUNEFS_IN_PROGRESS;
+		else if (!(flags & TUNEFS_FLAG_RESUME))
+			err = TUNEFS_ET_CLUSTER_SIZE_IN_PROGRESS;
+		if (err)
+			goto out;
 	}
 
 	err = tunefs_lock_filesystem(fs, flags);
@@ -2125,6 +3300,8 @@ errcode_t tunefs_close(ocfs2_filesys *fs)
 	 */
 	if (fs) {
 		verbosef(VL_LIB, "Closing device \"%s\"\n", fs->fs_devname);
+		if (estimate_state.es_active)
+			tunefs_estimate_reads(fs);
 		tunefs_close_online_descriptor(fs);
 		err = tunefs_close_bitmap_check(fs);
 		tmp = tunefs_unlock_filesystem(fs);
@@ -2157,12 +3334,36 @@ errcode_t tunefs_feature_run(ocfs2_filesys *master_fs,
 	int rc = 0;
 	errcode_t err, tmp;
 	ocfs2_filesys *fs;
-	int flags;
+	int flags, shared;
 
 	verbosef(VL_DEBUG, "Running feature \"%s\"\n", feat->tf_name);
 
-	flags = feat->tf_open_flags & ~(TUNEFS_FLAG_ONLINE |
-				      TUNEFS_FLAG_NOCLUSTER);
+	if (estimate_state.es_active &&
+	    !(feat->tf_open_flags & TUNEFS_FLAG_ESTIMATE)) {
+		printf("%s: cannot be estimated; skipped\n", feat->tf_name);
+		return 0;
+	}
+
+	/*
+	 * Features that can share an inode scan also share the
+	 * filesystem, as long as they want it opened the same way.
+	 * Anything else finishes the queued passes first.
+	 */
+	shared = pass_batch.pb_active &&
+		(feat->tf_open_flags & TUNEFS_FLAG_INODE_PASS);
+	if (!shared || (pass_batch.pb_open_flags != feat->tf_open_flags)) {
+		err = tunefs_pass_batch_close();
+		if (err)
+			goto out;
+	}
+	if (shared && pass_batch.pb_fs) {
+		fs = pass_batch.pb_fs;
+		flags = pass_batch.pb_flags;
+		goto run;
+	}
+
+	flags = tunefs_run_flags(feat->tf_open_flags &
+				 ~TUNEFS_FLAG_INODE_PASS);
 	err = tunefs_open(master_fs->fs_devname, feat->tf_open_flags, &fs);
 	if (err == TUNEFS_ET_PERFORM_ONLINE)
 		flags |= TUNEFS_FLAG_ONLINE;
@@ -2171,6 +3372,14 @@ errcode_t tunefs_feature_run(ocfs2_filesys *master_fs,
 	else if (err)
 		goto out;
 
+	if (shared) {
+		pass_batch.pb_fs = fs;
+		pass_batch.pb_open_flags = feat->tf_open_flags;
+		pass_batch.pb_flags = flags;
+	}
+
+run:
+
 	err = 0;
 	switch (feat->tf_action) {
 		case FEATURE_ENABLE:
@@ -2199,9 +3408,11 @@ errcode_t tunefs_feature_run(ocfs2_filesys *master_fs,
 	if (rc)
 		err = TUNEFS_ET_OPERATION_FAILED;
 
-	tmp = tunefs_close(fs);
-	if (!err)
-		err = tmp;
+	if (!shared) {
+		tmp = tunefs_close(fs);
+		if (!err)
+			err = tmp;
+	}
 
 out:
 	return err;
@@ -2216,8 +3427,13 @@ errcode_t tunefs_op_run(ocfs2_filesys *master_fs,
 
 	verbosef(VL_DEBUG, "Running operation \"%s\"\n", op->to_name);
 
-	flags = op->to_open_flags & ~(TUNEFS_FLAG_ONLINE |
-				      TUNEFS_FLAG_NOCLUSTER);
+	if (estimate_state.es_active &&
+	    !(op->to_open_flags & TUNEFS_FLAG_ESTIMATE)) {
+		printf("%s: cannot be estimated; skipped\n", op->to_name);
+		return 0;
+	}
+
+	flags = tunefs_run_flags(op->to_open_flags);
 	err = tunefs_open(master_fs->fs_devname, op->to_open_flags, &fs);
 	if (err == TUNEFS_ET_PERFORM_ONLINE)
 		flags |= TUNEFS_FLAG_ONLINE;
@@ -75,6 +75,15 @@
 					   cluster stack */
 #define TUNEFS_FLAG_LARGECACHE	0x20	/* Operation needs a large I/O
 					   cache */
+#define TUNEFS_FLAG_INODE_PASS	0x40	/* Feature may share its
+					   filesystem and inode scan
+					   with other features */
+#define TUNEFS_FLAG_ESTIMATE	0x80	/* Operation can estimate its
+					   cost on a read-only
+					   filesystem */
+#define TUNEFS_FLAG_RESUME	0x100	/* Operation finishes an
+					   interrupted cluster size
+					   change */
 
 
 /* What to do with a feature */
@@ -227,12 +236,61 @@ errcode_t tunefs_set_journal_size(ocfs2_filesys *fs, uint64_t new_size,
 /* Determine how many clusters the filesystem has free */
 errcode_t tunefs_get_free_clusters(ocfs2_filesys *fs, uint32_t *clusters);
 
+/*
+ * Move a suballocator group between chain allocators.  These only
+ * update the descriptors and allocator inodes in memory; the caller
+ * writes them out.  tunefs_link_group() puts the group at the head of
+ * the chain of di picked by tunefs_link_group_chain().
+ * tunefs_link_group_tail() appends it after tail, the last group of
+ * that chain, or NULL if the chain is empty.  tunefs_unlink_group()
+ * takes it off the chain in di, where prev is the group before it or
+ * NULL if it is the head.
+ */
+uint16_t tunefs_link_group_chain(struct ocfs2_dinode *di);
+void tunefs_link_group(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+		       struct ocfs2_dinode *di);
+void tunefs_link_group_tail(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+			    struct ocfs2_group_desc *tail,
+			    struct ocfs2_dinode *di);
+void tunefs_unlink_group(ocfs2_filesys *fs, struct ocfs2_group_desc *gd,
+			 struct ocfs2_group_desc *prev,
+			 struct ocfs2_dinode *di);
+
+/*
+ * Point the inode or metadata block at blkno at the allocator in a new
+ * slot.  buf is a block of scratch space.
+ */
+errcode_t tunefs_set_suballoc_slot(ocfs2_filesys *fs, uint64_t blkno,
+				   uint16_t slot, char *buf);
+
+/*
+ * Rebuild the extent tree of di at minimal depth from num_recs leaf
+ * records in cpos order.  The new extent blocks come from the inode's
+ * slot, and writing the inode switches to them.  On failure they are
+ * freed and the tree on disk is untouched, though di may not be.  The
+ * caller frees the old extent blocks.  tunefs_extent_tree_layout()
+ * returns the number of extent blocks such a tree needs.
+ */
+uint32_t tunefs_extent_tree_layout(ocfs2_filesys *fs,
+				   struct ocfs2_dinode *di,
+				   uint32_t num_recs, uint16_t *depth);
+errcode_t tunefs_rebuild_extent_tree(ocfs2_filesys *fs,
+				     struct ocfs2_dinode *di,
+				     struct ocfs2_extent_rec *recs,
+				     uint32_t num_recs);
+
 /* Zero out an extent at start_blk */
 errcode_t tunefs_empty_clusters(ocfs2_filesys *fs, uint64_t start_blk,
 				uint32_t num_clusters);
 
 /* Tell tunefs that you updated the filesystem size */
 void tunefs_update_fs_clusters(ocfs2_filesys *fs);
+/*
+ * Tell tunefs that you changed the cluster size.  Other handles on the
+ * filesystem no longer describe it, so the global bitmap is checked
+ * through fs now rather than at close.
+ */
+errcode_t tunefs_update_fs_geometry(ocfs2_filesys *fs);
 
 /*
  * Send an ioctl() to a live filesystem for online operation.  If the
@@ -257,8 +315,120 @@ errcode_t tunefs_foreach_inode(ocfs2_filesys *fs,
 						 void *user_data),
 			       void *user_data);
 
+/*
+ * Features that walk every inode can share one inode scan.  A feature
+ * sets TUNEFS_FLAG_INODE_PASS and, instead of calling
+ * tunefs_foreach_inode(), hands tunefs_queue_inode_pass() a pass
+ * describing its per-inode visitor and the finish() that does the rest
+ * of its work.  When ocfs2ne runs several such features, they share one
+ * ocfs2_filesys and their passes are queued.  The queue is flushed by a
+ * single scan that calls each visitor on each inode in queue order,
+ * followed by each finish() in queue order.  Anywhere else, the pass
+ * runs right away.
+ *
+ * The visitor gets its own copy of the inode.  A visitor that writes
+ * inodes must set TUNEFS_PASS_WRITES_INODES so that later visitors see
+ * its changes.  A visitor error stops that pass only; it is handed to
+ * finish(), which must report it and free ip_data.  If an earlier
+ * finish() failed, later ones are called with TUNEFS_ET_OPERATION_FAILED
+ * and should just clean up.
+ *
+ * A feature that depends on the completed work of features queued
+ * before it calls tunefs_flush_inode_passes() first.
+ *
+ * A scan where every pass sets TUNEFS_PASS_RESUMABLE saves a cursor in
+ * the superblock every so often, and a later run of the same passes
+ * picks up after it.  Each such visitor may see an inode it already
+ * converted and must leave it correct.  If the visitor only gathers
+ * inodes, checkpoint() must finish the work for those it has gathered
+ * so far.  It is called before each save and once more at the end of
+ * the scan, and its errors are handled like visitor errors.
+ *
+ * A checkpoint() that allocates must not start on a volume that can't
+ * hold all of the work.  Such a pass sets count(), which adds the
+ * clusters an inode will need to *clusters without changing anything.
+ * A resumable scan first counts the remaining inodes for every pass,
+ * and if the total doesn't fit, those passes fail with
+ * OCFS2_ET_NO_SPACE before any visitor runs.
+ */
+#define TUNEFS_PASS_WRITES_INODES	0x01
+#define TUNEFS_PASS_RESUMABLE		0x02
+
+struct tunefs_inode_pass {
+	struct list_head	ip_list;
+	const char		*ip_name;
+	int			ip_flags;
+	errcode_t		(*ip_visit)(ocfs2_filesys *fs,
+					    struct ocfs2_dinode *di,
+					    void *user_data);
+	int			(*ip_finish)(ocfs2_filesys *fs,
+					     errcode_t err,
+					     void *user_data);
+	errcode_t		(*ip_checkpoint)(ocfs2_filesys *fs,
+						 void *user_data);
+	errcode_t		(*ip_count)(ocfs2_filesys *fs,
+					    struct ocfs2_dinode *di,
+					    uint64_t *clusters,
+					    void *user_data);
+	void			*ip_data;
+	errcode_t		ip_err;
+};
+
+/*
+ * Returns the finish() result if the pass ran now, zero if it was
+ * queued.
+ */
+int tunefs_queue_inode_pass(ocfs2_filesys *fs,
+			    struct tunefs_inode_pass *pass);
+/* Runs any queued passes.  Non-zero if a finish() failed */
+int tunefs_flush_inode_passes(ocfs2_filesys *fs);
+/*
+ * Non-zero if an interrupted scan left a cursor for the named pass.  A
+ * feature that changes the superblock before its pass can use this to
+ * tell a resume from a feature that is already done.
+ */
+int tunefs_inode_pass_interrupted(ocfs2_filesys *fs, const char *name);
+
+/*
+ * tunefs.ocfs2 --estimate opens every filesystem read-only and only
+ * runs operations with TUNEFS_FLAG_ESTIMATE.  They see it in their
+ * flags and, instead of changing anything, walk the metadata they
+ * would change and hand the cost to tunefs_estimate_report().  The
+ * blocks read while doing so are measured and need not be reported.
+ * Inode pass visitors don't get flags, so their feature passes the
+ * mode along in ip_data.  tunefs_estimate_super() reports an
+ * operation that only rewrites the superblock.
+ */
+struct tunefs_estimate {
+	uint64_t te_write_blocks;
+	uint64_t te_alloc_clusters;
+	uint64_t te_zero_bytes;
+	uint64_t te_copy_bytes;
+};
+
+void tunefs_estimate_report(const char *name, struct tunefs_estimate *est);
+void tunefs_estimate_super(ocfs2_filesys *fs, const char *name);
+/* Blocks written by ocfs2_write_super() */
+int tunefs_super_blocks(ocfs2_filesys *fs);
+
 /* Functions used by the core program sources */
 
+/*
+ * Start estimate mode before opening anything.  The end probes the
+ * device and prints the totals and projected runtime.
+ */
+void tunefs_estimate_begin(void);
+errcode_t tunefs_estimate_end(const char *device);
+
+/*
+ * Bracket a run of tunefs_feature_run() calls that may share inode
+ * passes.  The end flushes any queued passes.  A flush in between
+ * runs the passes queued so far and returns non-zero if any failed.
+ */
+void tunefs_inode_pass_batch_begin(void);
+int tunefs_inode_pass_batch_flush(void);
+errcode_t tunefs_inode_pass_batch_end(void);
+
 /* Open and cloee a filesystem */
 errcode_t tunefs_open(const char *device, int flags,
 		      ocfs2_filesys **ret_fs);
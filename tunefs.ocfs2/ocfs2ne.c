@@ -89,7 +89,9 @@ struct tunefs_run {
 
 
 extern struct tunefs_operation list_sparse_op;
+extern struct tunefs_operation compact_extents_op;
 extern struct tunefs_operation query_op;
+extern struct tunefs_operation rebalance_slots_op;
 extern struct tunefs_operation reset_uuid_op;
 extern struct tunefs_operation features_op;
 extern struct tunefs_operation resize_volume_op;
@@ -98,6 +100,7 @@ extern struct tunefs_operation set_journal_block32_op;
 extern struct tunefs_operation set_journal_block64_op;
 extern struct tunefs_operation set_label_op;
 extern struct tunefs_operation set_slot_count_op;
+extern struct tunefs_operation set_cluster_size_op;
 extern struct tunefs_operation update_cluster_stack_op;
 extern struct tunefs_operation cloned_volume_op;
 extern struct tunefs_operation set_usrquota_sync_interval_op;
@@ -247,6 +250,12 @@ static int handle_progress(struct tunefs_option *opt, char *arg)
 	return 0;
 }
 
+static int handle_estimate(struct tunefs_option *opt, char *arg)
+{
+	tunefs_estimate_begin();
+	return 0;
+}
+
 static int handle_answer(struct tunefs_option *opt, char *arg)
 {
 	int rc = 0;
@@ -498,6 +507,15 @@ static struct tunefs_option no_option = {
 	.opt_handle	= handle_answer,
 };
 
+static struct tunefs_option estimate_option = {
+	.opt_option	= {
+		.name	= "estimate",
+		.val	= CHAR_MAX,
+	},
+	.opt_help	= "   --estimate",
+	.opt_handle	= handle_estimate,
+};
+
 static struct tunefs_option query_option = {
 	.opt_option	= {
 		.name		= "query",
@@ -509,6 +527,15 @@ static struct tunefs_option query_option = {
 	.opt_op		= &query_op,
 };
 
+static struct tunefs_option compact_extents_option = {
+	.opt_option	= {
+		.name		= "compact-extents",
+		.val		= CHAR_MAX,
+	},
+	.opt_help	= "   --compact-extents",
+	.opt_op		= &compact_extents_op,
+};
+
 static struct tunefs_option list_sparse_option = {
 	.opt_option	= {
 		.name	= "list-sparse",
@@ -559,6 +586,17 @@ static struct tunefs_option set_slot_count_option = {
 	.opt_op		= &set_slot_count_op,
 };
 
+static struct tunefs_option rebalance_slots_option = {
+	.opt_option	= {
+		.name		= "rebalance-slots",
+		.val		= CHAR_MAX,
+		.has_arg	= 2,
+	},
+	.opt_help	= "   --rebalance-slots[=max-used-percent]",
+	.opt_handle	= generic_handle_arg,
+	.opt_op		= &rebalance_slots_op,
+};
+
 static struct tunefs_option set_label_option = {
 	.opt_option	= {
 		.name		= "label",
@@ -607,6 +645,17 @@ static struct tunefs_option resize_volume_option = {
 	.opt_handle	= strdup_handle_arg,
 };
 
+static struct tunefs_option set_cluster_size_option = {
+	.opt_option	= {
+		.name		= "cluster-size",
+		.val		= 'C',
+		.has_arg	= 1,
+	},
+	.opt_help	= "-C|--cluster-size <cluster-size>",
+	.opt_handle	= generic_handle_arg,
+	.opt_op		= &set_cluster_size_op,
+};
+
 static struct tunefs_option journal_option = {
 	.opt_option	= {
 		.name		= "journal-options",
@@ -645,15 +694,19 @@ static struct tunefs_option *options[] = {
 	&version_option,
 	&interactive_option,
 	&progress_option,
+	&estimate_option,
 	&verbose_option,
 	&quiet_option,
 	&set_label_option,
 	&set_slot_count_option,
+	&rebalance_slots_option,
 	&resize_volume_option,
+	&set_cluster_size_option,
 	&reset_uuid_option,
 	&journal_option,
 	&query_option,
 	&list_sparse_option,
+	&compact_extents_option,
 	&mount_type_option,
 	&backup_super_option,
 	&features_option,
@@ -1141,6 +1194,8 @@ int main(int argc, char *argv[])
 	}
 
 	rc = run_operations(device);
+	if (!rc && estimate_option.opt_set && tunefs_estimate_end(device))
+		rc = 1;
 
 	tools_progress_stop(tunefs_op_progress);
 
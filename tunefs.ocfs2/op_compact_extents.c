@@ -0,0 +1,277 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * op_compact_extents.c
+ *
+ * ocfs2 tune utility to rebuild extent trees at minimal depth.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * Inserts only merge with their immediate neighbours, and the tree never
+ * gives back depth once a split has added it.  Files written by small
+ * appends or punched and refilled keep physically contiguous records
+ * in separate slots and interior levels they no longer need.
+ *
+ * For each file we collect the leaf records in cpos order, merging any
+ * that are logically and physically contiguous with the same flags.
+ * The tree is then rebuilt bottom-up in newly allocated extent blocks:
+ * full leaves, full interior blocks, and the fewest levels that let the
+ * top level fit in the inode.  Writing the inode switches to the new
+ * tree; the old extent blocks are freed afterwards.  A crash at any
+ * point leaves a consistent tree and, at worst, leaked extent blocks
+ * for fsck to reclaim.  File data never moves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "ocfs2/ocfs2.h"
+
+#include "libocfs2ne.h"
+
+struct compact_ctxt {
+	struct tools_progress *cc_prog;
+	errcode_t cc_err;
+
+	/* The file being compacted */
+	struct ocfs2_extent_rec *cc_recs;	/* Merged leaf records */
+	uint32_t cc_num_recs;
+	uint32_t cc_max_recs;
+	uint32_t cc_old_recs;
+	uint64_t *cc_old_ebs;
+	uint32_t cc_num_old_ebs;
+	uint32_t cc_max_old_ebs;
+
+	uint64_t cc_files;
+	uint64_t cc_recs_merged;
+	uint64_t cc_ebs_freed;
+	uint64_t cc_levels_dropped;
+};
+
+static int compact_can_merge(ocfs2_filesys *fs, struct ocfs2_extent_rec *left,
+			     struct ocfs2_extent_rec *right)
+{
+	return (left->e_flags == right->e_flags) &&
+		(left->e_cpos + left->e_leaf_clusters == right->e_cpos) &&
+		(left->e_blkno +
+		 ocfs2_clusters_to_blocks(fs, left->e_leaf_clusters) ==
+		 right->e_blkno) &&
+		((uint32_t)left->e_leaf_clusters + right->e_leaf_clusters <=
+		 UINT16_MAX);
+}
+
+/* Nothing to gain from an inline list that has no neighbours to merge */
+static int compact_root_is_tight(ocfs2_filesys *fs, struct ocfs2_dinode *di)
+{
+	struct ocfs2_extent_list *el = &di->id2.i_list;
+	int i;
+
+	if (el->l_tree_depth)
+		return 0;
+
+	for (i = 1; i < el->l_next_free_rec; i++)
+		if (compact_can_merge(fs, &el->l_recs[i - 1], &el->l_recs[i]))
+			return 0;
+
+	return 1;
+}
+
+static int compact_collect(ocfs2_filesys *fs, struct ocfs2_extent_rec *rec,
+			   int tree_depth, uint32_t ccount,
+			   uint64_t ref_blkno, int ref_recno,
+			   void *priv_data)
+{
+	errcode_t ret;
+	uint32_t new_max;
+	struct compact_ctxt *ctxt = priv_data;
+	struct ocfs2_extent_rec *last;
+
+	if (tree_depth) {
+		if (ctxt->cc_num_old_ebs == ctxt->cc_max_old_ebs) {
+			new_max = ctxt->cc_max_old_ebs ?
+				ctxt->cc_max_old_ebs * 2 : 64;
+			ret = ocfs2_realloc(new_max * sizeof(uint64_t),
+					    &ctxt->cc_old_ebs);
+			if (ret)
+				goto error;
+			ctxt->cc_max_old_ebs = new_max;
+		}
+		ctxt->cc_old_ebs[ctxt->cc_num_old_ebs++] = rec->e_blkno;
+		return 0;
+	}
+
+	if (!rec->e_leaf_clusters)
+		return 0;
+
+	ctxt->cc_old_recs++;
+	if (ctxt->cc_num_recs) {
+		last = &ctxt->cc_recs[ctxt->cc_num_recs - 1];
+		if (compact_can_merge(fs, last, rec)) {
+			last->e_leaf_clusters += rec->e_leaf_clusters;
+			return 0;
+		}
+	}
+
+	if (ctxt->cc_num_recs == ctxt->cc_max_recs) {
+		new_max = ctxt->cc_max_recs ? ctxt->cc_max_recs * 2 : 256;
+		ret = ocfs2_realloc(new_max * sizeof(struct ocfs2_extent_rec),
+				    &ctxt->cc_recs);
+		if (ret)
+			goto error;
+		ctxt->cc_max_recs = new_max;
+	}
+	ctxt->cc_recs[ctxt->cc_num_recs++] = *rec;
+	return 0;
+
+error:
+	ctxt->cc_err = ret;
+	return OCFS2_EXTENT_ERROR;
+}
+
+static errcode_t compact_one_file(ocfs2_filesys *fs,
+				  struct ocfs2_dinode *di,
+				  void *user_data)
+{
+	errcode_t ret = 0;
+	struct compact_ctxt *ctxt = user_data;
+	uint16_t depth, old_depth = di->id2.i_list.l_tree_depth;
+	uint32_t blocks, i;
+
+	if (!S_ISREG(di->i_mode) && !S_ISDIR(di->i_mode) &&
+	    !S_ISLNK(di->i_mode))
+		goto out;
+	if (di->i_flags & OCFS2_SYSTEM_FL)
+		goto out;
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		goto out;
+	if (!di->i_clusters || compact_root_is_tight(fs, di))
+		goto out;
+
+	ctxt->cc_num_recs = 0;
+	ctxt->cc_old_recs = 0;
+	ctxt->cc_num_old_ebs = 0;
+	ctxt->cc_err = 0;
+	ret = ocfs2_extent_iterate_inode(fs, di, 0, NULL, compact_collect,
+					 ctxt);
+	if (!ret)
+		ret = ctxt->cc_err;
+	if (ret)
+		goto out;
+
+	blocks = tunefs_extent_tree_layout(fs, di, ctxt->cc_num_recs,
+					   &depth);
+	if ((ctxt->cc_num_recs == ctxt->cc_old_recs) &&
+	    (depth == old_depth) && (blocks >= ctxt->cc_num_old_ebs))
+		goto out;
+
+	tunefs_block_signals();
+	ret = tunefs_rebuild_extent_tree(fs, di, ctxt->cc_recs,
+					 ctxt->cc_num_recs);
+	if (ret) {
+		tunefs_unblock_signals();
+		goto out;
+	}
+
+	for (i = 0; i < ctxt->cc_num_old_ebs; i++) {
+		ret = ocfs2_delete_extent_block(fs, ctxt->cc_old_ebs[i]);
+		if (ret)
+			break;
+	}
+	tunefs_unblock_signals();
+	if (ret)
+		goto out;
+
+	ctxt->cc_files++;
+	ctxt->cc_recs_merged += ctxt->cc_old_recs - ctxt->cc_num_recs;
+	ctxt->cc_ebs_freed += ctxt->cc_num_old_ebs - blocks;
+	ctxt->cc_levels_dropped += old_depth - depth;
+
+out:
+	if (ret)
+		verbosef(VL_APP, "%s while compacting the extent tree of "
+			 "inode %"PRIu64"\n", error_message(ret),
+			 (uint64_t)di->i_blkno);
+	tools_progress_step(ctxt->cc_prog, 1);
+
+	return ret;
+}
+
+static errcode_t compact_extents(ocfs2_filesys *fs)
+{
+	errcode_t ret;
+	struct compact_ctxt ctxt;
+
+	memset(&ctxt, 0, sizeof(ctxt));
+
+	ctxt.cc_prog = tools_progress_start("Compacting extent trees",
+					    "compacting", 0);
+	if (!ctxt.cc_prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		goto out;
+	}
+
+	ret = tunefs_foreach_inode(fs, compact_one_file, &ctxt);
+	tools_progress_stop(ctxt.cc_prog);
+
+	verbosef(VL_APP, "Compacted %"PRIu64" extent trees: %"PRIu64
+		 " records merged, %"PRIu64" extent blocks freed, %"PRIu64
+		 " tree levels dropped\n", ctxt.cc_files,
+		 ctxt.cc_recs_merged, ctxt.cc_ebs_freed,
+		 ctxt.cc_levels_dropped);
+
+out:
+	if (ctxt.cc_recs)
+		ocfs2_free(&ctxt.cc_recs);
+	if (ctxt.cc_old_ebs)
+		ocfs2_free(&ctxt.cc_old_ebs);
+
+	return ret;
+}
+
+static int compact_extents_run(struct tunefs_operation *op,
+			       ocfs2_filesys *fs, int flags)
+{
+	errcode_t err;
+	int rc = 0;
+
+	if (!tools_interact("Compact the extent trees on device \"%s\"? ",
+			    fs->fs_devname))
+		return 0;
+
+	err = compact_extents(fs);
+	if (err) {
+		tcom_err(err,
+			 "- unable to compact the extent trees on device "
+			 "\"%s\"",
+			 fs->fs_devname);
+		rc = 1;
+	}
+
+	return rc;
+}
+
+DEFINE_TUNEFS_OP(compact_extents,
+		 "Usage: op_compact_extents [opts] <device>\n",
+		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION,
+		 NULL,
+		 compact_extents_run);
+
+#ifdef DEBUG_EXE
+int main(int argc, char *argv[])
+{
+	return tunefs_op_main(argc, argv, &compact_extents_op);
+}
+#endif
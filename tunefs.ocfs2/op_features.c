@@ -235,6 +235,8 @@ static int run_feature_func(ocfs2_fs_options *feature, void *user_data)
 	if (err && (err != TUNEFS_ET_OPERATION_FAILED))
 		tcom_err(err, "while toggling feature \"%s\"",
 			 feat->tf_name);
+	if (err)
+		ctxt->rc_error = 1;
 
 	return err;
 }
@@ -242,19 +244,34 @@ static int run_feature_func(ocfs2_fs_options *feature, void *user_data)
 static int features_run(struct tunefs_operation *op, ocfs2_filesys *fs,
 			int flags)
 {
+	errcode_t err;
 	struct feature_op_state *state = op->to_private;
 	struct run_features_context ctxt = {
 		.rc_state = state,
 		.rc_fs = fs,
 	};
 
+	/* Features that walk all inodes can share one scan */
+	tunefs_inode_pass_batch_begin();
 	ocfs2_feature_reverse_foreach(&state->fo_reverse_set,
 				      run_feature_func,
 				      &ctxt);
+	/*
+	 * A queued disable only fails when its pass runs.  Run the
+	 * disables' passes now so that a failed one stops the enables.
+	 */
+	if (!ctxt.rc_error && tunefs_inode_pass_batch_flush())
+		ctxt.rc_error = 1;
 	if (!ctxt.rc_error)
 		ocfs2_feature_foreach(&state->fo_feature_set,
 				      run_feature_func,
 				      &ctxt);
+	err = tunefs_inode_pass_batch_end();
+	if (err) {
+		if (err != TUNEFS_ET_OPERATION_FAILED)
+			tcom_err(err, "while finishing feature changes");
+		ctxt.rc_error = 1;
+	}
 
 	ocfs2_free(&state);
 	op->to_private = NULL;
@@ -0,0 +1,734 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * op_rebalance_slots.c
+ *
+ * ocfs2 tune utility to move suballocator groups between slots.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * Each slot grows its own inode_alloc and extent_alloc.  Over time some
+ * slots end up with thousands of empty groups while others are full and
+ * steal from their neighbours on every allocation.  We read every group
+ * of every slot's allocator, then plan moves of whole groups from the
+ * slot with the most free bits to the slot with the fewest.  Only empty
+ * or lightly used groups are moved, and only while the move leaves the
+ * donor with at least as many free bits as the receiver, so the plan
+ * always converges.  Every slot keeps at least one group.
+ *
+ * The objects allocated from a moved group have their suballoc slot
+ * rewritten.  The group is appended to a receiver chain and then
+ * unlinked from its donor chain, in an order that never leaves it
+ * unreachable; see move_one_group().  A donor chain left empty is
+ * replaced by the last chain, as fsck would do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
+
+#include "libocfs2ne.h"
+
+/* Groups with at most this percentage of bits used can move */
+#define REBALANCE_DEFAULT_MAX_USED	10
+
+#define REBALANCE_NO_TARGET		UINT16_MAX
+
+struct rebalance_group {
+	uint64_t rg_blkno;
+	uint16_t rg_slot;
+	uint16_t rg_target;
+	uint16_t rg_chain;
+	uint32_t rg_bits;
+	uint32_t rg_free;
+	int64_t rg_prev;		/* Index in the chain, -1 at the head */
+	int64_t rg_next;
+};
+
+struct rebalance_candidate {
+	uint32_t rn_used;
+	uint64_t rn_blkno;
+	int64_t rn_group;
+};
+
+struct rebalance_slot {
+	uint64_t rs_blkno;
+	char *rs_buf;			/* The allocator inode */
+	uint64_t rs_total;
+	uint64_t rs_free;		/* As planned */
+	uint32_t rs_groups;
+	int rs_exhausted;		/* Nothing left it can give */
+};
+
+struct rebalance_ctxt {
+	ocfs2_filesys *rc_fs;
+	int rc_type;
+	int rc_max_used;
+	int rc_nr_slots;
+	struct rebalance_slot *rc_slots;
+
+	struct rebalance_group *rc_groups;
+	int64_t rc_num_groups;
+	int64_t rc_max_groups;
+
+	/* Head group of each chain, rc_nr_slots rows of cl_count */
+	int64_t *rc_heads;
+	uint16_t rc_cl_count;
+
+	struct rebalance_candidate *rc_order;	/* Emptiest first */
+	int64_t rc_num_candidates;
+	uint64_t rc_moves;
+	uint64_t rc_moved_bits;
+
+	char *rc_gd_buf;
+	char *rc_prev_buf;
+	char *rc_tail_buf;
+	char *rc_ex_buf;
+};
+
+static int64_t *chain_head(struct rebalance_ctxt *rc, uint16_t slot,
+			   uint16_t chain)
+{
+	return &rc->rc_heads[slot * rc->rc_cl_count + chain];
+}
+
+static errcode_t add_group(struct rebalance_ctxt *rc, uint16_t slot,
+			   struct ocfs2_group_desc *gd, int64_t prev)
+{
+	errcode_t ret;
+	int64_t new_max;
+	struct rebalance_group *rg;
+
+	if (rc->rc_num_groups == rc->rc_max_groups) {
+		new_max = rc->rc_max_groups ? rc->rc_max_groups * 2 : 256;
+		ret = ocfs2_realloc(new_max * sizeof(struct rebalance_group),
+				    &rc->rc_groups);
+		if (ret)
+			return ret;
+		rc->rc_max_groups = new_max;
+	}
+
+	rg = &rc->rc_groups[rc->rc_num_groups];
+	rg->rg_blkno = gd->bg_blkno;
+	rg->rg_slot = slot;
+	rg->rg_target = REBALANCE_NO_TARGET;
+	rg->rg_chain = gd->bg_chain;
+	rg->rg_bits = gd->bg_bits;
+	rg->rg_free = gd->bg_free_bits_count;
+	rg->rg_prev = prev;
+	rg->rg_next = -1;
+	if (prev >= 0)
+		rc->rc_groups[prev].rg_next = rc->rc_num_groups;
+	else
+		*chain_head(rc, slot, gd->bg_chain) = rc->rc_num_groups;
+	rc->rc_num_groups++;
+
+	rc->rc_slots[slot].rs_total += gd->bg_bits;
+	rc->rc_slots[slot].rs_free += gd->bg_free_bits_count;
+	rc->rc_slots[slot].rs_groups++;
+
+	return 0;
+}
+
+static errcode_t load_slot(struct rebalance_ctxt *rc, uint16_t slot)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = rc->rc_fs;
+	struct rebalance_slot *rs = &rc->rc_slots[slot];
+	struct ocfs2_dinode *di;
+	struct ocfs2_chain_list *cl;
+	struct ocfs2_group_desc *gd;
+	uint64_t gd_blkno;
+	int64_t prev;
+	int i, j;
+
+	ret = ocfs2_lookup_system_inode(fs, rc->rc_type, slot,
+					&rs->rs_blkno);
+	if (ret)
+		return ret;
+
+	ret = ocfs2_malloc_block(fs->fs_io, &rs->rs_buf);
+	if (ret)
+		return ret;
+
+	ret = ocfs2_read_inode(fs, rs->rs_blkno, rs->rs_buf);
+	if (ret)
+		return ret;
+
+	di = (struct ocfs2_dinode *)rs->rs_buf;
+	if (!(di->i_flags & OCFS2_VALID_FL) ||
+	    !(di->i_flags & OCFS2_BITMAP_FL) ||
+	    !(di->i_flags & OCFS2_CHAIN_FL))
+		return OCFS2_ET_INODE_NOT_VALID;
+
+	cl = &di->id2.i_chain;
+	if (!rc->rc_heads) {
+		rc->rc_cl_count = cl->cl_count;
+		ret = ocfs2_malloc(rc->rc_nr_slots * rc->rc_cl_count *
+				   sizeof(int64_t), &rc->rc_heads);
+		if (ret)
+			return ret;
+		for (j = 0; j < rc->rc_nr_slots * rc->rc_cl_count; j++)
+			rc->rc_heads[j] = -1;
+	}
+	if (cl->cl_count != rc->rc_cl_count)
+		return OCFS2_ET_CORRUPT_CHAIN;
+
+	gd = (struct ocfs2_group_desc *)rc->rc_gd_buf;
+	for (i = 0; i < cl->cl_next_free_rec; i++) {
+		prev = -1;
+		gd_blkno = cl->cl_recs[i].c_blkno;
+		while (gd_blkno) {
+			ret = ocfs2_read_group_desc(fs, gd_blkno,
+						    rc->rc_gd_buf);
+			if (ret)
+				return ret;
+			if ((gd->bg_chain != i) ||
+			    (gd->bg_parent_dinode != rs->rs_blkno))
+				return OCFS2_ET_CORRUPT_CHAIN;
+
+			ret = add_group(rc, slot, gd, prev);
+			if (ret)
+				return ret;
+			prev = rc->rc_num_groups - 1;
+			gd_blkno = gd->bg_next_group;
+		}
+	}
+
+	return 0;
+}
+
+/* Bit 0 of every group is the descriptor itself */
+static uint32_t group_used(struct rebalance_group *rg)
+{
+	return rg->rg_bits - rg->rg_free - 1;
+}
+
+static int candidate_cmp(const void *a, const void *b)
+{
+	const struct rebalance_candidate *l = a, *r = b;
+
+	if (l->rn_used != r->rn_used)
+		return (l->rn_used < r->rn_used) ? -1 : 1;
+	if (l->rn_blkno != r->rn_blkno)
+		return (l->rn_blkno < r->rn_blkno) ? -1 : 1;
+	return 0;
+}
+
+static int pick_slots(struct rebalance_ctxt *rc, int *donor, int *receiver)
+{
+	int i;
+
+	*donor = *receiver = -1;
+	for (i = 0; i < rc->rc_nr_slots; i++) {
+		if (!rc->rc_slots[i].rs_exhausted &&
+		    ((*donor < 0) ||
+		     (rc->rc_slots[i].rs_free >
+		      rc->rc_slots[*donor].rs_free)))
+			*donor = i;
+		if ((*receiver < 0) ||
+		    (rc->rc_slots[i].rs_free <
+		     rc->rc_slots[*receiver].rs_free))
+			*receiver = i;
+	}
+
+	return (*donor >= 0) && (*donor != *receiver);
+}
+
+/*
+ * Repeatedly give the emptiest movable group of the richest slot to the
+ * poorest slot, as long as the donor stays at least as rich.
+ */
+static void plan_moves(struct rebalance_ctxt *rc)
+{
+	struct rebalance_group *rg = NULL;
+	struct rebalance_slot *from, *to;
+	int64_t i;
+	int donor, receiver;
+
+	while (pick_slots(rc, &donor, &receiver)) {
+		from = &rc->rc_slots[donor];
+		to = &rc->rc_slots[receiver];
+
+		for (i = 0; i < rc->rc_num_candidates; i++) {
+			rg = &rc->rc_groups[rc->rc_order[i].rn_group];
+			if ((rg->rg_slot != donor) ||
+			    (rg->rg_target != REBALANCE_NO_TARGET))
+				continue;
+			if (from->rs_groups < 2)
+				continue;
+			if ((uint64_t)rg->rg_free * 2 >
+			    from->rs_free - to->rs_free)
+				continue;
+			break;
+		}
+
+		if (i == rc->rc_num_candidates) {
+			from->rs_exhausted = 1;
+			continue;
+		}
+
+		rg->rg_target = receiver;
+		from->rs_groups--;
+		to->rs_groups++;
+		from->rs_total -= rg->rg_bits;
+		to->rs_total += rg->rg_bits;
+		from->rs_free -= rg->rg_free;
+		to->rs_free += rg->rg_free;
+		rc->rc_moves++;
+		rc->rc_moved_bits += rg->rg_bits;
+	}
+}
+
+static uint64_t group_bit_to_blkno(ocfs2_filesys *fs,
+				   struct ocfs2_group_desc *gd, int bit)
+{
+	struct ocfs2_extent_rec *rec;
+	uint16_t bpc = ocfs2_clusters_to_blocks(fs, 1);
+	uint32_t start, len;
+	int i;
+
+	if (!ocfs2_gd_is_discontig(gd))
+		return gd->bg_blkno + bit;
+
+	for (i = 0; i < gd->bg_list.l_next_free_rec; i++) {
+		rec = &gd->bg_list.l_recs[i];
+		start = rec->e_cpos * bpc;
+		len = rec->e_leaf_clusters * bpc;
+		if ((bit >= start) && (bit < start + len))
+			return rec->e_blkno + (bit - start);
+	}
+
+	return 0;
+}
+
+static errcode_t write_slot(struct rebalance_ctxt *rc, uint16_t slot)
+{
+	return ocfs2_write_inode(rc->rc_fs, rc->rc_slots[slot].rs_blkno,
+				 rc->rc_slots[slot].rs_buf);
+}
+
+/*
+ * The chain at @chain is empty.  Copy the last chain into its place and
+ * point every group of the copied chain at its new position.
+ */
+static errcode_t fill_empty_chain(struct rebalance_ctxt *rc, uint16_t slot,
+				  uint16_t chain)
+{
+	errcode_t ret;
+	struct ocfs2_dinode *di =
+		(struct ocfs2_dinode *)rc->rc_slots[slot].rs_buf;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+	struct ocfs2_group_desc *gd;
+	uint16_t last = cl->cl_next_free_rec - 1;
+	int64_t i;
+
+	if (chain < last) {
+		cl->cl_recs[chain] = cl->cl_recs[last];
+		*chain_head(rc, slot, chain) = *chain_head(rc, slot, last);
+
+		gd = (struct ocfs2_group_desc *)rc->rc_prev_buf;
+		for (i = *chain_head(rc, slot, chain); i >= 0;
+		     i = rc->rc_groups[i].rg_next) {
+			ret = ocfs2_read_group_desc(rc->rc_fs,
+						    rc->rc_groups[i].rg_blkno,
+						    rc->rc_prev_buf);
+			if (ret)
+				return ret;
+			gd->bg_chain = chain;
+			ret = ocfs2_write_group_desc(rc->rc_fs, gd->bg_blkno,
+						     rc->rc_prev_buf);
+			if (ret)
+				return ret;
+			rc->rc_groups[i].rg_chain = chain;
+		}
+	}
+
+	memset(&cl->cl_recs[last], 0, sizeof(struct ocfs2_chain_rec));
+	*chain_head(rc, slot, last) = -1;
+	cl->cl_next_free_rec--;
+
+	return 0;
+}
+
+/*
+ * The group is appended to the receiver chain before it leaves the
+ * donor chain, so every group stays reachable whenever we stop:
+ *
+ *   1. the receiver's tail points at the group, which still points
+ *      on into the donor chain;
+ *   2. the group's predecessor in the donor chain skips it;
+ *   3. the group ends the receiver chain and names its new parent;
+ *   4. both allocator inodes get their new counts.
+ *
+ * Between 1 and 3 the rest of the donor chain is reachable from both
+ * allocators, and until 4 the counts are stale.  fsck repairs both
+ * (GROUP_DUPLICATE, GROUP_PARENT, CHAIN_BITS and friends) without
+ * losing a group.
+ */
+static errcode_t move_one_group(struct rebalance_ctxt *rc, int64_t idx)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = rc->rc_fs;
+	struct rebalance_group *rg = &rc->rc_groups[idx];
+	uint16_t donor = rg->rg_slot, receiver = rg->rg_target;
+	struct ocfs2_dinode *from_di =
+		(struct ocfs2_dinode *)rc->rc_slots[donor].rs_buf;
+	struct ocfs2_dinode *to_di =
+		(struct ocfs2_dinode *)rc->rc_slots[receiver].rs_buf;
+	struct ocfs2_group_desc *gd, *prev = NULL, *tail = NULL;
+	uint64_t blkno;
+	int64_t tail_idx;
+	uint16_t chain, donor_chain;
+	int bit;
+
+	gd = (struct ocfs2_group_desc *)rc->rc_gd_buf;
+	ret = ocfs2_read_group_desc(fs, rg->rg_blkno, rc->rc_gd_buf);
+	if (ret)
+		return ret;
+
+	for (bit = 1; bit < gd->bg_bits; bit++) {
+		bit = ocfs2_find_next_bit_set(gd->bg_bitmap, gd->bg_bits, bit);
+		if (bit >= gd->bg_bits)
+			break;
+		blkno = group_bit_to_blkno(fs, gd, bit);
+		if (!blkno)
+			return OCFS2_ET_CORRUPT_CHAIN;
+		ret = tunefs_set_suballoc_slot(fs, blkno, receiver,
+					       rc->rc_ex_buf);
+		if (ret)
+			return ret;
+	}
+
+	if (rg->rg_prev >= 0) {
+		prev = (struct ocfs2_group_desc *)rc->rc_prev_buf;
+		ret = ocfs2_read_group_desc(fs,
+					    rc->rc_groups[rg->rg_prev].rg_blkno,
+					    rc->rc_prev_buf);
+		if (ret)
+			return ret;
+	}
+
+	chain = tunefs_link_group_chain(to_di);
+	tail_idx = -1;
+	if (chain < to_di->id2.i_chain.cl_next_free_rec) {
+		tail_idx = *chain_head(rc, receiver, chain);
+		while ((tail_idx >= 0) &&
+		       (rc->rc_groups[tail_idx].rg_next >= 0))
+			tail_idx = rc->rc_groups[tail_idx].rg_next;
+	}
+	if (tail_idx >= 0) {
+		tail = (struct ocfs2_group_desc *)rc->rc_tail_buf;
+		ret = ocfs2_read_group_desc(fs,
+					    rc->rc_groups[tail_idx].rg_blkno,
+					    rc->rc_tail_buf);
+		if (ret)
+			return ret;
+	}
+
+	tunefs_unlink_group(fs, gd, prev, from_di);
+	tunefs_link_group_tail(fs, gd, tail, to_di);
+
+	/* 1 */
+	if (tail)
+		ret = ocfs2_write_group_desc(fs, tail->bg_blkno,
+					     rc->rc_tail_buf);
+	else
+		ret = write_slot(rc, receiver);
+	if (ret)
+		return ret;
+
+	/* 2 */
+	if (prev)
+		ret = ocfs2_write_group_desc(fs, prev->bg_blkno,
+					     rc->rc_prev_buf);
+	else
+		ret = write_slot(rc, donor);
+	if (ret)
+		return ret;
+
+	/* 3 */
+	ret = ocfs2_write_group_desc(fs, gd->bg_blkno, rc->rc_gd_buf);
+	if (ret)
+		return ret;
+
+	/* Keep both chains in memory in step with the disk */
+	if (rg->rg_prev >= 0)
+		rc->rc_groups[rg->rg_prev].rg_next = rg->rg_next;
+	else
+		*chain_head(rc, donor, rg->rg_chain) = rg->rg_next;
+	if (rg->rg_next >= 0)
+		rc->rc_groups[rg->rg_next].rg_prev = rg->rg_prev;
+
+	rg->rg_prev = tail_idx;
+	rg->rg_next = -1;
+	if (tail_idx >= 0)
+		rc->rc_groups[tail_idx].rg_next = idx;
+	else
+		*chain_head(rc, receiver, chain) = idx;
+	rg->rg_slot = receiver;
+	rg->rg_target = REBALANCE_NO_TARGET;
+	donor_chain = rg->rg_chain;
+	rg->rg_chain = chain;
+
+	/* 4 */
+	ret = write_slot(rc, receiver);
+	if (ret)
+		return ret;
+
+	if (!from_di->id2.i_chain.cl_recs[donor_chain].c_blkno) {
+		ret = fill_empty_chain(rc, donor, donor_chain);
+		if (ret)
+			return ret;
+	}
+
+	return write_slot(rc, donor);
+}
+
+static errcode_t run_moves(struct rebalance_ctxt *rc,
+			   struct tools_progress *prog)
+{
+	errcode_t ret = 0;
+	int64_t i;
+
+	for (i = 0; i < rc->rc_num_groups; i++) {
+		if (rc->rc_groups[i].rg_target == REBALANCE_NO_TARGET)
+			continue;
+
+		ret = move_one_group(rc, i);
+		if (ret)
+			break;
+		tools_progress_step(prog, 1);
+	}
+
+	return ret;
+}
+
+static void print_slots(struct rebalance_ctxt *rc, const char *when)
+{
+	int i;
+	char fname[OCFS2_MAX_FILENAME_LEN];
+
+	for (i = 0; i < rc->rc_nr_slots; i++) {
+		ocfs2_sprintf_system_inode_name(fname, OCFS2_MAX_FILENAME_LEN,
+						rc->rc_type, i);
+		verbosef(VL_APP, "%s \"%s\": %u groups, %"PRIu64" of %"
+			 PRIu64" bits free\n", when, fname,
+			 rc->rc_slots[i].rs_groups, rc->rc_slots[i].rs_free,
+			 rc->rc_slots[i].rs_total);
+	}
+}
+
+static void free_ctxt(struct rebalance_ctxt *rc)
+{
+	int i;
+
+	if (rc->rc_slots) {
+		for (i = 0; i < rc->rc_nr_slots; i++)
+			if (rc->rc_slots[i].rs_buf)
+				ocfs2_free(&rc->rc_slots[i].rs_buf);
+		ocfs2_free(&rc->rc_slots);
+	}
+	if (rc->rc_groups)
+		ocfs2_free(&rc->rc_groups);
+	if (rc->rc_heads)
+		ocfs2_free(&rc->rc_heads);
+	if (rc->rc_order)
+		ocfs2_free(&rc->rc_order);
+	if (rc->rc_gd_buf)
+		ocfs2_free(&rc->rc_gd_buf);
+	if (rc->rc_prev_buf)
+		ocfs2_free(&rc->rc_prev_buf);
+	if (rc->rc_tail_buf)
+		ocfs2_free(&rc->rc_tail_buf);
+	if (rc->rc_ex_buf)
+		ocfs2_free(&rc->rc_ex_buf);
+}
+
+static errcode_t rebalance_allocators(ocfs2_filesys *fs, int type,
+				      int max_used)
+{
+	errcode_t ret;
+	struct rebalance_ctxt rc;
+	struct rebalance_group *rg;
+	struct tools_progress *prog = NULL;
+	const char *name = (type == INODE_ALLOC_SYSTEM_INODE) ?
+		"inode" : "extent";
+	int64_t i;
+	int slot;
+
+	memset(&rc, 0, sizeof(rc));
+	rc.rc_fs = fs;
+	rc.rc_type = type;
+	rc.rc_max_used = max_used;
+	rc.rc_nr_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+
+	ret = ocfs2_malloc0(rc.rc_nr_slots * sizeof(struct rebalance_slot),
+			    &rc.rc_slots);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &rc.rc_gd_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &rc.rc_prev_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &rc.rc_tail_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &rc.rc_ex_buf);
+	if (ret)
+		goto out;
+
+	for (slot = 0; slot < rc.rc_nr_slots; slot++) {
+		ret = load_slot(&rc, slot);
+		if (ret) {
+			verbosef(VL_APP, "%s while reading the %s allocator "
+				 "for slot %d\n", error_message(ret), name,
+				 slot);
+			goto out;
+		}
+	}
+
+	print_slots(&rc, "Before");
+
+	if (rc.rc_num_groups) {
+		ret = ocfs2_malloc(rc.rc_num_groups *
+				   sizeof(struct rebalance_candidate),
+				   &rc.rc_order);
+		if (ret)
+			goto out;
+	}
+	for (i = 0; i < rc.rc_num_groups; i++) {
+		rg = &rc.rc_groups[i];
+		if ((uint64_t)group_used(rg) * 100 >
+		    (uint64_t)rc.rc_max_used * rg->rg_bits)
+			continue;
+		rc.rc_order[rc.rc_num_candidates].rn_used = group_used(rg);
+		rc.rc_order[rc.rc_num_candidates].rn_blkno = rg->rg_blkno;
+		rc.rc_order[rc.rc_num_candidates].rn_group = i;
+		rc.rc_num_candidates++;
+	}
+	qsort(rc.rc_order, rc.rc_num_candidates,
+	      sizeof(struct rebalance_candidate), candidate_cmp);
+
+	plan_moves(&rc);
+	if (!rc.rc_moves) {
+		verbosef(VL_APP, "The %s allocators are balanced; nothing "
+			 "to do\n", name);
+		goto out;
+	}
+
+	if (!tools_interact("Move %"PRIu64" %s allocator groups between "
+			    "the slots of device \"%s\"? ",
+			    rc.rc_moves, name, fs->fs_devname))
+		goto out;
+
+	prog = tools_progress_start("Rebalancing allocators", name,
+				    rc.rc_moves);
+	if (!prog) {
+		ret = TUNEFS_ET_NO_MEMORY;
+		goto out;
+	}
+
+	/* fsck.ocfs2 checks the chains if we don't get to the end */
+	ret = tunefs_set_in_progress(fs, OCFS2_TUNEFS_INPROG_REBALANCE);
+	if (ret)
+		goto out;
+
+	tunefs_block_signals();
+	ret = run_moves(&rc, prog);
+	tunefs_unblock_signals();
+	if (ret) {
+		verbosef(VL_APP, "%s while moving %s allocator groups\n",
+			 error_message(ret), name);
+		goto out;
+	}
+
+	ret = tunefs_clear_in_progress(fs, OCFS2_TUNEFS_INPROG_REBALANCE);
+	if (ret)
+		goto out;
+
+	verbosef(VL_APP, "Moved %"PRIu64" %s allocator groups holding %"
+		 PRIu64" bits\n", rc.rc_moves, name, rc.rc_moved_bits);
+	print_slots(&rc, "After");
+
+out:
+	if (prog)
+		tools_progress_stop(prog);
+	free_ctxt(&rc);
+	return ret;
+}
+
+static int rebalance_slots_parse_option(struct tunefs_operation *op,
+					char *arg)
+{
+	char *ptr = NULL;
+	long max_used = REBALANCE_DEFAULT_MAX_USED;
+
+	if (arg) {
+		max_used = strtol(arg, &ptr, 10);
+		if ((*ptr != '\0') || (max_used < 0) || (max_used > 100)) {
+			errorf("Invalid percentage: \"%s\"\n", arg);
+			return 1;
+		}
+	}
+
+	op->to_private = (void *)(unsigned long)max_used;
+	return 0;
+}
+
+static int rebalance_slots_run(struct tunefs_operation *op,
+			       ocfs2_filesys *fs, int flags)
+{
+	errcode_t err;
+	int rc = 0;
+	int max_used = (int)(unsigned long)op->to_private;
+
+	if (OCFS2_RAW_SB(fs->fs_super)->s_max_slots < 2) {
+		verbosef(VL_APP, "Device \"%s\" has only one slot; nothing "
+			 "to do\n", fs->fs_devname);
+		return 0;
+	}
+
+	err = rebalance_allocators(fs, INODE_ALLOC_SYSTEM_INODE, max_used);
+	if (!err)
+		err = rebalance_allocators(fs, EXTENT_ALLOC_SYSTEM_INODE,
+					   max_used);
+	if (err) {
+		tcom_err(err,
+			 "- unable to rebalance the allocators on device "
+			 "\"%s\"",
+			 fs->fs_devname);
+		rc = 1;
+	}
+
+	return rc;
+}
+
+
+DEFINE_TUNEFS_OP(rebalance_slots,
+		 "Usage: op_rebalance_slots [opts] <device> "
+		 "[max-used-percent]\n",
+		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION,
+		 rebalance_slots_parse_option,
+		 rebalance_slots_run);
+
+#ifdef DEBUG_EXE
+int main(int argc, char *argv[])
+{
+	return tunefs_op_main(argc, argv, &rebalance_slots_op);
+}
+#endif
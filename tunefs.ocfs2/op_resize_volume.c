@@ -662,8 +662,58 @@ out:
 	return err;
 }
 
+/*
+ * Each new group gets its descriptor written and its first cluster
+ * zeroed.  The bitmap inode and the old tail group are written once,
+ * and the superblock is marked and cleared around the resize.
+ */
+static errcode_t estimate_resize(ocfs2_filesys *fs, uint32_t new_clusters)
+{
+	errcode_t ret;
+	uint64_t bm_blkno = 0;
+	uint32_t cpg, tail, groups = 0;
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+	struct tunefs_estimate est = { 0, };
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_lookup_system_inode(fs, GLOBAL_BITMAP_SYSTEM_INODE, 0,
+					&bm_blkno);
+	if (ret)
+		goto out;
+
+	ret = ocfs2_read_inode(fs, bm_blkno, buf);
+	if (ret)
+		goto out;
+
+	di = (struct ocfs2_dinode *)buf;
+	cpg = di->id2.i_chain.cl_cpg;
+
+	/* What the tail group can't take goes into new groups */
+	tail = (cpg - (fs->fs_clusters % cpg)) % cpg;
+	if (new_clusters - fs->fs_clusters > tail)
+		groups = (new_clusters - fs->fs_clusters - tail + cpg - 1) /
+			cpg;
+
+	est.te_write_blocks = groups + 2 + 2 + tunefs_super_blocks(fs);
+	est.te_zero_bytes = (uint64_t)groups * fs->fs_clustersize;
+	tunefs_estimate_report("resize", &est);
+
+out:
+	if (buf)
+		ocfs2_free(&buf);
+	if (ret)
+		tcom_err(ret, "while estimating the resize of device \"%s\"",
+			 fs->fs_devname);
+
+	return ret;
+}
+
 static errcode_t update_volume_size(ocfs2_filesys *fs, uint64_t new_size,
-				    int online)
+				    int flags)
 {
 	errcode_t err = 0;
 	uint32_t new_clusters;
@@ -680,12 +730,17 @@ static errcode_t update_volume_size(ocfs2_filesys *fs, uint64_t new_size,
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		err = estimate_resize(fs, new_clusters);
+		goto out;
+	}
+
 	if (!tools_interact("Grow the filesystem on device \"%s\" from "
 			    "%"PRIu32" to %"PRIu32" clusters? ",
 			    fs->fs_devname, fs->fs_clusters, new_clusters))
 		goto out;
 
-	if (online)
+	if (flags & TUNEFS_FLAG_ONLINE)
 		err = update_volume_size_online(fs, new_clusters);
 	else
 		err = update_volume_size_offline(fs, new_clusters);
@@ -774,7 +829,7 @@ static int resize_volume_run(struct tunefs_operation *op,
 	if (new_size < specs->rs_size)
 		new_size = UINT64_MAX;
 
-	err = update_volume_size(fs, new_size, flags & TUNEFS_FLAG_ONLINE);
+	err = update_volume_size(fs, new_size, flags);
 
 	ocfs2_free(&specs);
 	op->to_private = NULL;
@@ -788,7 +843,7 @@ DEFINE_TUNEFS_OP(resize_volume,
 		 "If [size] is left out, the filesystem will be "
 		 "resized to fill the volume\n",
 		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
-		 TUNEFS_FLAG_ONLINE,
+		 TUNEFS_FLAG_ONLINE | TUNEFS_FLAG_ESTIMATE,
 		 resize_volume_parse_option,
 		 resize_volume_run);
 
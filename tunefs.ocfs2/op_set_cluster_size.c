@@ -0,0 +1,3014 @@
+/* -*- mode: c; c-basic-offset: 8; -*-
+ * vim: noexpandtab sw=8 ts=8 sts=0:
+ *
+ * op_set_cluster_size.c
+ *
+ * ocfs2 tune utility to convert a volume to a larger cluster size.
+ *
+ * Copyright (C) 2026 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * A new cluster is a window of ratio old clusters.  The conversion runs
+ * in three stages, the first two under the old geometry.
+ *
+ * First, every file is made to own whole windows.  A window that is
+ * fully mapped, physically contiguous and starts on a new cluster stays
+ * where it is.  Any other window is copied into a free aligned window,
+ * holes becoming zeroes.  The extent tree is rebuilt from the resulting
+ * records before the old clusters are freed, so each file is consistent
+ * on disk at every step.  Directory indexes point into the blocks being
+ * moved; they are dropped here and rebuilt at the end.
+ *
+ * Second, suballocator groups must start on a new cluster and span a
+ * whole number of them.  An aligned group grows in place when the
+ * clusters after it are free.  Any other group is copied to an aligned
+ * run, which renumbers the inodes in it, so every inode, directory
+ * entry, extent block and group descriptor pointing into it is
+ * rewritten at its new home.  The old groups are freed last.
+ *
+ * Last, the counts of every extent tree and allocator are divided by the
+ * ratio and the global bitmap is rebuilt.  A new cluster is in use when
+ * any old cluster inside it was.  The tail of the volume that doesn't
+ * make a whole new cluster is dropped.
+ *
+ * Before the first stage, the directories to reindex are written to a
+ * record in free clusters and the superblock is marked with
+ * OCFS2_TUNEFS_INPROG_CLUSTER_SIZE and the record's location.  Before
+ * the second, a new record holding the plan takes its place.  From then
+ * on every step can be run again from where the record says it stopped,
+ * and running the conversion again finishes it.  fsck.ocfs2 and the
+ * kernel refuse the volume until then, as a file that is part way
+ * aligned owns more than its size.  Refcount trees, xattr
+ * values outside the inode or xattr block, indexed xattr blocks and
+ * discontiguous groups are not handled.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+
+#include "ocfs2/ocfs2.h"
+#include "ocfs2/bitops.h"
+#include "ocfs2/byteorder.h"
+
+#include "libocfs2ne.h"
+
+
+/* Windows per read and write while copying */
+#define CSIZE_IO_WINDOWS	16
+
+/* Clusters claimed for the conversion, given back if it fails */
+struct csize_alloc {
+	uint64_t a_blkno;
+	uint32_t a_clusters;
+};
+
+struct csize_group {
+	uint64_t g_old;
+	uint64_t g_new;
+	uint32_t g_blocks;
+	uint32_t g_new_blocks;		/* Rounded up to a new cluster */
+	int g_inodes;			/* Of an inode allocator */
+};
+
+/*
+ * The record of a conversion in progress.  The header is the first
+ * block, two scratch blocks follow, then the groups and the directories
+ * to reindex.  It is little endian.
+ *
+ * Each step can be run again.  Moved groups are copied before anything
+ * points at them, and what points into a group is always read from the
+ * old copy or rewritten in place, so remapping restarts at the group it
+ * stopped in.  Dividing counts can't be repeated, so blocks are flipped
+ * in batches: a scratch block holds the crc32 of every block of the
+ * batch as it was, and on the way back in only blocks that still match
+ * are flipped.  Each new global group overwrites the descriptor of the
+ * first old group it covers, so that descriptor is saved in a scratch
+ * block first.  The scratch blocks take turns, so the header always
+ * names a whole one.
+ */
+#define CSIZE_RECORD_SIGNATURE	"CSIZEREC"
+#define CSIZE_RECORD_SCRATCH	1
+#define CSIZE_RECORD_LISTS	3
+
+struct csize_record {
+	__u8	cr_signature[8];
+	__le32	cr_old_size;
+	__le32	cr_new_size;
+	__le32	cr_step;
+	__le32	cr_offset;		/* Block within the inode at
+					   cr_cursor */
+	__le64	cr_cursor;
+	__le32	cr_clusters;		/* Old clusters the record takes */
+	__le32	cr_scratch;		/* Scratch block last written */
+	__le32	cr_count;		/* Entries in it, 0 if none */
+	__le32	cr_scratch_crc;
+	__le64	cr_num_groups;
+	__le64	cr_num_dx_dirs;
+	__le32	cr_lists_crc;
+	__le32	cr_crc;			/* Of the header, with this zero */
+};
+
+struct csize_record_group {
+	__le64	rg_old;
+	__le64	rg_new;
+	__le32	rg_blocks;
+	__le32	rg_new_blocks;
+	__le32	rg_inodes;
+	__le32	rg_reserved;
+};
+
+enum csize_step {
+	CSIZE_STEP_ALIGN = 1,		/* Align the files */
+	CSIZE_STEP_COPY,		/* Copy and grow the groups */
+	CSIZE_STEP_REMAP,		/* Point at the new groups */
+	CSIZE_STEP_FREE,		/* Free the old groups */
+	CSIZE_STEP_FLIP,		/* Divide the counts */
+	CSIZE_STEP_BITMAP,		/* Write the new global bitmap */
+	CSIZE_STEP_SUPER,		/* Write the new geometry */
+	CSIZE_STEP_INDEX,		/* Rebuild directory indexes */
+	CSIZE_STEP_DONE,
+};
+
+/* A block in the batch being flipped */
+struct csize_flip {
+	uint64_t f_blkno;
+	int f_inode;
+};
+
+/* A window of the file being converted */
+struct csize_window {
+	uint32_t w_cpos;
+	uint32_t w_first;		/* Records that touch it */
+	uint32_t w_last;
+	uint64_t w_blkno;		/* Where it starts, if it stays */
+	uint16_t w_flags;
+	int w_stays;
+	int w_written;			/* Some of it is not unwritten */
+};
+
+struct csize_ctxt {
+	ocfs2_filesys *cs_fs;
+	uint32_t cs_ratio;
+	uint32_t cs_old_size;
+	uint32_t cs_new_size;
+	uint32_t cs_old_bpc;		/* Blocks per old cluster */
+	uint32_t cs_new_bpc;		/* Blocks per new cluster */
+	uint32_t cs_new_clusters;
+	uint32_t cs_limit;		/* Old clusters that are kept */
+	uint32_t cs_cpg;		/* Of the global bitmap */
+	uint32_t cs_max_run;		/* Windows per allocation */
+	uint32_t cs_max_rec;		/* Longest record, in old clusters */
+	uint64_t cs_bitmap_blkno;
+	uint64_t cs_hb_blkno;
+	uint64_t cs_root_blkno;
+	int cs_dry;
+	int cs_system;			/* Which files this pass converts */
+	errcode_t cs_err;
+	struct tools_progress *cs_prog;
+	ocfs2_quota_hash *cs_usrhash;
+	ocfs2_quota_hash *cs_grphash;
+
+	/* The file being converted */
+	struct ocfs2_extent_rec *cs_recs;
+	uint64_t cs_num_recs, cs_max_recs;
+	struct ocfs2_extent_rec *cs_new_recs;
+	uint64_t cs_num_new_recs, cs_max_new_recs;
+	uint64_t *cs_old_ebs;
+	uint64_t cs_num_old_ebs, cs_max_old_ebs;
+	int cs_misaligned;
+	char *cs_io_buf;
+	uint64_t cs_io_blkno;
+	uint32_t cs_io_windows;
+
+	struct csize_alloc *cs_allocs;
+	uint64_t cs_num_allocs, cs_max_allocs;
+
+	/* Suballocator groups, sorted by g_old, and the inodes in them */
+	struct csize_group *cs_groups;
+	uint64_t cs_num_groups, cs_max_groups;
+	uint64_t *cs_inodes;
+	uint64_t cs_num_inodes, cs_max_inodes;
+	uint64_t *cs_dx_dirs;
+	uint64_t cs_num_dx_dirs, cs_max_dx_dirs;
+
+	/* The record and where it says we are */
+	uint64_t cs_rec_blkno;
+	uint32_t cs_rec_clusters;	/* Old clusters */
+	uint64_t cs_rec_groups;		/* Groups planned, as recorded */
+	uint32_t cs_step;
+	uint64_t cs_cursor;
+	uint32_t cs_offset;
+	uint32_t cs_scratch;
+	uint32_t cs_count;
+	uint32_t cs_scratch_crc;
+	uint32_t cs_lists_crc;
+	char *cs_rec_buf;
+	char *cs_scratch_buf;
+	struct csize_flip *cs_flips;
+
+	char *cs_buf;
+	char *cs_orig_buf;
+	char *cs_gd_buf;
+	char *cs_gd_orig_buf;
+	char *cs_dir_buf;
+
+	/* Totals */
+	uint64_t cs_seen;
+	uint64_t cs_files;
+	uint64_t cs_windows;		/* Aligned windows wanted */
+	uint64_t cs_free_windows;
+	uint64_t cs_moves;
+	uint64_t cs_grows;
+	uint64_t cs_grow_blocks;
+};
+
+
+static errcode_t csize_reserve(void *array, uint64_t *max, uint64_t num,
+			       size_t size)
+{
+	errcode_t ret;
+	uint64_t new_max;
+
+	if (num < *max)
+		return 0;
+
+	new_max = *max ? *max * 2 : 64;
+	ret = ocfs2_realloc(new_max * size, array);
+	if (!ret)
+		*max = new_max;
+
+	return ret;
+}
+
+static errcode_t csize_push_blkno(uint64_t **array, uint64_t *num,
+				  uint64_t *max, uint64_t blkno)
+{
+	errcode_t ret;
+
+	ret = csize_reserve(array, max, *num, sizeof(uint64_t));
+	if (!ret)
+		(*array)[(*num)++] = blkno;
+
+	return ret;
+}
+
+static errcode_t csize_add_alloc(struct csize_ctxt *ctxt, uint64_t blkno,
+				 uint32_t clusters)
+{
+	errcode_t ret;
+
+	ret = csize_reserve(&ctxt->cs_allocs, &ctxt->cs_max_allocs,
+			    ctxt->cs_num_allocs, sizeof(struct csize_alloc));
+	if (ret) {
+		ocfs2_free_clusters(ctxt->cs_fs, clusters, blkno);
+		return ret;
+	}
+
+	ctxt->cs_allocs[ctxt->cs_num_allocs].a_blkno = blkno;
+	ctxt->cs_allocs[ctxt->cs_num_allocs].a_clusters = clusters;
+	ctxt->cs_num_allocs++;
+
+	return 0;
+}
+
+/* Gives back everything claimed since the last commit */
+static void csize_free_allocs(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	struct csize_alloc *a;
+	uint64_t i;
+
+	for (i = 0; i < ctxt->cs_num_allocs; i++) {
+		a = &ctxt->cs_allocs[i];
+		ret = ocfs2_free_clusters(ctxt->cs_fs, a->a_clusters,
+					  a->a_blkno);
+		if (ret)
+			verbosef(VL_APP,
+				 "%s while freeing %"PRIu32" clusters at "
+				 "block %"PRIu64"\n",
+				 error_message(ret), a->a_clusters,
+				 a->a_blkno);
+	}
+
+	ctxt->cs_num_allocs = 0;
+}
+
+static void csize_drop_allocator(ocfs2_filesys *fs,
+				 ocfs2_cached_inode **cinode)
+{
+	if (*cinode) {
+		ocfs2_free_cached_inode(fs, *cinode);
+		*cinode = NULL;
+	}
+}
+
+/*
+ * The cached allocators and quota inodes describe the layout being
+ * replaced.  Nothing else lets go of them, so we do between the steps.
+ * A dirty quota inode is written first; closing the filesystem would
+ * otherwise write a stale copy.
+ */
+static errcode_t csize_drop_caches(ocfs2_filesys *fs)
+{
+	errcode_t ret;
+	int i, type;
+	int max_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
+
+	for (type = 0; type < MAXQUOTAS; type++) {
+		if (!fs->qinfo[type].qi_inode)
+			continue;
+
+		if (fs->qinfo[type].flags & OCFS2_QF_INFO_DIRTY) {
+			ret = ocfs2_write_global_quota_info(fs, type);
+			if (!ret)
+				ret = ocfs2_write_cached_inode(fs,
+						fs->qinfo[type].qi_inode);
+			if (ret)
+				return ret;
+			fs->qinfo[type].flags &= ~OCFS2_QF_INFO_DIRTY;
+		}
+
+		csize_drop_allocator(fs, &fs->qinfo[type].qi_inode);
+	}
+
+	csize_drop_allocator(fs, &fs->fs_cluster_alloc);
+	csize_drop_allocator(fs, &fs->fs_system_inode_alloc);
+	csize_drop_allocator(fs, &fs->fs_system_eb_alloc);
+	for (i = 0; i < max_slots; i++) {
+		if (fs->fs_inode_allocs)
+			csize_drop_allocator(fs, &fs->fs_inode_allocs[i]);
+		if (fs->fs_eb_allocs)
+			csize_drop_allocator(fs, &fs->fs_eb_allocs[i]);
+	}
+
+	return 0;
+}
+
+static int csize_has_extents(struct ocfs2_dinode *di)
+{
+	if (di->i_flags & (OCFS2_SUPER_BLOCK_FL | OCFS2_LOCAL_ALLOC_FL |
+			   OCFS2_CHAIN_FL | OCFS2_DEALLOC_FL))
+		return 0;
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return 0;
+	/* Fast symlinks keep their target in the inode */
+	if (S_ISLNK(di->i_mode) && !di->i_clusters)
+		return 0;
+
+	return 1;
+}
+
+static errcode_t csize_check_xattrs(struct ocfs2_xattr_header *xh)
+{
+	int i;
+
+	for (i = 0; i < xh->xh_count; i++) {
+		if (!ocfs2_xattr_is_local(&xh->xh_entries[i]))
+			return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+	}
+
+	return 0;
+}
+
+/* Refuses what the conversion can't move or must not lose */
+static errcode_t csize_check_inode(struct csize_ctxt *ctxt,
+				   struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_xattr_block *xb;
+
+	if (di->i_flags & OCFS2_ORPHANED_FL)
+		return TUNEFS_ET_ORPHAN_DIR_NOT_EMPTY;
+	if ((di->i_flags & OCFS2_LOCAL_ALLOC_FL) &&
+	    di->id1.bitmap1.i_total)
+		return TUNEFS_ET_LOCAL_ALLOC_NOT_EMPTY;
+	if ((di->i_flags & OCFS2_DEALLOC_FL) &&
+	    di->id2.i_dealloc.tl_used)
+		return TUNEFS_ET_TRUNCATE_LOG_NOT_EMPTY;
+	if (di->i_dyn_features & OCFS2_HAS_REFCOUNT_FL)
+		return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+
+	if (di->i_dyn_features & OCFS2_INLINE_XATTR_FL) {
+		ret = csize_check_xattrs((struct ocfs2_xattr_header *)
+					 ((char *)di + fs->fs_blocksize -
+					  di->i_xattr_inline_size));
+		if (ret)
+			return ret;
+	}
+
+	if (!di->i_xattr_loc)
+		return 0;
+
+	ret = ocfs2_read_xattr_block(fs, di->i_xattr_loc, ctxt->cs_dir_buf);
+	if (ret)
+		return ret;
+
+	xb = (struct ocfs2_xattr_block *)ctxt->cs_dir_buf;
+	if (xb->xb_flags & OCFS2_XATTR_INDEXED)
+		return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+
+	return csize_check_xattrs(&xb->xb_attrs.xb_header);
+}
+
+static errcode_t csize_read_eb(ocfs2_filesys *fs, uint64_t blkno,
+			       uint16_t parent_depth, char *buf)
+{
+	errcode_t ret;
+	struct ocfs2_extent_block *eb;
+
+	ret = ocfs2_read_extent_block(fs, blkno, buf);
+	if (ret)
+		return ret;
+
+	eb = (struct ocfs2_extent_block *)buf;
+	if (eb->h_list.l_tree_depth != parent_depth - 1)
+		return OCFS2_ET_CORRUPT_EXTENT_BLOCK;
+
+	return 0;
+}
+
+/* Collects the leaf records of a file and the extent blocks above them */
+static errcode_t csize_collect_list(struct csize_ctxt *ctxt,
+				    struct ocfs2_extent_list *el)
+{
+	errcode_t ret = 0;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_extent_rec *rec;
+	struct ocfs2_extent_block *eb;
+	char *buf = NULL;
+	int i;
+
+	if (el->l_tree_depth) {
+		ret = ocfs2_malloc_block(ctxt->cs_fs->fs_io, &buf);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		rec = &el->l_recs[i];
+
+		if (!el->l_tree_depth) {
+			if (!rec->e_leaf_clusters)
+				continue;
+			if ((rec->e_cpos % r) || (rec->e_leaf_clusters % r) ||
+			    (rec->e_blkno % ctxt->cs_new_bpc))
+				ctxt->cs_misaligned = 1;
+
+			ret = csize_reserve(&ctxt->cs_recs,
+					    &ctxt->cs_max_recs,
+					    ctxt->cs_num_recs,
+					    sizeof(struct ocfs2_extent_rec));
+			if (ret)
+				break;
+			ctxt->cs_recs[ctxt->cs_num_recs++] = *rec;
+			continue;
+		}
+
+		if ((rec->e_cpos % r) || (rec->e_int_clusters % r))
+			ctxt->cs_misaligned = 1;
+
+		ret = csize_push_blkno(&ctxt->cs_old_ebs,
+				       &ctxt->cs_num_old_ebs,
+				       &ctxt->cs_max_old_ebs, rec->e_blkno);
+		if (!ret)
+			ret = csize_read_eb(ctxt->cs_fs, rec->e_blkno,
+					    el->l_tree_depth, buf);
+		if (ret)
+			break;
+
+		eb = (struct ocfs2_extent_block *)buf;
+		ret = csize_collect_list(ctxt, &eb->h_list);
+		if (ret)
+			break;
+	}
+
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+/*
+ * Fills in the next window at or after *next that holds data.  A window
+ * stays if one physically contiguous piece with a single set of flags
+ * covers it, starting on a new cluster inside the part of the volume
+ * that is kept.
+ */
+static int csize_next_window(struct csize_ctxt *ctxt, uint32_t *idx,
+			     uint32_t *next, struct csize_window *w)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_extent_rec *rec;
+	uint32_t i = *idx, start, end, pend, expect;
+	uint64_t blkno, expect_blkno = 0;
+
+	while ((i < ctxt->cs_num_recs) &&
+	       (ctxt->cs_recs[i].e_cpos +
+		ctxt->cs_recs[i].e_leaf_clusters <= *next))
+		i++;
+	*idx = i;
+	if (i == ctxt->cs_num_recs)
+		return 0;
+
+	w->w_cpos = ocfs2_max(*next, ctxt->cs_recs[i].e_cpos / r * r);
+	w->w_first = i;
+	w->w_blkno = 0;
+	w->w_flags = 0;
+	w->w_stays = 1;
+	w->w_written = 0;
+	end = w->w_cpos + r;
+	expect = w->w_cpos;
+
+	for (; (i < ctxt->cs_num_recs) && (ctxt->cs_recs[i].e_cpos < end);
+	     i++) {
+		rec = &ctxt->cs_recs[i];
+		start = ocfs2_max(rec->e_cpos, w->w_cpos);
+		pend = ocfs2_min(rec->e_cpos + rec->e_leaf_clusters, end);
+		blkno = rec->e_blkno +
+			ocfs2_clusters_to_blocks(fs, start - rec->e_cpos);
+
+		if (i == w->w_first) {
+			w->w_blkno = blkno;
+			w->w_flags = rec->e_flags;
+		} else if ((blkno != expect_blkno) ||
+			   (rec->e_flags != w->w_flags))
+			w->w_stays = 0;
+		if (start != expect)
+			w->w_stays = 0;
+		if (!(rec->e_flags & OCFS2_EXT_UNWRITTEN))
+			w->w_written = 1;
+
+		expect = pend;
+		expect_blkno = blkno +
+			ocfs2_clusters_to_blocks(fs, pend - start);
+	}
+
+	if ((expect != end) || (w->w_blkno % ctxt->cs_new_bpc) ||
+	    ((uint64_t)ocfs2_blocks_to_clusters(fs, w->w_blkno) + r >
+	     ctxt->cs_limit))
+		w->w_stays = 0;
+
+	w->w_last = i;
+	*next = end;
+
+	return 1;
+}
+
+/* Claims an aligned run inside the part of the volume that is kept */
+static errcode_t csize_claim(struct csize_ctxt *ctxt, uint32_t clusters,
+			     uint64_t *blkno)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+
+	ret = ocfs2_new_clusters_aligned(fs, clusters, ctxt->cs_ratio, blkno);
+	if (ret)
+		return ret;
+
+	if ((uint64_t)ocfs2_blocks_to_clusters(fs, *blkno) + clusters >
+	    ctxt->cs_limit) {
+		ocfs2_free_clusters(fs, clusters, *blkno);
+		ret = OCFS2_ET_BIT_NOT_FOUND;
+	}
+
+	return ret;
+}
+
+/* Claims an aligned run for up to windows windows */
+static errcode_t csize_alloc_run(struct csize_ctxt *ctxt, uint32_t windows,
+				 int whole, uint64_t *blkno, uint32_t *got)
+{
+	errcode_t ret;
+	uint32_t want = ocfs2_min(windows, ctxt->cs_max_run);
+
+	if (whole && (want < windows))
+		return OCFS2_ET_NO_SPACE;
+
+	for (;;) {
+		ret = csize_claim(ctxt, want * ctxt->cs_ratio, blkno);
+		if ((ret != OCFS2_ET_BIT_NOT_FOUND) || whole || (want == 1))
+			break;
+		want /= 2;
+	}
+	if (ret == OCFS2_ET_BIT_NOT_FOUND)
+		ret = OCFS2_ET_NO_SPACE;
+
+	if (!ret)
+		ret = csize_add_alloc(ctxt, *blkno, want * ctxt->cs_ratio);
+	if (!ret)
+		*got = want;
+
+	return ret;
+}
+
+static errcode_t csize_flush_io(struct csize_ctxt *ctxt)
+{
+	uint32_t windows = ctxt->cs_io_windows;
+
+	if (!windows)
+		return 0;
+
+	ctxt->cs_io_windows = 0;
+	return io_write_block_nocache(ctxt->cs_fs->fs_io, ctxt->cs_io_blkno,
+				      windows * ctxt->cs_new_bpc,
+				      ctxt->cs_io_buf);
+}
+
+/* Directory trailers record the block they live in */
+static void csize_fix_trailers(struct csize_ctxt *ctxt,
+			       struct ocfs2_dinode *di, char *buf,
+			       uint32_t cpos, uint64_t blkno)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_dir_block_trailer *trailer;
+	uint64_t first = ocfs2_clusters_to_blocks(fs, cpos);
+	uint64_t size = ocfs2_blocks_in_bytes(fs, di->i_size);
+	uint32_t i;
+	char *block;
+
+	if (!S_ISDIR(di->i_mode) || !ocfs2_supports_dir_trailer(fs))
+		return;
+
+	for (i = 0; (i < ctxt->cs_new_bpc) && (first + i < size); i++) {
+		block = buf + (uint64_t)i * fs->fs_blocksize;
+		trailer = ocfs2_dir_trailer_from_block(fs, block);
+		if (memcmp(trailer->db_signature, OCFS2_DIR_TRAILER_SIGNATURE,
+			   sizeof(OCFS2_DIR_TRAILER_SIGNATURE) - 1))
+			continue;
+
+		trailer->db_blkno = cpu_to_le64(blkno + i);
+		ocfs2_compute_meta_ecc(fs, block, &trailer->db_check);
+	}
+}
+
+/*
+ * Copies a window to blkno through the I/O buffer.  Holes and unwritten
+ * pieces read as zeroes.
+ */
+static errcode_t csize_copy_window(struct csize_ctxt *ctxt,
+				   struct ocfs2_dinode *di,
+				   struct csize_window *w, uint64_t blkno)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint64_t bytes = (uint64_t)ctxt->cs_new_bpc * fs->fs_blocksize;
+	struct ocfs2_extent_rec *rec;
+	uint32_t i, start, end;
+	char *buf;
+
+	if ((ctxt->cs_io_windows == CSIZE_IO_WINDOWS) ||
+	    (ctxt->cs_io_windows &&
+	     (ctxt->cs_io_blkno +
+	      (uint64_t)ctxt->cs_io_windows * ctxt->cs_new_bpc != blkno))) {
+		ret = csize_flush_io(ctxt);
+		if (ret)
+			return ret;
+	}
+	if (!ctxt->cs_io_windows)
+		ctxt->cs_io_blkno = blkno;
+
+	buf = ctxt->cs_io_buf + ctxt->cs_io_windows * bytes;
+	memset(buf, 0, bytes);
+
+	for (i = w->w_first; i < w->w_last; i++) {
+		rec = &ctxt->cs_recs[i];
+		if (rec->e_flags & OCFS2_EXT_UNWRITTEN)
+			continue;
+
+		start = ocfs2_max(rec->e_cpos, w->w_cpos);
+		end = ocfs2_min(rec->e_cpos + rec->e_leaf_clusters,
+				w->w_cpos + ctxt->cs_ratio);
+		ret = io_read_block_nocache(fs->fs_io,
+				rec->e_blkno +
+				ocfs2_clusters_to_blocks(fs,
+							 start - rec->e_cpos),
+				ocfs2_clusters_to_blocks(fs, end - start),
+				buf + ocfs2_clusters_to_bytes(fs,
+							start - w->w_cpos));
+		if (ret)
+			return ret;
+	}
+
+	csize_fix_trailers(ctxt, di, buf, w->w_cpos, blkno);
+	ctxt->cs_io_windows++;
+
+	return 0;
+}
+
+static errcode_t csize_free_window(struct csize_ctxt *ctxt,
+				   struct csize_window *w)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_extent_rec *rec;
+	uint32_t i, start, end;
+
+	for (i = w->w_first; i < w->w_last; i++) {
+		rec = &ctxt->cs_recs[i];
+		start = ocfs2_max(rec->e_cpos, w->w_cpos);
+		end = ocfs2_min(rec->e_cpos + rec->e_leaf_clusters,
+				w->w_cpos + ctxt->cs_ratio);
+		ret = ocfs2_free_clusters(fs, end - start,
+					  rec->e_blkno +
+					  ocfs2_clusters_to_blocks(fs,
+						start - rec->e_cpos));
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* Adds a window to the new records, merging with the last one */
+static errcode_t csize_emit(struct csize_ctxt *ctxt, uint32_t cpos,
+			    uint64_t blkno, uint16_t flags)
+{
+	errcode_t ret;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_extent_rec *rec;
+
+	if (ctxt->cs_num_new_recs) {
+		rec = &ctxt->cs_new_recs[ctxt->cs_num_new_recs - 1];
+		if ((rec->e_flags == flags) &&
+		    (rec->e_cpos + rec->e_leaf_clusters == cpos) &&
+		    (rec->e_blkno +
+		     ocfs2_clusters_to_blocks(ctxt->cs_fs,
+					      rec->e_leaf_clusters) == blkno) &&
+		    ((uint32_t)rec->e_leaf_clusters + r <= ctxt->cs_max_rec)) {
+			rec->e_leaf_clusters += r;
+			return 0;
+		}
+	}
+
+	ret = csize_reserve(&ctxt->cs_new_recs, &ctxt->cs_max_new_recs,
+			    ctxt->cs_num_new_recs,
+			    sizeof(struct ocfs2_extent_rec));
+	if (ret)
+		return ret;
+
+	rec = &ctxt->cs_new_recs[ctxt->cs_num_new_recs++];
+	memset(rec, 0, sizeof(struct ocfs2_extent_rec));
+	rec->e_cpos = cpos;
+	rec->e_leaf_clusters = r;
+	rec->e_blkno = blkno;
+	rec->e_flags = flags;
+
+	return 0;
+}
+
+/*
+ * Moves the windows of a file that can't stay, rebuilds its tree and
+ * frees what it used to own.  The heartbeat is read through its first
+ * record only, so it moves whole or not at all.
+ */
+static errcode_t csize_move_file(struct csize_ctxt *ctxt,
+				 struct ocfs2_dinode *di,
+				 uint32_t windows, uint32_t moving, int whole)
+{
+	errcode_t ret = 0, err;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct csize_window w;
+	uint32_t idx = 0, next = 0, left = 0;
+	uint64_t blkno = 0, i;
+	int64_t change;
+
+	tunefs_block_signals();
+
+	while (!ret && csize_next_window(ctxt, &idx, &next, &w)) {
+		if (w.w_stays && !whole) {
+			ret = csize_emit(ctxt, w.w_cpos, w.w_blkno,
+					 w.w_flags);
+			continue;
+		}
+
+		if (!left) {
+			ret = csize_alloc_run(ctxt, moving, whole, &blkno,
+					      &left);
+			if (ret)
+				break;
+		}
+
+		if (w.w_written)
+			ret = csize_copy_window(ctxt, di, &w, blkno);
+		if (!ret)
+			ret = csize_emit(ctxt, w.w_cpos, blkno,
+					 w.w_written ? 0 :
+					 OCFS2_EXT_UNWRITTEN);
+		blkno += ctxt->cs_new_bpc;
+		left--;
+		moving--;
+	}
+	if (!ret)
+		ret = csize_flush_io(ctxt);
+	ctxt->cs_io_windows = 0;
+
+	if (!ret) {
+		change = (int64_t)windows * ctxt->cs_ratio - di->i_clusters;
+		di->i_clusters = windows * ctxt->cs_ratio;
+		ret = tunefs_rebuild_extent_tree(fs, di, ctxt->cs_new_recs,
+						 ctxt->cs_num_new_recs);
+	}
+	if (ret) {
+		csize_free_allocs(ctxt);
+		goto out;
+	}
+
+	/* The file is safe in its new home; let the old one go */
+	ctxt->cs_num_allocs = 0;
+	ocfs2_defer_allocator_writes(fs);
+	idx = next = 0;
+	while (!ret && csize_next_window(ctxt, &idx, &next, &w)) {
+		if (!w.w_stays || whole)
+			ret = csize_free_window(ctxt, &w);
+	}
+	for (i = 0; !ret && (i < ctxt->cs_num_old_ebs); i++)
+		ret = ocfs2_delete_extent_block(fs, ctxt->cs_old_ebs[i]);
+	err = ocfs2_write_deferred_allocators(fs);
+	if (!ret)
+		ret = err;
+
+	if (!ret && !ctxt->cs_system && change)
+		ret = ocfs2_apply_quota_change(fs, ctxt->cs_usrhash,
+					       ctxt->cs_grphash,
+					       di->i_uid, di->i_gid,
+					       change * fs->fs_clustersize,
+					       0);
+
+out:
+	tunefs_unblock_signals();
+	return ret;
+}
+
+static errcode_t csize_convert_file(ocfs2_filesys *fs,
+				    struct ocfs2_dinode *di,
+				    void *user_data)
+{
+	errcode_t ret = 0;
+	struct csize_ctxt *ctxt = user_data;
+	struct csize_window w;
+	uint32_t idx = 0, next = 0, windows = 0, moving = 0;
+	int whole, system = (di->i_flags & OCFS2_SYSTEM_FL) &&
+		(di->i_blkno != ctxt->cs_root_blkno);
+
+	if (ctxt->cs_dry) {
+		ctxt->cs_seen++;
+		ret = csize_check_inode(ctxt, di);
+		if (ret)
+			goto out;
+	} else if (system != ctxt->cs_system)
+		return 0;
+
+	if (!csize_has_extents(di) || !di->i_clusters)
+		goto out;
+
+	if (S_ISDIR(di->i_mode) && ocfs2_dir_indexed(di)) {
+		/* A resumed survey has them from the record */
+		if (ctxt->cs_dry && !ctxt->cs_rec_blkno)
+			ret = csize_push_blkno(&ctxt->cs_dx_dirs,
+					       &ctxt->cs_num_dx_dirs,
+					       &ctxt->cs_max_dx_dirs,
+					       di->i_blkno);
+		else if (!ctxt->cs_dry) {
+			ret = ocfs2_dx_dir_truncate(fs, di->i_blkno);
+			if (!ret)
+				ret = ocfs2_read_inode(fs, di->i_blkno,
+						       (char *)di);
+		}
+		if (ret)
+			goto out;
+	}
+
+	ctxt->cs_num_recs = 0;
+	ctxt->cs_num_new_recs = 0;
+	ctxt->cs_num_old_ebs = 0;
+	ctxt->cs_misaligned = 0;
+	ret = csize_collect_list(ctxt, &di->id2.i_list);
+	if (ret)
+		goto out;
+
+	while (csize_next_window(ctxt, &idx, &next, &w)) {
+		windows++;
+		if (!w.w_stays)
+			moving++;
+	}
+
+	whole = moving && (di->i_blkno == ctxt->cs_hb_blkno);
+	if (whole)
+		moving = windows;
+	if (!windows || (!moving && !ctxt->cs_misaligned))
+		goto out;
+
+	ctxt->cs_files++;
+	ctxt->cs_windows += moving;
+	if (!ctxt->cs_dry)
+		ret = csize_move_file(ctxt, di, windows, moving, whole);
+
+out:
+	if (ret)
+		verbosef(VL_APP,
+			 "%s while converting inode %"PRIu64"\n",
+			 error_message(ret), (uint64_t)di->i_blkno);
+	else if (ctxt->cs_prog)
+		tools_progress_step(ctxt->cs_prog, 1);
+
+	return ret;
+}
+
+/*
+ * System files go first and the quota files are read again afterwards,
+ * so charging users for rounding never goes through a stale tree.
+ */
+static errcode_t csize_convert_files(struct csize_ctxt *ctxt)
+{
+	errcode_t ret, err;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+
+	ctxt->cs_prog = tools_progress_start("Aligning files", "aligning",
+					     0);
+	if (!ctxt->cs_prog)
+		return TUNEFS_ET_NO_MEMORY;
+
+	ctxt->cs_files = ctxt->cs_windows = 0;
+	ctxt->cs_system = 1;
+	ret = csize_drop_caches(fs);
+	if (!ret)
+		ret = tunefs_foreach_inode(fs, csize_convert_file, ctxt);
+	if (!ret)
+		ret = csize_drop_caches(fs);
+	if (!ret)
+		ret = ocfs2_load_fs_quota_info(fs);
+	if (!ret)
+		ret = ocfs2_init_quota_change(fs, &ctxt->cs_usrhash,
+					      &ctxt->cs_grphash);
+	if (!ret) {
+		ctxt->cs_system = 0;
+		ret = tunefs_foreach_inode(fs, csize_convert_file, ctxt);
+		err = ocfs2_finish_quota_change(fs, ctxt->cs_usrhash,
+						ctxt->cs_grphash);
+		if (!ret)
+			ret = err;
+		ctxt->cs_usrhash = ctxt->cs_grphash = NULL;
+	}
+	if (!ret)
+		ret = csize_drop_caches(fs);
+
+	tools_progress_stop(ctxt->cs_prog);
+	ctxt->cs_prog = NULL;
+
+	if (!ret)
+		verbosef(VL_APP,
+			 "Moved %"PRIu64" windows in %"PRIu64" files\n",
+			 ctxt->cs_windows, ctxt->cs_files);
+
+	return ret;
+}
+
+static int csize_group_cmp(const void *a, const void *b)
+{
+	const struct csize_group *ga = a, *gb = b;
+
+	if (ga->g_old < gb->g_old)
+		return -1;
+	if (ga->g_old > gb->g_old)
+		return 1;
+	return 0;
+}
+
+static struct csize_group *csize_find_group(struct csize_ctxt *ctxt,
+					    uint64_t blkno)
+{
+	struct csize_group *g;
+	uint64_t lo = 0, hi = ctxt->cs_num_groups, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		g = &ctxt->cs_groups[mid];
+		if (blkno < g->g_old)
+			hi = mid;
+		else if (blkno >= g->g_old + g->g_blocks)
+			lo = mid + 1;
+		else
+			return g;
+	}
+
+	return NULL;
+}
+
+static uint64_t csize_remap(struct csize_ctxt *ctxt, uint64_t blkno)
+{
+	struct csize_group *g;
+
+	if (!blkno)
+		return 0;
+
+	g = csize_find_group(ctxt, blkno);
+	if (!g)
+		return blkno;
+
+	return g->g_new + (blkno - g->g_old);
+}
+
+/* Records the groups of a suballocator and the inodes allocated in them */
+static errcode_t csize_scan_allocator(struct csize_ctxt *ctxt, int type,
+				      int slot)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	struct ocfs2_chain_list *cl;
+	struct csize_group *g;
+	char name[OCFS2_MAX_FILENAME_LEN];
+	uint64_t blkno;
+	uint32_t bits, new_bits;
+	int i, bit;
+
+	ret = ocfs2_lookup_system_inode(fs, type, slot, &blkno);
+	if (!ret)
+		ret = ocfs2_read_inode(fs, blkno, ctxt->cs_buf);
+	if (ret)
+		return ret;
+	if (!(di->i_flags & OCFS2_CHAIN_FL))
+		return OCFS2_ET_INODE_NOT_VALID;
+
+	cl = &di->id2.i_chain;
+	bits = cl->cl_cpg * cl->cl_bpc;
+	new_bits = (bits + ctxt->cs_new_bpc - 1) / ctxt->cs_new_bpc *
+		ctxt->cs_new_bpc;
+
+	for (i = 0; i < cl->cl_next_free_rec; i++) {
+		for (blkno = cl->cl_recs[i].c_blkno; blkno;
+		     blkno = gd->bg_next_group) {
+			ret = ocfs2_read_group_desc(fs, blkno, ctxt->cs_gd_buf);
+			if (ret)
+				return ret;
+
+			if (ocfs2_gd_is_discontig(gd) ||
+			    (gd->bg_bits != bits) ||
+			    (new_bits > gd->bg_size * 8) ||
+			    (new_bits > UINT16_MAX)) {
+				ocfs2_sprintf_system_inode_name(name,
+							sizeof(name),
+							type, slot);
+				verbosef(VL_APP,
+					 "Group %"PRIu64" of \"%s\" cannot "
+					 "grow to %"PRIu32" bits\n",
+					 blkno, name, new_bits);
+				return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+			}
+
+			ret = csize_reserve(&ctxt->cs_groups,
+					    &ctxt->cs_max_groups,
+					    ctxt->cs_num_groups,
+					    sizeof(struct csize_group));
+			if (ret)
+				return ret;
+			g = &ctxt->cs_groups[ctxt->cs_num_groups++];
+			g->g_old = g->g_new = blkno;
+			g->g_blocks = bits;
+			g->g_new_blocks = new_bits;
+			g->g_inodes = (type != EXTENT_ALLOC_SYSTEM_INODE);
+
+			if (type == EXTENT_ALLOC_SYSTEM_INODE)
+				continue;
+
+			/* Bit 0 is the descriptor */
+			for (bit = 1; bit < gd->bg_bits; bit++) {
+				bit = ocfs2_find_next_bit_set(gd->bg_bitmap,
+							      gd->bg_bits,
+							      bit);
+				if (bit >= gd->bg_bits)
+					break;
+				ret = csize_push_blkno(&ctxt->cs_inodes,
+						       &ctxt->cs_num_inodes,
+						       &ctxt->cs_max_inodes,
+						       blkno + bit);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static errcode_t csize_scan_allocators(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	int slot, max_slots = OCFS2_RAW_SB(ctxt->cs_fs->fs_super)->s_max_slots;
+
+	ctxt->cs_num_groups = 0;
+	ctxt->cs_num_inodes = 0;
+
+	ret = csize_scan_allocator(ctxt, GLOBAL_INODE_ALLOC_SYSTEM_INODE, 0);
+	for (slot = 0; !ret && (slot < max_slots); slot++) {
+		ret = csize_scan_allocator(ctxt, INODE_ALLOC_SYSTEM_INODE,
+					   slot);
+		if (!ret)
+			ret = csize_scan_allocator(ctxt,
+						   EXTENT_ALLOC_SYSTEM_INODE,
+						   slot);
+	}
+
+	if (!ret)
+		qsort(ctxt->cs_groups, ctxt->cs_num_groups,
+		      sizeof(struct csize_group), csize_group_cmp);
+
+	return ret;
+}
+
+/*
+ * Decides where each group ends up.  An aligned group grows into the
+ * clusters after it when they are free; any other group gets an
+ * aligned run of its own.  A dry run only counts.  If anything can't
+ * be placed, everything claimed is given back.
+ */
+static errcode_t csize_plan_groups(struct csize_ctxt *ctxt)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct csize_group *g;
+	uint32_t clusters, grow, start, c;
+	uint64_t i;
+	int stays;
+
+	ctxt->cs_moves = ctxt->cs_grows = ctxt->cs_grow_blocks = 0;
+
+	for (i = 0; i < ctxt->cs_num_groups; i++) {
+		g = &ctxt->cs_groups[i];
+		clusters = g->g_new_blocks / ctxt->cs_old_bpc;
+		grow = (g->g_new_blocks - g->g_blocks) / ctxt->cs_old_bpc;
+
+		stays = !(g->g_old % ctxt->cs_new_bpc) &&
+			((uint64_t)ocfs2_blocks_to_clusters(fs, g->g_old) +
+			 clusters <= ctxt->cs_limit);
+		if (stays && grow) {
+			ret = ocfs2_test_clusters(fs, grow,
+						  g->g_old + g->g_blocks, 0,
+						  &stays);
+			if (ret)
+				break;
+		}
+
+		if (stays) {
+			if (!grow)
+				continue;
+			ctxt->cs_grows++;
+			ctxt->cs_grow_blocks += g->g_new_blocks - g->g_blocks;
+			if (ctxt->cs_dry)
+				continue;
+
+			start = ocfs2_blocks_to_clusters(fs, g->g_old +
+							 g->g_blocks);
+			for (c = 0; !ret && (c < grow); c++) {
+				ret = ocfs2_new_specific_cluster(fs, start + c);
+				if (!ret)
+					ret = csize_add_alloc(ctxt,
+						ocfs2_clusters_to_blocks(fs,
+							start + c), 1);
+			}
+			if (ret)
+				break;
+			continue;
+		}
+
+		ctxt->cs_moves++;
+		ctxt->cs_grow_blocks += g->g_new_blocks - g->g_blocks;
+		if (ctxt->cs_dry) {
+			ctxt->cs_windows += clusters / ctxt->cs_ratio;
+			continue;
+		}
+
+		ret = csize_claim(ctxt, clusters, &g->g_new);
+		if (ret == OCFS2_ET_BIT_NOT_FOUND)
+			ret = OCFS2_ET_NO_SPACE;
+		if (!ret)
+			ret = csize_add_alloc(ctxt, g->g_new, clusters);
+		if (ret) {
+			g->g_new = g->g_old;
+			break;
+		}
+	}
+
+	if (ret && !ctxt->cs_dry) {
+		csize_free_allocs(ctxt);
+		for (i = 0; i < ctxt->cs_num_groups; i++)
+			ctxt->cs_groups[i].g_new = ctxt->cs_groups[i].g_old;
+	}
+
+	return ret;
+}
+
+static uint64_t csize_lists_bytes(uint64_t groups, uint64_t dx_dirs)
+{
+	return groups * sizeof(struct csize_record_group) +
+		dx_dirs * sizeof(uint64_t);
+}
+
+/* Old clusters for a record of this size, in whole windows */
+static uint32_t csize_record_clusters(struct csize_ctxt *ctxt,
+				      uint64_t groups, uint64_t dx_dirs)
+{
+	uint32_t bs = ctxt->cs_fs->fs_blocksize;
+	uint64_t blocks = CSIZE_RECORD_LISTS +
+		(csize_lists_bytes(groups, dx_dirs) + bs - 1) / bs;
+
+	return (blocks + ctxt->cs_new_bpc - 1) / ctxt->cs_new_bpc *
+		ctxt->cs_ratio;
+}
+
+static errcode_t csize_write_header(struct csize_ctxt *ctxt)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct csize_record *cr = (struct csize_record *)ctxt->cs_rec_buf;
+
+	memset(ctxt->cs_rec_buf, 0, fs->fs_blocksize);
+	memcpy(cr->cr_signature, CSIZE_RECORD_SIGNATURE,
+	       sizeof(cr->cr_signature));
+	cr->cr_old_size = cpu_to_le32(ctxt->cs_old_size);
+	cr->cr_new_size = cpu_to_le32(ctxt->cs_new_size);
+	cr->cr_step = cpu_to_le32(ctxt->cs_step);
+	cr->cr_offset = cpu_to_le32(ctxt->cs_offset);
+	cr->cr_cursor = cpu_to_le64(ctxt->cs_cursor);
+	cr->cr_clusters = cpu_to_le32(ctxt->cs_rec_clusters);
+	cr->cr_scratch = cpu_to_le32(ctxt->cs_scratch);
+	cr->cr_count = cpu_to_le32(ctxt->cs_count);
+	cr->cr_scratch_crc = cpu_to_le32(ctxt->cs_scratch_crc);
+	cr->cr_num_groups = cpu_to_le64(ctxt->cs_rec_groups);
+	cr->cr_num_dx_dirs = cpu_to_le64(ctxt->cs_num_dx_dirs);
+	cr->cr_lists_crc = cpu_to_le32(ctxt->cs_lists_crc);
+	cr->cr_crc = cpu_to_le32(crc32_le(~0, (unsigned char *)cr,
+					  sizeof(struct csize_record)));
+
+	return io_write_block(fs->fs_io, ctxt->cs_rec_blkno, 1,
+			      ctxt->cs_rec_buf);
+}
+
+/* Moves the record on to the start of a step, or a point inside one */
+static errcode_t csize_set_cursor(struct csize_ctxt *ctxt, uint32_t step,
+				  uint64_t cursor, uint32_t offset)
+{
+	ctxt->cs_step = step;
+	ctxt->cs_cursor = cursor;
+	ctxt->cs_offset = offset;
+	ctxt->cs_count = 0;
+
+	return csize_write_header(ctxt);
+}
+
+/*
+ * Writes the scratch block the header doesn't name, then a header that
+ * does.  A crash in between leaves the header naming the old one.
+ */
+static errcode_t csize_write_scratch(struct csize_ctxt *ctxt,
+				     uint64_t cursor, uint32_t offset,
+				     uint32_t count)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t scratch = !ctxt->cs_scratch;
+
+	ret = io_write_block(fs->fs_io,
+			     ctxt->cs_rec_blkno + CSIZE_RECORD_SCRATCH + scratch,
+			     1, ctxt->cs_scratch_buf);
+	if (ret)
+		return ret;
+
+	ctxt->cs_scratch = scratch;
+	ctxt->cs_scratch_crc = crc32_le(~0,
+					(unsigned char *)ctxt->cs_scratch_buf,
+					fs->fs_blocksize);
+	ctxt->cs_cursor = cursor;
+	ctxt->cs_offset = offset;
+	ctxt->cs_count = count;
+
+	return csize_write_header(ctxt);
+}
+
+/* Writes the groups and directories, then the header that covers them */
+static errcode_t csize_write_record(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint64_t bytes = csize_lists_bytes(ctxt->cs_rec_groups,
+					   ctxt->cs_num_dx_dirs);
+	uint64_t blocks = (bytes + fs->fs_blocksize - 1) / fs->fs_blocksize;
+	struct csize_record_group *rg;
+	struct csize_group *g;
+	uint64_t *dx, i;
+	char *buf = NULL;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, blocks, &buf);
+	if (ret)
+		return ret;
+	memset(buf, 0, blocks * fs->fs_blocksize);
+
+	rg = (struct csize_record_group *)buf;
+	for (i = 0; i < ctxt->cs_rec_groups; i++) {
+		g = &ctxt->cs_groups[i];
+		rg[i].rg_old = cpu_to_le64(g->g_old);
+		rg[i].rg_new = cpu_to_le64(g->g_new);
+		rg[i].rg_blocks = cpu_to_le32(g->g_blocks);
+		rg[i].rg_new_blocks = cpu_to_le32(g->g_new_blocks);
+		rg[i].rg_inodes = cpu_to_le32(g->g_inodes);
+	}
+	dx = (uint64_t *)(rg + ctxt->cs_rec_groups);
+	for (i = 0; i < ctxt->cs_num_dx_dirs; i++)
+		dx[i] = cpu_to_le64(ctxt->cs_dx_dirs[i]);
+
+	ctxt->cs_lists_crc = crc32_le(~0, (unsigned char *)buf, bytes);
+	ret = io_write_block(fs->fs_io,
+			     ctxt->cs_rec_blkno + CSIZE_RECORD_LISTS, blocks,
+			     buf);
+	if (!ret)
+		ret = csize_write_header(ctxt);
+
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/* Reads the header of an interrupted conversion and its scratch block */
+static errcode_t csize_read_header(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct csize_record *cr = (struct csize_record *)ctxt->cs_rec_buf;
+	uint32_t crc;
+
+	ctxt->cs_rec_blkno = OCFS2_RAW_SB(fs->fs_super)->s_tunefs_csize_record;
+	if (!ctxt->cs_rec_blkno ||
+	    (ctxt->cs_rec_blkno + CSIZE_RECORD_LISTS >= fs->fs_blocks))
+		return OCFS2_ET_BAD_BLKNO;
+
+	ret = io_read_block(fs->fs_io, ctxt->cs_rec_blkno, 1,
+			    ctxt->cs_rec_buf);
+	if (ret)
+		return ret;
+
+	crc = le32_to_cpu(cr->cr_crc);
+	cr->cr_crc = 0;
+	if (memcmp(cr->cr_signature, CSIZE_RECORD_SIGNATURE,
+		   sizeof(cr->cr_signature)) ||
+	    (crc32_le(~0, (unsigned char *)cr,
+		      sizeof(struct csize_record)) != crc))
+		return OCFS2_ET_BAD_CRC32;
+
+	ctxt->cs_old_size = le32_to_cpu(cr->cr_old_size);
+	ctxt->cs_new_size = le32_to_cpu(cr->cr_new_size);
+	ctxt->cs_step = le32_to_cpu(cr->cr_step);
+	ctxt->cs_offset = le32_to_cpu(cr->cr_offset);
+	ctxt->cs_cursor = le64_to_cpu(cr->cr_cursor);
+	ctxt->cs_rec_clusters = le32_to_cpu(cr->cr_clusters);
+	ctxt->cs_scratch = le32_to_cpu(cr->cr_scratch);
+	ctxt->cs_count = le32_to_cpu(cr->cr_count);
+	ctxt->cs_scratch_crc = le32_to_cpu(cr->cr_scratch_crc);
+	ctxt->cs_rec_groups = le64_to_cpu(cr->cr_num_groups);
+	ctxt->cs_num_dx_dirs = le64_to_cpu(cr->cr_num_dx_dirs);
+	ctxt->cs_lists_crc = le32_to_cpu(cr->cr_lists_crc);
+	if ((ctxt->cs_step < CSIZE_STEP_ALIGN) ||
+	    (ctxt->cs_step >= CSIZE_STEP_DONE) ||
+	    (ctxt->cs_old_size < fs->fs_blocksize) ||
+	    (ctxt->cs_new_size <= ctxt->cs_old_size) ||
+	    (ctxt->cs_new_size % ctxt->cs_old_size) ||
+	    (ctxt->cs_scratch > 1) ||
+	    (ctxt->cs_count > fs->fs_blocksize / sizeof(uint32_t)))
+		return OCFS2_ET_BAD_CRC32;
+
+	if (!ctxt->cs_count)
+		return 0;
+
+	ret = io_read_block(fs->fs_io,
+			    ctxt->cs_rec_blkno + CSIZE_RECORD_SCRATCH +
+			    ctxt->cs_scratch, 1, ctxt->cs_scratch_buf);
+	if (!ret &&
+	    (crc32_le(~0, (unsigned char *)ctxt->cs_scratch_buf,
+		      fs->fs_blocksize) != ctxt->cs_scratch_crc))
+		ret = OCFS2_ET_BAD_CRC32;
+
+	return ret;
+}
+
+/* Reads the groups and directories back from the record */
+static errcode_t csize_read_lists(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint64_t bytes = csize_lists_bytes(ctxt->cs_rec_groups,
+					   ctxt->cs_num_dx_dirs);
+	uint64_t blocks = (bytes + fs->fs_blocksize - 1) / fs->fs_blocksize;
+	struct csize_record_group *rg;
+	struct csize_group *g;
+	uint64_t *dx, i;
+	char *buf = NULL;
+
+	if ((ctxt->cs_rec_clusters * (uint64_t)ctxt->cs_old_bpc <
+	     CSIZE_RECORD_LISTS + blocks) ||
+	    (ctxt->cs_rec_blkno + CSIZE_RECORD_LISTS + blocks >
+	     fs->fs_blocks))
+		return OCFS2_ET_BAD_CRC32;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, blocks, &buf);
+	if (!ret)
+		ret = io_read_block(fs->fs_io,
+				    ctxt->cs_rec_blkno + CSIZE_RECORD_LISTS,
+				    blocks, buf);
+	if (!ret && (crc32_le(~0, (unsigned char *)buf, bytes) !=
+		     ctxt->cs_lists_crc))
+		ret = OCFS2_ET_BAD_CRC32;
+	if (!ret && ctxt->cs_rec_groups)
+		ret = ocfs2_malloc(ctxt->cs_rec_groups *
+				   sizeof(struct csize_group),
+				   &ctxt->cs_groups);
+	if (!ret && ctxt->cs_num_dx_dirs)
+		ret = ocfs2_malloc(ctxt->cs_num_dx_dirs * sizeof(uint64_t),
+				   &ctxt->cs_dx_dirs);
+	if (ret)
+		goto out;
+
+	rg = (struct csize_record_group *)buf;
+	ctxt->cs_num_groups = ctxt->cs_max_groups = ctxt->cs_rec_groups;
+	for (i = 0; i < ctxt->cs_rec_groups; i++) {
+		g = &ctxt->cs_groups[i];
+		g->g_old = le64_to_cpu(rg[i].rg_old);
+		g->g_new = le64_to_cpu(rg[i].rg_new);
+		g->g_blocks = le32_to_cpu(rg[i].rg_blocks);
+		g->g_new_blocks = le32_to_cpu(rg[i].rg_new_blocks);
+		g->g_inodes = le32_to_cpu(rg[i].rg_inodes);
+	}
+	dx = (uint64_t *)(rg + ctxt->cs_rec_groups);
+	ctxt->cs_max_dx_dirs = ctxt->cs_num_dx_dirs;
+	for (i = 0; i < ctxt->cs_num_dx_dirs; i++)
+		ctxt->cs_dx_dirs[i] = le64_to_cpu(dx[i]);
+
+out:
+	if (buf)
+		ocfs2_free(&buf);
+	return ret;
+}
+
+/* The directories and the global bitmap as they are once remapped */
+static void csize_remap_known(struct csize_ctxt *ctxt)
+{
+	uint64_t i;
+
+	for (i = 0; i < ctxt->cs_num_dx_dirs; i++)
+		ctxt->cs_dx_dirs[i] = csize_remap(ctxt, ctxt->cs_dx_dirs[i]);
+	ctxt->cs_bitmap_blkno = csize_remap(ctxt, ctxt->cs_bitmap_blkno);
+}
+
+/*
+ * Writes a record starting at step and points the superblock at it,
+ * marking the volume if it isn't yet.  The record it replaces is given
+ * back afterwards; stopping in between only leaks it.  Until the
+ * superblock is written, a failure gives back everything claimed.
+ */
+static errcode_t csize_new_record(struct csize_ctxt *ctxt, uint32_t step)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	uint64_t old_blkno = ctxt->cs_rec_blkno;
+	uint32_t old_clusters = ctxt->cs_rec_clusters, clusters;
+
+	clusters = csize_record_clusters(ctxt, ctxt->cs_rec_groups,
+					 ctxt->cs_num_dx_dirs);
+	ret = csize_claim(ctxt, clusters, &ctxt->cs_rec_blkno);
+	if (ret == OCFS2_ET_BIT_NOT_FOUND)
+		ret = OCFS2_ET_NO_SPACE;
+	if (!ret)
+		ret = csize_add_alloc(ctxt, ctxt->cs_rec_blkno, clusters);
+	if (ret)
+		goto out;
+
+	ctxt->cs_rec_clusters = clusters;
+	ctxt->cs_scratch = 0;
+	ctxt->cs_step = step;
+	ctxt->cs_cursor = ctxt->cs_offset = ctxt->cs_count = 0;
+	ret = csize_write_record(ctxt);
+	if (ret)
+		goto out;
+
+	sb->s_tunefs_csize_record = ctxt->cs_rec_blkno;
+	ret = tunefs_set_in_progress(fs, OCFS2_TUNEFS_INPROG_CLUSTER_SIZE);
+	if (ret) {
+		sb->s_tunefs_csize_record = old_blkno;
+		if (!old_blkno)
+			tunefs_clear_in_progress(fs,
+					OCFS2_TUNEFS_INPROG_CLUSTER_SIZE);
+		goto out;
+	}
+
+	/* The record owns the claims now */
+	ctxt->cs_num_allocs = 0;
+	if (old_blkno)
+		ret = ocfs2_free_clusters(fs, old_clusters, old_blkno);
+	return ret;
+
+out:
+	ctxt->cs_rec_blkno = old_blkno;
+	ctxt->cs_rec_clusters = old_clusters;
+	csize_free_allocs(ctxt);
+	return ret;
+}
+
+/*
+ * Plans the groups and replaces the record with one that holds the
+ * plan.  Every step is taken, so a suballocator left miscounted by a
+ * stop while aligning is summed again when it is remapped.
+ */
+static errcode_t csize_begin(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+
+	ret = csize_scan_allocators(ctxt);
+	if (!ret)
+		ret = csize_plan_groups(ctxt);
+	if (ret)
+		return ret;
+
+	ctxt->cs_rec_groups = ctxt->cs_num_groups;
+	ret = csize_new_record(ctxt, CSIZE_STEP_COPY);
+	if (ret)
+		return ret;
+
+	csize_remap_known(ctxt);
+	verbosef(VL_APP,
+		 "Moving %"PRIu64" and growing %"PRIu64" allocator groups\n",
+		 ctxt->cs_moves, ctxt->cs_grows);
+
+	return 0;
+}
+
+static errcode_t csize_copy_blocks(struct csize_ctxt *ctxt, uint64_t from,
+				   uint64_t to, uint32_t blocks)
+{
+	errcode_t ret = 0;
+	uint32_t max = CSIZE_IO_WINDOWS * ctxt->cs_new_bpc, done, n;
+	io_channel *io = ctxt->cs_fs->fs_io;
+
+	for (done = 0; !ret && (done < blocks); done += n) {
+		n = ocfs2_min(blocks - done, max);
+		ret = io_read_block_nocache(io, from + done, n,
+					    ctxt->cs_io_buf);
+		if (!ret)
+			ret = io_write_block_nocache(io, to + done, n,
+						     ctxt->cs_io_buf);
+	}
+
+	return ret;
+}
+
+/* Copies moved groups as they are and zeroes what every group gains */
+static errcode_t csize_copy_groups(struct csize_ctxt *ctxt)
+{
+	errcode_t ret = 0;
+	struct csize_group *g;
+	uint64_t i;
+
+	for (i = 0; !ret && (i < ctxt->cs_num_groups); i++) {
+		g = &ctxt->cs_groups[i];
+		if (g->g_new != g->g_old) {
+			ret = csize_copy_blocks(ctxt, g->g_old, g->g_new,
+						g->g_blocks);
+			tools_progress_step(ctxt->cs_prog, 1);
+		}
+		if (!ret && (g->g_new_blocks > g->g_blocks))
+			ret = tunefs_empty_clusters(ctxt->cs_fs,
+					g->g_new + g->g_blocks,
+					(g->g_new_blocks - g->g_blocks) /
+					ctxt->cs_old_bpc);
+	}
+
+	return ret;
+}
+
+static errcode_t csize_remap_dirents(struct csize_ctxt *ctxt, char *buf,
+				     unsigned int end, int *changed)
+{
+	struct ocfs2_dir_entry *de;
+	unsigned int offset = 0;
+	uint64_t ino;
+
+	while (offset < end) {
+		de = (struct ocfs2_dir_entry *)(buf + offset);
+		if ((de->rec_len < OCFS2_DIR_MIN_REC_LEN) ||
+		    (offset + de->rec_len > end))
+			return OCFS2_ET_DIR_CORRUPTED;
+
+		if (de->inode) {
+			ino = csize_remap(ctxt, de->inode);
+			if (ino != de->inode) {
+				de->inode = ino;
+				*changed = 1;
+			}
+		}
+		offset += de->rec_len;
+	}
+
+	return 0;
+}
+
+static int csize_remap_dir_block(ocfs2_filesys *fs, uint64_t blkno,
+				 uint64_t bcount, uint16_t ext_flags,
+				 void *priv_data)
+{
+	struct csize_ctxt *ctxt = priv_data;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_dir_block_trailer *trailer;
+	unsigned int end = fs->fs_blocksize;
+	int changed = 0;
+
+	if (bcount >= ocfs2_blocks_in_bytes(fs, di->i_size))
+		return 0;
+
+	ctxt->cs_err = ocfs2_read_dir_block(fs, di, blkno, ctxt->cs_dir_buf);
+	if (ctxt->cs_err)
+		return OCFS2_BLOCK_ABORT;
+
+	if (ocfs2_dir_has_trailer(fs, di)) {
+		end = ocfs2_dir_trailer_blk_off(fs);
+		trailer = ocfs2_dir_trailer_from_block(fs, ctxt->cs_dir_buf);
+		if (trailer->db_parent_dinode != di->i_blkno) {
+			trailer->db_parent_dinode = di->i_blkno;
+			changed = 1;
+		}
+	}
+
+	ctxt->cs_err = csize_remap_dirents(ctxt, ctxt->cs_dir_buf, end,
+					   &changed);
+	if (!ctxt->cs_err && changed)
+		ctxt->cs_err = ocfs2_write_dir_block(fs, di, blkno,
+						     ctxt->cs_dir_buf);
+
+	return ctxt->cs_err ? OCFS2_BLOCK_ABORT : 0;
+}
+
+static errcode_t csize_remap_dir(struct csize_ctxt *ctxt,
+				 struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	int changed = 0;
+
+	if (di->i_dyn_features & OCFS2_INLINE_DATA_FL)
+		return csize_remap_dirents(ctxt,
+				(char *)di->id2.i_data.id_data,
+				ocfs2_min((uint64_t)di->i_size,
+					  (uint64_t)di->id2.i_data.id_count),
+				&changed);
+
+	ctxt->cs_err = 0;
+	ret = ocfs2_block_iterate_inode(ctxt->cs_fs, di, 0,
+					csize_remap_dir_block, ctxt);
+	if (!ret)
+		ret = ctxt->cs_err;
+
+	return ret;
+}
+
+static errcode_t csize_remap_xattr(struct csize_ctxt *ctxt,
+				   struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	struct ocfs2_xattr_block *xb =
+		(struct ocfs2_xattr_block *)ctxt->cs_dir_buf;
+	uint64_t blkno = csize_remap(ctxt, di->i_xattr_loc);
+
+	if (blkno == di->i_xattr_loc)
+		return 0;
+
+	ret = ocfs2_read_xattr_block(ctxt->cs_fs, di->i_xattr_loc,
+				     ctxt->cs_dir_buf);
+	if (ret)
+		return ret;
+
+	xb->xb_blkno = blkno;
+	if (xb->xb_suballoc_loc)
+		xb->xb_suballoc_loc = csize_remap(ctxt, xb->xb_suballoc_loc);
+	ret = ocfs2_write_xattr_block(ctxt->cs_fs, blkno, ctxt->cs_dir_buf);
+	if (!ret)
+		di->i_xattr_loc = blkno;
+
+	return ret;
+}
+
+/* Reads each extent block where it was and writes it where it goes */
+static errcode_t csize_remap_list(struct csize_ctxt *ctxt,
+				  struct ocfs2_extent_list *el)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_extent_rec *rec;
+	struct ocfs2_extent_block *eb;
+	char *buf = NULL;
+	uint64_t blkno;
+	int i;
+
+	if (!el->l_tree_depth)
+		return 0;
+
+	ret = ocfs2_malloc_blocks(fs->fs_io, 2, &buf);
+	if (ret)
+		return ret;
+
+	eb = (struct ocfs2_extent_block *)buf;
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		rec = &el->l_recs[i];
+		blkno = rec->e_blkno;
+
+		ret = csize_read_eb(fs, blkno, el->l_tree_depth, buf);
+		if (ret)
+			break;
+		memcpy(buf + fs->fs_blocksize, buf, fs->fs_blocksize);
+
+		eb->h_blkno = csize_remap(ctxt, blkno);
+		if (eb->h_suballoc_loc)
+			eb->h_suballoc_loc = csize_remap(ctxt,
+							 eb->h_suballoc_loc);
+		eb->h_next_leaf_blk = csize_remap(ctxt, eb->h_next_leaf_blk);
+
+		ret = csize_remap_list(ctxt, &eb->h_list);
+		if (!ret && ((eb->h_blkno != blkno) ||
+			     memcmp(buf, buf + fs->fs_blocksize,
+				    fs->fs_blocksize)))
+			ret = ocfs2_write_extent_block(fs, eb->h_blkno, buf);
+		if (ret)
+			break;
+
+		rec->e_blkno = eb->h_blkno;
+	}
+
+	ocfs2_free(&buf);
+	return ret;
+}
+
+/*
+ * Relinks the groups of an allocator.  A suballocator's groups grow to a
+ * whole number of new clusters, so its geometry follows.  Its counts are
+ * summed again, as some groups may have grown already or a stop may have
+ * left them behind their descriptors.
+ */
+static errcode_t csize_remap_chain(struct csize_ctxt *ctxt, uint64_t blkno,
+				   struct ocfs2_dinode *di)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	struct ocfs2_chain_rec *cr;
+	uint64_t next, gd_blkno, total = 0, free_bits = 0;
+	uint32_t grow, bpc = ctxt->cs_new_bpc;
+	int i, global = (csize_remap(ctxt, blkno) == ctxt->cs_bitmap_blkno);
+
+	for (i = 0; i < cl->cl_next_free_rec; i++) {
+		cr = &cl->cl_recs[i];
+		next = cr->c_blkno;
+		cr->c_blkno = csize_remap(ctxt, next);
+		if (!global)
+			cr->c_total = cr->c_free = 0;
+
+		while (next) {
+			gd_blkno = next;
+			ret = ocfs2_read_group_desc(fs, gd_blkno,
+						    ctxt->cs_gd_buf);
+			if (ret)
+				return ret;
+			memcpy(ctxt->cs_gd_orig_buf, ctxt->cs_gd_buf,
+			       fs->fs_blocksize);
+
+			next = gd->bg_next_group;
+			gd->bg_blkno = csize_remap(ctxt, gd_blkno);
+			gd->bg_next_group = csize_remap(ctxt, next);
+			gd->bg_parent_dinode = di->i_blkno;
+			if (!global) {
+				grow = (gd->bg_bits + bpc - 1) / bpc * bpc -
+					gd->bg_bits;
+				gd->bg_bits += grow;
+				gd->bg_free_bits_count += grow;
+				cr->c_total += gd->bg_bits;
+				cr->c_free += gd->bg_free_bits_count;
+			}
+
+			if ((gd->bg_blkno != gd_blkno) ||
+			    memcmp(ctxt->cs_gd_buf, ctxt->cs_gd_orig_buf,
+				   fs->fs_blocksize)) {
+				ret = ocfs2_write_group_desc(fs, gd->bg_blkno,
+							     ctxt->cs_gd_buf);
+				if (ret)
+					return ret;
+			}
+		}
+		total += cr->c_total;
+		free_bits += cr->c_free;
+	}
+
+	if (global || !cl->cl_next_free_rec)
+		return 0;
+
+	cl->cl_cpg = (cl->cl_cpg * cl->cl_bpc + bpc - 1) / bpc * bpc /
+		cl->cl_bpc;
+	di->id1.bitmap1.i_total = total;
+	di->id1.bitmap1.i_used = total - free_bits;
+	di->i_clusters = total / ctxt->cs_old_bpc;
+	di->i_size = (uint64_t)di->i_clusters * fs->fs_clustersize;
+
+	return 0;
+}
+
+/*
+ * Every block an inode points at is read where it is now.  The inode is
+ * written at its new home once everything below it is.
+ */
+static errcode_t csize_remap_inode(struct csize_ctxt *ctxt, uint64_t blkno)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+
+	ret = ocfs2_read_inode(fs, blkno, ctxt->cs_buf);
+	if (ret)
+		return ret;
+	memcpy(ctxt->cs_orig_buf, ctxt->cs_buf, fs->fs_blocksize);
+
+	di->i_blkno = csize_remap(ctxt, blkno);
+	if (di->i_suballoc_loc)
+		di->i_suballoc_loc = csize_remap(ctxt, di->i_suballoc_loc);
+
+	if (S_ISDIR(di->i_mode))
+		ret = csize_remap_dir(ctxt, di);
+	if (!ret && di->i_xattr_loc)
+		ret = csize_remap_xattr(ctxt, di);
+	if (!ret) {
+		if (di->i_flags & OCFS2_CHAIN_FL)
+			ret = csize_remap_chain(ctxt, blkno, di);
+		else if (csize_has_extents(di) &&
+			 di->id2.i_list.l_tree_depth) {
+			ret = csize_remap_list(ctxt, &di->id2.i_list);
+			di->i_last_eb_blk = csize_remap(ctxt,
+							di->i_last_eb_blk);
+		}
+	}
+	if (ret)
+		return ret;
+
+	if ((di->i_blkno == blkno) &&
+	    !memcmp(ctxt->cs_buf, ctxt->cs_orig_buf, fs->fs_blocksize))
+		return 0;
+
+	return ocfs2_write_inode(fs, di->i_blkno, ctxt->cs_buf);
+}
+
+/* Remaps the inodes of a group, read from the old copy of the group */
+static errcode_t csize_remap_group(struct csize_ctxt *ctxt,
+				   struct csize_group *g)
+{
+	errcode_t ret;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	uint64_t i;
+	int bit;
+
+	ret = ocfs2_read_group_desc(ctxt->cs_fs, g->g_old, ctxt->cs_gd_buf);
+	if (ret)
+		return ret;
+
+	/* Bit 0 is the descriptor */
+	ctxt->cs_num_inodes = 0;
+	for (bit = 1; bit < gd->bg_bits; bit++) {
+		bit = ocfs2_find_next_bit_set(gd->bg_bitmap, gd->bg_bits, bit);
+		if (bit >= gd->bg_bits)
+			break;
+		ret = csize_push_blkno(&ctxt->cs_inodes, &ctxt->cs_num_inodes,
+				       &ctxt->cs_max_inodes, g->g_old + bit);
+		if (ret)
+			return ret;
+	}
+
+	for (i = 0; i < ctxt->cs_num_inodes; i++) {
+		ret = csize_remap_inode(ctxt, ctxt->cs_inodes[i]);
+		if (ret) {
+			verbosef(VL_APP,
+				 "%s while remapping inode %"PRIu64"\n",
+				 error_message(ret), ctxt->cs_inodes[i]);
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Rewrites everything that points into the groups, one group of inodes
+ * at a time, and then the superblock.  The old copies stay untouched
+ * until the groups are freed, so a group can be remapped again.
+ */
+static errcode_t csize_remap_groups(struct csize_ctxt *ctxt)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	uint64_t i;
+
+	for (i = ctxt->cs_cursor; !ret && (i < ctxt->cs_num_groups); i++) {
+		if (!ctxt->cs_groups[i].g_inodes)
+			continue;
+
+		ret = csize_remap_group(ctxt, &ctxt->cs_groups[i]);
+		if (!ret)
+			ret = csize_set_cursor(ctxt, CSIZE_STEP_REMAP, i + 1,
+					       0);
+		tools_progress_step(ctxt->cs_prog, 1);
+	}
+	if (ret)
+		return ret;
+
+	sb->s_root_blkno = csize_remap(ctxt, sb->s_root_blkno);
+	sb->s_system_dir_blkno = csize_remap(ctxt, sb->s_system_dir_blkno);
+	fs->fs_root_blkno = sb->s_root_blkno;
+	fs->fs_sysdir_blkno = sb->s_system_dir_blkno;
+	ret = ocfs2_write_primary_super(fs);
+	if (!ret)
+		ret = csize_drop_caches(fs);
+
+	return ret;
+}
+
+/* An old group that was given back already is left alone */
+static errcode_t csize_free_old_groups(struct csize_ctxt *ctxt)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct csize_group *g;
+	uint32_t clusters;
+	uint64_t i;
+	int used;
+
+	for (i = 0; !ret && (i < ctxt->cs_num_groups); i++) {
+		g = &ctxt->cs_groups[i];
+		if (g->g_new == g->g_old)
+			continue;
+
+		clusters = g->g_blocks / ctxt->cs_old_bpc;
+		ret = ocfs2_test_clusters(fs, clusters, g->g_old, 1, &used);
+		if (!ret && used)
+			ret = ocfs2_free_clusters(fs, clusters, g->g_old);
+	}
+
+	return ret;
+}
+
+/* Checks that every record of a tree covers whole new clusters */
+static errcode_t csize_check_list(struct csize_ctxt *ctxt,
+				  struct ocfs2_extent_list *el)
+{
+	errcode_t ret = 0;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_extent_rec *rec;
+	struct ocfs2_extent_block *eb;
+	char *buf = NULL;
+	int i;
+
+	if (el->l_tree_depth) {
+		ret = ocfs2_malloc_block(fs->fs_io, &buf);
+		if (ret)
+			return ret;
+	}
+
+	eb = (struct ocfs2_extent_block *)buf;
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		rec = &el->l_recs[i];
+		if ((rec->e_cpos % r) ||
+		    (ocfs2_rec_clusters(el->l_tree_depth, rec) % r) ||
+		    (!el->l_tree_depth &&
+		     (rec->e_blkno % ctxt->cs_new_bpc))) {
+			ret = TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+			break;
+		}
+
+		if (!el->l_tree_depth)
+			continue;
+
+		ret = csize_read_eb(fs, rec->e_blkno, el->l_tree_depth, buf);
+		if (!ret)
+			ret = csize_check_list(ctxt, &eb->h_list);
+		if (ret)
+			break;
+	}
+
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+static errcode_t csize_check_tree(struct csize_ctxt *ctxt, uint64_t blkno)
+{
+	errcode_t ret;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+
+	ret = ocfs2_read_inode(ctxt->cs_fs, blkno, ctxt->cs_buf);
+	if (ret)
+		return ret;
+
+	if (di->i_flags & OCFS2_CHAIN_FL) {
+		if (blkno == ctxt->cs_bitmap_blkno)
+			return 0;
+		return ((cl->cl_cpg % r) || (di->i_clusters % r)) ?
+			TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE : 0;
+	}
+	if (!csize_has_extents(di))
+		return 0;
+	if (di->i_clusters % r)
+		return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+
+	return csize_check_list(ctxt, &di->id2.i_list);
+}
+
+static uint64_t csize_global_group(struct csize_ctxt *ctxt, uint32_t k)
+{
+	if (!k)
+		return ctxt->cs_fs->fs_first_cg_blkno;
+
+	return (uint64_t)k * ctxt->cs_cpg * ctxt->cs_new_bpc;
+}
+
+static uint64_t csize_old_group(struct csize_ctxt *ctxt, uint32_t j)
+{
+	if (!j)
+		return ctxt->cs_fs->fs_first_cg_blkno;
+
+	return (uint64_t)j * ctxt->cs_cpg * ctxt->cs_old_bpc;
+}
+
+/* Reads the old global bitmap and checks that its groups can fold */
+static errcode_t csize_read_bitmap(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+
+	ret = ocfs2_read_inode(ctxt->cs_fs, ctxt->cs_bitmap_blkno,
+			       ctxt->cs_buf);
+	if (ret)
+		return ret;
+
+	if ((cl->cl_bpc != 1) || (cl->cl_cpg % ctxt->cs_ratio)) {
+		verbosef(VL_APP,
+			 "The global bitmap has %u clusters per group and "
+			 "%u per bit\n", cl->cl_cpg, cl->cl_bpc);
+		return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+	}
+	ctxt->cs_cpg = cl->cl_cpg;
+	ctxt->cs_max_run = ocfs2_max(ctxt->cs_cpg / ctxt->cs_ratio - 1, 1U);
+
+	return 0;
+}
+
+/*
+ * Reads old global group j from blkno, which is where it lives unless
+ * a copy is being read back from the record.
+ */
+static errcode_t csize_read_old_group(struct csize_ctxt *ctxt, uint32_t j,
+				      uint64_t blkno, char *buf)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_group_desc *gd = (struct ocfs2_group_desc *)buf;
+	uint64_t expect = csize_old_group(ctxt, j);
+	uint32_t cpg = ctxt->cs_cpg;
+
+	ret = ocfs2_read_group_desc(fs, blkno, buf);
+	if (ret)
+		return ret;
+
+	if ((gd->bg_blkno != expect) ||
+	    (gd->bg_bits != ocfs2_min(cpg, fs->fs_clusters - j * cpg))) {
+		verbosef(VL_APP,
+			 "Global bitmap group %"PRIu64" is not where or as "
+			 "large as expected\n", expect);
+		return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+	}
+
+	return 0;
+}
+
+/*
+ * Marks the new clusters that old group j uses in gd, the new group
+ * covering it, or only checks them if gd is NULL.  The descriptors of
+ * old groups that don't start a new group are not carried over.
+ */
+static errcode_t csize_fold_group(struct csize_ctxt *ctxt, uint32_t j,
+				  struct ocfs2_group_desc *old,
+				  struct ocfs2_group_desc *gd)
+{
+	uint32_t r = ctxt->cs_ratio, cpg = ctxt->cs_cpg, c;
+	int b, retired;
+
+	retired = j && ((j % r) || ((uint64_t)j * cpg >= ctxt->cs_limit));
+	for (b = 0; b < old->bg_bits; b++) {
+		b = ocfs2_find_next_bit_set(old->bg_bitmap, old->bg_bits, b);
+		if (b >= old->bg_bits)
+			break;
+		if (!b && retired)
+			continue;
+
+		c = j * cpg + b;
+		if (c >= ctxt->cs_limit) {
+			verbosef(VL_APP,
+				 "Cluster %"PRIu32" past the end of the "
+				 "converted volume is in use\n", c);
+			return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+		}
+		if (gd)
+			ocfs2_set_bit(c / r - j / r * cpg, gd->bg_bitmap);
+	}
+
+	return 0;
+}
+
+/* Counts the free aligned windows below the limit */
+static errcode_t csize_count_windows(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	uint32_t r = ctxt->cs_ratio, cpg, groups, j, end;
+	int b, set;
+
+	ret = csize_read_bitmap(ctxt);
+	if (ret)
+		return ret;
+
+	cpg = ctxt->cs_cpg;
+	groups = (fs->fs_clusters + cpg - 1) / cpg;
+	for (j = 0; j < groups; j++) {
+		ret = csize_read_old_group(ctxt, j, csize_old_group(ctxt, j),
+					   ctxt->cs_gd_buf);
+		if (ret)
+			return ret;
+
+		end = 0;
+		if ((uint64_t)j * cpg < ctxt->cs_limit)
+			end = ocfs2_min((uint32_t)gd->bg_bits,
+					ctxt->cs_limit - j * cpg);
+		b = 0;
+		while (b + r <= end) {
+			set = ocfs2_find_next_bit_set(gd->bg_bitmap,
+						      gd->bg_bits, b);
+			if (set > (int)end)
+				set = end;
+			ctxt->cs_free_windows += (set - b) / r;
+			b = (set / r + 1) * r;
+		}
+	}
+
+	return 0;
+}
+
+/* Checks that nothing past the limit is in use */
+static errcode_t csize_check_bitmap(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t cpg, groups, j;
+
+	ret = csize_read_bitmap(ctxt);
+	if (ret)
+		return ret;
+
+	cpg = ctxt->cs_cpg;
+	groups = (fs->fs_clusters + cpg - 1) / cpg;
+	for (j = 0; !ret && (j < groups); j++) {
+		ret = csize_read_old_group(ctxt, j, csize_old_group(ctxt, j),
+					   ctxt->cs_gd_buf);
+		if (!ret)
+			ret = csize_fold_group(ctxt, j,
+				(struct ocfs2_group_desc *)ctxt->cs_gd_buf,
+				NULL);
+	}
+
+	return ret;
+}
+
+/*
+ * Everything must own whole new clusters before any count is divided.
+ * Nothing has been divided yet, so a volume that fails here is still
+ * whole under the old geometry.
+ */
+static errcode_t csize_check_switch(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	struct csize_group *g;
+	uint64_t i;
+
+	ret = csize_scan_allocators(ctxt);
+	for (i = 0; !ret && (i < ctxt->cs_num_groups); i++) {
+		g = &ctxt->cs_groups[i];
+		if ((g->g_old % ctxt->cs_new_bpc) ||
+		    (g->g_blocks % ctxt->cs_new_bpc))
+			ret = TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+	}
+	for (i = 0; !ret && (i < ctxt->cs_num_inodes); i++) {
+		ret = csize_check_tree(ctxt, ctxt->cs_inodes[i]);
+		if (ret)
+			verbosef(VL_APP,
+				 "%s while checking inode %"PRIu64"\n",
+				 error_message(ret), ctxt->cs_inodes[i]);
+	}
+	if (!ret)
+		ret = csize_check_bitmap(ctxt);
+
+	return ret;
+}
+
+/*
+ * Lists the extent blocks of an inode and returns how many blocks it
+ * has to flip, the inode itself last.  Some inodes have none.
+ */
+static errcode_t csize_flip_blocks(struct csize_ctxt *ctxt, uint64_t blkno,
+				   uint32_t *blocks)
+{
+	errcode_t ret;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+
+	*blocks = 0;
+	ctxt->cs_num_recs = 0;
+	ctxt->cs_num_old_ebs = 0;
+
+	ret = ocfs2_read_inode(ctxt->cs_fs, blkno, ctxt->cs_buf);
+	if (ret)
+		return ret;
+
+	if (di->i_flags & OCFS2_CHAIN_FL) {
+		if (blkno == ctxt->cs_bitmap_blkno)
+			return 0;
+	} else if (!csize_has_extents(di) ||
+		   (!di->i_clusters && !di->id2.i_list.l_next_free_rec))
+		return 0;
+	else {
+		ret = csize_collect_list(ctxt, &di->id2.i_list);
+		if (ret)
+			return ret;
+	}
+
+	*blocks = ctxt->cs_num_old_ebs + 1;
+	return 0;
+}
+
+static errcode_t csize_read_flip(struct csize_ctxt *ctxt,
+				 struct csize_flip *f, uint32_t *crc)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+
+	if (f->f_inode)
+		ret = ocfs2_read_inode(fs, f->f_blkno, ctxt->cs_buf);
+	else
+		ret = ocfs2_read_extent_block(fs, f->f_blkno, ctxt->cs_buf);
+	if (!ret)
+		*crc = crc32_le(~0, (unsigned char *)ctxt->cs_buf,
+				fs->fs_blocksize);
+
+	return ret;
+}
+
+static void csize_flip_list(struct csize_ctxt *ctxt,
+			    struct ocfs2_extent_list *el)
+{
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_extent_rec *rec;
+	int i;
+
+	for (i = 0; i < el->l_next_free_rec; i++) {
+		rec = &el->l_recs[i];
+		rec->e_cpos /= r;
+		if (el->l_tree_depth)
+			rec->e_int_clusters /= r;
+		else
+			rec->e_leaf_clusters /= r;
+	}
+}
+
+/* Divides the counts of the block just read and writes it back */
+static errcode_t csize_flip_block(struct csize_ctxt *ctxt,
+				  struct csize_flip *f)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t r = ctxt->cs_ratio;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_extent_block *eb =
+		(struct ocfs2_extent_block *)ctxt->cs_buf;
+
+	if (!f->f_inode) {
+		csize_flip_list(ctxt, &eb->h_list);
+		return ocfs2_write_extent_block(fs, f->f_blkno, ctxt->cs_buf);
+	}
+
+	if (di->i_flags & OCFS2_CHAIN_FL) {
+		di->id2.i_chain.cl_cpg /= r;
+		di->id2.i_chain.cl_bpc *= r;
+	} else
+		csize_flip_list(ctxt, &di->id2.i_list);
+	di->i_clusters /= r;
+
+	return ocfs2_write_inode(fs, f->f_blkno, ctxt->cs_buf);
+}
+
+/*
+ * Flips a batch.  Unless the record already holds them, the crc32s of
+ * its blocks go to a scratch block first.  A block that no longer
+ * matches was flipped before we were interrupted.
+ */
+static errcode_t csize_flip_batch(struct csize_ctxt *ctxt, uint64_t cursor,
+				  uint32_t offset, uint32_t count, int saved)
+{
+	errcode_t ret = 0;
+	uint32_t *crcs = (uint32_t *)ctxt->cs_scratch_buf;
+	uint32_t i, crc;
+
+	if (!saved) {
+		memset(ctxt->cs_scratch_buf, 0, ctxt->cs_fs->fs_blocksize);
+		for (i = 0; !ret && (i < count); i++) {
+			ret = csize_read_flip(ctxt, &ctxt->cs_flips[i], &crc);
+			crcs[i] = cpu_to_le32(crc);
+		}
+		if (!ret)
+			ret = csize_write_scratch(ctxt, cursor, offset, count);
+	}
+
+	for (i = 0; !ret && (i < count); i++) {
+		ret = csize_read_flip(ctxt, &ctxt->cs_flips[i], &crc);
+		if (!ret && (crc == le32_to_cpu(crcs[i])))
+			ret = csize_flip_block(ctxt, &ctxt->cs_flips[i]);
+		tools_progress_step(ctxt->cs_prog, 1);
+	}
+
+	return ret;
+}
+
+/*
+ * Divides the counts of every allocator and extent tree by the ratio, a
+ * batch of blocks at a time.  The record names the inode and block the
+ * batch in flight starts at, and the batch after it starts afresh.
+ */
+static errcode_t csize_flip(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	uint32_t max = ctxt->cs_fs->fs_blocksize / sizeof(uint32_t);
+	uint32_t offset = ctxt->cs_offset, start_offset = offset;
+	uint32_t blocks = 0, count = 0;
+	uint64_t i = ctxt->cs_cursor, start = i, loaded = UINT64_MAX;
+	int saved = !!ctxt->cs_count;
+	struct csize_flip *f;
+
+	if (saved)
+		max = ctxt->cs_count;
+
+	ret = csize_scan_allocators(ctxt);
+	while (!ret && (i < ctxt->cs_num_inodes)) {
+		if (loaded != i) {
+			ret = csize_flip_blocks(ctxt, ctxt->cs_inodes[i],
+						&blocks);
+			if (ret)
+				break;
+			loaded = i;
+		}
+
+		while ((offset < blocks) && (count < max)) {
+			f = &ctxt->cs_flips[count++];
+			f->f_inode = (offset == ctxt->cs_num_old_ebs);
+			f->f_blkno = f->f_inode ? ctxt->cs_inodes[i] :
+				ctxt->cs_old_ebs[offset];
+			offset++;
+		}
+		if (offset >= blocks) {
+			i++;
+			offset = 0;
+		}
+		if ((count < max) && (i < ctxt->cs_num_inodes))
+			continue;
+
+		if (count)
+			ret = csize_flip_batch(ctxt, start, start_offset,
+					       count, saved);
+		saved = 0;
+		max = ctxt->cs_fs->fs_blocksize / sizeof(uint32_t);
+		count = 0;
+		start = i;
+		start_offset = offset;
+	}
+
+	return ret;
+}
+
+/*
+ * Builds new global group k from the old groups it covers and writes it.
+ * It lands on the descriptor of the first of them, so that descriptor
+ * goes to a scratch block first and is read back from there if we were
+ * interrupted.
+ */
+static errcode_t csize_write_global_group(struct csize_ctxt *ctxt,
+					  uint32_t k, uint32_t generation,
+					  uint16_t chains)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	struct ocfs2_group_desc *old =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_orig_buf;
+	uint32_t r = ctxt->cs_ratio, cpg = ctxt->cs_cpg, j, first = k * r;
+	uint32_t groups = (ctxt->cs_new_clusters + cpg - 1) / cpg;
+	uint32_t old_groups = (fs->fs_clusters + cpg - 1) / cpg;
+	uint32_t bits = ocfs2_min(cpg, ctxt->cs_new_clusters - k * cpg);
+	uint32_t b, used = 0;
+	uint64_t blkno = csize_global_group(ctxt, k);
+	uint64_t from = csize_old_group(ctxt, first);
+
+	if ((k == ctxt->cs_cursor) && ctxt->cs_count)
+		from = ctxt->cs_rec_blkno + CSIZE_RECORD_SCRATCH +
+			ctxt->cs_scratch;
+	ret = csize_read_old_group(ctxt, first, from, ctxt->cs_gd_orig_buf);
+	if (!ret && (from == csize_old_group(ctxt, first))) {
+		ret = io_read_block(fs->fs_io, from, 1, ctxt->cs_scratch_buf);
+		if (!ret)
+			ret = csize_write_scratch(ctxt, k, 0, 1);
+	}
+	if (ret)
+		return ret;
+
+	ocfs2_init_group_desc(fs, gd, blkno, generation,
+			      ctxt->cs_bitmap_blkno, bits, k % chains, 0);
+	ret = csize_fold_group(ctxt, first, old, gd);
+	for (j = first + 1; !ret && (j < first + r) && (j < old_groups); j++) {
+		ret = csize_read_old_group(ctxt, j, csize_old_group(ctxt, j),
+					   ctxt->cs_gd_orig_buf);
+		if (!ret)
+			ret = csize_fold_group(ctxt, j, old, gd);
+	}
+	if (ret)
+		return ret;
+
+	/* The new descriptor may sit where an old group's data was */
+	ocfs2_set_bit(blkno / ctxt->cs_new_bpc - (uint64_t)k * cpg,
+		      gd->bg_bitmap);
+	for (b = 0; b < bits; b++) {
+		if (ocfs2_test_bit(b, gd->bg_bitmap))
+			used++;
+	}
+	gd->bg_free_bits_count = bits - used;
+	if (k + chains < groups)
+		gd->bg_next_group = csize_global_group(ctxt, k + chains);
+
+	return ocfs2_write_group_desc(fs, blkno, ctxt->cs_gd_buf);
+}
+
+/*
+ * Writes the global bitmap for the new geometry.  The groups before the
+ * cursor are done and only counted.
+ */
+static errcode_t csize_write_global(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	struct ocfs2_group_desc *gd =
+		(struct ocfs2_group_desc *)ctxt->cs_gd_buf;
+	struct ocfs2_chain_list *cl = &di->id2.i_chain;
+	struct ocfs2_chain_rec *cr;
+	uint32_t cpg, groups, k, total_used = 0, generation;
+	uint16_t chains;
+
+	ret = csize_read_bitmap(ctxt);
+	if (!ret)
+		ret = ocfs2_read_group_desc(fs, fs->fs_first_cg_blkno,
+					    ctxt->cs_gd_buf);
+	if (ret)
+		return ret;
+
+	cpg = ctxt->cs_cpg;
+	chains = cl->cl_count;
+	generation = gd->bg_generation;
+	groups = (ctxt->cs_new_clusters + cpg - 1) / cpg;
+	memset(cl->cl_recs, 0, chains * sizeof(struct ocfs2_chain_rec));
+
+	for (k = 0; k < groups; k++) {
+		if (k < ctxt->cs_cursor)
+			ret = ocfs2_read_group_desc(fs,
+						    csize_global_group(ctxt, k),
+						    ctxt->cs_gd_buf);
+		else
+			ret = csize_write_global_group(ctxt, k, generation,
+						       chains);
+		if (ret)
+			return ret;
+
+		cr = &cl->cl_recs[k % chains];
+		if (k < chains)
+			cr->c_blkno = gd->bg_blkno;
+		cr->c_total += gd->bg_bits;
+		cr->c_free += gd->bg_free_bits_count;
+		total_used += gd->bg_bits - gd->bg_free_bits_count;
+		tools_progress_step(ctxt->cs_prog, 1);
+	}
+
+	cl->cl_next_free_rec = ocfs2_min(groups, (uint32_t)chains);
+	di->i_clusters = ctxt->cs_new_clusters;
+	di->i_size = (uint64_t)ctxt->cs_new_clusters * ctxt->cs_new_size;
+	di->id1.bitmap1.i_total = ctxt->cs_new_clusters;
+	di->id1.bitmap1.i_used = total_used;
+
+	return ocfs2_write_inode(fs, ctxt->cs_bitmap_blkno, ctxt->cs_buf);
+}
+
+/* Switches the superblock to the new geometry */
+static errcode_t csize_write_geometry(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+	uint32_t bits = 0;
+
+	while ((1U << bits) < ctxt->cs_new_size)
+		bits++;
+	sb->s_clustersize_bits = bits;
+	fs->fs_super->i_clusters = ctxt->cs_new_clusters;
+	fs->fs_clustersize = ctxt->cs_new_size;
+	fs->fs_clusters = ctxt->cs_new_clusters;
+	fs->fs_blocks = ocfs2_clusters_to_blocks(fs, fs->fs_clusters);
+
+	ret = csize_drop_caches(fs);
+	if (!ret)
+		ret = ocfs2_write_super(fs);
+
+	return ret;
+}
+
+/* A directory that has its index back was done before we stopped */
+static errcode_t csize_rebuild_indexes(struct csize_ctxt *ctxt)
+{
+	errcode_t ret, err = 0;
+	struct ocfs2_dinode *di = (struct ocfs2_dinode *)ctxt->cs_buf;
+	uint64_t i;
+
+	for (i = 0; i < ctxt->cs_num_dx_dirs; i++) {
+		ret = ocfs2_read_inode(ctxt->cs_fs, ctxt->cs_dx_dirs[i],
+				       ctxt->cs_buf);
+		if (!ret && ocfs2_dir_indexed(di))
+			continue;
+		if (!ret)
+			ret = ocfs2_dx_dir_build(ctxt->cs_fs,
+						 ctxt->cs_dx_dirs[i]);
+		if (ret) {
+			verbosef(VL_APP,
+				 "%s while rebuilding the index of directory "
+				 "%"PRIu64"\n",
+				 error_message(ret), ctxt->cs_dx_dirs[i]);
+			err = TUNEFS_ET_DX_DIRS_BUILD_FAILED;
+		}
+	}
+
+	return err;
+}
+
+/*
+ * Clears the mark, then gives back the record.  Stopping in between
+ * only leaks the record's clusters.
+ */
+static errcode_t csize_finish(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+
+	sb->s_tunefs_csize_record = 0;
+	ret = tunefs_clear_in_progress(fs, OCFS2_TUNEFS_INPROG_CLUSTER_SIZE);
+	if (!ret)
+		ret = ocfs2_write_super(fs);
+	if (!ret)
+		ret = ocfs2_free_clusters(fs,
+					  (uint64_t)ctxt->cs_rec_clusters *
+					  ctxt->cs_old_size /
+					  fs->fs_clustersize,
+					  ctxt->cs_rec_blkno);
+	if (!ret && (fs->fs_clustersize == ctxt->cs_new_size))
+		ret = tunefs_update_fs_geometry(fs);
+
+	return ret;
+}
+
+/*
+ * Runs the conversion from where the record says it is.  If the volume
+ * can't be switched, nothing has been divided yet and it stays whole
+ * under the old geometry; the indexes are rebuilt and the mark cleared.
+ */
+static errcode_t csize_run_steps(struct csize_ctxt *ctxt)
+{
+	errcode_t ret, refused = 0, err = 0;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint32_t next;
+
+	ctxt->cs_prog = tools_progress_start("Switching cluster size",
+					     "switching", 0);
+	if (!ctxt->cs_prog)
+		return TUNEFS_ET_NO_MEMORY;
+
+	tunefs_block_signals();
+	ret = csize_drop_caches(fs);
+	while (!ret && (ctxt->cs_step < CSIZE_STEP_DONE)) {
+		next = ctxt->cs_step + 1;
+		switch (ctxt->cs_step) {
+		case CSIZE_STEP_COPY:
+			ret = csize_copy_groups(ctxt);
+			break;
+		case CSIZE_STEP_REMAP:
+			ret = csize_remap_groups(ctxt);
+			break;
+		case CSIZE_STEP_FREE:
+			ret = csize_free_old_groups(ctxt);
+			if (!ret)
+				refused = csize_check_switch(ctxt);
+			if (refused)
+				next = CSIZE_STEP_INDEX;
+			break;
+		case CSIZE_STEP_FLIP:
+			ret = csize_flip(ctxt);
+			break;
+		case CSIZE_STEP_BITMAP:
+			ret = csize_write_global(ctxt);
+			break;
+		case CSIZE_STEP_SUPER:
+			ret = csize_write_geometry(ctxt);
+			break;
+		case CSIZE_STEP_INDEX:
+			err = csize_rebuild_indexes(ctxt);
+			break;
+		}
+
+		if (ret)
+			break;
+		if (next < CSIZE_STEP_DONE)
+			ret = csize_set_cursor(ctxt, next, 0, 0);
+		else
+			ctxt->cs_step = next;
+	}
+	if (!ret)
+		ret = csize_finish(ctxt);
+	tunefs_unblock_signals();
+
+	tools_progress_stop(ctxt->cs_prog);
+	ctxt->cs_prog = NULL;
+
+	if (!ret && (fs->fs_clustersize != ctxt->cs_new_size))
+		ret = refused ? refused : TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+	if (!ret)
+		ret = err;
+
+	return ret;
+}
+
+/* Backup superblocks can't live in the tail we drop */
+static errcode_t csize_check_backups(struct csize_ctxt *ctxt)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	uint64_t blocks[OCFS2_MAX_BACKUP_SUPERBLOCKS];
+	int i, num;
+
+	if (!OCFS2_HAS_COMPAT_FEATURE(OCFS2_RAW_SB(fs->fs_super),
+				      OCFS2_FEATURE_COMPAT_BACKUP_SB))
+		return 0;
+
+	num = ocfs2_get_backup_super_offsets(fs, blocks,
+					     OCFS2_MAX_BACKUP_SUPERBLOCKS);
+	for (i = 0; i < num; i++) {
+		if (ocfs2_blocks_to_clusters(fs, blocks[i]) >=
+		    ctxt->cs_limit) {
+			verbosef(VL_APP,
+				 "Backup superblock at block %"PRIu64" is "
+				 "past the end of the converted volume\n",
+				 blocks[i]);
+			return TUNEFS_ET_CLUSTER_SIZE_UNMOVABLE;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Reads everything the conversion will touch without changing it.  Every
+ * refusal happens here, as does the check for enough free windows.
+ */
+static errcode_t csize_survey(struct csize_ctxt *ctxt)
+{
+	errcode_t ret;
+	ocfs2_filesys *fs = ctxt->cs_fs;
+
+	ctxt->cs_dry = 1;
+	ret = csize_check_backups(ctxt);
+	if (!ret)
+		ret = csize_count_windows(ctxt);
+	if (!ret)
+		ret = tunefs_foreach_inode(fs, csize_convert_file, ctxt);
+	if (!ret)
+		ret = csize_scan_allocators(ctxt);
+	if (!ret)
+		ret = csize_plan_groups(ctxt);
+	ctxt->cs_dry = 0;
+	if (ret)
+		return ret;
+
+	/* The records */
+	ctxt->cs_windows += (csize_record_clusters(ctxt, 0,
+						   ctxt->cs_num_dx_dirs) +
+			     csize_record_clusters(ctxt, ctxt->cs_num_groups,
+						   ctxt->cs_num_dx_dirs)) /
+		ctxt->cs_ratio;
+
+	verbosef(VL_APP,
+		 "%"PRIu64" files and %"PRIu64" allocator groups need "
+		 "%"PRIu64" of %"PRIu64" free %"PRIu32"-byte windows\n",
+		 ctxt->cs_files, ctxt->cs_moves, ctxt->cs_windows,
+		 ctxt->cs_free_windows, ctxt->cs_new_size);
+
+	if (ctxt->cs_windows > ctxt->cs_free_windows)
+		return OCFS2_ET_NO_SPACE;
+
+	return 0;
+}
+
+/*
+ * Every aligned window is written once, every inode and the new global
+ * groups about once each.
+ */
+static void csize_estimate(struct csize_ctxt *ctxt)
+{
+	ocfs2_filesys *fs = ctxt->cs_fs;
+	struct tunefs_estimate est = { 0, };
+
+	est.te_alloc_clusters = ctxt->cs_windows * ctxt->cs_ratio;
+	est.te_copy_bytes = ctxt->cs_windows * ctxt->cs_new_size;
+	est.te_zero_bytes = ctxt->cs_grow_blocks * fs->fs_blocksize;
+	est.te_write_blocks = ctxt->cs_seen * 2 +
+		(ctxt->cs_new_clusters + ctxt->cs_cpg - 1) / ctxt->cs_cpg +
+		tunefs_super_blocks(fs) * 2;
+	tunefs_estimate_report("cluster-size", &est);
+}
+
+static void csize_free_ctxt(struct csize_ctxt *ctxt)
+{
+	char **bufs[] = {
+		(char **)&ctxt->cs_recs, (char **)&ctxt->cs_new_recs,
+		(char **)&ctxt->cs_old_ebs, (char **)&ctxt->cs_allocs,
+		(char **)&ctxt->cs_groups, (char **)&ctxt->cs_inodes,
+		(char **)&ctxt->cs_dx_dirs, (char **)&ctxt->cs_flips,
+		&ctxt->cs_io_buf, &ctxt->cs_buf, &ctxt->cs_orig_buf,
+		&ctxt->cs_gd_buf, &ctxt->cs_gd_orig_buf, &ctxt->cs_dir_buf,
+		&ctxt->cs_rec_buf, &ctxt->cs_scratch_buf,
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(bufs) / sizeof(bufs[0]); i++) {
+		if (*bufs[i])
+			ocfs2_free(bufs[i]);
+	}
+}
+
+static int csize_in_progress(ocfs2_filesys *fs)
+{
+	struct ocfs2_super_block *sb = OCFS2_RAW_SB(fs->fs_super);
+
+	return (sb->s_feature_incompat &
+		OCFS2_FEATURE_INCOMPAT_TUNEFS_INPROG) &&
+		(sb->s_tunefs_flag & OCFS2_TUNEFS_INPROG_CLUSTER_SIZE);
+}
+
+static errcode_t set_cluster_size(ocfs2_filesys *fs, uint32_t new_size,
+				  int flags)
+{
+	errcode_t ret;
+	int resume = csize_in_progress(fs);
+	struct csize_ctxt ctxt = {
+		.cs_fs = fs,
+		.cs_old_size = fs->fs_clustersize,
+		.cs_new_size = new_size,
+		.cs_root_blkno = fs->fs_root_blkno,
+	};
+
+	ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_rec_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_scratch_buf);
+	if (!ret && resume)
+		ret = csize_read_header(&ctxt);
+	if (ret)
+		goto out;
+
+	if (ctxt.cs_new_size != new_size) {
+		errorf("Device \"%s\" was being converted to a cluster size "
+		       "of %u\n", fs->fs_devname, ctxt.cs_new_size);
+		ret = TUNEFS_ET_CLUSTER_SIZE_IN_PROGRESS;
+		goto out;
+	}
+
+	ctxt.cs_ratio = ctxt.cs_new_size / ctxt.cs_old_size;
+	ctxt.cs_old_bpc = ctxt.cs_old_size / fs->fs_blocksize;
+	ctxt.cs_new_bpc = ctxt.cs_old_bpc * ctxt.cs_ratio;
+	ctxt.cs_new_clusters = fs->fs_clusters;
+	if (fs->fs_clustersize == ctxt.cs_old_size)
+		ctxt.cs_new_clusters /= ctxt.cs_ratio;
+	ctxt.cs_limit = ctxt.cs_new_clusters * ctxt.cs_ratio;
+	ctxt.cs_max_rec = UINT16_MAX / ctxt.cs_ratio * ctxt.cs_ratio;
+	if (ctxt.cs_new_clusters < 2) {
+		verbosef(VL_APP, "The volume is %"PRIu32" clusters of %u "
+			 "bytes\n", ctxt.cs_new_clusters, new_size);
+		ret = OCFS2_ET_NO_SPACE;
+		goto out;
+	}
+
+	ret = ocfs2_lookup_system_inode(fs, GLOBAL_BITMAP_SYSTEM_INODE, 0,
+					&ctxt.cs_bitmap_blkno);
+	if (!ret)
+		ret = ocfs2_lookup_system_inode(fs, HEARTBEAT_SYSTEM_INODE, 0,
+						&ctxt.cs_hb_blkno);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_orig_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_gd_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_gd_orig_buf);
+	if (!ret)
+		ret = ocfs2_malloc_block(fs->fs_io, &ctxt.cs_dir_buf);
+	if (!ret)
+		ret = ocfs2_malloc(fs->fs_blocksize / sizeof(uint32_t) *
+				   sizeof(struct csize_flip), &ctxt.cs_flips);
+	if (!ret)
+		ret = ocfs2_malloc_blocks(fs->fs_io,
+					  CSIZE_IO_WINDOWS * ctxt.cs_new_bpc,
+					  &ctxt.cs_io_buf);
+	if (ret)
+		goto out;
+
+	if (resume) {
+		ret = csize_read_lists(&ctxt);
+		if (ret)
+			goto out;
+		csize_remap_known(&ctxt);
+	}
+
+	/* Files are aligned again from where they stopped */
+	if (ctxt.cs_step <= CSIZE_STEP_ALIGN) {
+		ret = csize_survey(&ctxt);
+		if (ret)
+			goto out;
+	}
+
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		if (resume)
+			verbosef(VL_APP,
+				 "Device \"%s\" is part way through changing "
+				 "its cluster size; nothing to estimate\n",
+				 fs->fs_devname);
+		else
+			csize_estimate(&ctxt);
+		goto out;
+	}
+
+	if (resume) {
+		if (!tools_interact("Finish changing the cluster size of "
+				    "device \"%s\" from %u to %u? ",
+				    fs->fs_devname, ctxt.cs_old_size,
+				    new_size))
+			goto out;
+	} else {
+		if (!tools_interact("Change the cluster size of device "
+				    "\"%s\" from %u to %"PRIu32"? ",
+				    fs->fs_devname, fs->fs_clustersize,
+				    new_size))
+			goto out;
+
+		ret = csize_new_record(&ctxt, CSIZE_STEP_ALIGN);
+		if (ret)
+			goto out;
+	}
+
+	if (ctxt.cs_step == CSIZE_STEP_ALIGN) {
+		/* New extent allocator groups should not need to move again */
+		ocfs2_set_stripe_geometry(fs, new_size, 0);
+		ret = csize_convert_files(&ctxt);
+		if (!ret)
+			ret = csize_begin(&ctxt);
+		ocfs2_set_stripe_geometry(fs, 0, 0);
+	}
+
+	if (!ret)
+		ret = csize_run_steps(&ctxt);
+
+out:
+	if (ret && (ret != TUNEFS_ET_CLUSTER_SIZE_IN_PROGRESS) &&
+	    csize_in_progress(fs))
+		errorf("Device \"%s\" is part way through changing its "
+		       "cluster size; run \"tunefs.ocfs2 --cluster-size %u\" "
+		       "again to finish\n", fs->fs_devname, new_size);
+	csize_free_ctxt(&ctxt);
+	return ret;
+}
+
+static int set_cluster_size_parse_option(struct tunefs_operation *op,
+					 char *arg)
+{
+	errcode_t err;
+	uint64_t size;
+
+	if (!arg) {
+		errorf("No cluster size specified\n");
+		return 1;
+	}
+
+	err = tunefs_get_number(arg, &size);
+	if (err) {
+		tcom_err(err, "- cluster size is invalid\n");
+		return 1;
+	}
+
+	if ((size < OCFS2_MIN_CLUSTERSIZE) ||
+	    (size > OCFS2_MAX_CLUSTERSIZE) || (size & (size - 1))) {
+		errorf("Invalid cluster size: \"%s\"; it must be a power of "
+		       "two from %u to %u\n", arg, OCFS2_MIN_CLUSTERSIZE,
+		       OCFS2_MAX_CLUSTERSIZE);
+		return 1;
+	}
+
+	op->to_private = (void *)(unsigned long)size;
+	return 0;
+}
+
+static int set_cluster_size_run(struct tunefs_operation *op,
+				ocfs2_filesys *fs, int flags)
+{
+	errcode_t err;
+	int rc = 0;
+	uint32_t new_size = (uint32_t)(unsigned long)op->to_private;
+
+	/* An interrupted change is finished whatever the size says */
+	if (!csize_in_progress(fs) && (new_size == fs->fs_clustersize)) {
+		verbosef(VL_APP,
+			 "Device \"%s\" already has a cluster size of %u; "
+			 "nothing to do\n", fs->fs_devname, new_size);
+		return 0;
+	}
+
+	if (!csize_in_progress(fs) && (new_size < fs->fs_clustersize)) {
+		errorf("Device \"%s\" has a cluster size of %u; it can only "
+		       "grow\n", fs->fs_devname, fs->fs_clustersize);
+		return 1;
+	}
+
+	err = set_cluster_size(fs, new_size, flags);
+	if (err) {
+		tcom_err(err,
+			 "- unable to change the cluster size of device "
+			 "\"%s\"",
+			 fs->fs_devname);
+		rc = 1;
+	}
+
+	return rc;
+}
+
+
+DEFINE_TUNEFS_OP(set_cluster_size,
+		 "Usage: op_set_cluster_size [opts] <device> "
+		 "<cluster-size>\n",
+		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
+		 TUNEFS_FLAG_LARGECACHE | TUNEFS_FLAG_ESTIMATE |
+		 TUNEFS_FLAG_RESUME,
+		 set_cluster_size_parse_option,
+		 set_cluster_size_run);
+
+#ifdef DEBUG_EXE
+int main(int argc, char *argv[])
+{
+	return tunefs_op_main(argc, argv, &set_cluster_size_op);
+}
+#endif
@@ -36,7 +36,6 @@ struct moved_group {
 };
 
 struct relink_ctxt {
-	int inode_type;
 	struct ocfs2_chain_rec *cr;
 	uint16_t new_slot;
 	uint64_t dst_blkno;
@@ -189,105 +188,29 @@ bail:
 	return ret;
 }
 
-static errcode_t change_sub_alloc_slot(ocfs2_filesys *fs,
-				       uint64_t blkno,
-				       struct relink_ctxt *ctxt)
-{
-	errcode_t ret;
-	struct ocfs2_dinode *di = NULL;
-	struct ocfs2_extent_block *eb = NULL;
-
-	if (ctxt->inode_type == EXTENT_ALLOC_SYSTEM_INODE) {
-		/* change sub alloc bit in the extent block. */
-		ret = ocfs2_read_extent_block(fs, blkno, ctxt->ex_buf);
-		if (ret)
-			goto bail;
-
-		eb = (struct ocfs2_extent_block *)ctxt->ex_buf;
-		eb->h_suballoc_slot = ctxt->new_slot;
-
-		ret = ocfs2_write_extent_block(fs, blkno, ctxt->ex_buf);
-		if (ret)
-			goto bail;
-	} else {
-		/* change sub alloc bit in the inode. */
-		ret = ocfs2_read_inode(fs, blkno, ctxt->ex_buf);
-		if (ret)
-			goto bail;
-
-		di = (struct ocfs2_dinode *)ctxt->ex_buf;
-		di->i_suballoc_slot = ctxt->new_slot;
-
-		ret = ocfs2_write_inode(fs, blkno, ctxt->ex_buf);
-		if (ret)
-			goto bail;
-	}
-bail:
-	return ret;
-}
-
 static errcode_t move_group(ocfs2_filesys *fs,
 			    struct relink_ctxt *ctxt,
 			    struct moved_group *group)
 {
 	errcode_t ret = 0;
-	uint16_t cr_pos;
 	struct ocfs2_group_desc *gd = NULL;
-	struct ocfs2_dinode *di = NULL;
-	struct ocfs2_chain_list *cl = NULL;
-	struct ocfs2_chain_rec *cr = NULL;
 
 	if (!group || !group->blkno || !group->gd_buf)
 		goto bail;
 
-	di = (struct ocfs2_dinode *)ctxt->dst_inode;
-	cl = &di->id2.i_chain;
-
-	/* calculate the insert position. */
-	if (cl->cl_next_free_rec < cl->cl_count)
-		cr_pos = cl->cl_next_free_rec;
-	else {
-		/* Now we have all the chain record filled with some groups.
-		 * so we figure out all the groups we have and then calculate
-		 * the proper place for our insert.
-		 */
-		cr_pos = di->id1.bitmap1.i_total / (cl->cl_cpg * cl->cl_bpc);
-		cr_pos %= cl->cl_count;
-	}
-
-	cr = &cl->cl_recs[cr_pos];
-
-	gd = (struct ocfs2_group_desc *)group->gd_buf;
-	gd->bg_chain = cr_pos;
-	gd->bg_parent_dinode = ctxt->dst_blkno;
-
-	/* we can safely set the bg_next_group here since all the group
-	 * below it in the moving chain is already moved to the new
-	 * position and we don't need to worry about any "lost" groups.
+	/* we can safely link the group at the chain head here since all
+	 * the group below it in the moving chain is already moved to the
+	 * new position and we don't need to worry about any "lost" groups.
 	 *
 	 * Please see how we build up the group list in move_chain_rec.
 	 */
-	gd->bg_next_group = cr->c_blkno;
+	gd = (struct ocfs2_group_desc *)group->gd_buf;
+	tunefs_link_group(fs, gd, (struct ocfs2_dinode *)ctxt->dst_inode);
 
 	ret = ocfs2_write_group_desc(fs, group->blkno, group->gd_buf);
 	if (ret)
 		goto bail;
 
-	/* modify the chain record and the new files simultaneously. */
-	cr->c_blkno = gd->bg_blkno;
-	cr->c_total += gd->bg_bits;
-	cr->c_free += gd->bg_free_bits_count;
-
-	/* If the chain isn't full, increase the free_rec. */
-	if (cl->cl_next_free_rec != cl->cl_count)
-		cl->cl_next_free_rec++;
-
-	di->id1.bitmap1.i_total += gd->bg_bits;
-	di->id1.bitmap1.i_used += gd->bg_bits;
-	di->id1.bitmap1.i_used -= gd->bg_free_bits_count;
-	di->i_clusters += cl->cl_cpg;
-	di->i_size += cl->cl_cpg * fs->fs_clustersize;
-
 	ret = ocfs2_write_inode(fs, ctxt->dst_blkno, ctxt->dst_inode);
 
 bail:
@@ -363,7 +286,9 @@ static errcode_t move_chain_rec(ocfs2_filesys *fs, struct relink_ctxt *ctxt)
 			for (i = start; i < end; i++) {
 				blkno = group->blkno + i;
 
-				ret = change_sub_alloc_slot(fs, blkno, ctxt);
+				ret = tunefs_set_suballoc_slot(fs, blkno,
+							       ctxt->new_slot,
+							       ctxt->ex_buf);
 				if (ret)
 					goto bail;
 
@@ -464,7 +389,6 @@ static errcode_t relink_system_alloc(ocfs2_filesys *fs,
 	}
 
 	cl = &di->id2.i_chain;
-	ctxt.inode_type = inode_type;
 
 	/*iterate all the chain record and move them to the new slots. */
 	for (i = cl->cl_next_free_rec - 1; i >= 0; i--) {
@@ -543,6 +467,7 @@ static errcode_t empty_journal(ocfs2_filesys *fs,
 	int bs_bits = OCFS2_RAW_SB(fs->fs_super)->s_blocksize_bits;
 	uint64_t offset = 0;
 	uint32_t wrote, count;
+	ocfs2_write_session *ws = NULL;
 
 #define BUFLEN	1048576
 	ret = ocfs2_malloc_blocks(fs->fs_io, (BUFLEN >> bs_bits), &buf);
@@ -550,17 +475,28 @@ static errcode_t empty_journal(ocfs2_filesys *fs,
 		goto out;
 	memset(buf, 0, BUFLEN);
 
+	ret = ocfs2_write_session_begin(ci, &ws);
+	if (ret)
+		goto out;
+
 	count = (uint32_t) ci->ci_inode->i_size;
 	while (count) {
-		ret = ocfs2_file_write(ci, buf, ocfs2_min((uint32_t) BUFLEN, count),
-				       offset, &wrote);
+		ret = ocfs2_write_session_write(ws, buf,
+					ocfs2_min((uint32_t) BUFLEN, count),
+					offset, &wrote);
 		if (ret)
 			goto out;
 		offset += wrote;
 		count -= wrote;
 	}
 
+	ret = ocfs2_write_session_flush(ws);
+
 out:
+	if (ws)
+		ocfs2_write_session_free(ws);
+	if (buf)
+		ocfs2_free(&buf);
 	return ret;
 }
 
@@ -1067,7 +1003,94 @@ bail:
 	return ret;
 }
 
-static errcode_t update_slot_count(ocfs2_filesys *fs, int num_slots)
+/*
+ * New slots get their system files and a journal as big as the
+ * largest one, which is zeroed as it is formatted.  Removed slots have
+ * every group of their suballocators moved to another slot.  The slot
+ * map and superblock are written either way.
+ */
+static errcode_t estimate_slot_count(ocfs2_filesys *fs, int num_slots)
+{
+	errcode_t ret;
+	struct ocfs2_super_block *super = OCFS2_RAW_SB(fs->fs_super);
+	int orig_slots = super->s_max_slots;
+	int i, slot, files = 0;
+	uint32_t journal_clusters = 0;
+	uint64_t blkno, slots;
+	char *buf = NULL;
+	struct ocfs2_dinode *di;
+	struct tunefs_estimate est = { 0, };
+
+	for (i = OCFS2_LAST_GLOBAL_SYSTEM_INODE + 1; i < NUM_SYSTEM_INODES;
+	     ++i) {
+		if (i == LOCAL_USER_QUOTA_SYSTEM_INODE &&
+		    !OCFS2_HAS_RO_COMPAT_FEATURE(super,
+					OCFS2_FEATURE_RO_COMPAT_USRQUOTA))
+			continue;
+		if (i == LOCAL_GROUP_QUOTA_SYSTEM_INODE &&
+		    !OCFS2_HAS_RO_COMPAT_FEATURE(super,
+					OCFS2_FEATURE_RO_COMPAT_GRPQUOTA))
+			continue;
+		files++;
+	}
+
+	ret = ocfs2_malloc_block(fs->fs_io, &buf);
+	if (ret)
+		goto out;
+	di = (struct ocfs2_dinode *)buf;
+
+	if (num_slots > orig_slots) {
+		for (slot = 0; slot < orig_slots; slot++) {
+			ret = ocfs2_lookup_system_inode(fs,
+							JOURNAL_SYSTEM_INODE,
+							slot, &blkno);
+			if (!ret)
+				ret = ocfs2_read_inode(fs, blkno, buf);
+			if (ret)
+				goto out;
+			journal_clusters = ocfs2_max(journal_clusters,
+						     (uint32_t)di->i_clusters);
+		}
+
+		slots = num_slots - orig_slots;
+		est.te_write_blocks = slots * files;
+		est.te_alloc_clusters = slots * journal_clusters;
+		est.te_zero_bytes = slots *
+			ocfs2_clusters_to_bytes(fs, journal_clusters);
+	} else {
+		for (slot = num_slots; slot < orig_slots; slot++) {
+			est.te_write_blocks += files;
+			for (i = EXTENT_ALLOC_SYSTEM_INODE;
+			     i <= INODE_ALLOC_SYSTEM_INODE; i++) {
+				ret = ocfs2_lookup_system_inode(fs, i, slot,
+								&blkno);
+				if (!ret)
+					ret = ocfs2_read_inode(fs, blkno,
+							       buf);
+				if (ret)
+					goto out;
+				if (!di->id2.i_chain.cl_cpg)
+					continue;
+				est.te_write_blocks +=
+					(di->i_clusters +
+					 di->id2.i_chain.cl_cpg - 1) /
+					di->id2.i_chain.cl_cpg;
+			}
+		}
+	}
+
+	est.te_write_blocks += 1 + tunefs_super_blocks(fs);
+	tunefs_estimate_report("slots", &est);
+
+out:
+	if (buf)
+		ocfs2_free(&buf);
+
+	return ret;
+}
+
+static errcode_t update_slot_count(ocfs2_filesys *fs, int num_slots,
+				   int flags)
 {
 	errcode_t ret = 0;
 	int orig_slots = OCFS2_RAW_SB(fs->fs_super)->s_max_slots;
@@ -1083,6 +1106,11 @@ static errcode_t update_slot_count(ocfs2_filesys *fs, int num_slots)
 		goto out;
 	}
 
+	if (flags & TUNEFS_FLAG_ESTIMATE) {
+		ret = estimate_slot_count(fs, num_slots);
+		goto out;
+	}
+
 	if (!tools_interact("Change the number of node slots on device "
 			    "\"%s\" from %d to %d? ",
 			    fs->fs_devname, orig_slots, num_slots))
@@ -1183,7 +1211,7 @@ static int set_slot_count_run(struct tunefs_operation *op,
 	int rc = 0;
 	int num_slots = (int)(unsigned long)op->to_private;
 
-	err = update_slot_count(fs, num_slots);
+	err = update_slot_count(fs, num_slots, flags);
 	if (err) {
 		tcom_err(err,
 			 "- unable to update the number of slots on device "
@@ -1199,7 +1227,8 @@ static int set_slot_count_run(struct tunefs_operation *op,
 DEFINE_TUNEFS_OP(set_slot_count,
 		 "Usage: op_set_slot_count [opts] <device> "
 		 "<number_of_slots>\n",
-		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION,
+		 TUNEFS_FLAG_RW | TUNEFS_FLAG_ALLOCATION |
+		 TUNEFS_FLAG_ESTIMATE,
 		 set_slot_count_parse_option,
 		 set_slot_count_run);
 